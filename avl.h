@@ -35,12 +35,27 @@
  * early if we are not the deepest branch (or become no longer the deepest branch
  * due to a rotation), is also mine. There may be some other way this is 
  * usually done.
+ *
+ *   Order statistics:
+ * Derive your node from AVLCountedNode_base instead of AVLNode_base, and
+ * each node keeps the size of it's subtree, which gives you rank() and
+ * select() in one descent. insert() and remove() add one word per node, and
+ * a walk to the root, rotations recompute the two nodes they move. Nodes
+ * derived from plain AVLNode_base pay nothing.
+ *
+ *   Hinted inserts:
+ * insert_hint() puts a node just before an iterator without a descent, for
+ * keys that arrive clustered or in order. There's no pointer to the largest
+ * node for keys past the end, as the hashtables keep an AVL per bucket and
+ * count on it being one pointer. insert_hint(end()) walks down the right
+ * spine instead, it just doesn't compare on the way.
  * 
  * Threadsafety:
  *  thread compatible
  */
 
 #include <stdio.h>
+#include <type_traits>
 #include <utility>
 #include "panic.h"
 
@@ -95,6 +110,14 @@ class AVLNode_base {
     }
 };
 
+// Use this as your base for rank() and select(), see "Order statistics"
+template<typename Node_T, typename Val_T>
+class AVLCountedNode_base : public AVLNode_base<Node_T, Val_T> {
+  public:
+    // Nodes in the subtree rooted here, including this one
+    size_t count;
+};
+
 template <typename Node_T, typename Val_T>
 class AVL{
   static_assert(std::is_same<decltype(std::declval<Node_T>().val()), Val_T>(), "Please define a method Val_T val() method on Node_T class");
@@ -106,6 +129,34 @@ class AVL{
     void _print(Node_T *n) const;
     int _rotate_left(Node_T *a);
     int _rotate_right(Node_T *a);
+    // Hangs n (a fresh leaf) off parent, and rebalances
+    void _link(Node_T *parent, Node_T *n, bool left);
+    // Subtree sizes, these do nothing unless Node_T is an AVLCountedNode_base
+    static const bool COUNTED = std::is_base_of<AVLCountedNode_base<Node_T,Val_T>, Node_T>::value;
+    static size_t _count(AVLCountedNode_base<Node_T,Val_T> *n) {
+      return n ? n->count : 0;
+    }
+    static void _recount(AVLCountedNode_base<Node_T,Val_T> *n) {
+      n->count = 1 + _count(n->left) + _count(n->right);
+    }
+    static void _recount(AVLNode_base<Node_T,Val_T> *n) {}
+    // Add delta to n and everything above it
+    static void _add_count(AVLCountedNode_base<Node_T,Val_T> *n, size_t delta) {
+      for (; n; n = n->parent) {
+        n->count += delta;
+      }
+    }
+    static void _add_count(AVLNode_base<Node_T,Val_T> *n, size_t delta) {}
+    static void _swap_count(AVLCountedNode_base<Node_T,Val_T> *a, AVLCountedNode_base<Node_T,Val_T> *b) {
+      std::swap(a->count, b->count);
+    }
+    static void _swap_count(AVLNode_base<Node_T,Val_T> *a, AVLNode_base<Node_T,Val_T> *b) {}
+    static bool _count_ok(AVLCountedNode_base<Node_T,Val_T> *n) {
+      return n->count == 1 + _count(n->left) + _count(n->right);
+    }
+    static bool _count_ok(AVLNode_base<Node_T,Val_T> *n) {
+      return true;
+    }
   public:
     // There are simpler ways to write this iterator (using a stack)
     // but this one takes constant instead of logarithmic space
@@ -138,6 +189,13 @@ class AVL{
           }
           return;
         }
+        // An iterator sitting on nn, which is at depth l, with b marking the
+        // levels above it where the path from root went right
+        Iterator(Node_T *nn, size_t b, size_t l) {
+          n = nn;
+          bits = b;
+          level = l;
+        }
         Iterator(const Iterator& other) {
           n = other.n;
           bits = other.bits;
@@ -207,14 +265,49 @@ class AVL{
     Iterator end() {
       return Iterator(nullptr);
     }
+    class Range {
+      private:
+        Iterator b;
+        Iterator e;
+      public:
+        Range(const Iterator &bb, const Iterator &ee):b(bb), e(ee) {}
+        Iterator begin() const {
+          return b;
+        }
+        Iterator end() const {
+          return e;
+        }
+    };
+  private:
+    Iterator _seek(Val_T v, bool after);
+  public:
+    // First node >= v, one descent rather than a walk from begin()
+    Iterator lower_bound(Val_T v);
+    // First node > v
+    Iterator upper_bound(Val_T v);
+    // Nodes in [lo, hi), for use in range based for loops
+    Range range(Val_T lo, Val_T hi);
     AVL();
     Node_T *get(Val_T v);
     // Returns False if node is already in the tree
     bool insert(Node_T *n);
+    // Inserts n just before hint, with two compares rather than a descent, if
+    // that's where it goes. Otherwise this is just insert(). Only the node
+    // hint is on matters, so a hint from before other inserts still works
+    // (e.g. for an ascending run of keys), as long as that node is still in
+    // the tree. With end() we walk the right spine, without comparing, and
+    // only compare n to the largest node.
+    bool insert_hint(Iterator hint, Node_T *n);
     // Assumes the node is in the tree
     //   if it's not you're going to have a bad time.
     void remove(Node_T *n);
     bool isempty() const;
+    // These need an AVLCountedNode_base, and take one descent
+    // The k'th smallest node (from 0), nullptr if there are <= k
+    Node_T *select(size_t k);
+    // How many nodes are < v
+    size_t rank(Val_T v);
+    size_t size(void) const;
     // These are mostly for debugging
     void check(void) const;
     void checkAll(void) const;
@@ -244,11 +337,99 @@ Node_T *AVL<Node_T, Val_T>::get(Val_T v) {
   }
 }
 
+template<typename Node_T, typename Val_T>
+typename AVL<Node_T, Val_T>::Iterator AVL<Node_T, Val_T>::_seek(Val_T v, bool after) {
+  // The answer is the last node we went left from (or v itself)
+  // Iterator's bits are exactly the levels where we went right to get there
+  Iterator best;
+  Node_T *n = root;
+  size_t bits = 0;
+  size_t level = 0;
+  while (n) {
+    int c = Node_T::compare(v, n->val());
+    if (c == 0 && !after) {
+      return Iterator(n, bits, level);
+    }
+    if (c < 0) {
+      best = Iterator(n, bits, level);
+      n = n->AVLNode_base<Node_T,Val_T>::left;
+    } else {
+      bits |= (1<<level);
+      n = n->AVLNode_base<Node_T,Val_T>::right;
+    }
+    level++;
+  }
+  return best;
+}
+
+template<typename Node_T, typename Val_T>
+typename AVL<Node_T, Val_T>::Iterator AVL<Node_T, Val_T>::lower_bound(Val_T v) {
+  return _seek(v, false);
+}
+
+template<typename Node_T, typename Val_T>
+typename AVL<Node_T, Val_T>::Iterator AVL<Node_T, Val_T>::upper_bound(Val_T v) {
+  return _seek(v, true);
+}
+
+template<typename Node_T, typename Val_T>
+typename AVL<Node_T, Val_T>::Range AVL<Node_T, Val_T>::range(Val_T lo, Val_T hi) {
+  // An empty range if hi <= lo, rather than running off the end
+  if (Node_T::compare(lo, hi) >= 0) {
+    return Range(end(), end());
+  }
+  return Range(lower_bound(lo), lower_bound(hi));
+}
+
 template<typename Node_T, typename Val_T>
 bool AVL<Node_T, Val_T>::isempty(void) const {
   return !root;
 }
 
+template<typename Node_T, typename Val_T>
+Node_T *AVL<Node_T, Val_T>::select(size_t k) {
+  static_assert(COUNTED, "select() needs Node_T to be an AVLCountedNode_base");
+  Node_T *n = root;
+  while (n) {
+    size_t l = _count(n->AVLNode_base<Node_T,Val_T>::left);
+    if (k < l) {
+      n = n->AVLNode_base<Node_T,Val_T>::left;
+    } else if (k == l) {
+      return n;
+    } else {
+      k -= l + 1;
+      n = n->AVLNode_base<Node_T,Val_T>::right;
+    }
+  }
+  return nullptr;
+}
+
+template<typename Node_T, typename Val_T>
+size_t AVL<Node_T, Val_T>::rank(Val_T v) {
+  static_assert(COUNTED, "rank() needs Node_T to be an AVLCountedNode_base");
+  size_t r = 0;
+  Node_T *n = root;
+  while (n) {
+    int c = Node_T::compare(v, n->val());
+    if (c > 0) {
+      // n and everything left of it are smaller
+      r += _count(n->AVLNode_base<Node_T,Val_T>::left) + 1;
+      n = n->AVLNode_base<Node_T,Val_T>::right;
+    } else if (c < 0) {
+      n = n->AVLNode_base<Node_T,Val_T>::left;
+    } else {
+      return r + _count(n->AVLNode_base<Node_T,Val_T>::left);
+    }
+  }
+  return r;
+}
+
+template<typename Node_T, typename Val_T>
+size_t AVL<Node_T, Val_T>::size(void) const {
+  static_assert(COUNTED, "size() needs Node_T to be an AVLCountedNode_base");
+  return _count(root);
+}
+
 /* Transform: 
  *   A         B
  *    \       / 
@@ -277,6 +458,9 @@ int AVL<Node_T, Val_T>::_rotate_left(Node_T *a) {
     root = b;
   }
   b->AVLNode_base<Node_T,Val_T>::parent = parent;
+  // a is now b's child, so it goes first
+  _recount(a);
+  _recount(b);
   // and update balance factors
   // YES this is hard to figure out! the result table is terrible.
   // I ran out the entire table, then figured out the rules below from 
@@ -339,6 +523,8 @@ int AVL<Node_T, Val_T>::_rotate_right(Node_T *a) {
     root = b;
   }
   b->AVLNode_base<Node_T,Val_T>::parent = parent;
+  _recount(a);
+  _recount(b);
   // and update balance factors
   // YES this is hard to figure out! the result table is terrible.
   // I ran out the entire table, then figured out the rules below from 
@@ -377,6 +563,7 @@ bool AVL<Node_T, Val_T>::insert(Node_T *n) {
   n->AVLNode_base<Node_T,Val_T>::right = nullptr;
   n->AVLNode_base<Node_T,Val_T>::left = nullptr;
   n->AVLNode_base<Node_T,Val_T>::balance = 0;
+  _recount(n);
   // We do this here, so we don't have to do the check every iteration
   if (!root) {
     root = n;
@@ -387,21 +574,20 @@ bool AVL<Node_T, Val_T>::insert(Node_T *n) {
     return true;
   }
   Node_T *parent = root;
+  bool left;
 
   // insert it
   while (true) {
     int c = Node_T::compare(n->val(), parent->val());
     if (c > 0) {
       if (!parent->AVLNode_base<Node_T,Val_T>::right) {
-        parent->AVLNode_base<Node_T,Val_T>::right = n;
-        n->AVLNode_base<Node_T,Val_T>::parent = parent;
+        left = false;
         break;
       }
       parent = parent->AVLNode_base<Node_T,Val_T>::right;
     } else if (c < 0) {
       if (!parent->AVLNode_base<Node_T,Val_T>::left) {
-        parent->AVLNode_base<Node_T,Val_T>::left = n;
-        n->AVLNode_base<Node_T,Val_T>::parent = parent;
+        left = true;
         break;
       }
       parent = parent->AVLNode_base<Node_T,Val_T>::left;
@@ -410,6 +596,93 @@ bool AVL<Node_T, Val_T>::insert(Node_T *n) {
       return false;
     }
   }
+  _link(parent, n, left);
+  return true;
+}
+
+template<typename Node_T, typename Val_T>
+bool AVL<Node_T, Val_T>::insert_hint(Iterator hint, Node_T *n) {
+  if (!root) {
+    return insert(n);
+  }
+  Node_T *parent;
+  bool left;
+  if (hint == end()) {
+    // n goes right of the largest node, if it's larger
+    parent = root;
+    while (parent->AVLNode_base<Node_T,Val_T>::right) {
+      parent = parent->AVLNode_base<Node_T,Val_T>::right;
+    }
+    int c = Node_T::compare(n->val(), parent->val());
+    if (c == 0) {
+      return false;
+    }
+    if (c < 0) {
+      return insert(n);
+    }
+    left = false;
+  } else {
+    Node_T *h = &(*hint);
+    int c = Node_T::compare(n->val(), h->val());
+    if (c == 0) {
+      return false;
+    }
+    if (c > 0) {
+      return insert(n);
+    }
+    // The node before h is the largest in h's left subtree, and n goes right
+    // of it. If h has no left subtree, it's the first node above h that h is
+    // right of, and n goes left of h.
+    Node_T *before;
+    if (h->AVLNode_base<Node_T,Val_T>::left) {
+      before = h->AVLNode_base<Node_T,Val_T>::left;
+      while (before->AVLNode_base<Node_T,Val_T>::right) {
+        before = before->AVLNode_base<Node_T,Val_T>::right;
+      }
+      parent = before;
+      left = false;
+    } else {
+      before = h;
+      while (before->AVLNode_base<Node_T,Val_T>::parent &&
+          before->AVLNode_base<Node_T,Val_T>::parent->AVLNode_base<Node_T,Val_T>::left == before) {
+        before = before->AVLNode_base<Node_T,Val_T>::parent;
+      }
+      before = before->AVLNode_base<Node_T,Val_T>::parent;
+      parent = h;
+      left = true;
+    }
+    if (before) {
+      c = Node_T::compare(n->val(), before->val());
+      if (c == 0) {
+        return false;
+      }
+      if (c < 0) {
+        return insert(n);
+      }
+    }
+  }
+  PRINT("Begin Insert hint\n");
+  CHECK_ALL();
+  PRINT_TREE();
+  n->AVLNode_base<Node_T,Val_T>::right = nullptr;
+  n->AVLNode_base<Node_T,Val_T>::left = nullptr;
+  n->AVLNode_base<Node_T,Val_T>::balance = 0;
+  _recount(n);
+  _link(parent, n, left);
+  return true;
+}
+
+template<typename Node_T, typename Val_T>
+void AVL<Node_T, Val_T>::_link(Node_T *parent, Node_T *n, bool left) {
+  if (left) {
+    parent->AVLNode_base<Node_T,Val_T>::left = n;
+  } else {
+    parent->AVLNode_base<Node_T,Val_T>::right = n;
+  }
+  n->AVLNode_base<Node_T,Val_T>::parent = parent;
+  // Count n everywhere above it before any rotations, which recount from
+  // their children
+  _add_count(parent, 1);
   CHECK();
   PRINT("node added\n");
   PRINT_TREE();
@@ -429,13 +702,13 @@ bool AVL<Node_T, Val_T>::insert(Node_T *n) {
     parent->AVLNode_base<Node_T,Val_T>::balance += 1;
     if (parent->AVLNode_base<Node_T,Val_T>::balance <= 0) {
       CHECK_ALL();
-      return true;
+      return;
     }
   } else {
     parent->AVLNode_base<Node_T,Val_T>::balance -= 1;
     if (parent->AVLNode_base<Node_T,Val_T>::balance >= 0) {
       CHECK_ALL();
-      return true;
+      return;
     }
   }
   // so we need to start at new_n->AVLNode_base<Node_T,Val_T>::parent->AVLNode_base<Node_T,Val_T>::parent, or grandparent
@@ -504,7 +777,6 @@ bool AVL<Node_T, Val_T>::insert(Node_T *n) {
   PRINT_TREE();
   CHECK_ALL();
   PRINT("Insert complete\n");
-  return true;  
 }
 
 template<typename Node_T, typename Val_T>
@@ -607,6 +879,8 @@ void AVL<Node_T, Val_T>::remove(Node_T *n)  {
     tmp_balance = replacement->AVLNode_base<Node_T,Val_T>::balance;
     replacement->AVLNode_base<Node_T,Val_T>::balance = n->AVLNode_base<Node_T,Val_T>::balance;
     n->AVLNode_base<Node_T,Val_T>::balance = tmp_balance;
+    // counts belong to the position too
+    _swap_count(n, replacement);
     // and continue with removing n, now in a more useful place
     PRINT("Done replacement\n");
     PRINT_TREE();
@@ -622,6 +896,8 @@ void AVL<Node_T, Val_T>::remove(Node_T *n)  {
   PRINT("beginning remove balance\n");
   PRINT_TREE();
   // we're going to remove n, but we'll wait until later to simplify logic here.
+  // Uncount it now though, so rotations on the way up see the right sizes
+  _add_count(n, -1);
   Node_T *sibling;
   Node_T *old_n = n;
   while (n->AVLNode_base<Node_T,Val_T>::parent) {
@@ -761,6 +1037,13 @@ size_t AVL<Node_T, Val_T>::_checkAll(Node_T *parent, Node_T *n) const {
     printf("\n");
     PANIC("Node is corrupt, it doesn't point to it's parent");
   }
+  if (!_count_ok(n)) {
+    print();
+    printf("node's count is wrong: ");
+    n->print();
+    printf("\n");
+    PANIC("node doesn't know it's count");
+  }
   size_t depth = (size_l > size_r ? size_l : size_r) + 1;
   return depth;
 }
@@ -6,6 +6,8 @@
  * resizes up when size is < x data it contains
  * resizes down when size is > 2x data it contains
  *
+ * HP is the hashing policy, see hash.h
+ *
  * Worst case operation is linear per op due to linear rehash
  *
  * When to use this:
@@ -21,6 +23,7 @@
 #include "panic.h"
 #include "delayed_copy_array.h"
 #include "avl.h"
+#include "hash.h"
 
 #ifndef AVL_HASHTABLE_H
 #define AVL_HASHTABLE_H
@@ -39,9 +42,11 @@ class AVLHashTableNode_base: public AVLNode_base<Node_T, Val_T> {
     // static size_t hash(Val_T v);
 };
 
-template <typename Node_T, typename Val_T>
+template <typename Node_T, typename Val_T, typename HP=DefaultHash>
 class AVLHashTable {
   private:
+    // See hash.h
+    uint64_t seed;
     DCUArray<AVL<Node_T, Val_T>> table;
     size_t count = 0;
     void check_sizeup(void);
@@ -137,8 +142,9 @@ class AVLHashTable {
     void print();
 };
 
-template <typename Node_T, typename Val_T>
-AVLHashTable<Node_T,Val_T>::AVLHashTable():table(MINSIZE) {
+template <typename Node_T, typename Val_T, typename HP>
+AVLHashTable<Node_T,Val_T,HP>::AVLHashTable():table(MINSIZE) {
+  seed = HP::new_seed();
   // We have to initialize the lists since
   // array doesn't construct objects it contains
   for (size_t i=0; i<MINSIZE; ++i) {
@@ -146,8 +152,9 @@ AVLHashTable<Node_T,Val_T>::AVLHashTable():table(MINSIZE) {
   }
 }
 
-template <typename Node_T, typename Val_T>
-AVLHashTable<Node_T,Val_T>::AVLHashTable(size_t s):table(s) {
+template <typename Node_T, typename Val_T, typename HP>
+AVLHashTable<Node_T,Val_T,HP>::AVLHashTable(size_t s):table(s) {
+  seed = HP::new_seed();
   // We have to initialize the lists since
   // array doesn't construct objects it contains
   for (size_t i=0; i<s; ++i) {
@@ -155,8 +162,8 @@ AVLHashTable<Node_T,Val_T>::AVLHashTable(size_t s):table(s) {
   }
 }
 
-template <typename Node_T, typename Val_T>
-AVLHashTable<Node_T,Val_T>::~AVLHashTable() {
+template <typename Node_T, typename Val_T, typename HP>
+AVLHashTable<Node_T,Val_T,HP>::~AVLHashTable() {
   for (size_t i=0; i<table.size(); ++i) {
     if (!table[i].isempty()) {
       PANIC("Hashtable not empty before destruction");
@@ -166,13 +173,13 @@ AVLHashTable<Node_T,Val_T>::~AVLHashTable() {
   }
 };
 
-template <typename Node_T, typename Val_T>
-bool AVLHashTable<Node_T, Val_T>::insert(Node_T *new_node) {
+template <typename Node_T, typename Val_T, typename HP>
+bool AVLHashTable<Node_T,Val_T,HP>::insert(Node_T *new_node) {
   check_sizeup();
   // set the hash table size 
   new_node->hs = table.size();
   // Hash it
-  size_t i = Node_T::hash(new_node->val()) % table.size();
+  size_t i = HP::index(Node_T::hash(new_node->val()), seed, table.size());
   if (table[i].insert(new_node)) {
     count++;
     return true;
@@ -180,24 +187,24 @@ bool AVLHashTable<Node_T, Val_T>::insert(Node_T *new_node) {
   return false;
 }
 
-template <typename Node_T, typename Val_T>
-Node_T* AVLHashTable<Node_T,Val_T>::get(Val_T key) {
-  size_t i = Node_T::hash(key) % table.size();
+template <typename Node_T, typename Val_T, typename HP>
+Node_T* AVLHashTable<Node_T,Val_T,HP>::get(Val_T key) {
+  size_t i = HP::index(Node_T::hash(key), seed, table.size());
   return table[i].get(key);
 }
 
-template <typename Node_T, typename Val_T>
-Node_T* AVLHashTable<Node_T,Val_T>::remove(Node_T *n) {
+template <typename Node_T, typename Val_T, typename HP>
+Node_T* AVLHashTable<Node_T,Val_T,HP>::remove(Node_T *n) {
   Val_T v = n->val();
-  size_t i = Node_T::hash(v) % table.size();
+  size_t i = HP::index(Node_T::hash(v), seed, table.size());
   table[i].remove(n);
   count--;
   check_sizedown();
   return n;
 }
 
-template <typename Node_T, typename Val_T>
-bool AVLHashTable<Node_T,Val_T>::isempty(void) const {
+template <typename Node_T, typename Val_T, typename HP>
+bool AVLHashTable<Node_T,Val_T,HP>::isempty(void) const {
   return count == 0;
 }
 
@@ -205,8 +212,8 @@ bool AVLHashTable<Node_T,Val_T>::isempty(void) const {
 // as it walks all the elements for every element it moves
 // If 3 elements stay, and 3 elements move, it'll walk the first
 // 3 elements 3 times...
-template <typename Node_T, typename Val_T>
-void AVLHashTable<Node_T,Val_T>::resize(size_t s) {
+template <typename Node_T, typename Val_T, typename HP>
+void AVLHashTable<Node_T,Val_T,HP>::resize(size_t s) {
   // nothing to do
   if (s == table.size()) {
     return;
@@ -227,7 +234,7 @@ void AVLHashTable<Node_T,Val_T>::resize(size_t s) {
     while (n != table[i].end()) {
       if (n->hs != s) {
         auto node = &(*n);
-        size_t new_index = Node_T::hash(node->val()) % s;
+        size_t new_index = HP::index(Node_T::hash(node->val()), seed, s);
         node->hs = s;
         if (new_index != i) {
           table[i].remove(node);
@@ -245,8 +252,8 @@ void AVLHashTable<Node_T,Val_T>::resize(size_t s) {
   }
 }
 
-template <typename Node_T, typename Val_T>
-void AVLHashTable<Node_T,Val_T>::check_sizedown(void) {
+template <typename Node_T, typename Val_T, typename HP>
+void AVLHashTable<Node_T,Val_T,HP>::check_sizedown(void) {
   // If it's under a quarter full resize down
   if (table.size() > 2*count) {
     size_t s = table.size() / 2;
@@ -257,15 +264,15 @@ void AVLHashTable<Node_T,Val_T>::check_sizedown(void) {
   }
 }
 
-template <typename Node_T, typename Val_T>
-void AVLHashTable<Node_T,Val_T>::check_sizeup(void) {
+template <typename Node_T, typename Val_T, typename HP>
+void AVLHashTable<Node_T,Val_T,HP>::check_sizeup(void) {
   // If it's over half-full resize up
   if (table.size() < count) {
     resize(table.size()*2); 
   } 
 }
-template <typename Node_T, typename Val_T>
-void AVLHashTable<Node_T,Val_T>::print(void) {
+template <typename Node_T, typename Val_T, typename HP>
+void AVLHashTable<Node_T,Val_T,HP>::print(void) {
   printf("[\n");
   for (size_t i=0; i<table.size(); ++i) {
     printf("  ");
@@ -0,0 +1,608 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * A B^epsilon-tree (buffered B-tree), a write optimized dictionary.
+ *
+ * When to use this:
+ *   You insert a lot more than you look things up, into a dictionary much
+ *   bigger than cache, e.g. ingesting random keys. Every BTree insert walks
+ *   root to leaf, a cache miss per level. Here an insert usually stops at
+ *   the root, and work moves down the tree in big sorted batches.
+ *   Lookups cost a bit more than a BTree's (a binary search of a buffer per
+ *   level as well), and deletes are write optimized too.
+ *
+ * How it works:
+ *   Inner nodes have up to FANOUT children, and a buffer of pending messages
+ *   ("upsert this element" or "erase this key") for the subtree under them,
+ *   sorted by key, at most one per key. upsert() and erase() just add a
+ *   message to the root's buffer. When a buffer holds more than
+ *   SIZE - FANOUT messages we flush: move all the messages for the child that
+ *   has the most of them down in to that child's buffer, in one sorted merge,
+ *   and so on down if that buffer overflows too. Messages that reach a leaf
+ *   are applied to it. Leaves hold up to SIZE elements, and split (or
+ *   disappear, if they empty out) as messages are applied.
+ *   A message higher in the tree is newer than anything below it, so get()
+ *   walks down returning the first message or element it finds for the key.
+ *
+ *   Tuning (the epsilon):
+ * A node holds about SIZE things, FANOUT children plus SIZE - FANOUT
+ * messages, so FANOUT = SIZE^epsilon. With FANOUT near SIZE (epsilon = 1)
+ * there's no room for buffers and this is just a slower BTree. Smaller FANOUT
+ * makes the tree taller (lookups slower), but each flush moves more messages
+ * per child, so inserts get cheaper. The usual choice is epsilon = 1/2, e.g.
+ * SIZE=256, FANOUT=16. See betree_benchmark.
+ *
+ * Design Decisions:
+ *   Blind writes:
+ * upsert() (insert or replace) and erase() don't look at the tree, that's
+ * what makes them fast, and why they can't tell you if the key was there.
+ * insert() and remove() have BTree's meaning (insert() doesn't replace,
+ * both return whether anything happened), so they need a get() first, and
+ * are only as fast as a lookup. remove() copies the element out to you (the
+ * tombstone only reaches it later), so that needs a copyable T.
+ *
+ *   No rebalancing on delete:
+ * Leaves are dropped when they empty out, but we don't merge under full
+ * nodes. Like ts_btree.h's tree, this is meant for data that mostly grows.
+ *
+ *   Recursion:
+ * Unlike btree.h, flushes recurse down the tree. The tree is only
+ * log_FANOUT(n) deep, so the stack stays small.
+ *
+ *   isempty() has to flush every buffer, since a message anywhere can hide an
+ * element below it, so it's O(n).
+ *
+ * T, Val_T and C are the same as for btree.h.
+ *
+ * Threadsafety:
+ *   thread compatible
+ */
+
+#include <algorithm>
+#include <iterator>
+#include <stdint.h>
+#include <stdio.h>
+#include <utility>
+#include <vector>
+#include "panic.h"
+
+#ifndef BETREE_H
+#define BETREE_H
+
+// Define this to implement some expensive consistancy checking
+// This checks all of the invariants before and after every operation
+#ifdef BETREE_DEBUG
+#define BETREE_CHECK() check()
+#else
+#define BETREE_CHECK()
+#endif
+
+template<typename T, typename Val_T, typename C, int SIZE=256, int FANOUT=16>
+class BETree {
+  static_assert(std::is_same<decltype(C::compare(std::declval<Val_T>(), std::declval<Val_T>())), int>(), "Please define a static method int compare(Val_T, Val_T) method on C class");
+  static_assert(std::is_same<decltype(C::val(std::declval<T>())), Val_T>(), "Please define a static method Val_T val(T) method on C class");
+  static_assert(FANOUT >= 3, "FANOUT must be at least 3");
+  static_assert(SIZE > FANOUT, "SIZE must leave room for a buffer");
+  private:
+    static const size_t BUFFER = SIZE - FANOUT;
+    struct Message {
+      Val_T key;
+      bool tombstone;
+      // Unused for tombstones
+      T datum;
+    };
+    struct Node {
+      bool leaf;
+    };
+    struct Leaf: public Node {
+      // sorted
+      std::vector<T> data;
+    };
+    struct Inner: public Node {
+      // keys < pivots[i] go to children[i], keys >= pivots[i] to children[i+1]
+      std::vector<Val_T> pivots;
+      std::vector<Node*> children;
+      // sorted by key, one message per key
+      std::vector<Message> buffer;
+    };
+    Node *root;
+    // Reused by every merge, so flushes don't allocate
+    std::vector<Message> scratch_messages;
+    std::vector<T> scratch_data;
+
+    static Leaf* new_leaf() {
+      Leaf *l = new Leaf();
+      l->leaf = true;
+      l->data.reserve(SIZE);
+      return l;
+    }
+    static Inner* new_inner() {
+      Inner *n = new Inner();
+      n->leaf = false;
+      n->pivots.reserve(FANOUT);
+      n->children.reserve(FANOUT+1);
+      n->buffer.reserve(BUFFER+1);
+      return n;
+    }
+    static void destroy(Node *n);
+    static bool hollow(const Node *n);
+    static size_t route(const Inner *n, Val_T key);
+    static typename std::vector<Message>::iterator find_message(std::vector<Message> &buffer, Val_T key);
+    void put(Message &&m);
+    void apply(Inner *parent, size_t c, typename std::vector<Message>::iterator b, typename std::vector<Message>::iterator e);
+    void push(Inner *parent, size_t c, typename std::vector<Message>::iterator b, typename std::vector<Message>::iterator e);
+    void flush(Inner *n, size_t limit);
+    void flush_all(Node *n);
+    void split_child(Inner *parent, size_t c);
+    void fix_root(void);
+    void _check(const Node *n, const Val_T *lo, const Val_T *hi, size_t depth, size_t *leaf_depth) const;
+    void _print(const Node *n) const;
+  public:
+    BETree();
+    ~BETree();
+    // Insert datum, replacing anything with the same key. Doesn't look.
+    void upsert(T datum);
+    // Remove key, if it's there. Doesn't look.
+    void erase(Val_T key);
+    // Same as BTree: false (and no change) if key is already there
+    bool insert(T datum);
+    // Same as BTree: false if key isn't there, result may be nullptr
+    bool remove(Val_T key, T *result);
+    // Valid until the next change to the tree
+    T* get(Val_T key) const;
+    // Pushes every pending message down to the leaves
+    void flush_all(void);
+    // O(n), see above
+    bool isempty(void);
+    void check(void) const;
+    void print(void) const;
+};
+
+template<typename T, typename Val_T, typename C, int SIZE, int FANOUT>
+BETree<T,Val_T,C,SIZE,FANOUT>::BETree() {
+  root = new_leaf();
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, int FANOUT>
+BETree<T,Val_T,C,SIZE,FANOUT>::~BETree() {
+  destroy(root);
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, int FANOUT>
+void BETree<T,Val_T,C,SIZE,FANOUT>::destroy(Node *n) {
+  if (n->leaf) {
+    delete (Leaf*) n;
+    return;
+  }
+  Inner *in = (Inner*) n;
+  for (Node *c : in->children) {
+    destroy(c);
+  }
+  delete in;
+}
+
+// True if there's nothing at all under n
+template<typename T, typename Val_T, typename C, int SIZE, int FANOUT>
+bool BETree<T,Val_T,C,SIZE,FANOUT>::hollow(const Node *n) {
+  if (n->leaf) {
+    return ((const Leaf*) n)->data.empty();
+  }
+  const Inner *in = (const Inner*) n;
+  if (!in->buffer.empty()) {
+    return false;
+  }
+  for (const Node *c : in->children) {
+    if (!hollow(c)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Which child key belongs under
+template<typename T, typename Val_T, typename C, int SIZE, int FANOUT>
+size_t BETree<T,Val_T,C,SIZE,FANOUT>::route(const Inner *n, Val_T key) {
+  return std::upper_bound(n->pivots.begin(), n->pivots.end(), key,
+      [](const Val_T &k, const Val_T &p) { return C::compare(k, p) < 0; }) - n->pivots.begin();
+}
+
+// First message with a key >= key
+template<typename T, typename Val_T, typename C, int SIZE, int FANOUT>
+typename std::vector<typename BETree<T,Val_T,C,SIZE,FANOUT>::Message>::iterator BETree<T,Val_T,C,SIZE,FANOUT>::find_message(std::vector<Message> &buffer, Val_T key) {
+  return std::lower_bound(buffer.begin(), buffer.end(), key,
+      [](const Message &m, const Val_T &k) { return C::compare(m.key, k) < 0; });
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, int FANOUT>
+T* BETree<T,Val_T,C,SIZE,FANOUT>::get(Val_T key) const {
+  const Node *n = root;
+  while (!n->leaf) {
+    Inner *in = (Inner*) n;
+    auto m = find_message(in->buffer, key);
+    if (m != in->buffer.end() && C::compare(m->key, key) == 0) {
+      return m->tombstone ? nullptr : &(m->datum);
+    }
+    n = in->children[route(in, key)];
+  }
+  Leaf *l = (Leaf*) n;
+  auto d = std::lower_bound(l->data.begin(), l->data.end(), key,
+      [](const T &t, const Val_T &k) { return C::compare(C::val(t), k) < 0; });
+  if (d != l->data.end() && C::compare(C::val(*d), key) == 0) {
+    return &(*d);
+  }
+  return nullptr;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, int FANOUT>
+void BETree<T,Val_T,C,SIZE,FANOUT>::upsert(T datum) {
+  BETREE_CHECK();
+  Message m;
+  m.key = C::val(datum);
+  m.tombstone = false;
+  m.datum = std::move(datum);
+  put(std::move(m));
+  BETREE_CHECK();
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, int FANOUT>
+void BETree<T,Val_T,C,SIZE,FANOUT>::erase(Val_T key) {
+  BETREE_CHECK();
+  Message m;
+  m.key = key;
+  m.tombstone = true;
+  put(std::move(m));
+  BETREE_CHECK();
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, int FANOUT>
+bool BETree<T,Val_T,C,SIZE,FANOUT>::insert(T datum) {
+  if (get(C::val(datum))) {
+    return false;
+  }
+  upsert(std::move(datum));
+  return true;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, int FANOUT>
+bool BETree<T,Val_T,C,SIZE,FANOUT>::remove(Val_T key, T *result) {
+  T *d = get(key);
+  if (!d) {
+    return false;
+  }
+  // d stays in it's leaf or buffer until the tombstone reaches it, so we
+  // copy rather than move, a moved from T could have a different key
+  if (result) {
+    *result = *d;
+  }
+  erase(key);
+  return true;
+}
+
+// Adds m to the root
+template<typename T, typename Val_T, typename C, int SIZE, int FANOUT>
+void BETree<T,Val_T,C,SIZE,FANOUT>::put(Message &&m) {
+  if (root->leaf) {
+    // Just a leaf, apply it directly, under a temporary root
+    Inner *r = new_inner();
+    r->children.push_back(root);
+    r->buffer.push_back(std::move(m));
+    apply(r, 0, r->buffer.begin(), r->buffer.end());
+    r->buffer.clear();
+    root = r;
+    fix_root();
+    return;
+  }
+  Inner *r = (Inner*) root;
+  auto pos = find_message(r->buffer, m.key);
+  if (pos != r->buffer.end() && C::compare(pos->key, m.key) == 0) {
+    *pos = std::move(m);
+    return;
+  }
+  r->buffer.insert(pos, std::move(m));
+  if (r->buffer.size() > BUFFER) {
+    flush(r, BUFFER);
+    fix_root();
+  }
+}
+
+// Merges [b, e) (all for child c) in to leaf child c, replacing it with as
+// many leaves as it takes to hold the result, or none if it's empty
+template<typename T, typename Val_T, typename C, int SIZE, int FANOUT>
+void BETree<T,Val_T,C,SIZE,FANOUT>::apply(Inner *parent, size_t c, typename std::vector<Message>::iterator b, typename std::vector<Message>::iterator e) {
+  Leaf *l = (Leaf*) parent->children[c];
+  std::vector<T> &out = scratch_data;
+  out.clear();
+  auto d = l->data.begin();
+  while (b != e) {
+    int cmp = d == l->data.end() ? 1 : C::compare(C::val(*d), b->key);
+    if (cmp < 0) {
+      out.push_back(std::move(*d));
+      ++d;
+      continue;
+    }
+    if (cmp == 0) {
+      // replaced or erased
+      ++d;
+    }
+    if (!b->tombstone) {
+      out.push_back(std::move(b->datum));
+    }
+    ++b;
+  }
+  for (; d != l->data.end(); ++d) {
+    out.push_back(std::move(*d));
+  }
+  if (out.empty() && parent->children.size() > 1) {
+    // Drop the leaf, and the pivot between it and a neighbor
+    parent->pivots.erase(parent->pivots.begin() + (c > 0 ? c-1 : 0));
+    parent->children.erase(parent->children.begin() + c);
+    delete l;
+    return;
+  }
+  // Split in to even pieces of at most SIZE
+  size_t pieces = std::max((size_t) 1, (out.size() + SIZE - 1) / SIZE);
+  l->data.clear();
+  size_t start = 0;
+  for (size_t p=0; p<pieces; ++p) {
+    size_t end = out.size() * (p+1) / pieces;
+    Leaf *piece = l;
+    if (p > 0) {
+      piece = new_leaf();
+      parent->pivots.insert(parent->pivots.begin() + c + p - 1, C::val(out[start]));
+      parent->children.insert(parent->children.begin() + c + p, piece);
+    }
+    std::move(out.begin() + start, out.begin() + end, std::back_inserter(piece->data));
+    start = end;
+  }
+}
+
+// Merges [b, e) (all for child c) in to inner child c's buffer, they're newer
+// than what's there. Then flushes and splits the child if it needs it.
+template<typename T, typename Val_T, typename C, int SIZE, int FANOUT>
+void BETree<T,Val_T,C,SIZE,FANOUT>::push(Inner *parent, size_t c, typename std::vector<Message>::iterator b, typename std::vector<Message>::iterator e) {
+  Inner *child = (Inner*) parent->children[c];
+  std::vector<Message> &out = scratch_messages;
+  out.clear();
+  auto o = child->buffer.begin();
+  while (b != e) {
+    int cmp = o == child->buffer.end() ? 1 : C::compare(o->key, b->key);
+    if (cmp < 0) {
+      out.push_back(std::move(*o));
+      ++o;
+      continue;
+    }
+    if (cmp == 0) {
+      ++o;
+    }
+    out.push_back(std::move(*b));
+    ++b;
+  }
+  for (; o != child->buffer.end(); ++o) {
+    out.push_back(std::move(*o));
+  }
+  child->buffer.swap(out);
+  if (child->buffer.size() > BUFFER) {
+    flush(child, BUFFER);
+  }
+  if (child->children.size() > FANOUT) {
+    split_child(parent, c);
+  }
+}
+
+// Moves messages down until n has at most limit buffered. n may end up with
+// more than FANOUT children, the caller splits it.
+template<typename T, typename Val_T, typename C, int SIZE, int FANOUT>
+void BETree<T,Val_T,C,SIZE,FANOUT>::flush(Inner *n, size_t limit) {
+  while (n->buffer.size() > limit) {
+    // Find the child with the most messages, the buffer is sorted, so each
+    // child's messages are a run
+    size_t best = 0;
+    size_t best_start = 0;
+    size_t best_count = 0;
+    size_t start = 0;
+    while (start < n->buffer.size()) {
+      size_t c = route(n, n->buffer[start].key);
+      size_t end = c < n->pivots.size() ?
+        find_message(n->buffer, n->pivots[c]) - n->buffer.begin() : n->buffer.size();
+      if (end - start > best_count) {
+        best = c;
+        best_start = start;
+        best_count = end - start;
+      }
+      start = end;
+    }
+    auto b = n->buffer.begin() + best_start;
+    auto e = b + best_count;
+    if (n->children[best]->leaf) {
+      apply(n, best, b, e);
+    } else {
+      push(n, best, b, e);
+    }
+    n->buffer.erase(b, e);
+  }
+}
+
+// Splits parent's child c in to as many pieces as it takes to get each down
+// to FANOUT children
+template<typename T, typename Val_T, typename C, int SIZE, int FANOUT>
+void BETree<T,Val_T,C,SIZE,FANOUT>::split_child(Inner *parent, size_t c) {
+  Inner *n = (Inner*) parent->children[c];
+  size_t total = n->children.size();
+  size_t pieces = (total + FANOUT - 1) / FANOUT;
+  // Piece p gets children [total*p/pieces, total*(p+1)/pieces), the pivot
+  // just before its first child goes up to parent
+  size_t first = total / pieces;
+  for (size_t p=1; p<pieces; ++p) {
+    size_t start = total * p / pieces;
+    size_t end = total * (p+1) / pieces;
+    Inner *piece = new_inner();
+    Val_T up = n->pivots[start-1];
+    piece->children.assign(n->children.begin() + start, n->children.begin() + end);
+    piece->pivots.assign(n->pivots.begin() + start, n->pivots.begin() + end - 1);
+    // Messages >= up (and less than the next piece's pivot) move with it
+    auto mb = find_message(n->buffer, up);
+    auto me = end < total ? find_message(n->buffer, n->pivots[end-1]) : n->buffer.end();
+    std::move(mb, me, std::back_inserter(piece->buffer));
+    parent->pivots.insert(parent->pivots.begin() + c + p - 1, up);
+    parent->children.insert(parent->children.begin() + c + p, piece);
+  }
+  // What's left in n is the first piece
+  n->buffer.erase(find_message(n->buffer, n->pivots[first-1]), n->buffer.end());
+  n->children.resize(first);
+  n->pivots.resize(first-1);
+}
+
+// After a change at the root, grows new roots while it has too many children,
+// and drops a root that's down to one child and nothing buffered
+template<typename T, typename Val_T, typename C, int SIZE, int FANOUT>
+void BETree<T,Val_T,C,SIZE,FANOUT>::fix_root(void) {
+  while (!root->leaf && ((Inner*) root)->children.size() > FANOUT) {
+    Inner *n = new_inner();
+    n->children.push_back(root);
+    split_child(n, 0);
+    root = n;
+  }
+  while (!root->leaf && ((Inner*) root)->children.size() == 1 && ((Inner*) root)->buffer.empty()) {
+    Inner *old = (Inner*) root;
+    root = old->children[0];
+    delete old;
+  }
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, int FANOUT>
+void BETree<T,Val_T,C,SIZE,FANOUT>::flush_all(void) {
+  BETREE_CHECK();
+  if (root->leaf) {
+    return;
+  }
+  flush_all(root);
+  fix_root();
+  BETREE_CHECK();
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, int FANOUT>
+void BETree<T,Val_T,C,SIZE,FANOUT>::flush_all(Node *n) {
+  Inner *in = (Inner*) n;
+  flush(in, 0);
+  size_t c = 0;
+  while (c < in->children.size()) {
+    if (in->children[c]->leaf) {
+      ++c;
+      continue;
+    }
+    flush_all(in->children[c]);
+    // Deletes can leave whole subtrees empty, don't keep them around
+    if (in->children.size() > 1 && hollow(in->children[c])) {
+      destroy(in->children[c]);
+      in->pivots.erase(in->pivots.begin() + (c > 0 ? c-1 : 0));
+      in->children.erase(in->children.begin() + c);
+      continue;
+    }
+    // The new pieces are flushed already, skip them
+    size_t before = in->children.size();
+    if (((Inner*) in->children[c])->children.size() > FANOUT) {
+      split_child(in, c);
+    }
+    c += in->children.size() - before + 1;
+  }
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, int FANOUT>
+bool BETree<T,Val_T,C,SIZE,FANOUT>::isempty(void) {
+  flush_all();
+  return hollow(root);
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, int FANOUT>
+void BETree<T,Val_T,C,SIZE,FANOUT>::check(void) const {
+  size_t leaf_depth = 0;
+  _check(root, nullptr, nullptr, 0, &leaf_depth);
+}
+
+// Everything under n must be in [lo, hi)
+template<typename T, typename Val_T, typename C, int SIZE, int FANOUT>
+void BETree<T,Val_T,C,SIZE,FANOUT>::_check(const Node *n, const Val_T *lo, const Val_T *hi, size_t depth, size_t *leaf_depth) const {
+  auto in_range = [lo, hi](Val_T v) {
+    return (!lo || C::compare(v, *lo) >= 0) && (!hi || C::compare(v, *hi) < 0);
+  };
+  if (n->leaf) {
+    const Leaf *l = (const Leaf*) n;
+    if (l->data.size() > SIZE) {
+      PANIC("Leaf is over full");
+    }
+    for (size_t i=0; i<l->data.size(); ++i) {
+      if (!in_range(C::val(l->data[i])) ||
+          (i > 0 && C::compare(C::val(l->data[i-1]), C::val(l->data[i])) >= 0)) {
+        PANIC("Leaf is out of order");
+      }
+    }
+    if (*leaf_depth && *leaf_depth != depth) {
+      PANIC("Leaves are at different depths");
+    }
+    *leaf_depth = depth;
+    return;
+  }
+  const Inner *in = (const Inner*) n;
+  if (in->children.size() > FANOUT || in->children.size() != in->pivots.size() + 1 ||
+      in->buffer.size() > BUFFER) {
+    printf("children=%ld pivots=%ld buffer=%ld\n", in->children.size(), in->pivots.size(), in->buffer.size());
+    PANIC("Inner node is the wrong shape");
+  }
+  for (size_t i=0; i<in->buffer.size(); ++i) {
+    if (!in_range(in->buffer[i].key) ||
+        (i > 0 && C::compare(in->buffer[i-1].key, in->buffer[i].key) >= 0)) {
+      PANIC("Buffer is out of order");
+    }
+  }
+  for (size_t i=0; i<in->children.size(); ++i) {
+    const Val_T *l = i > 0 ? &in->pivots[i-1] : lo;
+    const Val_T *h = i < in->pivots.size() ? &in->pivots[i] : hi;
+    if (l && !in_range(*l)) {
+      PANIC("Pivot is out of range");
+    }
+    if (l && h && C::compare(*l, *h) >= 0) {
+      PANIC("Pivots are out of order");
+    }
+    _check(in->children[i], l, h, depth+1, leaf_depth);
+  }
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, int FANOUT>
+void BETree<T,Val_T,C,SIZE,FANOUT>::print(void) const {
+  _print(root);
+  printf("\n");
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, int FANOUT>
+void BETree<T,Val_T,C,SIZE,FANOUT>::_print(const Node *n) const {
+  if (n->leaf) {
+    const Leaf *l = (const Leaf*) n;
+    printf("(");
+    for (size_t i=0; i<l->data.size(); ++i) {
+      if (i) {
+        printf(",");
+      }
+      C::printT(l->data[i]);
+    }
+    printf(")");
+    return;
+  }
+  const Inner *in = (const Inner*) n;
+  printf("[{");
+  for (size_t i=0; i<in->buffer.size(); ++i) {
+    if (i) {
+      printf(",");
+    }
+    if (in->buffer[i].tombstone) {
+      printf("-");
+    } else {
+      C::printT(in->buffer[i].datum);
+    }
+  }
+  printf("}");
+  for (size_t i=0; i<in->children.size(); ++i) {
+    _print(in->children[i]);
+  }
+  printf("]");
+}
+
+#endif
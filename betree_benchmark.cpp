@@ -0,0 +1,123 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * Benchmark for BETree against BTree, on the workload it's for: ingesting
+ * TEST_SIZE random keys, a data set well past the size of the cache.
+ * We time the inserts, then TEST_ITERATIONS random gets (all hits), for BTree
+ * and for BETree at a few epsilons (FANOUT = SIZE^epsilon, see betree.h).
+ * BETree's gets are timed both with whatever is still buffered, and after
+ * flush_all(), which is also timed.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "panic.h"
+#include "timer.h"
+#include "btree.h"
+#include "betree.h"
+
+#ifndef TEST_SIZE
+#define TEST_SIZE 16000000
+#endif
+#ifndef BTREE_ARITY
+#define BTREE_ARITY 64
+#endif
+#ifndef TEST_ITERATIONS
+#define TEST_ITERATIONS 4000000
+#endif
+
+struct KV {
+  uint64_t key;
+  uint64_t value;
+};
+
+class KVComp {
+  public:
+    static uint64_t val(const KV &kv) {
+      return kv.key;
+    }
+    static int compare(uint64_t v1, uint64_t v2) {
+      return v1 < v2 ? -1 : v1 > v2;
+    }
+    static void printT(const KV &kv) {
+      printf("%lu", kv.key);
+    }
+};
+
+uint64_t *keys;
+
+template<typename Tree>
+void gets(const char *name, Tree *tree) {
+  timeb t1, t2;
+  ftime(&t1);
+  for (int i=0; i<TEST_ITERATIONS; ++i) {
+    uint64_t k = keys[i % TEST_SIZE];
+    KV *kv = tree->get(k);
+    if (!kv || kv->value != k * 2) {
+      PANIC("tree lost an element");
+    }
+  }
+  ftime(&t2);
+  printf("%s time=%lf ops_per_sec=%.0lf\n", name, tdiff(t2, t1), TEST_ITERATIONS / tdiff(t2, t1));
+}
+
+template<typename Tree>
+double inserts(Tree *tree) {
+  timeb t1, t2;
+  ftime(&t1);
+  for (int i=0; i<TEST_SIZE; ++i) {
+    KV kv = {keys[i], keys[i] * 2};
+    tree->insert(kv);
+  }
+  ftime(&t2);
+  return tdiff(t2, t1);
+}
+
+template<int SIZE, int FANOUT>
+void betree() {
+  typedef BETree<KV, uint64_t, KVComp, SIZE, FANOUT> Tree;
+  Tree *tree = new Tree();
+  timeb t1, t2;
+  printf("BETree.h SIZE=%d FANOUT=%d epsilon=%.2lf\n", SIZE, FANOUT, log(FANOUT) / log(SIZE));
+  ftime(&t1);
+  for (int i=0; i<TEST_SIZE; ++i) {
+    KV kv = {keys[i], keys[i] * 2};
+    tree->upsert(kv);
+  }
+  ftime(&t2);
+  printf("upsert time=%lf ops_per_sec=%.0lf\n", tdiff(t2, t1), TEST_SIZE / tdiff(t2, t1));
+  gets("get_buffered", tree);
+  ftime(&t1);
+  tree->flush_all();
+  ftime(&t2);
+  printf("flush_all time=%lf\n", tdiff(t2, t1));
+  gets("get_flushed", tree);
+  delete tree;
+}
+
+int main(int argc, char* argv[]) {
+  printf("test_size=%d test_iterations=%d\n", TEST_SIZE, TEST_ITERATIONS);
+  keys = new uint64_t[TEST_SIZE];
+  // Note, we did not initialize rand, this is purposeful
+  for (int i=0; i<TEST_SIZE; ++i) {
+    keys[i] = ((uint64_t) rand() << 31) ^ rand();
+  }
+
+  {
+    printf("BTree.h SIZE=%d\n", BTREE_ARITY);
+    BTree<KV, uint64_t, KVComp, BTREE_ARITY> *tree = new BTree<KV, uint64_t, KVComp, BTREE_ARITY>();
+    double t = inserts(tree);
+    printf("insert time=%lf ops_per_sec=%.0lf\n", t, TEST_SIZE / t);
+    gets("get", tree);
+    delete tree;
+  }
+  // epsilon = 1/2, the usual choice
+  betree<256, 16>();
+  // More fanout, cheaper gets, dearer inserts
+  betree<256, 64>();
+  // Less fanout, the other way around
+  betree<256, 6>();
+  delete[] keys;
+  return 0;
+}
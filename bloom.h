@@ -0,0 +1,102 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * A blocked Bloom filter, a set of hashes that can say "definitely not here"
+ * or "maybe here".
+ *
+ * When to use this:
+ *   In front of something expensive to search, when most searches miss, e.g.
+ *   the sorted runs of lsm.h. Never a false negative, false positives at a
+ *   rate set by the bits per key you give it (about 1% at 10).
+ *
+ * How to use this:
+ *   init(n, bits_per_key) for n keys, add() each key's hash, then
+ *   maybe_contains(). Hashes can be lazy (e.g. the key itself), we mix them.
+ *
+ * Design Decisions:
+ *   Blocked:
+ * A textbook Bloom filter touches k random cache lines per lookup. We pick
+ * one 64 byte block per key and set all k bits in it (Putze et al, "Cache-,
+ * Hash- and Space-Efficient Bloom Filters"), so a lookup is one cache miss.
+ * The cost is a somewhat higher false positive rate for the same space, since
+ * blocks fill unevenly.
+ *
+ *   k (hashes per key) is bits_per_key * ln(2), the usual optimum. The bit
+ * positions come from two hashes, g_i = h1 + i*h2 (Kirsch and Mitzenmacher),
+ * both out of a second 64 bit mix (the first picks the block, reusing its
+ * bits would put keys sharing a block on the same positions).
+ *
+ * Threadsafety:
+ *   thread compatible (concurrent maybe_contains() calls are fine)
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "hash.h"
+
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#define BLOOM_BLOCK_WORDS 8
+#define BLOOM_BLOCK_BITS (BLOOM_BLOCK_WORDS * 64)
+
+class BloomFilter {
+  private:
+    std::vector<uint64_t> bits;
+    size_t blocks;
+    uint32_t k;
+
+    // Index of the first word of hash's block, and its two bit hashes
+    size_t probe(uint64_t hash, uint32_t *h1, uint32_t *h2) const {
+      uint64_t m = hash_mix64(hash);
+      uint64_t p = hash_mix64(m);
+      *h1 = (uint32_t) p;
+      *h2 = (uint32_t) (p >> 32) | 1;
+      return hash_fastrange(m, blocks) * BLOOM_BLOCK_WORDS;
+    }
+  public:
+    BloomFilter():blocks(0), k(0) {}
+    // Room for n keys, bits_per_key bits each
+    void init(size_t n, size_t bits_per_key) {
+      blocks = (n * bits_per_key + BLOOM_BLOCK_BITS - 1) / BLOOM_BLOCK_BITS;
+      if (blocks == 0) {
+        blocks = 1;
+      }
+      bits.assign(blocks * BLOOM_BLOCK_WORDS, 0);
+      // ln(2) ~= 0.69
+      k = bits_per_key * 69 / 100;
+      if (k < 1) {
+        k = 1;
+      }
+      if (k > 16) {
+        k = 16;
+      }
+    }
+    void add(uint64_t hash) {
+      uint32_t h1, h2;
+      uint64_t *block = &bits[probe(hash, &h1, &h2)];
+      for (uint32_t i=0; i<k; ++i) {
+        uint32_t bit = (h1 + i * h2) % BLOOM_BLOCK_BITS;
+        block[bit / 64] |= 1lu << (bit % 64);
+      }
+    }
+    bool maybe_contains(uint64_t hash) const {
+      if (!blocks) {
+        return false;
+      }
+      uint32_t h1, h2;
+      const uint64_t *block = &bits[probe(hash, &h1, &h2)];
+      for (uint32_t i=0; i<k; ++i) {
+        uint32_t bit = (h1 + i * h2) % BLOOM_BLOCK_BITS;
+        if (!(block[bit / 64] & (1lu << (bit % 64)))) {
+          return false;
+        }
+      }
+      return true;
+    }
+    size_t bytes() const {
+      return bits.size() * sizeof(uint64_t);
+    }
+};
+
+#endif
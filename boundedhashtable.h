@@ -22,6 +22,8 @@
  * This means worst case: O(log(n)) insert, remove, get
  * Average case: O(1) insert, remove, get
  *
+ * HP is the hashing policy, see hash.h
+ *
  * resizes up when size is < x data it contains
  * resizes down when size is > 2x data it contains
  *
@@ -35,15 +37,18 @@
 #include "zero_array.h"
 #include "avl.h"
 #include "dlist.h"
+#include "hash.h"
 
 #ifndef BOUNDED_HASHTABLE_H
 #define BOUNDED_HASHTABLE_H
 
 #define MINSIZE 4
 
-template <typename Node_T, typename Val_T>
+template <typename Node_T, typename Val_T, typename HP=DefaultHash>
 class FixedHashTable {
   private:
+    // See hash.h
+    uint64_t seed;
     ZeroArray<AVL<Node_T, Val_T>> table;
     DList<Node_T, Val_T> l;
     size_t next;
@@ -65,8 +70,9 @@ class FixedHashTable {
     size_t size(void);
 };
 
-template <typename Node_T, typename Val_T>
-FixedHashTable<Node_T,Val_T>::FixedHashTable() {
+template <typename Node_T, typename Val_T, typename HP>
+FixedHashTable<Node_T,Val_T,HP>::FixedHashTable() {
+  seed = HP::new_seed();
   // Warning: There's a trick happening here!! 
   // We create one empty AVL tree. That empty AVL tree
   // is *copied* in to a node whenever one is accessed
@@ -77,19 +83,19 @@ FixedHashTable<Node_T,Val_T>::FixedHashTable() {
   table.set_zero(AVL<Node_T, Val_T>());
 }
 
-template <typename Node_T, typename Val_T>
-FixedHashTable<Node_T,Val_T>::~FixedHashTable() {};
+template <typename Node_T, typename Val_T, typename HP>
+FixedHashTable<Node_T,Val_T,HP>::~FixedHashTable() {};
 
-template <typename Node_T, typename Val_T>
-void FixedHashTable<Node_T,Val_T>::reset(size_t s) {
+template <typename Node_T, typename Val_T, typename HP>
+void FixedHashTable<Node_T,Val_T,HP>::reset(size_t s) {
   table.reset(s); // this is constant time
 }
  
 
-template <typename Node_T, typename Val_T>
-bool FixedHashTable<Node_T, Val_T>::insert(Node_T *new_node) {
+template <typename Node_T, typename Val_T, typename HP>
+bool FixedHashTable<Node_T,Val_T,HP>::insert(Node_T *new_node) {
   // Hash it
-  size_t i = Node_T::hash(new_node->val()) % table.size();
+  size_t i = HP::index(Node_T::hash(new_node->val()), seed, table.size());
   bool b = table[i].insert(new_node); 
   if (b) {
     l.insert(new_node);
@@ -97,28 +103,28 @@ bool FixedHashTable<Node_T, Val_T>::insert(Node_T *new_node) {
   return b;
 }
 
-template <typename Node_T, typename Val_T>
-Node_T* FixedHashTable<Node_T,Val_T>::get(Val_T key) {
-  size_t i = Node_T::hash(key) % table.size();
+template <typename Node_T, typename Val_T, typename HP>
+Node_T* FixedHashTable<Node_T,Val_T,HP>::get(Val_T key) {
+  size_t i = HP::index(Node_T::hash(key), seed, table.size());
   return table[i].get(key);
 }
 
-template <typename Node_T, typename Val_T>
-Node_T* FixedHashTable<Node_T,Val_T>::getOne(void) {
+template <typename Node_T, typename Val_T, typename HP>
+Node_T* FixedHashTable<Node_T,Val_T,HP>::getOne(void) {
   return l.peak();
 }
 
-template <typename Node_T, typename Val_T>
-Node_T* FixedHashTable<Node_T,Val_T>::remove(Node_T *n) {
+template <typename Node_T, typename Val_T, typename HP>
+Node_T* FixedHashTable<Node_T,Val_T,HP>::remove(Node_T *n) {
   Val_T v = n->val();
-  size_t i = Node_T::hash(v) % table.size();
+  size_t i = HP::index(Node_T::hash(v), seed, table.size());
   table[i].remove(n);
   l.remove(n);
   return n;
 }
 
-template <typename Node_T, typename Val_T>
-void FixedHashTable<Node_T,Val_T>::print(void) {
+template <typename Node_T, typename Val_T, typename HP>
+void FixedHashTable<Node_T,Val_T,HP>::print(void) {
   printf("[\n");
   for (size_t i=0; i<table.size(); ++i) {
     printf("  ");
@@ -127,18 +133,18 @@ void FixedHashTable<Node_T,Val_T>::print(void) {
   printf("]\n");
 }
  
-template <typename Node_T, typename Val_T>
-size_t FixedHashTable<Node_T,Val_T>::size(void) {
+template <typename Node_T, typename Val_T, typename HP>
+size_t FixedHashTable<Node_T,Val_T,HP>::size(void) {
   return table.size();
 }
 
-template <typename Node_T, typename Val_T>
+template <typename Node_T, typename Val_T, typename HP=DefaultHash>
 class BoundedHashTable {
   private:
-    FixedHashTable<Node_T, Val_T> at1;
-    FixedHashTable<Node_T, Val_T> at2;
-    FixedHashTable<Node_T, Val_T> *t1;
-    FixedHashTable<Node_T, Val_T> *t2;
+    FixedHashTable<Node_T, Val_T, HP> at1;
+    FixedHashTable<Node_T, Val_T, HP> at2;
+    FixedHashTable<Node_T, Val_T, HP> *t1;
+    FixedHashTable<Node_T, Val_T, HP> *t2;
 
     size_t count;
     void resize(size_t s) {
@@ -291,10 +297,10 @@ class BoundedHashTable {
 // again when we take it out...
 // This emulates the behavior of a classic C-style externally allocated structure
 // with less macro magic, at the cost of a little loss in type-checking.
-template <typename Node_T, typename Val_T>
+template <typename Node_T, typename Val_T, typename HP=DefaultHash>
 class BoundedHashTableNode_base: public AVLNode_base<Node_T, Val_T>, public DListNode_base<Node_T> {
   public:
-    FixedHashTable<Node_T,Val_T> *ht;
+    FixedHashTable<Node_T,Val_T,HP> *ht;
     // subclass must implement:
     // Val_T val(void);
     // void print(void);
@@ -0,0 +1,638 @@
+/*
+ * Copyright: Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * When to use this:
+ * Where you'd use btree.h, but you iterate or range scan a lot. get(),
+ * insert() and remove() cost about the same as btree.h.
+ *
+ * This is a B+tree. Unlike btree.h data only lives in leaves, inner nodes
+ * hold copies of keys that separate their children. Leaves are doubly linked,
+ * so iterating is a walk along an array, then a hop to the next leaf (which
+ * we prefetch), rather than climbing up and down a stack of parents.
+ *
+ * Design Decisions:
+ *   Same template contract as btree.h:
+ * T, Val_T, C and SIZE mean the same thing as in btree.h (read the notes
+ * there), so you can swap one for the other. SIZE is the size of a leaf.
+ *
+ *   Inner node size:
+ * Inner nodes only hold Val_T's and child pointers, we fit as many as would
+ * fit in a btree.h node of the same SIZE. If T is bigger than Val_T that's
+ * a higher fanout than btree.h, so a shallower tree.
+ *
+ *   Split/merge on the way down:
+ * Just like btree.h, insert() splits full nodes on the way down, and
+ * remove() tops up nodes that are at their minimum on the way down, so we
+ * never have to walk back up.
+ *
+ *   Separators:
+ * A separator is the first key of the right hand leaf when it was split. We
+ * don't update it when that key is removed, everything left of it is still
+ * smaller, and everything right of it still at least as big.
+ *
+ * Threadsafety:
+ *   thread compatible
+ */
+
+#include <algorithm>
+#include <stdio.h>
+#include <utility>
+#include "panic.h"
+
+#ifndef BPLUSTREE_H
+#define BPLUSTREE_H
+
+// Define this to implement some expensive consistancy checking
+// This checks all of the invariants before and after every operation
+#ifdef BPLUSTREE_DEBUG
+#define BPLUSTREE_CHECK() check()
+#else
+#define BPLUSTREE_CHECK()
+#endif
+
+// Leaves and inner nodes both start with used, so we can look at a child
+// before we know which it is
+struct BPlusTreeNode_base {
+  size_t used;
+};
+
+template<typename T, int SIZE>
+struct BPlusTreeLeaf: public BPlusTreeNode_base {
+  BPlusTreeLeaf<T,SIZE> *prev;
+  BPlusTreeLeaf<T,SIZE> *next;
+  T data[SIZE];
+  BPlusTreeLeaf() {
+    used = 0;
+    prev = nullptr;
+    next = nullptr;
+  }
+};
+
+template<typename Val_T, int ISIZE>
+struct BPlusTreeInner: public BPlusTreeNode_base {
+  // keys[i] separates children[i] and children[i+1]
+  Val_T keys[ISIZE];
+  BPlusTreeNode_base *children[ISIZE+1];
+  BPlusTreeInner() {
+    used = 0;
+  }
+};
+
+template<typename T, typename Val_T, typename C, int SIZE>
+class BPlusTree {
+  static_assert(std::is_same<decltype(C::compare(std::declval<Val_T>(), std::declval<Val_T>())), int>(), "Please define a static method int compare(Val_T, Val_T) method on C class");
+  static_assert(std::is_same<decltype(C::val(std::declval<T>())), Val_T>(), "Please define a static method Val_T val(T) method on C class");
+  static_assert(SIZE >= 4, "SIZE must be at least 4");
+  private:
+    // As many keys as fit in a btree.h node of the same SIZE
+    static const int ISIZE = SIZE * (sizeof(T) + sizeof(void*)) / (sizeof(Val_T) + sizeof(void*)) > 4 ?
+      SIZE * (sizeof(T) + sizeof(void*)) / (sizeof(Val_T) + sizeof(void*)) : 4;
+    // Non-root nodes never have fewer than this, and are topped up by
+    // remove() if they have this few
+    static const size_t MIN = (SIZE-1)/2;
+    static const size_t IMIN = (ISIZE-1)/2;
+    typedef BPlusTreeLeaf<T,SIZE> Leaf;
+    typedef BPlusTreeInner<Val_T,ISIZE> Inner;
+    // data
+    BPlusTreeNode_base *root;
+    // number of levels of inner nodes, 0 means root is a leaf
+    size_t height;
+    // methods
+    static size_t child_index(const Inner *n, Val_T v);
+    static size_t leaf_index(const Leaf *l, Val_T v);
+    void split_child(Inner *parent, size_t i, bool leaf);
+    void fix_child(Inner *parent, size_t i, bool leaf);
+    void _delete(BPlusTreeNode_base *n, size_t level);
+    void _check(BPlusTreeNode_base *n, size_t level, const Val_T *lo, const Val_T *hi, Leaf **last) const;
+    void _print(BPlusTreeNode_base *n, size_t level) const;
+    Leaf *find_leaf(Val_T v) const;
+  public:
+    // classes
+    class Iterator;
+    class Range;
+    // methods
+    Iterator begin(void) const;
+    Iterator end(void) const;
+    // First element >= val
+    Iterator lower_bound(Val_T val) const;
+    // First element > val
+    Iterator upper_bound(Val_T val) const;
+    // Elements in [lo, hi), for use in range based for loops
+    Range range(Val_T lo, Val_T hi) const;
+    BPlusTree(); // base constructor
+    BPlusTree(BPlusTree<T,Val_T,C,SIZE> &&t); // move constructor
+    // We intentionally don't supply a copy constructor, as with btree.h
+    ~BPlusTree();
+    BPlusTree& operator=(BPlusTree<T,Val_T,C,SIZE> &&t);
+    T* get(Val_T val) const;
+    bool insert(T);
+    bool remove(Val_T val, T* result);
+    void check(void) const;
+    void print(void) const;
+    bool isempty(void) const;
+};
+
+template<typename T, typename Val_T, typename C, int SIZE>
+BPlusTree<T,Val_T,C,SIZE>::BPlusTree() {
+  root = nullptr;
+  height = 0;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+BPlusTree<T,Val_T,C,SIZE>::BPlusTree(BPlusTree<T,Val_T,C,SIZE> &&t) {
+  root = t.root;
+  height = t.height;
+  // ensure the destructor doesn't delete everything
+  t.root = nullptr;
+  t.height = 0;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+BPlusTree<T,Val_T,C,SIZE>& BPlusTree<T,Val_T,C,SIZE>::operator=(BPlusTree<T,Val_T,C,SIZE> &&t) {
+  _delete(root, height);
+  root = t.root;
+  height = t.height;
+  t.root = nullptr;
+  t.height = 0;
+  return *this;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+BPlusTree<T,Val_T,C,SIZE>::~BPlusTree() {
+  _delete(root, height);
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+void BPlusTree<T,Val_T,C,SIZE>::_delete(BPlusTreeNode_base *n, size_t level) {
+  if (!n) {
+    return;
+  }
+  if (level == 0) {
+    delete static_cast<Leaf*>(n);
+    return;
+  }
+  Inner *in = static_cast<Inner*>(n);
+  for (size_t i=0; i<=in->used; ++i) {
+    _delete(in->children[i], level-1);
+  }
+  delete in;
+}
+
+// Which child of n v belongs in, the number of separators <= v
+template<typename T, typename Val_T, typename C, int SIZE>
+size_t BPlusTree<T,Val_T,C,SIZE>::child_index(const Inner *n, Val_T v) {
+  size_t s = 0;
+  size_t e = n->used;
+  while (s < e) {
+    size_t m = (s+e)/2;
+    if (C::compare(v, n->keys[m]) >= 0) {
+      s = m+1;
+    } else {
+      e = m;
+    }
+  }
+  return s;
+}
+
+// Index of the first element of l >= v
+template<typename T, typename Val_T, typename C, int SIZE>
+size_t BPlusTree<T,Val_T,C,SIZE>::leaf_index(const Leaf *l, Val_T v) {
+  size_t s = 0;
+  size_t e = l->used;
+  while (s < e) {
+    size_t m = (s+e)/2;
+    if (C::compare(C::val(l->data[m]), v) < 0) {
+      s = m+1;
+    } else {
+      e = m;
+    }
+  }
+  return s;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+typename BPlusTree<T,Val_T,C,SIZE>::Leaf* BPlusTree<T,Val_T,C,SIZE>::find_leaf(Val_T v) const {
+  BPlusTreeNode_base *n = root;
+  for (size_t level = height; level > 0; --level) {
+    Inner *in = static_cast<Inner*>(n);
+    n = in->children[child_index(in, v)];
+  }
+  return static_cast<Leaf*>(n);
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+T* BPlusTree<T,Val_T,C,SIZE>::get(Val_T val) const {
+  if (!root) {
+    return nullptr;
+  }
+  Leaf *l = find_leaf(val);
+  size_t i = leaf_index(l, val);
+  if (i < l->used && C::compare(C::val(l->data[i]), val) == 0) {
+    return &(l->data[i]);
+  }
+  return nullptr;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+bool BPlusTree<T,Val_T,C,SIZE>::isempty(void) const {
+  return root == nullptr;
+}
+
+// Splits parent's full child i in two, adding a separator to parent
+template<typename T, typename Val_T, typename C, int SIZE>
+void BPlusTree<T,Val_T,C,SIZE>::split_child(Inner *parent, size_t i, bool leaf) {
+  Val_T sep;
+  BPlusTreeNode_base *right;
+  if (leaf) {
+    Leaf *l = static_cast<Leaf*>(parent->children[i]);
+    Leaf *r = new Leaf();
+    size_t half = l->used / 2;
+    std::copy(l->data + half, l->data + l->used, r->data);
+    r->used = l->used - half;
+    l->used = half;
+    // link r in after l
+    r->next = l->next;
+    r->prev = l;
+    if (l->next) {
+      l->next->prev = r;
+    }
+    l->next = r;
+    sep = C::val(r->data[0]);
+    right = r;
+  } else {
+    Inner *l = static_cast<Inner*>(parent->children[i]);
+    Inner *r = new Inner();
+    size_t half = l->used / 2;
+    // keys[half] moves up to parent, the rest to the right
+    sep = l->keys[half];
+    std::copy(l->keys + half + 1, l->keys + l->used, r->keys);
+    std::copy(l->children + half + 1, l->children + l->used + 1, r->children);
+    r->used = l->used - half - 1;
+    l->used = half;
+    right = r;
+  }
+  std::copy_backward(parent->keys + i, parent->keys + parent->used, parent->keys + parent->used + 1);
+  std::copy_backward(parent->children + i + 1, parent->children + parent->used + 1, parent->children + parent->used + 2);
+  parent->keys[i] = sep;
+  parent->children[i+1] = right;
+  parent->used++;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+bool BPlusTree<T,Val_T,C,SIZE>::insert(T datum) {
+  BPLUSTREE_CHECK();
+  Val_T v = C::val(datum);
+  if (!root) {
+    root = new Leaf();
+  }
+  // Full root, split it under a new root
+  if (root->used == (height ? (size_t) ISIZE : (size_t) SIZE)) {
+    Inner *r = new Inner();
+    r->children[0] = root;
+    root = r;
+    split_child(r, 0, height == 0);
+    height++;
+  }
+  BPlusTreeNode_base *n = root;
+  for (size_t level = height; level > 0; --level) {
+    Inner *in = static_cast<Inner*>(n);
+    size_t i = child_index(in, v);
+    bool leaf = level == 1;
+    if (in->children[i]->used == (leaf ? (size_t) SIZE : (size_t) ISIZE)) {
+      split_child(in, i, leaf);
+      if (C::compare(v, in->keys[i]) >= 0) {
+        i++;
+      }
+    }
+    n = in->children[i];
+  }
+  Leaf *l = static_cast<Leaf*>(n);
+  size_t i = leaf_index(l, v);
+  if (i < l->used && C::compare(C::val(l->data[i]), v) == 0) {
+    BPLUSTREE_CHECK();
+    return false;
+  }
+  std::copy_backward(l->data + i, l->data + l->used, l->data + l->used + 1);
+  l->data[i] = datum;
+  l->used++;
+  BPLUSTREE_CHECK();
+  return true;
+}
+
+// parent's child i has the minimum number of elements, so borrow one from a
+// sibling, or if they're small too merge with one
+template<typename T, typename Val_T, typename C, int SIZE>
+void BPlusTree<T,Val_T,C,SIZE>::fix_child(Inner *parent, size_t i, bool leaf) {
+  // Always work on a left/right pair, with the separator between them at s
+  size_t s = i > 0 ? i-1 : i;
+  if (leaf) {
+    Leaf *l = static_cast<Leaf*>(parent->children[s]);
+    Leaf *r = static_cast<Leaf*>(parent->children[s+1]);
+    if (i == s+1 && l->used > MIN) {
+      // borrow l's last
+      std::copy_backward(r->data, r->data + r->used, r->data + r->used + 1);
+      r->data[0] = l->data[l->used-1];
+      r->used++;
+      l->used--;
+      parent->keys[s] = C::val(r->data[0]);
+      return;
+    }
+    if (i == s && r->used > MIN) {
+      // borrow r's first
+      l->data[l->used++] = r->data[0];
+      std::copy(r->data + 1, r->data + r->used, r->data);
+      r->used--;
+      parent->keys[s] = C::val(r->data[0]);
+      return;
+    }
+    // merge r into l
+    std::copy(r->data, r->data + r->used, l->data + l->used);
+    l->used += r->used;
+    l->next = r->next;
+    if (r->next) {
+      r->next->prev = l;
+    }
+    delete r;
+  } else {
+    Inner *l = static_cast<Inner*>(parent->children[s]);
+    Inner *r = static_cast<Inner*>(parent->children[s+1]);
+    if (i == s+1 && l->used > IMIN) {
+      // rotate right, through the separator
+      std::copy_backward(r->keys, r->keys + r->used, r->keys + r->used + 1);
+      std::copy_backward(r->children, r->children + r->used + 1, r->children + r->used + 2);
+      r->keys[0] = parent->keys[s];
+      r->children[0] = l->children[l->used];
+      r->used++;
+      parent->keys[s] = l->keys[l->used-1];
+      l->used--;
+      return;
+    }
+    if (i == s && r->used > IMIN) {
+      // rotate left, through the separator
+      l->keys[l->used] = parent->keys[s];
+      l->children[l->used+1] = r->children[0];
+      l->used++;
+      parent->keys[s] = r->keys[0];
+      std::copy(r->keys + 1, r->keys + r->used, r->keys);
+      std::copy(r->children + 1, r->children + r->used + 1, r->children);
+      r->used--;
+      return;
+    }
+    // merge r into l, the separator comes down between them
+    l->keys[l->used] = parent->keys[s];
+    std::copy(r->keys, r->keys + r->used, l->keys + l->used + 1);
+    std::copy(r->children, r->children + r->used + 1, l->children + l->used + 1);
+    l->used += r->used + 1;
+    delete r;
+  }
+  // r is gone, remove it and it's separator from parent
+  std::copy(parent->keys + s + 1, parent->keys + parent->used, parent->keys + s);
+  std::copy(parent->children + s + 2, parent->children + parent->used + 1, parent->children + s + 1);
+  parent->used--;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+bool BPlusTree<T,Val_T,C,SIZE>::remove(Val_T v, T *result) {
+  BPLUSTREE_CHECK();
+  if (!root) {
+    return false;
+  }
+  BPlusTreeNode_base *n = root;
+  for (size_t level = height; level > 0; --level) {
+    Inner *in = static_cast<Inner*>(n);
+    size_t i = child_index(in, v);
+    bool leaf = level == 1;
+    if (in->children[i]->used <= (leaf ? (size_t) MIN : (size_t) IMIN)) {
+      fix_child(in, i, leaf);
+      // things moved, look again
+      i = child_index(in, v);
+    }
+    n = in->children[i];
+  }
+  Leaf *l = static_cast<Leaf*>(n);
+  size_t i = leaf_index(l, v);
+  bool found = i < l->used && C::compare(C::val(l->data[i]), v) == 0;
+  if (found) {
+    *result = l->data[i];
+    std::copy(l->data + i + 1, l->data + l->used, l->data + i);
+    l->used--;
+  }
+  // merges may have left root with one child
+  while (height && root->used == 0) {
+    Inner *r = static_cast<Inner*>(root);
+    root = r->children[0];
+    delete r;
+    height--;
+  }
+  if (!height && root->used == 0) {
+    delete static_cast<Leaf*>(root);
+    root = nullptr;
+  }
+  BPLUSTREE_CHECK();
+  return found;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+void BPlusTree<T,Val_T,C,SIZE>::print(void) const {
+  _print(root, height);
+  printf("\n");
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+void BPlusTree<T,Val_T,C,SIZE>::_print(BPlusTreeNode_base *n, size_t level) const {
+  if (!n) {
+    printf("[]");
+    return;
+  }
+  printf("[");
+  if (level == 0) {
+    Leaf *l = static_cast<Leaf*>(n);
+    for (size_t i=0; i<l->used; ++i) {
+      C::printT(l->data[i]);
+      if (i+1 < l->used) {
+        printf(",");
+      }
+    }
+  } else {
+    Inner *in = static_cast<Inner*>(n);
+    for (size_t i=0; i<in->used; ++i) {
+      _print(in->children[i], level-1);
+      printf(",");
+      C::printV(in->keys[i]);
+      printf(",");
+    }
+    _print(in->children[in->used], level-1);
+  }
+  printf("]");
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+void BPlusTree<T,Val_T,C,SIZE>::check(void) const {
+  if (!root) {
+    if (height) {
+      PANIC("empty tree with height");
+    }
+    return;
+  }
+  Leaf *last = nullptr;
+  _check(root, height, nullptr, nullptr, &last);
+  if (last->next) {
+    PANIC("last leaf has a next");
+  }
+}
+
+// Everything in n must be in [lo, hi), and leaves must be linked in order
+template<typename T, typename Val_T, typename C, int SIZE>
+void BPlusTree<T,Val_T,C,SIZE>::_check(BPlusTreeNode_base *n, size_t level, const Val_T *lo, const Val_T *hi, Leaf **last) const {
+  if (n != root && n->used < (level ? (size_t) IMIN : (size_t) MIN)) {
+    print();
+    PANIC("Node is insufficiently full, and is not root");
+  }
+  if (level == 0) {
+    Leaf *l = static_cast<Leaf*>(n);
+    if (l->prev != *last || (*last && (*last)->next != l)) {
+      PANIC("Leaves are not linked in order");
+    }
+    *last = l;
+    for (size_t i=0; i<l->used; ++i) {
+      Val_T v = C::val(l->data[i]);
+      if (i > 0 && C::compare(C::val(l->data[i-1]), v) >= 0) {
+        PANIC("Leaf out of order");
+      }
+      if ((lo && C::compare(v, *lo) < 0) || (hi && C::compare(v, *hi) >= 0)) {
+        PANIC("Element on the wrong side of a separator");
+      }
+    }
+    return;
+  }
+  Inner *in = static_cast<Inner*>(n);
+  if (in->used == 0) {
+    PANIC("Inner node with one child");
+  }
+  for (size_t i=0; i<=in->used; ++i) {
+    if (i > 0 && i < in->used && C::compare(in->keys[i-1], in->keys[i]) >= 0) {
+      PANIC("Separators out of order");
+    }
+    _check(in->children[i], level-1, i > 0 ? &in->keys[i-1] : lo, i < in->used ? &in->keys[i] : hi, last);
+  }
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+class BPlusTree<T,Val_T,C,SIZE>::Iterator {
+  private:
+    Leaf *leaf;
+    size_t index;
+    friend class BPlusTree;
+    // Step onto the next leaf if we're off the end of this one
+    void settle(void) {
+      while (leaf && index >= leaf->used) {
+        leaf = leaf->next;
+        index = 0;
+        if (leaf && leaf->next) {
+          __builtin_prefetch(leaf->next);
+        }
+      }
+    }
+  public:
+    Iterator():leaf(nullptr), index(0) {}
+    Iterator(Leaf *l, size_t i):leaf(l), index(i) {
+      settle();
+    }
+    bool operator==(const Iterator& other) const {
+      return leaf == other.leaf && (leaf == nullptr || index == other.index);
+    }
+    bool operator!=(const Iterator& other) const {
+      return !(*this == other);
+    }
+    Iterator& operator++(void) {
+      index++;
+      settle();
+      return *this;
+    }
+    Iterator operator++(int) {
+      Iterator tmp(*this);
+      ++(*this);
+      return tmp;
+    }
+    // Not valid on end(), or begin()
+    Iterator& operator--(void) {
+      if (index == 0) {
+        leaf = leaf->prev;
+        index = leaf->used;
+      }
+      index--;
+      return *this;
+    }
+    Iterator operator--(int) {
+      Iterator tmp(*this);
+      --(*this);
+      return tmp;
+    }
+    T& operator*() {
+      return leaf->data[index];
+    }
+    T* operator->() {
+      return &leaf->data[index];
+    }
+};
+
+template<typename T, typename Val_T, typename C, int SIZE>
+class BPlusTree<T,Val_T,C,SIZE>::Range {
+  private:
+    Iterator b;
+    Iterator e;
+  public:
+    Range(const Iterator &bb, const Iterator &ee):b(bb), e(ee) {}
+    Iterator begin(void) const {
+      return b;
+    }
+    Iterator end(void) const {
+      return e;
+    }
+};
+
+template<typename T, typename Val_T, typename C, int SIZE>
+typename BPlusTree<T,Val_T,C,SIZE>::Iterator BPlusTree<T,Val_T,C,SIZE>::begin(void) const {
+  BPlusTreeNode_base *n = root;
+  if (!n) {
+    return end();
+  }
+  for (size_t level = height; level > 0; --level) {
+    n = static_cast<Inner*>(n)->children[0];
+  }
+  return Iterator(static_cast<Leaf*>(n), 0);
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+typename BPlusTree<T,Val_T,C,SIZE>::Iterator BPlusTree<T,Val_T,C,SIZE>::end(void) const {
+  return Iterator(nullptr, 0);
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+typename BPlusTree<T,Val_T,C,SIZE>::Iterator BPlusTree<T,Val_T,C,SIZE>::lower_bound(Val_T val) const {
+  if (!root) {
+    return end();
+  }
+  Leaf *l = find_leaf(val);
+  return Iterator(l, leaf_index(l, val));
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+typename BPlusTree<T,Val_T,C,SIZE>::Iterator BPlusTree<T,Val_T,C,SIZE>::upper_bound(Val_T val) const {
+  Iterator i = lower_bound(val);
+  if (i != end() && C::compare(C::val(*i), val) == 0) {
+    ++i;
+  }
+  return i;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+typename BPlusTree<T,Val_T,C,SIZE>::Range BPlusTree<T,Val_T,C,SIZE>::range(Val_T lo, Val_T hi) const {
+  // An empty range if hi <= lo, rather than running off the end
+  if (C::compare(lo, hi) >= 0) {
+    return Range(end(), end());
+  }
+  return Range(lower_bound(lo), lower_bound(hi));
+}
+
+#endif
@@ -24,6 +24,40 @@
  * The advantage of this approach, is there's no need to recurse back up the
  * tree. All operations can simply walk down the tree, and terminate.
  *
+ *   COUNTED:
+ * Set this and every node also stores how many elements are under each of
+ * it's children, which gives you rank() and select() (order statistics) in
+ * one descent. Splits, merges and rotations recount the child slots they
+ * touched from the children themselves, insert() and remove() remember the
+ * slots they went down and add +1/-1 to them at the end. It costs a word per
+ * child, and a bit on every insert and remove, so it's off by default, and
+ * then the code compiles away completely.
+ *
+ *   Sequential inserts:
+ * Keys often arrive in order (timestamps, sequence numbers). insert() checks
+ * root's last datum first, and if the key is past it follows the last child
+ * down to the rightmost leaf without a binary search at each level, and
+ * appends there if there's room. When that leaf (or anything on the right
+ * spine) is full we split it 90/10 rather than in half, since nothing will
+ * land in the left part again. This leaves the tree nearly full rather than
+ * half full. So the right spine is exempt from the minimum fill, which costs
+ * nothing in depth, as every other node on each level is still half full.
+ * For clustered keys, insert_hint() inserts just before an iterator without
+ * a descent.
+ *
+ *   Bulk loading:
+ * When all the data is at hand in order (a copy, or the output of a merge)
+ * there's no need to search or split at all. Builder appends to the rightmost
+ * node on each level, leaves first, fills nodes to SIZE-1 and starts a new
+ * one, so it's linear and leaves the tree nearly full. At the end nodes on
+ * the right spine may be empty, finish() replaces each with it's left
+ * sibling, which takes the separator between them. That's the one slot we
+ * left free. set_union(), set_intersection() and
+ * set_difference() walk both trees' iterators in step and feed a Builder.
+ * With threads, each thread merges one key range (cut at keys from near the
+ * top of the tree) in to a vector, then we append those in order, which is
+ * all moves.
+ *
  *   Why the horrific template?
  * I was trying to get speeds up. With this implementation if "T", the data
  * stored in the tree, is a simple "int" we incur no extra costs, for
@@ -33,8 +67,9 @@
  * You can pass key's in (of type Val_T), for searches, e.g. a tid for a tree of
  * thread structures. Again val() and compare() can be inlined.
  * If for some reason you *want* to store entire classes in the B-tree it will
- * work. If you do this you may want to go through making sure all the T's are T&
- * so you don't call the copy constructor over and over and over again.
+ * work. Shifts, splits and merges move T rather than copying it, so e.g. a
+ * std::string only has it's pointers shuffled around, and move-only types
+ * like std::unique_ptr work.
  * Also, if T is complex read the requirements below very carefully.
  *
  * Threadsafety:
@@ -44,10 +79,13 @@
 
 #include <cstring>
 #include <stdio.h>
+#include <stdint.h>
 #include <utility>
 #include "array.h"
 #include "panic.h"
 #include <algorithm>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 #ifndef BTREE_H
@@ -75,10 +113,10 @@
 
 // Below are the requirements for T, Val_T, C, and SIZE
 
-// T must have a valid, trivial, Copy() constructor:
-// Note that T will *move* in memory at times via the copy constructor,
+// T must have a default constructor and move assignment (a copy is fine too)
+// Note that T will *move* in memory at times via move assignment,
 // so pointers to T cannot be used
-// We DO use std::copy to move it now, so the copy construcor will be called on complex types
+// insert() takes T by value, pass it an rvalue and it's never copied
 //
 // Val_T is simply whatever is returned by "Val_T C::val(T)", the point is for it to be easilly
 // comparable, and small/cheap to toss around. An integral type of appropriate size for
@@ -92,18 +130,60 @@
 // static Val_T val(T &v1) 
 // whith returns Val_T, that is whatever component of T is to be used for compare()
 
+// How deep a tree with this minimum fanout can get, before it has 2^64
+// elements (which it can't, that's the whole address space)
+constexpr size_t btree_max_depth(size_t fanout, size_t n = 1, size_t depth = 0) {
+  return n > SIZE_MAX / fanout ? depth + 1 : btree_max_depth(fanout, n * fanout, depth + 1);
+}
+
 // SIZE must be at least 5
 // if SIZE=4 then splitting the node creates an element of size 1. This gets
 // awkward because lazy deletion would then require an element of size 0 to be
 // legal temporarilly. We want nodes to have at least 1 element in them (excepting root
 // which can transitionally be empty).
 
-template<typename T, typename Val_T, typename C, int SIZE>
-class BTreeNode {
+// With COUNTED a node also keeps how many elements are under each child, for
+// BTree's rank() and select(). Without it this is empty and costs nothing.
+template<int SIZE, bool COUNTED>
+class BTreeNodeCounts {
+  protected:
+    size_t counts_[SIZE+1];
+    size_t *counts() {
+      return counts_;
+    }
+};
+
+template<int SIZE>
+class BTreeNodeCounts<SIZE, false> {
+  protected:
+    size_t *counts() {
+      return nullptr;
+    }
+};
+
+// Children are pointers to other nodes by default. paged_btree.h sets Ref to
+// use page numbers instead, and pins the pages itself.
+template<typename Node, typename Ref>
+struct BTreeNodeRef {
+  typedef Ref type;
+};
+
+template<typename Node>
+struct BTreeNodeRef<Node, void> {
+  typedef Node* type;
+};
+
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED=false, typename Ref=void>
+class BTreeNode : public BTreeNodeCounts<SIZE, COUNTED> {
+  static_assert(!COUNTED || std::is_same<Ref, void>::value,
+      "COUNTED needs pointer children, paged nodes can't count their children");
+  public:
+    typedef typename BTreeNodeRef<BTreeNode<T,Val_T,C,SIZE,COUNTED,Ref>, Ref>::type Child;
   private:
     T data[SIZE];
-    BTreeNode<T,Val_T,C,SIZE> *children[SIZE+1];
+    Child children[SIZE+1];
     size_t used;
+    using BTreeNodeCounts<SIZE, COUNTED>::counts;
   public:
     void print(void) const {
       printf("[");
@@ -124,9 +204,12 @@ class BTreeNode {
       }
       printf("]");
     }
-    BTreeNode<T,Val_T,C,SIZE>() {
+    BTreeNode() {
       used = 0;
       memset(children, 0, (SIZE+1)*sizeof(children[0]));
+      if (COUNTED) {
+        memset(counts(), 0, (SIZE+1)*sizeof(size_t));
+      }
     }
     T& get_data(size_t i) {
       #ifdef BTREE_DEBUG
@@ -137,7 +220,7 @@ class BTreeNode {
       #endif
       return data[i];
     }
-    BTreeNode<T,Val_T,C,SIZE> *get_node(size_t i) const {
+    Child get_node(size_t i) const {
       #ifdef BTREE_DEBUG
       if (i >= used+1) {
         printf("i = %ld, used = %ld\n", i, used);
@@ -146,16 +229,16 @@ class BTreeNode {
       #endif
       return children[i];
     }
-    void set_data(size_t i, T& datum) {
+    void set_data(size_t i, T&& datum) {
       #ifdef BTREE_DEBUG
       if (i >= used) {
         printf("i = %ld, used = %ld\n", i, used);
         PANIC("Bad Index, datum is empty");
       }
       #endif
-      data[i] = datum;
+      data[i] = std::move(datum);
     }
-    void set_node(size_t i, BTreeNode<T,Val_T,C,SIZE> *n) {
+    void set_node(size_t i, Child n) {
       #ifdef BTREE_DEBUG
       if (i >= used+1) {
         printf("i = %ld, used = %ld\n", i, used);
@@ -163,6 +246,37 @@ class BTreeNode {
       }
       #endif
       children[i] = n;
+      if (COUNTED) {
+        recount(i);
+      }
+    }
+    // Elements under children[i], only kept with COUNTED
+    size_t get_count(size_t i) {
+      return counts()[i];
+    }
+    void add_count(size_t i, size_t delta) {
+      counts()[i] += delta;
+    }
+    // Recomputes counts()[i] from the child itself, after it changed shape
+    void recount(size_t i) {
+      counts()[i] = child_total(children[i]);
+    }
+    static size_t child_total(BTreeNode<T,Val_T,C,SIZE,COUNTED,Ref> *n) {
+      return n ? n->total() : 0;
+    }
+    // Children that aren't pointers (see paged_btree.h) are never COUNTED,
+    // see the static_assert above, this just lets recount() compile for them
+    template<typename R>
+    static size_t child_total(R) {
+      return 0;
+    }
+    // Elements in this subtree
+    size_t total() {
+      size_t t = used;
+      for (size_t j=0; j<=used; ++j) {
+        t += counts()[j];
+      }
+      return t;
     }
     size_t get_used() const {
       return used;
@@ -219,7 +333,7 @@ class BTreeNode {
       return s+1; // pointer after fist element
     }
     // Inserts a new datum in a node, with a child to it's right
-    void insert_right(size_t i, T& datum, BTreeNode<T,Val_T,C,SIZE> *child) {
+    void insert_right(size_t i, T&& datum, Child child) {
       #ifdef BTREE_DEBUG
       if (i>used+1) {
         PANIC("Bad Index, index out of range");
@@ -229,17 +343,20 @@ class BTreeNode {
       }
       #endif
       // shift the array
-      std::copy_backward(data+i, data+used, data+used+1);
+      std::move_backward(data+i, data+used, data+used+1);
       //memmove(&(data[i+1]), &(data[i]), (used-i) * sizeof(T));
       std::copy_backward(children+i+1, children+used+1, children+used+2);
       //memmove(&(children[i+2]), &(children[i+1]), (used-i) * sizeof(child));
+      if (COUNTED) {
+        std::copy_backward(counts()+i+1, counts()+used+1, counts()+used+2);
+      }
       used += 1;
       // and set my element
-      set_data(i, datum);
+      set_data(i, std::move(datum));
       set_node(i+1, child); 
     }
     // Inserts a new datum in a node, with a child to it's left
-    void insert_left(size_t i, T& datum, BTreeNode<T,Val_T,C,SIZE> *child) {
+    void insert_left(size_t i, T&& datum, Child child) {
       #ifdef BTREE_DEBUG
       if (i>used+1) {
         PANIC("Bad Index, index out of range");
@@ -249,104 +366,164 @@ class BTreeNode {
       }
       #endif
       // shift the array
-      std::copy_backward(data+i, data+used, data+used+1);
+      std::move_backward(data+i, data+used, data+used+1);
       //memmove(&(data[i+1]), &(data[i]), (used-i) * sizeof(T));
       std::copy_backward(children+i, children+used+1, children+used+2);
       //memmove(&(children[i+1]), &(children[i]), (used-i+1) * sizeof(child));
+      if (COUNTED) {
+        std::copy_backward(counts()+i, counts()+used+1, counts()+used+2);
+      }
       used += 1;
       // and set my element
-      set_data(i, datum);
+      set_data(i, std::move(datum));
       set_node(i, child); 
     }
     // Removes a datum from a node, along with the child to it's right
-    T remove_right(size_t i, BTreeNode<T,Val_T,C,SIZE> **pivot_child) {
-      T pivot = get_data(i);
+    T remove_right(size_t i, Child *pivot_child) {
+      T pivot = std::move(get_data(i));
       // get the pivot's right child
       *pivot_child = get_node(i+1);
       // shift the array
-      std::copy(data+i+1, data+used, data+i);
+      std::move(data+i+1, data+used, data+i);
       //memmove(&(data[i]), &(data[i+1]), (used-i-1) * sizeof(T));
       std::copy(children+i+2, children+used+1, children+i+1);
       //memmove(&(children[i+1]), &(children[i+2]), (used-i-1) * sizeof(pivot_child));
+      if (COUNTED) {
+        std::copy(counts()+i+2, counts()+used+1, counts()+i+1);
+      }
       used--;
       return pivot;
     }
     // Removes a datum from a node, along with the child to it's left
-    T remove_left(size_t i, BTreeNode<T,Val_T,C,SIZE> **pivot_child) {
-      T pivot = get_data(i);
+    T remove_left(size_t i, Child *pivot_child) {
+      T pivot = std::move(get_data(i));
       // get the pivot's lect child
       *pivot_child = get_node(i);
       // shift the array
-      std::copy(data+i+1, data+used, data+i);
+      std::move(data+i+1, data+used, data+i);
       //memmove(&(data[i]), &(data[i+1]), (used-i-1) * sizeof(T));
       std::copy(children+i+1, children+used+1, children+i);
       //memmove(&(children[i]), &(children[i+1]), (used-i) * sizeof(pivot_child));
+      if (COUNTED) {
+        std::copy(counts()+i+1, counts()+used+1, counts()+i);
+      }
       used--;
       return pivot;
     }
     // split's a node, putting the right half of the node in right_n
     // returns the pivot datum (so it can be put in the parent)
-    T split(BTreeNode<T,Val_T,C,SIZE> *right_n) {
-      size_t pivot_i = (used-1)/2; // middle element for odd "used", lower of 2 middle for even "used"
-      std::copy(data+pivot_i+1, data+used, right_n->data);
+    T split(BTreeNode<T,Val_T,C,SIZE,COUNTED,Ref> *right_n) {
+      // middle element for odd "used", lower of 2 middle for even "used"
+      return split(right_n, (used-1)/2);
+    }
+    // Like split(), but leaves this node about 90% full and right_n nearly
+    // empty. For keys arriving in order, nothing else will land in this node
+    T split_tail(BTreeNode<T,Val_T,C,SIZE,COUNTED,Ref> *right_n) {
+      size_t right_used = used/10 ? used/10 : 1;
+      return split(right_n, used-right_used-1);
+    }
+    // data[pivot_i] goes up, everything after it goes to right_n
+    T split(BTreeNode<T,Val_T,C,SIZE,COUNTED,Ref> *right_n, size_t pivot_i) {
+      std::move(data+pivot_i+1, data+used, right_n->data);
       //memcpy(right_n->data, &(data[pivot_i+1]), (used - pivot_i-1) * sizeof(T));
       std::copy(children+pivot_i+1, children+used+1, right_n->children);
       //memcpy(right_n->children, &(children[pivot_i+1]), (used - pivot_i) * sizeof(right_n));
+      if (COUNTED) {
+        std::copy(counts()+pivot_i+1, counts()+used+1, right_n->counts());
+      }
       right_n->used = used - pivot_i-1;
       used = pivot_i;
-      return data[pivot_i];
+      return std::move(data[pivot_i]);
     }
     // merge's this with right_n, using pivot as the dividing datum
-    void merge(T pivot, BTreeNode<T,Val_T,C,SIZE> *right_n) {
+    void merge(T pivot, BTreeNode<T,Val_T,C,SIZE,COUNTED,Ref> *right_n) {
       size_t old_used = used;
       used = used + right_n->used + 1;
-      set_data(old_used, pivot);
-      std::copy(right_n->data, right_n->data+right_n->used, data+old_used+1);
+      set_data(old_used, std::move(pivot));
+      std::move(right_n->data, right_n->data+right_n->used, data+old_used+1);
       //memcpy(&(data[old_used+1]), right_n->data, right_n->used * sizeof(T));
       std::copy(right_n->children, right_n->children+right_n->used+1, children+old_used+1);
       //memcpy(&(children[old_used+1]), right_n->children, (right_n->used+1) * sizeof(right_n));
+      if (COUNTED) {
+        std::copy(right_n->counts(), right_n->counts()+right_n->used+1, counts()+old_used+1);
+      }
     }
 };
 
-template<typename T, typename Val_T, typename C, int SIZE>
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED=false>
 class BTree {
   static_assert(std::is_same<decltype(C::compare(std::declval<Val_T>(), std::declval<Val_T>())), int>(), "Please define a static method int compare(Val_T, Val_T) method on C class");
   static_assert(std::is_same<decltype(C::val(std::declval<T>())), Val_T>(), "Please define a static method Val_T val(T) method on C class");
   private:
     // data 
-    BTreeNode<T,Val_T,C,SIZE> *root;
+    BTreeNode<T,Val_T,C,SIZE,COUNTED> *root;
     // methods 
-    bool maybe_split(BTreeNode<T,Val_T,C,SIZE> *parent, BTreeNode<T,Val_T,C,SIZE> *n, size_t i);
-    int maybe_merge(BTreeNode<T,Val_T,C,SIZE> *parent, size_t i);
-    std::pair<Val_T,Val_T> _check(BTreeNode<T,Val_T,C,SIZE> *n, Val_T v) const;
-    void _print(BTreeNode<T,Val_T,C,SIZE> *n) const;
+    bool maybe_split(BTreeNode<T,Val_T,C,SIZE,COUNTED> *parent, BTreeNode<T,Val_T,C,SIZE,COUNTED> *n, size_t i, bool at_tail);
+    int maybe_merge(BTreeNode<T,Val_T,C,SIZE,COUNTED> *parent, size_t i);
+    std::pair<Val_T,Val_T> _check(BTreeNode<T,Val_T,C,SIZE,COUNTED> *n, Val_T v, bool rightmost) const;
+    void _print(BTreeNode<T,Val_T,C,SIZE,COUNTED> *n) const;
+    class Path;
+    enum MergeOp { UNION, INTERSECTION, DIFFERENCE };
+    template<typename Iter, typename Emit>
+    static void merge_range(MergeOp op, Iter ia, Iter ea, Iter ib, Iter eb, Emit emit);
+    static BTree merge(const BTree &a, const BTree &b, MergeOp op, size_t threads);
+    // Up to parts-1 keys, in order, which cut the tree in to about equal parts
+    std::vector<Val_T> split_points(size_t parts) const;
   public:
     // class
     class Iterator;
+    class Range;
+    // Builds a tree from data in ascending order, in linear time
+    class Builder;
     // methods
     Iterator begin(void) const;
     Iterator end(void) const;
+    // First element >= val, one descent rather than a walk from begin()
+    Iterator lower_bound(Val_T val) const;
+    // First element > val
+    Iterator upper_bound(Val_T val) const;
+    // Elements in [lo, hi), for use in range based for loops
+    Range range(Val_T lo, Val_T hi) const;
     BTree(); // base constructor
-    BTree(BTree<T,Val_T,C,SIZE> &&t); // move constructor
+    BTree(BTree<T,Val_T,C,SIZE,COUNTED> &&t); // move constructor
     // We intentionally don't supply a copy constructor, as this would be an inefficient mess
     ~BTree();
-    BTree& operator=(BTree<T,Val_T,C,SIZE> &&t);
+    BTree& operator=(BTree<T,Val_T,C,SIZE,COUNTED> &&t);
     T* get(Val_T val) const;
     bool insert(T);
+    // Inserts datum just before hint, without a descent, if that's where it
+    // goes and there's room in hint's leaf. Otherwise this is just insert().
+    // Either way hint is left on the same element, so it's still a good hint
+    // for the next key in an ascending run. end() is a fine hint for keys
+    // past the end, though insert() already handles those without a descent.
+    bool insert_hint(Iterator &hint, T datum);
+    // result may be nullptr, if you don't want the element back
     bool remove(Val_T val, T* result);
+    // These need COUNTED, and take one descent
+    // The k'th smallest element (from 0), nullptr if there are <= k
+    T* select(size_t k) const;
+    // How many elements are < val
+    size_t rank(Val_T val) const;
+    // Set algebra, each is one linear merge of a and b built with a Builder.
+    // Where both have an element the result gets a copy of a's. With
+    // threads > 1 that many key ranges are merged at once.
+    static BTree set_union(const BTree &a, const BTree &b, size_t threads=1);
+    static BTree set_intersection(const BTree &a, const BTree &b, size_t threads=1);
+    static BTree set_difference(const BTree &a, const BTree &b, size_t threads=1);
+    size_t size(void) const;
     void check(void) const;
     void print(void) const; 
     bool isempty(void) const;
 };
 
-template<typename T, typename Val_T, typename C, int SIZE>
-BTree<T,Val_T,C,SIZE>::BTree() {
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+BTree<T,Val_T,C,SIZE,COUNTED>::BTree() {
   root = nullptr;
 }
 
 // Move constructor
-template<typename T, typename Val_T, typename C, int SIZE>
-BTree<T,Val_T,C,SIZE>::BTree(BTree<T,Val_T,C,SIZE> &&t) {
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+BTree<T,Val_T,C,SIZE,COUNTED>::BTree(BTree<T,Val_T,C,SIZE,COUNTED> &&t) {
   root = t.root;
   // ensure the destructor doesn't delete everything
   t.root = nullptr;
@@ -358,8 +535,8 @@ BTree<T,Val_T,C,SIZE>::BTree(BTree<T,Val_T,C,SIZE> &&t) {
 // recursion... and this would be the only recursive method
 // Or we could add parent pointers, but otherwise we don't need them.
 // It took Nlog(N) to build anyway, so we assume this is okay.
-template<typename T, typename Val_T, typename C, int SIZE>
-BTree<T,Val_T,C,SIZE>::~BTree() {
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+BTree<T,Val_T,C,SIZE,COUNTED>::~BTree() {
   while (true) {
     auto gparent = root;
     if (!gparent) {
@@ -388,16 +565,20 @@ BTree<T,Val_T,C,SIZE>::~BTree() {
   }
 }
 
-template<typename T, typename Val_T, typename C, int SIZE>
-BTree<T,Val_T,C,SIZE>& BTree<T,Val_T,C,SIZE>::operator=(BTree<T,Val_T,C,SIZE> &&t) { 
-  this->root = t.root;
-  // Just a precaution so only one tree points at things.
-  t.root = nullptr;
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+BTree<T,Val_T,C,SIZE,COUNTED>& BTree<T,Val_T,C,SIZE,COUNTED>::operator=(BTree<T,Val_T,C,SIZE,COUNTED> &&t) { 
+  if (this != &t) {
+    // old takes our tree, and deletes it on the way out
+    BTree<T,Val_T,C,SIZE,COUNTED> old(std::move(*this));
+    this->root = t.root;
+    // Just a precaution so only one tree points at things.
+    t.root = nullptr;
+  }
   return *this;
 }
 
-template<typename T, typename Val_T, typename C, int SIZE>
-T* BTree<T,Val_T,C,SIZE>::get(Val_T val) const {
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+T* BTree<T,Val_T,C,SIZE,COUNTED>::get(Val_T val) const {
   PRINT("BTree Get, begins\n");
   PRINT_TREE();
   BTREE_CHECK();
@@ -419,16 +600,102 @@ T* BTree<T,Val_T,C,SIZE>::get(Val_T val) const {
   return nullptr;
 }
 
-template<typename T, typename Val_T, typename C, int SIZE>
-bool BTree<T,Val_T,C,SIZE>::isempty(void) const {
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+bool BTree<T,Val_T,C,SIZE,COUNTED>::isempty(void) const {
   // it is possible for root to have only one child
   // it'll resolve as soon as we run a remove or something, but
   // it means we have to check it's child for nullptr
   return root == nullptr || root->get_used() == 0;
 }
 
-template<typename T, typename Val_T, typename C, int SIZE>
-bool BTree<T,Val_T,C,SIZE>::insert(T datum) {
+// The child slots insert() and remove() went down. With COUNTED each of them
+// gains (or loses) one element, we add that in once the element has actually
+// moved, so the counts stay exact through the splits and merges on the way.
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+class BTree<T,Val_T,C,SIZE,COUNTED>::Path {
+  private:
+    // See Iterator
+    static const size_t MAX_DEPTH = btree_max_depth((SIZE-1)/2 > 2 ? (SIZE-1)/2 : 2) + 2;
+    BTreeNode<T,Val_T,C,SIZE,COUNTED> *nodes[MAX_DEPTH];
+    size_t slots[MAX_DEPTH];
+    size_t depth;
+  public:
+    Path():depth(0) {}
+    void push(BTreeNode<T,Val_T,C,SIZE,COUNTED> *n, size_t i) {
+      if (!COUNTED) {
+        return;
+      }
+      #ifdef BTREE_DEBUG
+      if (depth >= MAX_DEPTH) {
+        PANIC("Path overflow, tree is deeper than should be possible");
+      }
+      #endif
+      nodes[depth] = n;
+      slots[depth] = i;
+      depth++;
+    }
+    void apply(size_t delta) {
+      for (size_t j=0; j<depth; ++j) {
+        nodes[j]->add_count(slots[j], delta);
+      }
+    }
+};
+
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+T* BTree<T,Val_T,C,SIZE,COUNTED>::select(size_t k) const {
+  static_assert(COUNTED, "select() needs a COUNTED BTree");
+  auto *n = root;
+  while (n) {
+    size_t i;
+    for (i=0; i<n->get_used(); ++i) {
+      size_t c = n->get_count(i);
+      if (k < c) {
+        break;
+      }
+      k -= c;
+      if (k == 0) {
+        return &(n->get_data(i));
+      }
+      k--;
+    }
+    if (i == n->get_used() && k >= n->get_count(i)) {
+      return nullptr;
+    }
+    n = n->get_node(i);
+  }
+  return nullptr;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+size_t BTree<T,Val_T,C,SIZE,COUNTED>::rank(Val_T val) const {
+  static_assert(COUNTED, "rank() needs a COUNTED BTree");
+  size_t r = 0;
+  auto *n = root;
+  bool found;
+  while (n) {
+    size_t i = n->find(val, &found);
+    // Everything left of slot i is smaller, and so are the i data before it
+    r += i;
+    for (size_t j=0; j<i; ++j) {
+      r += n->get_count(j);
+    }
+    if (found) {
+      // Plus everything in the child just left of it
+      return r + n->get_count(i);
+    }
+    n = n->get_node(i);
+  }
+  return r;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+size_t BTree<T,Val_T,C,SIZE,COUNTED>::size(void) const {
+  static_assert(COUNTED, "size() needs a COUNTED BTree");
+  return root ? root->total() : 0;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+bool BTree<T,Val_T,C,SIZE,COUNTED>::insert(T datum) {
   PRINT("BTree Insert, begins\n");
   #ifdef BTREE_DEBUG_VERBOSE
   printf("inserting: ");
@@ -438,21 +705,59 @@ bool BTree<T,Val_T,C,SIZE>::insert(T datum) {
   PRINT_TREE();
   BTREE_CHECK();
   auto *n = root;
-  BTreeNode<T,Val_T,C,SIZE> *parent = nullptr;
+  BTreeNode<T,Val_T,C,SIZE,COUNTED> *parent = nullptr;
   bool found = false;
   size_t i = 0;
+  Path path;
+
+  // Keys past the end of the tree (timestamps, sequence numbers...) go in the
+  // rightmost leaf. One compare against root tells us if that's the case,
+  // then we follow the last child down without searching, and if the leaf
+  // has room we're done.
+  bool at_tail = false;
+  if (root && root->get_used() && C::compare(C::val(datum), C::val(root->get_data(root->get_used()-1))) > 0) {
+    auto *t = root;
+    while (t->get_node(t->get_used())) {
+      t = t->get_node(t->get_used());
+    }
+    int c = C::compare(C::val(datum), C::val(t->get_data(t->get_used()-1)));
+    if (c == 0) {
+      return false;
+    }
+    if (c > 0) {
+      if (t->get_used() < SIZE) {
+        t->insert_right(t->get_used(), std::move(datum), nullptr);
+        // Every slot we walked down holds one more
+        if (COUNTED) {
+          for (auto *p = root; p != t; p = p->get_node(p->get_used())) {
+            p->add_count(p->get_used(), 1);
+          }
+        }
+        PRINT("BTree Insert, done at tail\n");
+        PRINT_TREE();
+        BTREE_CHECK();
+        return true;
+      }
+      // We'll go down the right spine splitting full nodes, see split_tail()
+      at_tail = true;
+    }
+  }
 
   // Root splits look a little different, so seperate them out
   if (root && root->get_used() == SIZE) {
-    auto right_n = new BTreeNode<T,Val_T,C,SIZE>();
-    T pivot = n->split(right_n);
-    root = new BTreeNode<T,Val_T,C,SIZE>();
+    auto right_n = new BTreeNode<T,Val_T,C,SIZE,COUNTED>();
+    T pivot = at_tail ? n->split_tail(right_n) : n->split(right_n);
+    root = new BTreeNode<T,Val_T,C,SIZE,COUNTED>();
     root->set_node(0, n);
-    root->insert_right(0, pivot, right_n);
+    root->insert_right(0, std::move(pivot), right_n);
     int c = C::compare(C::val(datum), C::val(root->get_data(i)));
     if (c > 0) { 
       i = 1;
+    } else if (c == 0) {
+      // The pivot we just pulled up is the one we're inserting
+      return false;
     }
+    path.push(root, i);
     n = root->get_node(i);
   }
 
@@ -461,23 +766,29 @@ bool BTree<T,Val_T,C,SIZE>::insert(T datum) {
     if (found) {
       return false;
     }
-    if (maybe_split(n, n->get_node(i), i)) {
+    if (maybe_split(n, n->get_node(i), i, at_tail)) {
       // Rather than find, we can just check this one case
       // Note that when we split, we always add the new node to our right
       int c = C::compare(C::val(datum), C::val(n->get_data(i)));
       if (c > 0) { 
         i++;
+      } else if (c == 0) {
+        // The pivot we just pulled up is the one we're inserting
+        return false;
       }
       // brute force and ignorance method, solution above is faster
       //i = n->find(C::val(datum), &found);
     }
     parent = n;
     n = n->get_node(i);
+    if (n) {
+      path.push(parent, i);
+    }
   }
   // empty-tree case
   if (!parent) {
-    root = new BTreeNode<T,Val_T,C,SIZE>();
-    root->insert_right(0, datum, nullptr);
+    root = new BTreeNode<T,Val_T,C,SIZE,COUNTED>();
+    root->insert_right(0, std::move(datum), nullptr);
     PRINT("BTree Insert, done\n");
     PRINT_TREE();
     BTREE_CHECK();
@@ -489,20 +800,81 @@ bool BTree<T,Val_T,C,SIZE>::insert(T datum) {
 
   // insert only occurs at leafs, parent is a leaf
   // it doesn't matter and insert_right is faster since it avoids any shifting 
-  parent->insert_right(i, datum, nullptr);
+  parent->insert_right(i, std::move(datum), nullptr);
+  path.apply(1);
   PRINT("BTree Insert, done\n");
   PRINT_TREE();
   BTREE_CHECK();
   return true;
 }
 
-template<typename T, typename Val_T, typename C, int SIZE>
-bool BTree<T,Val_T,C,SIZE>::remove(Val_T v, T *result) {
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+bool BTree<T,Val_T,C,SIZE,COUNTED>::insert_hint(Iterator &hint, T datum) {
+  PRINT("BTree Insert hint, begins\n");
+  PRINT_TREE();
+  BTREE_CHECK();
+  auto *n = hint.pos.node;
+  if (!n) {
+    // end() stays end()
+    return insert(std::move(datum));
+  }
+  size_t i = hint.pos.index;
+  int c = C::compare(C::val(datum), C::val(n->get_data(i)));
+  if (c == 0) {
+    return false;
+  }
+  // Insertion only happens at leaves, and this one needs room
+  if (c < 0 && !n->get_node(0) && n->get_used() < SIZE) {
+    // The element before hint is the one before it in this leaf, or else the
+    // pivot above the deepest child we went down other than the first
+    bool fits = true;
+    if (i > 0) {
+      c = C::compare(C::val(datum), C::val(n->get_data(i-1)));
+      fits = c > 0;
+    } else {
+      for (size_t d = hint.depth; d > 0; --d) {
+        auto &sn = hint.stack[d-1];
+        if (sn.index > 0) {
+          c = C::compare(C::val(datum), C::val(sn.node->get_data(sn.index-1)));
+          fits = c > 0;
+          break;
+        }
+      }
+    }
+    if (c == 0) {
+      return false;
+    }
+    if (fits) {
+      n->insert_right(i, std::move(datum), nullptr);
+      // hint's stack is exactly the slots we'd have gone down
+      if (COUNTED) {
+        for (size_t d = 0; d < hint.depth; ++d) {
+          hint.stack[d].node->add_count(hint.stack[d].index, 1);
+        }
+      }
+      // and hint's element moved over one
+      hint.pos.index++;
+      PRINT("BTree Insert hint, done\n");
+      PRINT_TREE();
+      BTREE_CHECK();
+      return true;
+    }
+  }
+  // insert() may split or move hint's element, so find it again
+  Val_T v = C::val(*hint);
+  bool r = insert(std::move(datum));
+  hint = lower_bound(v);
+  return r;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+bool BTree<T,Val_T,C,SIZE,COUNTED>::remove(Val_T v, T *result) {
   PRINT("BTree Remove, begins\n");
   PRINT_TREE();
   BTREE_CHECK();
   auto *n = root;
   bool found;
+  Path path;
   // if the root node is empty (except one child), delete it
   // this can only happen at root level
   if (n && !n->get_used()) {
@@ -519,7 +891,7 @@ bool BTree<T,Val_T,C,SIZE>::remove(Val_T v, T *result) {
       // deleting could migrate when/if we go to get a replacement element.
       // To simplify logic we check for a merge now, and re-search
       // for the element in case it moved
-      BTreeNode<T,Val_T,C,SIZE> *left_child = n->get_node(i);
+      BTreeNode<T,Val_T,C,SIZE,COUNTED> *left_child = n->get_node(i);
       if (left_child && maybe_merge(n, i)) {
         found = false;
         continue;
@@ -539,6 +911,7 @@ bool BTree<T,Val_T,C,SIZE>::remove(Val_T v, T *result) {
       // this is the brute force and ignorance method
       //i = n->find(v, &found);
     }
+    path.push(n, i);
     n = n->get_node(i);
   }
   // did we find it?
@@ -549,11 +922,14 @@ bool BTree<T,Val_T,C,SIZE>::remove(Val_T v, T *result) {
     return false;
   }
   // We found it
-  *result = n->get_data(i);
+  if (result) {
+    *result = std::move(n->get_data(i));
+  }
   if (n->get_node(i) == nullptr){
     // If we're a leaf, we can just remove the datum
-    BTreeNode<T,Val_T,C,SIZE> *junk;  
+    BTreeNode<T,Val_T,C,SIZE,COUNTED> *junk;  
     n->remove_right(i, &junk); 
+    path.apply(-1);
     PRINT("BTree Remove, complete\n");
     PRINT_TREE();
     BTREE_CHECK();
@@ -563,24 +939,27 @@ bool BTree<T,Val_T,C,SIZE>::remove(Val_T v, T *result) {
   // down into that node. 
 
   // If we're an inner node, we have to find a replacement datum
-  BTreeNode<T,Val_T,C,SIZE> *r;
+  BTreeNode<T,Val_T,C,SIZE,COUNTED> *r;
+  path.push(n, i);
   r = n->get_node(i);
   // we've already checked merge on n's left child
   while (r->get_node(r->get_used())) { // walk down the right side of n's left child
     maybe_merge(r, r->get_used());
+    path.push(r, r->get_used());
     r = r->get_node(r->get_used()); 
   }
-  BTreeNode<T,Val_T,C,SIZE> *junk;  
+  BTreeNode<T,Val_T,C,SIZE,COUNTED> *junk;  
   T replacement = r->remove_right(r->get_used()-1, &junk);
-  n->set_data(i, replacement); 
+  n->set_data(i, std::move(replacement));
+  path.apply(-1);
   PRINT("BTree Remove, complete\n");
   PRINT_TREE();
   BTREE_CHECK();
   return true; 
 }
 
-template<typename T, typename Val_T, typename C, int SIZE>
-bool BTree<T,Val_T,C,SIZE>::maybe_split(BTreeNode<T,Val_T,C,SIZE> *parent, BTreeNode<T,Val_T,C,SIZE> *n, size_t i){
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+bool BTree<T,Val_T,C,SIZE,COUNTED>::maybe_split(BTreeNode<T,Val_T,C,SIZE,COUNTED> *parent, BTreeNode<T,Val_T,C,SIZE,COUNTED> *n, size_t i, bool at_tail){
   // We need to always have one spare element, if so, we're good!
   if (!n || n->get_used() < SIZE) {
     return false;
@@ -588,9 +967,12 @@ bool BTree<T,Val_T,C,SIZE>::maybe_split(BTreeNode<T,Val_T,C,SIZE> *parent, BTree
   PRINT("Split begin\n");
   PRINT_TREE();
   BTREE_CHECK();
-  auto right_n = new BTreeNode<T,Val_T,C,SIZE>();
-  T pivot = n->split(right_n);
-  parent->insert_right(i, pivot, right_n);
+  auto right_n = new BTreeNode<T,Val_T,C,SIZE,COUNTED>();
+  T pivot = at_tail ? n->split_tail(right_n) : n->split(right_n);
+  parent->insert_right(i, std::move(pivot), right_n);
+  if (COUNTED) {
+    parent->recount(i);
+  }
   PRINT("Split end\n");
   PRINT_TREE();
   BTREE_CHECK();
@@ -600,11 +982,11 @@ bool BTree<T,Val_T,C,SIZE>::maybe_split(BTreeNode<T,Val_T,C,SIZE> *parent, BTree
 // This returns 0 if nothing changed, nonzero if something did change.
 // 1 is returned for events that can only grow parent->get_node(i)
 // 2 is returned for events that shrink (actually, delete) parent->get_node(i)
-template<typename T, typename Val_T, typename C, int SIZE>
-int BTree<T,Val_T,C,SIZE>::maybe_merge(BTreeNode<T,Val_T,C,SIZE> *parent, size_t i){
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+int BTree<T,Val_T,C,SIZE,COUNTED>::maybe_merge(BTreeNode<T,Val_T,C,SIZE,COUNTED> *parent, size_t i){
   PRINT("Maybe merge\n");
   BTREE_CHECK();
-  BTreeNode<T,Val_T,C,SIZE> *n = parent->get_node(i);
+  BTreeNode<T,Val_T,C,SIZE,COUNTED> *n = parent->get_node(i);
   if (!n || n->get_used() > (SIZE-1)/2-1) {
     return 0;
   }
@@ -616,20 +998,27 @@ int BTree<T,Val_T,C,SIZE>::maybe_merge(BTreeNode<T,Val_T,C,SIZE> *parent, size_t
       PRINT("stealing from node to left\n");
       // sibling is too large to join with, so rotate instead
       // Rotate right
-      BTreeNode<T,Val_T,C,SIZE> *sibling_child;
+      BTreeNode<T,Val_T,C,SIZE,COUNTED> *sibling_child;
       T sibling_datum = sibling->remove_right(sibling->get_used()-1, &sibling_child);
-      T old_pivot = parent->get_data(i-1); 
-      parent->set_data(i-1, sibling_datum); 
-      n->insert_left(0, old_pivot, sibling_child);
+      T old_pivot = std::move(parent->get_data(i-1));
+      parent->set_data(i-1, std::move(sibling_datum));
+      n->insert_left(0, std::move(old_pivot), sibling_child);
+      if (COUNTED) {
+        parent->recount(i-1);
+        parent->recount(i);
+      }
       PRINT_TREE();
       BTREE_CHECK();
       return 1;
     }
     PRINT("merging with node to left\n");
-    BTreeNode<T,Val_T,C,SIZE> *junk;
+    BTreeNode<T,Val_T,C,SIZE,COUNTED> *junk;
     T pivot = parent->remove_right(i-1, &junk); // remove the element left of n, and n
-    sibling->merge(pivot, n);
+    sibling->merge(std::move(pivot), n);
     delete n;
+    if (COUNTED) {
+      parent->recount(i-1);
+    }
     PRINT_TREE();
     BTREE_CHECK();
     return 2;
@@ -641,33 +1030,40 @@ int BTree<T,Val_T,C,SIZE>::maybe_merge(BTreeNode<T,Val_T,C,SIZE> *parent, size_t
     BTREE_CHECK();
     // sibling is too large to join with, so we rotate instead
     // Rotate left 
-    BTreeNode<T,Val_T,C,SIZE> *sibling_child;
+    BTreeNode<T,Val_T,C,SIZE,COUNTED> *sibling_child;
     T sibling_datum = sibling->remove_left(0, &sibling_child);
-    T old_pivot = parent->get_data(i); 
-    parent->set_data(i, sibling_datum); 
-    n->insert_right(n->get_used(), old_pivot, sibling_child);
+    T old_pivot = std::move(parent->get_data(i));
+    parent->set_data(i, std::move(sibling_datum));
+    n->insert_right(n->get_used(), std::move(old_pivot), sibling_child);
+    if (COUNTED) {
+      parent->recount(i);
+      parent->recount(i+1);
+    }
     PRINT_TREE();
     BTREE_CHECK();
     return 1;
   }
   PRINT("merging with node to right\n");
-  BTreeNode<T,Val_T,C,SIZE> *junk;
+  BTreeNode<T,Val_T,C,SIZE,COUNTED> *junk;
   T pivot = parent->remove_right(i, &junk); // remove the element right of n, and it's right child
-  n->merge(pivot, sibling);
+  n->merge(std::move(pivot), sibling);
   delete sibling;
+  if (COUNTED) {
+    parent->recount(i);
+  }
   PRINT_TREE();
   BTREE_CHECK();
   return 1;
 }
 
-template<typename T, typename Val_T, typename C, int SIZE>
-void BTree<T,Val_T,C,SIZE>::print(void) const {
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+void BTree<T,Val_T,C,SIZE,COUNTED>::print(void) const {
   _print(root);
   printf("\n");
 }
  
-template<typename T, typename Val_T, typename C, int SIZE>
-void BTree<T,Val_T,C,SIZE>::_print(BTreeNode<T,Val_T,C,SIZE> *n) const {
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+void BTree<T,Val_T,C,SIZE,COUNTED>::_print(BTreeNode<T,Val_T,C,SIZE,COUNTED> *n) const {
   if (!n) {
     printf("n");
     return;
@@ -685,18 +1081,20 @@ void BTree<T,Val_T,C,SIZE>::_print(BTreeNode<T,Val_T,C,SIZE> *n) const {
   printf("]");
 }
 
-template<typename T, typename Val_T, typename C, int SIZE>
-void BTree<T,Val_T,C,SIZE>::check() const {
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+void BTree<T,Val_T,C,SIZE,COUNTED>::check() const {
   if (root) {
     if (root->get_used()) {
-      _check(root, C::val(root->get_data(0)));  
+      _check(root, C::val(root->get_data(0)), true);
     }
   }
 }
 
-template<typename T, typename Val_T, typename C, int SIZE>
-std::pair<Val_T,Val_T> BTree<T,Val_T,C,SIZE>::_check(BTreeNode<T,Val_T,C,SIZE> *n, Val_T v) const {
-  if (n != root && n->get_used() < (SIZE-1)/2-1) {
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+std::pair<Val_T,Val_T> BTree<T,Val_T,C,SIZE,COUNTED>::_check(BTreeNode<T,Val_T,C,SIZE,COUNTED> *n, Val_T v, bool rightmost) const {
+  // split_tail() leaves nodes on the right spine nearly empty
+  size_t min_used = rightmost ? 1 : (SIZE-1)/2-1;
+  if (n != root && n->get_used() < min_used) {
     printf("Element: ");
     n->print();
     printf("\n");
@@ -714,8 +1112,14 @@ std::pair<Val_T,Val_T> BTree<T,Val_T,C,SIZE>::_check(BTreeNode<T,Val_T,C,SIZE> *
   bool range_initialized=false;
   std::pair<Val_T,Val_T> oldrange;
   for (i=0; i < n->get_used()+1; i++) {
+    if (COUNTED && n->get_count(i) != (n->get_node(i) ? n->get_node(i)->total() : 0)) {
+      printf("Node: ");
+      n->print();
+      printf(" slot %ld\n", i);
+      PANIC("Node's count for a child is wrong");
+    }
     if(n->get_node(i)) {
-      range = _check(n->get_node(i), v);
+      range = _check(n->get_node(i), v, rightmost && i == n->get_used());
       range_initialized=true;
       if (!minmax_initialized) {
         min = range.first;
@@ -776,13 +1180,14 @@ std::pair<Val_T,Val_T> BTree<T,Val_T,C,SIZE>::_check(BTreeNode<T,Val_T,C,SIZE> *
   return std::make_pair(min, max);
 }
 
-template<typename T, typename Val_T, typename C, int SIZE>
-class BTree<T,Val_T,C,SIZE>::Iterator {
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+class BTree<T,Val_T,C,SIZE,COUNTED>::Iterator {
   private:
     struct StackNode {
-      BTreeNode<T, Val_T, C, SIZE> *node;
+      BTreeNode<T, Val_T, C, SIZE, COUNTED> *node;
       size_t index;
-      StackNode(BTreeNode<T, Val_T, C, SIZE> *n, size_t i) {
+      StackNode() {}
+      StackNode(BTreeNode<T, Val_T, C, SIZE, COUNTED> *n, size_t i) {
         node = n;
         index = i;
       }
@@ -800,15 +1205,66 @@ class BTree<T,Val_T,C,SIZE>::Iterator {
         return *this;
       }
     };
-    std::vector<StackNode> stack;
+    // Non-root nodes off the right spine have at least (SIZE-1)/2-1 elements,
+    // and at least 1, and every leaf is at the same depth. Plus one level for
+    // root, and one for an empty root that still has a child.
+    // The path to pos lives here rather than in a std::vector, so making and
+    // copying iterators doesn't touch malloc.
+    static const size_t MAX_DEPTH = btree_max_depth((SIZE-1)/2 > 2 ? (SIZE-1)/2 : 2) + 2;
+    StackNode stack[MAX_DEPTH];
+    size_t depth;
     StackNode pos;
+    friend class BTree;
+    void push(const StackNode &sn) {
+      #ifdef BTREE_DEBUG
+      if (depth >= MAX_DEPTH) {
+        PANIC("Iterator stack overflow, tree is deeper than should be possible");
+      }
+      #endif
+      stack[depth++] = sn;
+    }
+    // Walk down from n to the first element >= v (> v if after is set)
+    // The stack ends up just as if we'd ++'d our way here from begin()
+    void seek(BTreeNode<T, Val_T, C, SIZE, COUNTED> *n, Val_T v, bool after) {
+      bool found;
+      while (n) {
+        size_t i = n->find(v, &found);
+        pos.node = n;
+        pos.index = i;
+        if (found) {
+          if (after) {
+            ++(*this);
+          }
+          return;
+        }
+        // data i comes after everything in child i, if there is a data i
+        n = n->get_node(i);
+        if (n) {
+          push(pos);
+        }
+      }
+      if (pos.node == nullptr) {
+        return;
+      }
+      // We fell off a leaf, possibly past it's last element, so go up
+      // until we're on an element
+      while (pos.index >= pos.node->get_used()) {
+        if (!depth) {
+          pos.node = nullptr;
+          pos.index = 0;
+          return;
+        }
+        pos = stack[--depth];
+      }
+    }
   public:
-    Iterator():pos(nullptr, 0) {}
-    Iterator(BTreeNode<T, Val_T, C, SIZE> *n, size_t i):pos(n,i) {
+    Iterator():depth(0), pos(nullptr, 0) {}
+    Iterator(BTreeNode<T, Val_T, C, SIZE, COUNTED> *n, size_t i):depth(0), pos(n,i) {
       if (pos.node == nullptr) {
         return;
       }
-      if (pos.node->get_used() == 0) {
+      // root can be empty with one child, just after a merge below it
+      if (pos.node->get_used() == 0 && !pos.node->get_node(0)) {
         pos.node = nullptr;
         pos.index = 0;
         return;
@@ -817,18 +1273,23 @@ class BTree<T,Val_T,C,SIZE>::Iterator {
       auto left_child = pos.node->get_node(0);
       while (left_child) {
         // Deep copy pos to the stack
-        stack.push_back(pos);
+        push(pos);
         // And change pos
         pos.node = left_child;
         pos.index = 0;
         left_child = left_child->get_node(0);
       }
+    }
+    Iterator(const Iterator& other):depth(other.depth), pos(other.pos) {
+      // Only the part of the stack in use
+      std::copy(other.stack, other.stack + depth, stack);
     }
 		Iterator& operator=(const Iterator& other) {
 			pos.node = other.pos.node;
 			pos.index = other.pos.index;
-      // Deep copy the whole stack
-      stack = other.stack;
+      // Deep copy the part of the stack in use
+      depth = other.depth;
+      std::copy(other.stack, other.stack + depth, stack);
 			return(*this);
 		}
     bool operator==(const Iterator& other) const {
@@ -847,7 +1308,7 @@ class BTree<T,Val_T,C,SIZE>::Iterator {
       bool found_child = !!child;
       while (child) {
         // deep copy pos to the stack
-        stack.push_back(pos);
+        push(pos);
         // And change pos
         pos.node = child;
         pos.index = 0;
@@ -863,13 +1324,12 @@ class BTree<T,Val_T,C,SIZE>::Iterator {
       // If there is no next element, go up
       StackNode sn(nullptr,0);
       do {
-        if (!stack.size()) {
+        if (!depth) {
           pos.node = nullptr;
           pos.index = 0;
           return *this; 
         }
-        pos = stack.back();
-        stack.pop_back();
+        pos = stack[--depth];
       } while (pos.index >= pos.node->get_used());
       return *this;
     }
@@ -886,14 +1346,278 @@ class BTree<T,Val_T,C,SIZE>::Iterator {
     }
 };
 
-template<typename T, typename Val_T, typename C, int SIZE>
-typename BTree<T,Val_T,C,SIZE>::Iterator BTree<T,Val_T,C,SIZE>::begin(void) const {
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+typename BTree<T,Val_T,C,SIZE,COUNTED>::Iterator BTree<T,Val_T,C,SIZE,COUNTED>::begin(void) const {
   return Iterator(root, 0);
 }
 
-template<typename T, typename Val_T, typename C, int SIZE>
-typename BTree<T,Val_T,C,SIZE>::Iterator BTree<T,Val_T,C,SIZE>::end(void) const {
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+typename BTree<T,Val_T,C,SIZE,COUNTED>::Iterator BTree<T,Val_T,C,SIZE,COUNTED>::end(void) const {
   return Iterator(nullptr, 0);
 }
 
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+class BTree<T,Val_T,C,SIZE,COUNTED>::Range {
+  private:
+    Iterator b;
+    Iterator e;
+  public:
+    Range(const Iterator &bb, const Iterator &ee):b(bb), e(ee) {}
+    Iterator begin(void) const {
+      return b;
+    }
+    Iterator end(void) const {
+      return e;
+    }
+};
+
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+typename BTree<T,Val_T,C,SIZE,COUNTED>::Iterator BTree<T,Val_T,C,SIZE,COUNTED>::lower_bound(Val_T val) const {
+  Iterator i;
+  i.seek(root, val, false);
+  return i;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+typename BTree<T,Val_T,C,SIZE,COUNTED>::Iterator BTree<T,Val_T,C,SIZE,COUNTED>::upper_bound(Val_T val) const {
+  Iterator i;
+  i.seek(root, val, true);
+  return i;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+typename BTree<T,Val_T,C,SIZE,COUNTED>::Range BTree<T,Val_T,C,SIZE,COUNTED>::range(Val_T lo, Val_T hi) const {
+  // An empty range if hi <= lo, rather than running off the end
+  if (C::compare(lo, hi) >= 0) {
+    return Range(end(), end());
+  }
+  return Range(lower_bound(lo), lower_bound(hi));
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+class BTree<T,Val_T,C,SIZE,COUNTED>::Builder {
+  private:
+    typedef BTreeNode<T,Val_T,C,SIZE,COUNTED> Node;
+    // The rightmost node on each level, spine[0] is a leaf
+    std::vector<Node*> spine;
+    // One short of full, so finish() can give a left sibling one more
+    static const size_t FILL = SIZE-1;
+  public:
+    Builder() {}
+    // Anything appended and never finish()'d is freed
+    ~Builder() {
+      if (!spine.empty()) {
+        finish();
+      }
+    }
+    // datum must come after everything already appended
+    void append(T datum) {
+      // datum goes on the lowest level with room, as the separator between
+      // the full nodes below it and new empty ones
+      size_t level = 0;
+      while (level < spine.size() && spine[level]->get_used() == FILL) {
+        level++;
+      }
+      // The full nodes below are done, so their counts are final
+      if (COUNTED) {
+        for (size_t l=1; l<=level && l<spine.size(); ++l) {
+          spine[l]->recount(spine[l]->get_used());
+        }
+      }
+      if (level == spine.size()) {
+        // Every level is full, add a root above them
+        Node *n = new Node();
+        if (level) {
+          n->set_node(0, spine[level-1]);
+        }
+        spine.push_back(n);
+      }
+      Node *below = nullptr;
+      for (size_t l=0; l<level; ++l) {
+        Node *n = new Node();
+        if (below) {
+          n->set_node(0, below);
+        }
+        spine[l] = n;
+        below = n;
+      }
+      spine[level]->insert_right(spine[level]->get_used(), std::move(datum), below);
+    }
+    // Hands back everything appended as a tree, and starts over empty
+    BTree finish() {
+      BTree t;
+      if (spine.empty()) {
+        return t;
+      }
+      // Top down, an empty node on the spine is replaced by the full node to
+      // it's left, which takes the separator between them (and the empty
+      // node's child). Nodes off the spine are one short of full, so there's
+      // room, and each fix moves one of them to the spine, so this ends.
+      size_t l = spine.size()-1;
+      while (l-- > 0) {
+        if (spine[l]->get_used()) {
+          continue;
+        }
+        Node *parent = spine[l+1];
+        Node *empty;
+        T pivot = parent->remove_right(parent->get_used()-1, &empty);
+        Node *left = parent->get_node(parent->get_used());
+        left->insert_right(left->get_used(), std::move(pivot), empty->get_node(0));
+        delete empty;
+        spine[l] = left;
+        if (parent->get_used() == 0) {
+          if (l+2 == spine.size()) {
+            // root is left with one child, which takes over
+            delete parent;
+            spine.pop_back();
+          } else {
+            // go back up and fix parent
+            l += 2;
+          }
+        }
+      }
+      // Only the spine's last slots weren't counted when their children filled
+      if (COUNTED) {
+        for (size_t l=1; l<spine.size(); ++l) {
+          spine[l]->recount(spine[l]->get_used());
+        }
+      }
+      t.root = spine.back();
+      spine.clear();
+      #ifdef BTREE_DEBUG
+      t.check();
+      #endif
+      return t;
+    }
+};
+
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+std::vector<Val_T> BTree<T,Val_T,C,SIZE,COUNTED>::split_points(size_t parts) const {
+  // Nodes on one level have about as many elements under each, so go down
+  // until a level has enough separators
+  std::vector<BTreeNode<T,Val_T,C,SIZE,COUNTED>*> level;
+  std::vector<BTreeNode<T,Val_T,C,SIZE,COUNTED>*> next;
+  std::vector<Val_T> keys;
+  if (root) {
+    level.push_back(root);
+  }
+  while (!level.empty()) {
+    keys.clear();
+    next.clear();
+    for (auto *n : level) {
+      for (size_t i=0; i<n->get_used(); ++i) {
+        keys.push_back(C::val(n->get_data(i)));
+      }
+      for (size_t i=0; n->get_node(0) && i<=n->get_used(); ++i) {
+        next.push_back(n->get_node(i));
+      }
+    }
+    if (keys.size() + 1 >= parts) {
+      break;
+    }
+    level.swap(next);
+  }
+  // Evenly spaced, these are distinct since keys are
+  std::vector<Val_T> result;
+  size_t k = std::min(parts ? parts-1 : 0, keys.size());
+  for (size_t j=1; j<=k; ++j) {
+    result.push_back(keys[j * keys.size() / (k+1)]);
+  }
+  return result;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+template<typename Iter, typename Emit>
+void BTree<T,Val_T,C,SIZE,COUNTED>::merge_range(MergeOp op, Iter ia, Iter ea, Iter ib, Iter eb, Emit emit) {
+  while (ia != ea && ib != eb) {
+    int c = C::compare(C::val(*ia), C::val(*ib));
+    if (c < 0) {
+      if (op != INTERSECTION) {
+        emit(*ia);
+      }
+      ++ia;
+    } else if (c > 0) {
+      if (op == UNION) {
+        emit(*ib);
+      }
+      ++ib;
+    } else {
+      if (op != DIFFERENCE) {
+        emit(*ia);
+      }
+      ++ia;
+      ++ib;
+    }
+  }
+  // One side ran out
+  if (op != INTERSECTION) {
+    for (; ia != ea; ++ia) {
+      emit(*ia);
+    }
+  }
+  if (op == UNION) {
+    for (; ib != eb; ++ib) {
+      emit(*ib);
+    }
+  }
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+BTree<T,Val_T,C,SIZE,COUNTED> BTree<T,Val_T,C,SIZE,COUNTED>::merge(const BTree &a, const BTree &b, MergeOp op, size_t threads) {
+  Builder out;
+  if (threads <= 1) {
+    merge_range(op, a.begin(), a.end(), b.begin(), b.end(), [&](T &datum) {
+      out.append(datum);
+    });
+    return out.finish();
+  }
+  // Cut by whichever tree gives us more ranges, a small tree may not have
+  // enough separators
+  std::vector<Val_T> splits = a.split_points(threads);
+  std::vector<Val_T> b_splits = b.split_points(threads);
+  if (b_splits.size() > splits.size()) {
+    splits.swap(b_splits);
+  }
+  size_t parts = splits.size() + 1;
+  std::vector<std::vector<T>> results(parts);
+  std::vector<std::thread> workers;
+  for (size_t t=0; t<parts; ++t) {
+    workers.push_back(std::thread([&, t]() {
+      Iterator ia = t ? a.lower_bound(splits[t-1]) : a.begin();
+      Iterator ea = t < parts-1 ? a.lower_bound(splits[t]) : a.end();
+      Iterator ib = t ? b.lower_bound(splits[t-1]) : b.begin();
+      Iterator eb = t < parts-1 ? b.lower_bound(splits[t]) : b.end();
+      merge_range(op, ia, ea, ib, eb, [&](T &datum) {
+        results[t].push_back(datum);
+      });
+    }));
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+  for (auto &r : results) {
+    for (auto &datum : r) {
+      out.append(std::move(datum));
+    }
+    // Free as we go, so we don't hold two copies of everything
+    std::vector<T>().swap(r);
+  }
+  return out.finish();
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+BTree<T,Val_T,C,SIZE,COUNTED> BTree<T,Val_T,C,SIZE,COUNTED>::set_union(const BTree &a, const BTree &b, size_t threads) {
+  return merge(a, b, UNION, threads);
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+BTree<T,Val_T,C,SIZE,COUNTED> BTree<T,Val_T,C,SIZE,COUNTED>::set_intersection(const BTree &a, const BTree &b, size_t threads) {
+  return merge(a, b, INTERSECTION, threads);
+}
+
+template<typename T, typename Val_T, typename C, int SIZE, bool COUNTED>
+BTree<T,Val_T,C,SIZE,COUNTED> BTree<T,Val_T,C,SIZE,COUNTED>::set_difference(const BTree &a, const BTree &b, size_t threads) {
+  return merge(a, b, DIFFERENCE, threads);
+}
+
 #endif
@@ -0,0 +1,446 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * A read-only, pointer-free, on-disk image of a sorted dictionary (a BTree,
+ * Dict or Set), meant to be mmap'd.
+ *
+ * When to use this:
+ *   You have a big dictionary that takes a long time to build, and you want to
+ *   get it back quickly after a restart. save() writes it out once, map()
+ *   makes it usable again in about the time of an mmap() call, and pages get
+ *   faulted in as lookups touch them. Since the mapping is read-only and
+ *   shared, many processes mapping the same file share one copy in the page
+ *   cache.
+ *   If you need to change it, load it in to a BTree (e.g. Dict::load()), which
+ *   costs about what the inserts would have.
+ *
+ * How to use this:
+ *   T, Val_T and C are the same as for btree.h. Both T and Val_T must be
+ *   trivially copyable, since we write out their bytes (so no pointers,
+ *   std::string etc.).
+ *   save() takes a sorted, duplicate free range of T's, e.g. a BTree's
+ *   begin() and end().
+ *   map() a saved file, or load() a buffer you already have (used in place,
+ *   not copied).
+ *   Dict and Set have Image, save() and load() if you define BTREE_IMAGE
+ *   before including them.
+ *
+ * Serialized form:
+ *   BTREE_IMAGE_PAGE sized pages, page 0 is the Header, then all of the leaves
+ *   in order, then each level of inner nodes, bottom up, ending at the root.
+ *   Leaves are packed full, since we never insert in to them. Inner nodes hold
+ *   the page number and smallest key of each child, instead of pointers.
+ *   Because the leaves are consecutive pages, iterating is a sequential scan.
+ *   It's in native byte order, don't move it between machines of different
+ *   endianness.
+ *
+ * Design Decisions:
+ *   This is more a B+tree than a B-tree (see bplustree.h), all elements are in
+ *   leaves. That way inner nodes only need keys, which are usually a lot
+ *   smaller than T (e.g. for a Dict), and the fanout is higher.
+ *   save() writes to a temporary file and renames it over path, so a process
+ *   that has the old image mapped keeps seeing the old image, rather than
+ *   crashing on a truncated file.
+ *   map() and load() check that the header matches the length and the shape
+ *   save() would have written, but don't read every page, that would fault
+ *   in the whole file. Each node is checked when we touch it instead, a
+ *   corrupt node (bad used count or child page) PANICs rather than reading
+ *   outside the image.
+ *
+ * Threadsafety:
+ *   thread compatible, everything but map(), load() and clear() is const and
+ *   can run concurrently.
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+#include "panic.h"
+
+#ifndef BTREE_IMAGE_H
+#define BTREE_IMAGE_H
+
+#ifndef BTREE_IMAGE_PAGE
+#define BTREE_IMAGE_PAGE 4096
+#endif
+#define BTREE_IMAGE_MAGIC 0x31474d4945455254lu
+
+template<typename T, typename Val_T, typename C>
+class BTreeImage {
+  static_assert(std::is_trivially_copy_constructible<T>::value && std::is_trivially_destructible<T>::value, "T must be trivially copyable to be saved");
+  static_assert(std::is_trivially_copy_constructible<Val_T>::value && std::is_trivially_destructible<Val_T>::value, "Val_T must be trivially copyable to be saved");
+  private:
+    struct Header {
+      uint64_t magic;
+      // So we notice if the file was written with a different T, Val_T or
+      // page size
+      uint64_t t_size;
+      uint64_t val_size;
+      uint64_t page;
+      uint64_t count;
+      uint64_t leaves;
+      uint64_t pages;
+      // page number of the root, and how many levels there are (1 is just a
+      // leaf)
+      uint64_t root;
+      uint64_t height;
+    };
+    static const size_t LEAF_SIZE = (BTREE_IMAGE_PAGE - sizeof(uint64_t)) / sizeof(T);
+    static const size_t INNER_SIZE = (BTREE_IMAGE_PAGE - sizeof(uint64_t)) / (sizeof(uint64_t) + sizeof(Val_T));
+    struct Leaf {
+      uint64_t used;
+      T data[LEAF_SIZE];
+    };
+    struct Inner {
+      uint64_t used;
+      uint64_t children[INNER_SIZE];
+      // smallest key under each child
+      Val_T keys[INNER_SIZE];
+    };
+    static_assert(LEAF_SIZE >= 1 && sizeof(Leaf) <= BTREE_IMAGE_PAGE, "T is too big for a page");
+    static_assert(INNER_SIZE >= 2 && sizeof(Inner) <= BTREE_IMAGE_PAGE, "Val_T is too big for a page");
+
+    const uint8_t *buf;
+    size_t len;
+    bool mapped;
+    const Header *header;
+
+    // Leaves are pages 1 to leaves, inner nodes are the pages after them
+    const Leaf* leaf(uint64_t i) const {
+      if (i >= header->leaves) {
+        PANIC("Corrupt image, leaf out of range");
+      }
+      const Leaf *l = (const Leaf*) (buf + (i + 1) * BTREE_IMAGE_PAGE);
+      if (l->used == 0 || l->used > LEAF_SIZE) {
+        PANIC("Corrupt image, bad leaf size");
+      }
+      return l;
+    }
+    const Inner* inner(uint64_t page) const {
+      if (page <= header->leaves || page >= header->pages) {
+        PANIC("Corrupt image, inner node out of range");
+      }
+      const Inner *n = (const Inner*) (buf + page * BTREE_IMAGE_PAGE);
+      if (n->used == 0 || n->used > INNER_SIZE) {
+        PANIC("Corrupt image, bad inner node size");
+      }
+      return n;
+    }
+    bool attach(const uint8_t *data, size_t l);
+    // The leaf val would be in, and the index of the first element >= val
+    void find(Val_T val, uint64_t *l, size_t *i) const;
+    static bool write_page(FILE *f, const void *page);
+  public:
+    class Iterator;
+    BTreeImage();
+    ~BTreeImage();
+    // Write [begin, end), which must be sorted and have no duplicates
+    template<typename It>
+    static bool save(const char *path, It begin, It end);
+    // Use data (e.g. mmap'd) in place, it must outlive us
+    bool load(const void *data, size_t l);
+    bool map(const char *path);
+    void clear();
+    const T* get(Val_T val) const;
+    size_t size() const;
+    bool isempty() const;
+    Iterator begin() const;
+    Iterator end() const;
+    // First element >= val
+    Iterator lower_bound(Val_T val) const;
+};
+
+template<typename T, typename Val_T, typename C>
+class BTreeImage<T,Val_T,C>::Iterator {
+  private:
+    const BTreeImage<T,Val_T,C> *image;
+    uint64_t l;
+    size_t i;
+  public:
+    Iterator(const BTreeImage<T,Val_T,C> *im, uint64_t leaf, size_t index):image(im), l(leaf), i(index) {
+      // Don't sit on the end of a leaf, so == works
+      if (image && l < image->header->leaves && i == image->leaf(l)->used) {
+        l++;
+        i = 0;
+      }
+    }
+    bool operator==(const Iterator &other) const {
+      return l == other.l && i == other.i;
+    }
+    bool operator!=(const Iterator &other) const {
+      return !(*this == other);
+    }
+    Iterator& operator++() {
+      i++;
+      if (i == image->leaf(l)->used) {
+        l++;
+        i = 0;
+      }
+      return *this;
+    }
+    Iterator operator++(int) {
+      Iterator tmp(*this);
+      ++(*this);
+      return tmp;
+    }
+    const T& operator*() const {
+      return image->leaf(l)->data[i];
+    }
+    const T* operator->() const {
+      return &(image->leaf(l)->data[i]);
+    }
+};
+
+template<typename T, typename Val_T, typename C>
+BTreeImage<T,Val_T,C>::BTreeImage() {
+  buf = nullptr;
+  len = 0;
+  mapped = false;
+  header = nullptr;
+}
+
+template<typename T, typename Val_T, typename C>
+BTreeImage<T,Val_T,C>::~BTreeImage() {
+  clear();
+}
+
+template<typename T, typename Val_T, typename C>
+void BTreeImage<T,Val_T,C>::clear() {
+  if (mapped) {
+    munmap((void*) buf, len);
+  }
+  buf = nullptr;
+  len = 0;
+  mapped = false;
+  header = nullptr;
+}
+
+template<typename T, typename Val_T, typename C>
+bool BTreeImage<T,Val_T,C>::write_page(FILE *f, const void *page) {
+  return fwrite(page, 1, BTREE_IMAGE_PAGE, f) == BTREE_IMAGE_PAGE;
+}
+
+template<typename T, typename Val_T, typename C>
+template<typename It>
+bool BTreeImage<T,Val_T,C>::save(const char *path, It begin, It end) {
+  std::string tmp = std::string(path) + ".tmp";
+  FILE *f = fopen(tmp.c_str(), "wb");
+  if (!f) {
+    return false;
+  }
+  alignas(Leaf) alignas(Inner) uint8_t page[BTREE_IMAGE_PAGE];
+  Header h;
+  memset(&h, 0, sizeof(h));
+  h.magic = BTREE_IMAGE_MAGIC;
+  h.t_size = sizeof(T);
+  h.val_size = sizeof(Val_T);
+  h.page = BTREE_IMAGE_PAGE;
+  // Placeholder, we don't know the shape until we've written the leaves
+  memset(page, 0, BTREE_IMAGE_PAGE);
+  bool ok = write_page(f, page);
+
+  // Page number and smallest key of each node on the level we just wrote
+  std::vector<uint64_t> pages;
+  std::vector<Val_T> keys;
+  Leaf *l = (Leaf*) page;
+  It it = begin;
+  while (ok && it != end) {
+    memset(page, 0, BTREE_IMAGE_PAGE);
+    for (; it != end && l->used < LEAF_SIZE; ++it) {
+      memcpy((void*) &l->data[l->used], (const void*) &(*it), sizeof(T));
+      l->used++;
+    }
+    pages.push_back(h.leaves + 1);
+    keys.push_back(C::val(l->data[0]));
+    h.count += l->used;
+    h.leaves++;
+    ok = write_page(f, page);
+  }
+  h.pages = h.leaves + 1;
+  h.height = h.leaves ? 1 : 0;
+  while (ok && pages.size() > 1) {
+    std::vector<uint64_t> up_pages;
+    std::vector<Val_T> up_keys;
+    Inner *n = (Inner*) page;
+    for (size_t s = 0; ok && s < pages.size(); s += INNER_SIZE) {
+      memset(page, 0, BTREE_IMAGE_PAGE);
+      for (size_t j = s; j < pages.size() && n->used < INNER_SIZE; ++j) {
+        n->children[n->used] = pages[j];
+        memcpy((void*) &n->keys[n->used], (const void*) &keys[j], sizeof(Val_T));
+        n->used++;
+      }
+      up_pages.push_back(h.pages);
+      up_keys.push_back(keys[s]);
+      h.pages++;
+      ok = write_page(f, page);
+    }
+    pages.swap(up_pages);
+    keys.swap(up_keys);
+    h.height++;
+  }
+  h.root = h.leaves ? pages[0] : 0;
+  ok = ok && fseek(f, 0, SEEK_SET) == 0 && fwrite(&h, 1, sizeof(h), f) == sizeof(h);
+  ok = (fclose(f) == 0) && ok;
+  if (!ok || rename(tmp.c_str(), path) != 0) {
+    unlink(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+// Sets up our pointers, and sanity checks the layout
+template<typename T, typename Val_T, typename C>
+bool BTreeImage<T,Val_T,C>::attach(const uint8_t *data, size_t l) {
+  if (l < sizeof(Header)) {
+    return false;
+  }
+  const Header *h = (const Header*) data;
+  // Divide rather than multiply, so a huge h->pages can't wrap around to l
+  if (h->magic != BTREE_IMAGE_MAGIC || h->t_size != sizeof(T) ||
+      h->val_size != sizeof(Val_T) || h->page != BTREE_IMAGE_PAGE ||
+      l % BTREE_IMAGE_PAGE != 0 || h->pages != l / BTREE_IMAGE_PAGE ||
+      h->leaves >= h->pages) {
+    return false;
+  }
+  // save() packs every leaf but the last one full
+  if (h->leaves ? (h->count <= (h->leaves - 1) * LEAF_SIZE ||
+                   h->count > h->leaves * LEAF_SIZE) : h->count != 0) {
+    return false;
+  }
+  // The inner levels, and so root and height, follow from the leaves
+  uint64_t pages = h->leaves + 1;
+  uint64_t height = h->leaves ? 1 : 0;
+  for (uint64_t n = h->leaves; n > 1; n = (n + INNER_SIZE - 1) / INNER_SIZE) {
+    pages += (n + INNER_SIZE - 1) / INNER_SIZE;
+    height++;
+  }
+  if (h->pages != pages || h->height != height ||
+      h->root != (h->leaves ? pages - 1 : 0)) {
+    return false;
+  }
+  buf = data;
+  len = l;
+  header = h;
+  return true;
+}
+
+template<typename T, typename Val_T, typename C>
+bool BTreeImage<T,Val_T,C>::load(const void *data, size_t l) {
+  clear();
+  return attach((const uint8_t*) data, l);
+}
+
+template<typename T, typename Val_T, typename C>
+bool BTreeImage<T,Val_T,C>::map(const char *path) {
+  clear();
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  void *m = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (m == MAP_FAILED) {
+    return false;
+  }
+  if (!attach((const uint8_t*) m, st.st_size)) {
+    munmap(m, st.st_size);
+    return false;
+  }
+  mapped = true;
+  return true;
+}
+
+template<typename T, typename Val_T, typename C>
+void BTreeImage<T,Val_T,C>::find(Val_T val, uint64_t *l, size_t *i) const {
+  uint64_t page = header->root;
+  for (uint64_t h = header->height; h > 1; --h) {
+    const Inner *n = inner(page);
+    // last child whose smallest key is <= val, or the first
+    size_t s = 1;
+    size_t e = n->used;
+    while (s < e) {
+      size_t m = (s+e)/2;
+      if (C::compare(val, n->keys[m]) < 0) {
+        e = m;
+      } else {
+        s = m+1;
+      }
+    }
+    page = n->children[s-1];
+  }
+  *l = page - 1;
+  const Leaf *lf = leaf(*l);
+  size_t s = 0;
+  size_t e = lf->used;
+  while (s < e) {
+    size_t m = (s+e)/2;
+    if (C::compare(C::val(lf->data[m]), val) < 0) {
+      s = m+1;
+    } else {
+      e = m;
+    }
+  }
+  *i = s;
+}
+
+template<typename T, typename Val_T, typename C>
+const T* BTreeImage<T,Val_T,C>::get(Val_T val) const {
+  if (isempty()) {
+    return nullptr;
+  }
+  uint64_t l;
+  size_t i;
+  find(val, &l, &i);
+  const Leaf *lf = leaf(l);
+  if (i < lf->used && C::compare(C::val(lf->data[i]), val) == 0) {
+    return &lf->data[i];
+  }
+  return nullptr;
+}
+
+template<typename T, typename Val_T, typename C>
+size_t BTreeImage<T,Val_T,C>::size() const {
+  return header ? header->count : 0;
+}
+
+template<typename T, typename Val_T, typename C>
+bool BTreeImage<T,Val_T,C>::isempty() const {
+  return size() == 0;
+}
+
+template<typename T, typename Val_T, typename C>
+typename BTreeImage<T,Val_T,C>::Iterator BTreeImage<T,Val_T,C>::begin() const {
+  if (isempty()) {
+    return end();
+  }
+  return Iterator(this, 0, 0);
+}
+
+template<typename T, typename Val_T, typename C>
+typename BTreeImage<T,Val_T,C>::Iterator BTreeImage<T,Val_T,C>::end() const {
+  return Iterator(nullptr, header ? header->leaves : 0, 0);
+}
+
+template<typename T, typename Val_T, typename C>
+typename BTreeImage<T,Val_T,C>::Iterator BTreeImage<T,Val_T,C>::lower_bound(Val_T val) const {
+  if (isempty()) {
+    return end();
+  }
+  uint64_t l;
+  size_t i;
+  find(val, &l, &i);
+  return Iterator(this, l, i);
+}
+
+#endif
@@ -0,0 +1,94 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * Benchmark for startup time with btree_image.h. We build a Dict with
+ * TEST_SIZE keys the slow way (inserts, in random order), save() it, and then
+ * compare getting it back by:
+ *  - rebuilding it with inserts, which is what a restart costs without images
+ *  - map()ing the image, and then doing TEST_ITERATIONS random gets on it
+ *  - load()ing the mapped image back in to a mutable Dict
+ * We ask the kernel to drop the image from the page cache first, so the gets
+ * include faulting it in from disk (if the kernel obliges).
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "panic.h"
+#include "timer.h"
+#define BTREE_IMAGE
+#include "dict.h"
+
+#ifndef TEST_SIZE
+#define TEST_SIZE 4000000
+#endif
+#ifndef TEST_ITERATIONS
+#define TEST_ITERATIONS 1000000
+#endif
+
+int keys[TEST_SIZE];
+
+int main(int argc, char* argv[]) {
+  printf("BTreeImage.h startup test_size=%d test_iterations=%d\n", TEST_SIZE, TEST_ITERATIONS);
+  const char *path = "/tmp/btree_image_benchmark.img";
+  for (int i=0; i<TEST_SIZE; ++i) {
+    keys[i] = i;
+  }
+  // Note, we did not initialize rand, this is purposeful
+  for (int i=TEST_SIZE-1; i>0; --i) {
+    std::swap(keys[i], keys[rand() % (i+1)]);
+  }
+
+  timeb t1, t2;
+  ftime(&t1);
+  Dict<int, int> *dict = new Dict<int, int>();
+  for (int i=0; i<TEST_SIZE; ++i) {
+    dict->insert(keys[i], i);
+  }
+  ftime(&t2);
+  printf("rebuild_with_inserts time=%lf\n", tdiff(t2, t1));
+
+  ftime(&t1);
+  if (!dict->save(path)) {
+    PANIC("save failed");
+  }
+  ftime(&t2);
+  printf("save time=%lf\n", tdiff(t2, t1));
+  delete dict;
+
+  int fd = open(path, O_RDONLY);
+  if (fd >= 0) {
+    fsync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+
+  ftime(&t1);
+  Dict<int, int>::Image image;
+  if (!image.map(path)) {
+    PANIC("map failed");
+  }
+  ftime(&t2);
+  printf("map time=%lf\n", tdiff(t2, t1));
+
+  ftime(&t1);
+  uint64_t sum = 0;
+  for (int i=0; i<TEST_ITERATIONS; ++i) {
+    auto kv = image.get(keys[i % TEST_SIZE]);
+    if (!kv) {
+      PANIC("image lost an element");
+    }
+    sum += kv->second;
+  }
+  ftime(&t2);
+  printf("map_then_gets time=%lf (checksum %lu)\n", tdiff(t2, t1), sum);
+
+  ftime(&t1);
+  Dict<int, int> loaded;
+  loaded.load(image);
+  ftime(&t2);
+  printf("load time=%lf\n", tdiff(t2, t1));
+  unlink(path);
+  return 0;
+}
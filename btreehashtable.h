@@ -13,6 +13,8 @@
  * resizes up when size is < x data it contains
  * resizes down when size is > 2x data it contains
  *
+ * HP is the hashing policy, see hash.h
+ *
  * Worst case operation is linear per op due to linear rehash
  * Next worst case is all elements hash collide, and operations are log(N)
  * 
@@ -22,6 +24,7 @@
 
 #include "panic.h"
 #include "btree.h"
+#include "hash.h"
 #include "stdio.h"
 #include <vector>
 
@@ -31,9 +34,11 @@
 #define MINSIZE 4
 #define ARITY 64
 
-template <typename Data_T, typename Val_T, typename HC>
+template <typename Data_T, typename Val_T, typename HC, typename HP=DefaultHash>
 class BTreeHashTable {
   private:
+    // See hash.h
+    uint64_t seed;
     std::vector<BTree<Data_T, Val_T, HC, ARITY>> *table;
     size_t count = 0;
     void check_sizeup(void);
@@ -129,26 +134,28 @@ class BTreeHashTable {
     void print(void);
 };
 
-template <typename Data_T, typename Val_T, typename HC>
-BTreeHashTable<Data_T, Val_T, HC>::BTreeHashTable() {
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+BTreeHashTable<Data_T, Val_T, HC, HP>::BTreeHashTable() {
+  seed = HP::new_seed();
   table = new std::vector<BTree<Data_T, Val_T, HC, ARITY>>(MINSIZE);
 }
 
-template <typename Data_T, typename Val_T, typename HC>
-BTreeHashTable<Data_T, Val_T, HC>::BTreeHashTable(size_t s) {
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+BTreeHashTable<Data_T, Val_T, HC, HP>::BTreeHashTable(size_t s) {
+  seed = HP::new_seed();
   table = new std::vector<BTree<Data_T, Val_T, HC, ARITY>>(s);
 }
 
-template <typename Data_T, typename Val_T, typename HC>
-BTreeHashTable<Data_T, Val_T, HC>::~BTreeHashTable() {
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+BTreeHashTable<Data_T, Val_T, HC, HP>::~BTreeHashTable() {
   delete table;
 };
 
-template <typename Data_T, typename Val_T, typename HC>
-bool BTreeHashTable<Data_T, Val_T, HC>::insert(const Data_T& data) {
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+bool BTreeHashTable<Data_T, Val_T, HC, HP>::insert(const Data_T& data) {
   check_sizeup();
   Val_T v = HC::val(data);
-  size_t i = HC::hash(v) % table->size();
+  size_t i = HP::index(HC::hash(v), seed, table->size());
   if ((*table)[i].insert(data)) {
     count++;
     return true;
@@ -156,15 +163,15 @@ bool BTreeHashTable<Data_T, Val_T, HC>::insert(const Data_T& data) {
   return false;
 }
 
-template <typename Data_T, typename Val_T, typename HC>
-Data_T* BTreeHashTable<Data_T, Val_T, HC>::get(Val_T key) {
-  size_t i = HC::hash(key) % table->size();
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+Data_T* BTreeHashTable<Data_T, Val_T, HC, HP>::get(Val_T key) {
+  size_t i = HP::index(HC::hash(key), seed, table->size());
   return (*table)[i].get(key);
 }
 
-template <typename Data_T, typename Val_T, typename HC>
-bool BTreeHashTable<Data_T, Val_T, HC>::remove(Val_T v, Data_T *data) {
-  size_t i = HC::hash(v) % table->size();
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+bool BTreeHashTable<Data_T, Val_T, HC, HP>::remove(Val_T v, Data_T *data) {
+  size_t i = HP::index(HC::hash(v), seed, table->size());
   bool b = (*table)[i].remove(v, data); 
   if (!b) {
     return false;
@@ -174,13 +181,13 @@ bool BTreeHashTable<Data_T, Val_T, HC>::remove(Val_T v, Data_T *data) {
   return true;
 }
 
-template <typename Data_T, typename Val_T, typename HC>
-bool BTreeHashTable<Data_T, Val_T, HC>::isempty(void) const {
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+bool BTreeHashTable<Data_T, Val_T, HC, HP>::isempty(void) const {
   return count == 0;
 }
 
-template <typename Data_T, typename Val_T, typename HC>
-void BTreeHashTable<Data_T, Val_T, HC>::resize(size_t s) {
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+void BTreeHashTable<Data_T, Val_T, HC, HP>::resize(size_t s) {
   // nothing to do
   if (s == table->size()) {
     return;
@@ -197,7 +204,7 @@ void BTreeHashTable<Data_T, Val_T, HC>::resize(size_t s) {
       continue;
     }
     Val_T v = *n;
-    size_t new_index = HC::hash(v) % s;
+    size_t new_index = HP::index(HC::hash(v), seed, s);
     Data_T data;
     // remove it
     if (!(*table)[i].remove(v, &data)) {
@@ -209,8 +216,8 @@ void BTreeHashTable<Data_T, Val_T, HC>::resize(size_t s) {
   table = new_table;
 }
 
-template <typename Data_T, typename Val_T, typename HC>
-void BTreeHashTable<Data_T, Val_T, HC>::check_sizedown(void) {
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+void BTreeHashTable<Data_T, Val_T, HC, HP>::check_sizedown(void) {
   // If it's under a quarter full resize down
   if (table->size() > 2*count) {
     size_t s = table->size() / 2;
@@ -221,16 +228,16 @@ void BTreeHashTable<Data_T, Val_T, HC>::check_sizedown(void) {
   }
 }
 
-template <typename Data_T, typename Val_T, typename HC>
-void BTreeHashTable<Data_T, Val_T, HC>::check_sizeup(void) {
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+void BTreeHashTable<Data_T, Val_T, HC, HP>::check_sizeup(void) {
   // If it's over half-full resize up
   if (table->size() < count) {
     resize(table->size()*2); 
   } 
 }
 
-template <typename Data_T, typename Val_T, typename HC>
-void BTreeHashTable<Data_T, Val_T, HC>::print(void) {
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+void BTreeHashTable<Data_T, Val_T, HC, HP>::print(void) {
 	printf("[\n");
   for (size_t i=0; i<table->size(); ++i) {
 		printf("  ");
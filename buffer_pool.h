@@ -0,0 +1,222 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * A buffer pool, a fixed amount of memory caching fixed size pages of a file.
+ *
+ * When to use this:
+ *   You have a structure that lives in a file bigger than you want to (or can)
+ *   keep in memory, e.g. paged_btree.h. pin() a page to get it in memory,
+ *   use it, and unpin() it when you're done, saying whether you changed it.
+ *   Pinned pages stay put, unpinned ones may be evicted to make room for
+ *   others, dirty ones are written back first.
+ *
+ * Design Decisions:
+ *   CLOCK eviction:
+ * Each frame has a referenced bit, set whenever the page is pinned. To evict
+ * we sweep a "hand" around the frames, clearing referenced bits, and take
+ * the first unpinned frame whose bit was already clear. That approximates LRU
+ * with no list to maintain on every pin. A sequential scan can still flush the
+ * pool (LRU-K wouldn't), but for a B-tree the upper levels get touched on
+ * every operation, so they keep their bits set and stay resident anyway.
+ *
+ *   Page table:
+ * Resident pages are found through an OCHashTable keyed on page number, with
+ * the frames themselves as nodes, so it never allocates once we're running.
+ *
+ *   Writes:
+ * Dirty pages are only written when evicted, or on flush(). There is no
+ * write-ahead log, if we crash between flushes the file can be left with
+ * some pages old and some new. flush() doesn't fsync either, call fsync()
+ * on the file yourself if you need it on disk.
+ *
+ * I/O errors PANIC, there's not much a B-tree can do with half a node.
+ *
+ * Threadsafety:
+ *   thread compatible
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include "panic.h"
+#include "ochashtable.h"
+
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+// Fewest frames we'll run with, whatever the budget. A B-tree operation pins a
+// handful of pages at once.
+#define BUFFER_POOL_MIN_FRAMES 16
+
+class BufferPool {
+  private:
+    class Frame: public OCHashTableNode_base<Frame> {
+      public:
+        uint64_t page;
+        size_t pins;
+        bool dirty;
+        bool referenced;
+        uint64_t val() const {
+          return page;
+        }
+        static size_t hash(uint64_t v) {
+          return v;
+        }
+    };
+    int fd;
+    size_t page_size;
+    std::vector<Frame> frames;
+    // frames.size() * page_size, page_size aligned
+    uint8_t *memory;
+    OCHashTable<Frame, uint64_t> table;
+    size_t hand;
+    // stats
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t writes;
+
+    uint8_t* data(const Frame *f) const {
+      return memory + (f - &frames[0]) * page_size;
+    }
+    void write_back(Frame *f) {
+      if (pwrite(fd, data(f), page_size, f->page * page_size) != (ssize_t) page_size) {
+        PANIC("BufferPool write failed");
+      }
+      f->dirty = false;
+      writes++;
+    }
+    // An empty frame, evicting whatever was there
+    Frame* victim() {
+      // Two sweeps clear every referenced bit, a third means everything is
+      // pinned
+      for (size_t n=0; n<3*frames.size(); ++n) {
+        Frame *f = &frames[hand];
+        hand = (hand + 1) % frames.size();
+        if (f->pins) {
+          continue;
+        }
+        if (f->referenced) {
+          f->referenced = false;
+          continue;
+        }
+        if (table.get(f->page) == f) {
+          if (f->dirty) {
+            write_back(f);
+          }
+          table.remove(f);
+        }
+        return f;
+      }
+      PANIC("BufferPool has every frame pinned");
+      return nullptr;
+    }
+    Frame* claim(uint64_t page) {
+      Frame *f = victim();
+      f->page = page;
+      f->pins = 1;
+      f->dirty = false;
+      f->referenced = true;
+      table.insert(f);
+      return f;
+    }
+  public:
+    // Caches pages of fd, using at most about budget bytes
+    BufferPool(int file, size_t page, size_t budget) {
+      fd = file;
+      page_size = page;
+      size_t n = budget / page_size;
+      if (n < BUFFER_POOL_MIN_FRAMES) {
+        n = BUFFER_POOL_MIN_FRAMES;
+      }
+      frames.resize(n);
+      for (auto &f : frames) {
+        f.page = 0;
+        f.pins = 0;
+        f.dirty = false;
+        f.referenced = false;
+      }
+      if (posix_memalign((void**) &memory, page_size, n * page_size) != 0) {
+        PANIC("BufferPool allocation failed");
+      }
+      hand = 0;
+      hits = 0;
+      misses = 0;
+      writes = 0;
+    }
+    ~BufferPool() {
+      flush();
+      for (auto &f : frames) {
+        if (table.get(f.page) == &f) {
+          table.remove(&f);
+        }
+      }
+      free(memory);
+    }
+    // page in memory, it stays there (at this address) until unpin()
+    void* pin(uint64_t page) {
+      Frame *f = table.get(page);
+      if (f) {
+        hits++;
+        f->pins++;
+        f->referenced = true;
+        return data(f);
+      }
+      misses++;
+      f = claim(page);
+      ssize_t r = pread(fd, data(f), page_size, page * page_size);
+      if (r < 0) {
+        PANIC("BufferPool read failed");
+      }
+      // Past the end of the file reads as zeros
+      memset(data(f) + r, 0, page_size - r);
+      return data(f);
+    }
+    // Like pin(), but for a page we're about to overwrite completely, so
+    // there's no need to read it
+    void* pin_new(uint64_t page) {
+      Frame *f = table.get(page);
+      if (!f) {
+        f = claim(page);
+      } else {
+        f->pins++;
+        f->referenced = true;
+      }
+      memset(data(f), 0, page_size);
+      f->dirty = true;
+      return data(f);
+    }
+    // p is what pin() returned, dirty if we changed it
+    void unpin(void *p, bool dirty) {
+      Frame *f = &frames[((uint8_t*) p - memory) / page_size];
+      #ifdef BUFFER_POOL_DEBUG
+      if (!f->pins) {
+        PANIC("BufferPool unpin of a page that isn't pinned");
+      }
+      #endif
+      f->pins--;
+      f->dirty |= dirty;
+    }
+    // Write back every dirty page
+    void flush() {
+      for (auto &f : frames) {
+        if (f.dirty) {
+          write_back(&f);
+        }
+      }
+    }
+    size_t get_frames() const {
+      return frames.size();
+    }
+    uint64_t get_hits() const {
+      return hits;
+    }
+    uint64_t get_misses() const {
+      return misses;
+    }
+    uint64_t get_writes() const {
+      return writes;
+    }
+};
+
+#endif
@@ -0,0 +1,319 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * A compact open chaining hashtable, using external allocation for nodes.
+ *
+ * When to use this:
+ *   Where you'd use ochashtable.h, but memory matters more than O(1) removal
+ *   of a node you already have. With huge tables ochashtable.h's per bucket
+ *   DList (head and tail) and per node prev, next and hs words dominate
+ *   memory use.
+ *   Here a bucket is one pointer, and a node carries one pointer and a 32 bit
+ *   fingerprint (a 4 byte key goes in the padding after it). For 64 bit keys
+ *   that's 24 bytes per node and 8-32 bytes per element of buckets (1 to 4
+ *   buckets per element, see below), against 32 and 16-32 for ochashtable.h,
+ *   which shrinks at half full. Note malloc rounds both node sizes up to
+ *   32 bytes, allocate nodes in arrays to see the difference. See
+ *   experiments/datastructure_size_comparison/bytes_per_element.
+ *
+ * Algorithm:
+ *   Buckets are singly linked chains, new nodes go on the front.
+ *   Each node stores a fingerprint of it's hash, lookups compare that before
+ *   calling compare(), so walking past the wrong nodes rarely touches keys.
+ *   remove() has to walk the chain to find the previous node, chains are
+ *   about one node long, so it's cheap.
+ *   Resize allocates a new bucket array and moves every node over, so there
+ *   is no per-node generation counter (ochashtable.h's hs).
+ *
+ * resizes up when size is < x data it contains
+ * resizes down when size is > 4x data it contains (not 2x, so a table sitting
+ *   right at a resize boundary doesn't resize back and forth)
+ *
+ * HP is the hashing policy, see hash.h
+ *
+ * Worst case operation is linear per op due to
+ * 1) linear rehash
+ * 2) possability of every item hash colliding
+ *
+ * Threadsafety:
+ *   thread compatible
+ */
+
+#include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include "panic.h"
+#include "hash.h"
+
+#ifndef COMPACTOCHASHTABLE_H
+#define COMPACTOCHASHTABLE_H
+
+#define COMPACTOC_MINSIZE 4
+// Keys get_batch() has in flight at once
+#define COMPACTOC_BATCH_GROUP 32
+
+template <typename Node_T>
+class CompactOCHashTableNode_base {
+  public:
+    // Next node in our bucket
+    Node_T *chain;
+    // Some bits of the hash, so we can skip most compare()s
+    uint32_t fingerprint;
+    // Having a constructor makes this non-POD, which lets the compiler put a
+    // subclass's 4 byte key in our padding (16 byte nodes, not 24)
+    CompactOCHashTableNode_base() {}
+    // subclass must implement:
+    // Val_T val(void);
+    // static size_t hash(Val_T v);
+    // static int compare(Val_T v1, Val_T v2);
+};
+
+template <typename Node_T, typename Val_T, typename HP=DefaultHash>
+class CompactOCHashTable {
+  private:
+    // See hash.h
+    uint64_t seed;
+    std::vector<Node_T*> table;
+    size_t count = 0;
+    uint64_t mix(Val_T v) const {
+      return HP::mix(Node_T::hash(v), seed);
+    }
+    // Independent of the bits reduce() uses, whichever policy we have
+    static uint32_t fingerprint(uint64_t m) {
+      return (m * 0x9E3779B97F4A7C15lu) >> 32;
+    }
+    Node_T* find(size_t i, uint32_t fp, Val_T key) const;
+    void check_sizeup(void);
+    void check_sizedown(void);
+  public:
+    class Iterator {
+      private:
+        std::vector<Node_T*> *table;
+        size_t index;
+        Node_T *n;
+        void skip() {
+          while (!n && index < table->size()) {
+            index++;
+            if (index < table->size()) {
+              n = (*table)[index];
+            }
+          }
+        }
+      public:
+        Iterator(std::vector<Node_T*> *t, size_t ind) {
+          table = t;
+          index = ind;
+          n = index < table->size() ? (*table)[index] : nullptr;
+          // Look for a valid element (if we don't have one)
+          skip();
+        }
+        Iterator(const Iterator& other) {
+          table = other.table;
+          index = other.index;
+          n = other.n;
+        }
+        Iterator& operator=(const Iterator& other) {
+          table = other.table;
+          index = other.index;
+          n = other.n;
+          return *this;
+        }
+        bool operator==(const Iterator& other) {
+          return index == other.index && n == other.n;
+        }
+        bool operator!=(const Iterator& other) {
+          return !((*this) == other);
+        }
+        Iterator operator++() {
+          // If we're at the end, we're done
+          if (!n) {
+            return *this;
+          }
+          n = n->chain;
+          skip();
+          return *this;
+        }
+        Iterator operator++(int) {
+          Iterator tmp(*this);
+          ++(*this);
+          return tmp;
+        }
+        Node_T& operator*() {
+          return *n;
+        }
+        Node_T* operator->() {
+          return n;
+        }
+    };
+    Iterator begin() {
+      return Iterator(&table, 0);
+    }
+    Iterator end() {
+      return Iterator(&table, table.size());
+    }
+    CompactOCHashTable();
+    CompactOCHashTable(size_t s);
+    ~CompactOCHashTable();
+    bool insert(Node_T *n);
+    Node_T* get(Val_T key);
+    // out[i] = get(keys[i]) for i in [0, n), but faster for big n
+    void get_batch(const Val_T *keys, size_t n, Node_T **out);
+    void remove(Node_T *n);
+    bool isempty(void) const;
+    size_t size(void) const;
+    void resize(size_t s);
+    void print();
+};
+
+template <typename Node_T, typename Val_T, typename HP>
+CompactOCHashTable<Node_T,Val_T,HP>::CompactOCHashTable():table(COMPACTOC_MINSIZE, nullptr) {
+  seed = HP::new_seed();
+}
+
+template <typename Node_T, typename Val_T, typename HP>
+CompactOCHashTable<Node_T,Val_T,HP>::CompactOCHashTable(size_t s):table(std::max(s, (size_t) COMPACTOC_MINSIZE), nullptr) {
+  seed = HP::new_seed();
+}
+
+template <typename Node_T, typename Val_T, typename HP>
+CompactOCHashTable<Node_T,Val_T,HP>::~CompactOCHashTable() {
+  if (count) {
+    PANIC("Hashtable not empty before destruction");
+  }
+}
+
+template <typename Node_T, typename Val_T, typename HP>
+Node_T* CompactOCHashTable<Node_T,Val_T,HP>::find(size_t i, uint32_t fp, Val_T key) const {
+  for (Node_T *n = table[i]; n; n = n->chain) {
+    if (n->fingerprint == fp && Node_T::compare(n->val(), key) == 0) {
+      return n;
+    }
+  }
+  return nullptr;
+}
+
+template <typename Node_T, typename Val_T, typename HP>
+bool CompactOCHashTable<Node_T,Val_T,HP>::insert(Node_T *new_node) {
+  check_sizeup();
+  uint64_t m = mix(new_node->val());
+  size_t i = HP::reduce(m, table.size());
+  uint32_t fp = fingerprint(m);
+  if (find(i, fp, new_node->val())) {
+    return false;
+  }
+  new_node->fingerprint = fp;
+  new_node->chain = table[i];
+  table[i] = new_node;
+  count++;
+  return true;
+}
+
+template <typename Node_T, typename Val_T, typename HP>
+Node_T* CompactOCHashTable<Node_T,Val_T,HP>::get(Val_T key) {
+  uint64_t m = mix(key);
+  return find(HP::reduce(m, table.size()), fingerprint(m), key);
+}
+
+template <typename Node_T, typename Val_T, typename HP>
+void CompactOCHashTable<Node_T,Val_T,HP>::get_batch(const Val_T *keys, size_t n, Node_T **out) {
+  // Group prefetching, see ochashtable.h
+  size_t index[COMPACTOC_BATCH_GROUP];
+  uint32_t fps[COMPACTOC_BATCH_GROUP];
+  for (size_t g=0; g<n; g+=COMPACTOC_BATCH_GROUP) {
+    size_t end = std::min(n, g + COMPACTOC_BATCH_GROUP);
+    for (size_t k=g; k<end; ++k) {
+      uint64_t m = mix(keys[k]);
+      index[k-g] = HP::reduce(m, table.size());
+      fps[k-g] = fingerprint(m);
+      __builtin_prefetch(&table[index[k-g]]);
+    }
+    for (size_t k=g; k<end; ++k) {
+      Node_T *head = table[index[k-g]];
+      if (head) {
+        __builtin_prefetch(head);
+      }
+    }
+    for (size_t k=g; k<end; ++k) {
+      out[k] = find(index[k-g], fps[k-g], keys[k]);
+    }
+  }
+}
+
+template <typename Node_T, typename Val_T, typename HP>
+void CompactOCHashTable<Node_T,Val_T,HP>::remove(Node_T *n) {
+  size_t i = HP::reduce(mix(n->val()), table.size());
+  // Find whatever points at n
+  Node_T **prev = &table[i];
+  while (*prev != n) {
+    if (!*prev) {
+      PANIC("removing node from hashtable that it is not a part of");
+    }
+    prev = &(*prev)->chain;
+  }
+  *prev = n->chain;
+  count--;
+  check_sizedown();
+}
+
+template <typename Node_T, typename Val_T, typename HP>
+bool CompactOCHashTable<Node_T,Val_T,HP>::isempty(void) const {
+  return count == 0;
+}
+
+template <typename Node_T, typename Val_T, typename HP>
+size_t CompactOCHashTable<Node_T,Val_T,HP>::size(void) const {
+  return count;
+}
+
+template <typename Node_T, typename Val_T, typename HP>
+void CompactOCHashTable<Node_T,Val_T,HP>::resize(size_t s) {
+  s = std::max(s, (size_t) COMPACTOC_MINSIZE);
+  // nothing to do
+  if (s == table.size()) {
+    return;
+  }
+  std::vector<Node_T*> new_table(s, nullptr);
+  for (size_t i=0; i<table.size(); ++i) {
+    Node_T *n = table[i];
+    while (n) {
+      Node_T *next = n->chain;
+      size_t j = HP::reduce(mix(n->val()), s);
+      n->chain = new_table[j];
+      new_table[j] = n;
+      n = next;
+    }
+  }
+  table.swap(new_table);
+}
+
+template <typename Node_T, typename Val_T, typename HP>
+void CompactOCHashTable<Node_T,Val_T,HP>::check_sizeup(void) {
+  // If it's over full resize up
+  if (table.size() < count) {
+    resize(table.size()*2);
+  }
+}
+
+template <typename Node_T, typename Val_T, typename HP>
+void CompactOCHashTable<Node_T,Val_T,HP>::check_sizedown(void) {
+  // If it's under a quarter full resize down
+  if (table.size() > COMPACTOC_MINSIZE && table.size() > 4*count) {
+    resize(table.size() / 2);
+  }
+}
+
+template <typename Node_T, typename Val_T, typename HP>
+void CompactOCHashTable<Node_T,Val_T,HP>::print(void) {
+  printf("[\n");
+  for (size_t i=0; i<table.size(); ++i) {
+    printf("  ");
+    for (Node_T *n = table[i]; n; n = n->chain) {
+      n->print();
+      printf(",");
+    }
+    printf("\n");
+  }
+  printf("]\n");
+}
+
+#endif
@@ -0,0 +1,607 @@
+/*
+ * Copyright: Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * When to use this:
+ * Where you'd use btree.h, but you need point in time snapshots of it, e.g.
+ * readers that want a consistent view of a big dictionary while a writer
+ * keeps changing it. Copying a CowBTree is O(1), and the copy is a snapshot.
+ * get(), insert() and remove() cost a bit more than btree.h (refcounts), and
+ * right after a snapshot a write copies every node on it's path.
+ *
+ * This is a B-tree with copy-on-write nodes. Every node has a refcount, the
+ * number of parents (or trees, for a root) pointing at it. A copy of the tree
+ * just shares the root. Nodes with a refcount of 1 that we reached through
+ * nodes with a refcount of 1 are ours alone, and we change them in place.
+ * Anything else is shared with some other tree, so a write copies it first
+ * (path copying), and from then on that copy is ours. A write after a
+ * snapshot copies only the root to leaf path it walks down, plus any
+ * siblings a split or merge touches.
+ *
+ * Design Decisions:
+ *   Same template contract as btree.h:
+ * T, Val_T, C and SIZE mean the same thing as in btree.h (read the notes
+ * there). T also needs a copy constructor, shared nodes get copied.
+ *
+ *   Split/merge on the way down:
+ * Just like btree.h, insert() splits full nodes on the way down, and remove()
+ * tops up nodes that are at their minimum on the way down, so we never walk
+ * back up. Since the walk down is also where we copy shared nodes, every node
+ * we change is already ours by the time we change it.
+ *
+ *   No parent pointers:
+ * A shared node has many parents, so we couldn't keep them anyway. The
+ * Iterator keeps a stack instead.
+ *
+ * Threadsafety:
+ *   Each CowBTree is thread compatible. Different copies (snapshots) of the
+ * same tree can be used from different threads with no locks, even while one
+ * of them is being written. Refcounts are atomic, and a node is only changed
+ * in place once no other tree can reach it.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <stdint.h>
+#include <stdio.h>
+#include <type_traits>
+#include <utility>
+#include "panic.h"
+
+#ifndef COW_BTREE_H
+#define COW_BTREE_H
+
+// Define this to implement some expensive consistancy checking
+// This checks all of the invariants before and after every operation
+#ifdef COW_BTREE_DEBUG
+#define COW_BTREE_CHECK() check()
+#else
+#define COW_BTREE_CHECK()
+#endif
+
+template<typename T, int SIZE>
+struct CowBTreeNode {
+  // Parents (or trees) pointing at us
+  std::atomic<size_t> refs;
+  size_t used;
+  T data[SIZE];
+  CowBTreeNode<T,SIZE> *children[SIZE+1];
+  CowBTreeNode():refs(1), used(0) {
+    memset(children, 0, (SIZE+1)*sizeof(children[0]));
+  }
+};
+
+template<typename T, typename Val_T, typename C, int SIZE>
+class CowBTree {
+  static_assert(std::is_same<decltype(C::compare(std::declval<Val_T>(), std::declval<Val_T>())), int>(), "Please define a static method int compare(Val_T, Val_T) method on C class");
+  static_assert(std::is_same<decltype(C::val(std::declval<T>())), Val_T>(), "Please define a static method Val_T val(T) method on C class");
+  static_assert(SIZE >= 3, "SIZE must be at least 3");
+  private:
+    typedef CowBTreeNode<T,SIZE> Node;
+    // Non-root nodes never have fewer than this, and are topped up by
+    // remove() if they have this few
+    static const size_t MIN = (SIZE-1)/2;
+    // data
+    Node *root;
+    // Nodes we've had to copy, see copies()
+    size_t copied;
+    // methods
+    static void acquire(Node *n);
+    static void release(Node *n);
+    Node *own(Node **slot);
+    static size_t find(const Node *n, Val_T v, bool *found);
+    void split_child(Node *parent, size_t i);
+    void merge_children(Node *parent, size_t i);
+    Node *fix_child(Node *parent, size_t i);
+    size_t _check(const Node *n, const Val_T *lo, const Val_T *hi) const;
+    void _print(const Node *n) const;
+  public:
+    class Iterator;
+    Iterator begin(void) const;
+    Iterator end(void) const;
+    CowBTree(); // base constructor
+    // O(1), the new tree shares all of our nodes until one of us writes
+    CowBTree(const CowBTree<T,Val_T,C,SIZE> &t);
+    CowBTree(CowBTree<T,Val_T,C,SIZE> &&t); // move constructor
+    ~CowBTree();
+    CowBTree& operator=(const CowBTree<T,Val_T,C,SIZE> &t);
+    CowBTree& operator=(CowBTree<T,Val_T,C,SIZE> &&t);
+    // Same as a copy, reads better at the call site
+    CowBTree<T,Val_T,C,SIZE> snapshot(void) const {
+      return *this;
+    }
+    const T* get(Val_T val) const;
+    bool insert(T datum);
+    // result may be nullptr, if you don't want the element back
+    bool remove(Val_T val, T* result);
+    bool isempty(void) const;
+    // How many nodes our writes have copied because they were shared, for
+    // measuring write amplification
+    size_t copies(void) const {
+      return copied;
+    }
+    void check(void) const;
+    void print(void) const;
+};
+
+template<typename T, typename Val_T, typename C, int SIZE>
+CowBTree<T,Val_T,C,SIZE>::CowBTree() {
+  root = nullptr;
+  copied = 0;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+CowBTree<T,Val_T,C,SIZE>::CowBTree(const CowBTree<T,Val_T,C,SIZE> &t) {
+  root = t.root;
+  copied = 0;
+  acquire(root);
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+CowBTree<T,Val_T,C,SIZE>::CowBTree(CowBTree<T,Val_T,C,SIZE> &&t) {
+  root = t.root;
+  copied = t.copied;
+  t.root = nullptr;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+CowBTree<T,Val_T,C,SIZE>::~CowBTree() {
+  release(root);
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+CowBTree<T,Val_T,C,SIZE>& CowBTree<T,Val_T,C,SIZE>::operator=(const CowBTree<T,Val_T,C,SIZE> &t) {
+  // acquire first, in case t is us
+  acquire(t.root);
+  release(root);
+  root = t.root;
+  return *this;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+CowBTree<T,Val_T,C,SIZE>& CowBTree<T,Val_T,C,SIZE>::operator=(CowBTree<T,Val_T,C,SIZE> &&t) {
+  if (this != &t) {
+    release(root);
+    root = t.root;
+    copied = t.copied;
+    t.root = nullptr;
+  }
+  return *this;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+void CowBTree<T,Val_T,C,SIZE>::acquire(Node *n) {
+  if (n) {
+    n->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+// Drop a reference, whoever drops the last one frees the node, and drops
+// it's references to it's children
+template<typename T, typename Val_T, typename C, int SIZE>
+void CowBTree<T,Val_T,C,SIZE>::release(Node *n) {
+  if (!n || n->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+    return;
+  }
+  for (size_t i=0; i<=n->used; ++i) {
+    release(n->children[i]);
+  }
+  delete n;
+}
+
+// Makes *slot ours alone, copying it if anyone else can see it, and returns
+// it. The node holding slot must already be ours.
+template<typename T, typename Val_T, typename C, int SIZE>
+typename CowBTree<T,Val_T,C,SIZE>::Node* CowBTree<T,Val_T,C,SIZE>::own(Node **slot) {
+  Node *n = *slot;
+  // acquire pairs with the release in release(), so if another tree just
+  // copied n and let go of it, we see all of it's reads finished before we
+  // start writing
+  if (n->refs.load(std::memory_order_acquire) == 1) {
+    return n;
+  }
+  Node *c = new Node();
+  c->used = n->used;
+  std::copy(n->data, n->data + n->used, c->data);
+  std::copy(n->children, n->children + n->used + 1, c->children);
+  for (size_t i=0; i<=c->used; ++i) {
+    acquire(c->children[i]);
+  }
+  *slot = c;
+  copied++;
+  release(n);
+  return c;
+}
+
+// Like btree.h: the index of v in n's data if found, otherwise the index of
+// the child v belongs under
+template<typename T, typename Val_T, typename C, int SIZE>
+size_t CowBTree<T,Val_T,C,SIZE>::find(const Node *n, Val_T v, bool *found) {
+  size_t s = 0;
+  size_t e = n->used;
+  while (s < e) {
+    size_t m = (s+e)/2;
+    int c = C::compare(v, C::val(n->data[m]));
+    if (c > 0) {
+      s = m+1;
+    } else if (c < 0) {
+      e = m;
+    } else {
+      *found = true;
+      return m;
+    }
+  }
+  *found = false;
+  return s;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+const T* CowBTree<T,Val_T,C,SIZE>::get(Val_T val) const {
+  const Node *n = root;
+  bool found;
+  while (n) {
+    size_t i = find(n, val, &found);
+    if (found) {
+      return &(n->data[i]);
+    }
+    n = n->children[i];
+  }
+  return nullptr;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+bool CowBTree<T,Val_T,C,SIZE>::isempty(void) const {
+  return root == nullptr;
+}
+
+// Splits parent's full child i in two, moving it's middle element up into
+// parent. Both parent and the child must be ours.
+template<typename T, typename Val_T, typename C, int SIZE>
+void CowBTree<T,Val_T,C,SIZE>::split_child(Node *parent, size_t i) {
+  Node *l = parent->children[i];
+  Node *r = new Node();
+  size_t mid = (l->used-1)/2;
+  std::move(l->data + mid + 1, l->data + l->used, r->data);
+  std::copy(l->children + mid + 1, l->children + l->used + 1, r->children);
+  r->used = l->used - mid - 1;
+  l->used = mid;
+  std::move_backward(parent->data + i, parent->data + parent->used, parent->data + parent->used + 1);
+  std::copy_backward(parent->children + i + 1, parent->children + parent->used + 1, parent->children + parent->used + 2);
+  parent->data[i] = std::move(l->data[mid]);
+  parent->children[i+1] = r;
+  parent->used++;
+}
+
+// Merges parent's children i and i+1, and the element between them, into
+// child i. parent must be ours.
+template<typename T, typename Val_T, typename C, int SIZE>
+void CowBTree<T,Val_T,C,SIZE>::merge_children(Node *parent, size_t i) {
+  Node *l = own(&parent->children[i]);
+  Node *r = own(&parent->children[i+1]);
+  l->data[l->used] = std::move(parent->data[i]);
+  std::move(r->data, r->data + r->used, l->data + l->used + 1);
+  // r's children move to l, so their refcounts don't change
+  std::copy(r->children, r->children + r->used + 1, l->children + l->used + 1);
+  l->used += r->used + 1;
+  std::move(parent->data + i + 1, parent->data + parent->used, parent->data + i);
+  std::copy(parent->children + i + 2, parent->children + parent->used + 1, parent->children + i + 1);
+  parent->used--;
+  delete r;
+}
+
+// Makes parent's child i ours, and tops it up if it's at the minimum, by
+// borrowing from a sibling or merging with one. Returns the node to continue
+// down into. parent must be ours.
+template<typename T, typename Val_T, typename C, int SIZE>
+typename CowBTree<T,Val_T,C,SIZE>::Node* CowBTree<T,Val_T,C,SIZE>::fix_child(Node *parent, size_t i) {
+  Node *n = own(&parent->children[i]);
+  if (n->used > MIN) {
+    return n;
+  }
+  // Look at the siblings before copying them, reading a shared node is fine
+  if (i > 0 && parent->children[i-1]->used > MIN) {
+    // borrow the largest from the left
+    Node *s = own(&parent->children[i-1]);
+    std::move_backward(n->data, n->data + n->used, n->data + n->used + 1);
+    std::copy_backward(n->children, n->children + n->used + 1, n->children + n->used + 2);
+    n->data[0] = std::move(parent->data[i-1]);
+    n->children[0] = s->children[s->used];
+    n->used++;
+    parent->data[i-1] = std::move(s->data[s->used-1]);
+    s->used--;
+    return n;
+  }
+  if (i < parent->used && parent->children[i+1]->used > MIN) {
+    // borrow the smallest from the right
+    Node *s = own(&parent->children[i+1]);
+    n->data[n->used] = std::move(parent->data[i]);
+    n->children[n->used+1] = s->children[0];
+    n->used++;
+    parent->data[i] = std::move(s->data[0]);
+    std::move(s->data + 1, s->data + s->used, s->data);
+    std::copy(s->children + 1, s->children + s->used + 1, s->children);
+    s->used--;
+    return n;
+  }
+  if (i > 0) {
+    merge_children(parent, i-1);
+    return parent->children[i-1];
+  }
+  merge_children(parent, i);
+  return parent->children[i];
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+bool CowBTree<T,Val_T,C,SIZE>::insert(T datum) {
+  COW_BTREE_CHECK();
+  Val_T v = C::val(datum);
+  if (!root) {
+    root = new Node();
+    root->data[0] = std::move(datum);
+    root->used = 1;
+    return true;
+  }
+  Node *n = own(&root);
+  // Full root, split it under a new root
+  if (n->used == SIZE) {
+    Node *r = new Node();
+    r->children[0] = n;
+    root = r;
+    split_child(r, 0);
+    n = r;
+  }
+  bool found;
+  while (true) {
+    size_t i = find(n, v, &found);
+    if (found) {
+      COW_BTREE_CHECK();
+      return false;
+    }
+    if (!n->children[i]) {
+      // a leaf, and we made sure it has room on the way down
+      std::move_backward(n->data + i, n->data + n->used, n->data + n->used + 1);
+      n->data[i] = std::move(datum);
+      n->used++;
+      COW_BTREE_CHECK();
+      return true;
+    }
+    Node *child = own(&n->children[i]);
+    if (child->used == SIZE) {
+      split_child(n, i);
+      // Note that when we split, the new node goes to our right
+      int c = C::compare(v, C::val(n->data[i]));
+      if (c == 0) {
+        COW_BTREE_CHECK();
+        return false;
+      }
+      if (c > 0) {
+        i++;
+      }
+      child = n->children[i];
+    }
+    n = child;
+  }
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+bool CowBTree<T,Val_T,C,SIZE>::remove(Val_T v, T *result) {
+  COW_BTREE_CHECK();
+  // Don't copy anything if it isn't here
+  if (!get(v)) {
+    return false;
+  }
+  Node *n = own(&root);
+  bool found;
+  while (true) {
+    size_t i = find(n, v, &found);
+    if (!found) {
+      n = fix_child(n, i);
+      continue;
+    }
+    if (!n->children[i]) {
+      // a leaf, just take it out
+      if (result) {
+        *result = std::move(n->data[i]);
+      }
+      std::move(n->data + i + 1, n->data + n->used, n->data + i);
+      n->used--;
+      break;
+    }
+    // An inner node, replace it with it's predecessor or successor, from
+    // whichever side can spare one
+    if (result) {
+      if (n->children[i]->used > MIN || n->children[i+1]->used > MIN) {
+        *result = std::move(n->data[i]);
+      }
+    }
+    if (n->children[i]->used > MIN) {
+      Node *m = own(&n->children[i]);
+      while (m->children[m->used]) {
+        m = fix_child(m, m->used);
+      }
+      n->data[i] = std::move(m->data[m->used-1]);
+      m->used--;
+      break;
+    }
+    if (n->children[i+1]->used > MIN) {
+      Node *m = own(&n->children[i+1]);
+      while (m->children[0]) {
+        m = fix_child(m, 0);
+      }
+      n->data[i] = std::move(m->data[0]);
+      std::move(m->data + 1, m->data + m->used, m->data);
+      m->used--;
+      break;
+    }
+    // Neither can, so merge them around it and remove it from there
+    merge_children(n, i);
+    n = n->children[i];
+  }
+  // The root can end up empty, from a merge or from removing the last element
+  if (root->used == 0) {
+    Node *old = root;
+    root = old->children[0];
+    delete old;
+  }
+  COW_BTREE_CHECK();
+  return true;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+class CowBTree<T,Val_T,C,SIZE>::Iterator {
+  private:
+    // Non-root nodes have at least MIN elements, so MIN+1 children. See
+    // btree.h
+    static const size_t MAX_DEPTH = 64;
+    struct Frame {
+      const Node *node;
+      // the next element of node to visit
+      size_t index;
+    };
+    Frame stack[MAX_DEPTH];
+    size_t depth;
+    // Walk down the left side from n
+    void descend(const Node *n) {
+      while (n) {
+        #ifdef COW_BTREE_DEBUG
+        if (depth >= MAX_DEPTH) {
+          PANIC("Iterator stack overflow, tree is deeper than should be possible");
+        }
+        #endif
+        stack[depth].node = n;
+        stack[depth].index = 0;
+        depth++;
+        n = n->children[0];
+      }
+    }
+  public:
+    Iterator():depth(0) {}
+    Iterator(const Node *root):depth(0) {
+      descend(root);
+    }
+    Iterator(const Iterator& other):depth(other.depth) {
+      std::copy(other.stack, other.stack + depth, stack);
+    }
+    Iterator& operator=(const Iterator& other) {
+      depth = other.depth;
+      std::copy(other.stack, other.stack + depth, stack);
+      return *this;
+    }
+    bool operator==(const Iterator& other) const {
+      if (depth == 0 || other.depth == 0) {
+        return depth == other.depth;
+      }
+      return stack[depth-1].node == other.stack[other.depth-1].node &&
+        stack[depth-1].index == other.stack[other.depth-1].index;
+    }
+    bool operator!=(const Iterator& other) const {
+      return !(*this == other);
+    }
+    Iterator& operator++() {
+      Frame &top = stack[depth-1];
+      top.index++;
+      // the child right of the element we were on
+      const Node *child = top.node->children[top.index];
+      if (child) {
+        descend(child);
+        return *this;
+      }
+      while (depth > 0 && stack[depth-1].index == stack[depth-1].node->used) {
+        depth--;
+      }
+      return *this;
+    }
+    Iterator operator++(int) {
+      Iterator tmp(*this);
+      ++(*this);
+      return tmp;
+    }
+    const T& operator*() const {
+      return stack[depth-1].node->data[stack[depth-1].index];
+    }
+    const T* operator->() const {
+      return &(stack[depth-1].node->data[stack[depth-1].index]);
+    }
+};
+
+template<typename T, typename Val_T, typename C, int SIZE>
+typename CowBTree<T,Val_T,C,SIZE>::Iterator CowBTree<T,Val_T,C,SIZE>::begin(void) const {
+  return Iterator(root);
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+typename CowBTree<T,Val_T,C,SIZE>::Iterator CowBTree<T,Val_T,C,SIZE>::end(void) const {
+  return Iterator();
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+void CowBTree<T,Val_T,C,SIZE>::check(void) const {
+  if (root) {
+    _check(root, nullptr, nullptr);
+  }
+}
+
+// Checks order, fill and refcounts under n, and returns it's depth
+template<typename T, typename Val_T, typename C, int SIZE>
+size_t CowBTree<T,Val_T,C,SIZE>::_check(const Node *n, const Val_T *lo, const Val_T *hi) const {
+  if (n->refs.load() == 0) {
+    PANIC("Reachable node has no references");
+  }
+  if (n->used > (size_t) SIZE || (n != root && n->used < MIN) || n->used == 0) {
+    printf("used = %ld\n", n->used);
+    PANIC("Node is over or under full");
+  }
+  for (size_t i=0; i<n->used; ++i) {
+    Val_T v = C::val(n->data[i]);
+    if ((lo && C::compare(v, *lo) <= 0) || (hi && C::compare(v, *hi) >= 0)) {
+      PANIC("Element is out of order");
+    }
+  }
+  if (!n->children[0]) {
+    for (size_t i=0; i<=n->used; ++i) {
+      if (n->children[i]) {
+        PANIC("Leaf has a child");
+      }
+    }
+    return 1;
+  }
+  size_t depth = 0;
+  for (size_t i=0; i<=n->used; ++i) {
+    if (!n->children[i]) {
+      PANIC("Inner node is missing a child");
+    }
+    Val_T l = i > 0 ? C::val(n->data[i-1]) : Val_T();
+    Val_T h = i < n->used ? C::val(n->data[i]) : Val_T();
+    size_t d = _check(n->children[i], i > 0 ? &l : lo, i < n->used ? &h : hi);
+    if (depth && d != depth) {
+      PANIC("Leaves are at different depths");
+    }
+    depth = d;
+  }
+  return depth + 1;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+void CowBTree<T,Val_T,C,SIZE>::print(void) const {
+  _print(root);
+  printf("\n");
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+void CowBTree<T,Val_T,C,SIZE>::_print(const Node *n) const {
+  if (!n) {
+    printf("n");
+    return;
+  }
+  printf("[");
+  for (size_t i=0; i<n->used; ++i) {
+    _print(n->children[i]);
+    printf(",");
+    C::printT(n->data[i]);
+    printf(",");
+  }
+  _print(n->children[n->used]);
+  printf("]");
+}
+
+#endif
@@ -0,0 +1,119 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * Benchmark for CowBTree snapshots. We fill a tree with TEST_SIZE keys, then
+ * measure:
+ *  - how long taking (and dropping) a snapshot takes
+ *  - the cost of a write (a remove and re-insert of a random key) with no
+ *    snapshots around, next to the same writes on a plain BTree
+ *  - the cost of a write when we take a snapshot every SNAPSHOT_EVERY writes
+ *    and every write, and how many nodes each write had to copy (write
+ *    amplification)
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "panic.h"
+#include "timer.h"
+#include "btree.h"
+#include "cow_btree.h"
+
+#ifndef TEST_SIZE
+#define TEST_SIZE 1000000
+#endif
+#ifndef TEST_ITERATIONS
+#define TEST_ITERATIONS 1000000
+#endif
+#ifndef ARITY
+#define ARITY 32
+#endif
+#ifndef SNAPSHOT_EVERY
+#define SNAPSHOT_EVERY 1000
+#endif
+
+class Comp {
+  public:
+    static int val(int t) {
+      return t;
+    }
+    static int compare(int v1, int v2) {
+      return v1-v2;
+    }
+    static void printT(int t) {
+      printf("%d", t);
+    }
+};
+
+typedef CowBTree<int, int, Comp, ARITY> Tree;
+
+int keys[TEST_ITERATIONS];
+
+// Writes every key in keys, snapshotting every "every" writes (0 for never).
+// Returns the time taken
+double writes(Tree *tree, size_t every) {
+  Tree snap;
+  timeb t1, t2;
+  ftime(&t1);
+  for (size_t i=0; i<TEST_ITERATIONS; ++i) {
+    if (every && i % every == 0) {
+      snap = tree->snapshot();
+    }
+    if (!tree->remove(keys[i], nullptr) || !tree->insert(keys[i])) {
+      PANIC("write failed");
+    }
+  }
+  ftime(&t2);
+  return tdiff(t2, t1);
+}
+
+void report(const char *name, double t, size_t copies) {
+  printf("%s ns_per_write=%.1lf copies_per_write=%.3lf\n", name, t * 1e9 / TEST_ITERATIONS, (double) copies / TEST_ITERATIONS);
+}
+
+int main(int argc, char* argv[]) {
+  printf("CowBTree.h snapshots test_size=%d arity=%d\n", TEST_SIZE, ARITY);
+  Tree tree;
+  BTree<int, int, Comp, ARITY> btree;
+  for (int i=0; i<TEST_SIZE; ++i) {
+    tree.insert(i);
+    btree.insert(i);
+  }
+  // Note, we did not initialize rand, this is purposeful
+  for (int i=0; i<TEST_ITERATIONS; ++i) {
+    keys[i] = rand() % TEST_SIZE;
+  }
+
+  timeb t1, t2;
+  ftime(&t1);
+  for (int i=0; i<TEST_ITERATIONS; ++i) {
+    Tree snap = tree.snapshot();
+    if (snap.isempty()) {
+      PANIC("snapshot is empty");
+    }
+  }
+  ftime(&t2);
+  printf("snapshot ns_per_snapshot=%.1lf\n", tdiff(t2, t1) * 1e9 / TEST_ITERATIONS);
+
+  ftime(&t1);
+  int junk;
+  for (int i=0; i<TEST_ITERATIONS; ++i) {
+    if (!btree.remove(keys[i], &junk) || !btree.insert(keys[i])) {
+      PANIC("write failed");
+    }
+  }
+  ftime(&t2);
+  report("btree_no_snapshots", tdiff(t2, t1), 0);
+
+  size_t before = tree.copies();
+  double t = writes(&tree, 0);
+  report("no_snapshots", t, tree.copies() - before);
+  before = tree.copies();
+  t = writes(&tree, SNAPSHOT_EVERY);
+  char name[64];
+  snprintf(name, sizeof(name), "snapshot_every_%d", SNAPSHOT_EVERY);
+  report(name, t, tree.copies() - before);
+  before = tree.copies();
+  t = writes(&tree, 1);
+  report("snapshot_every_1", t, tree.copies() - before);
+  return 0;
+}
@@ -0,0 +1,751 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * A bucketized cuckoo hashtable, with a stash.
+ * This uses internal allocation, like hashtable.h.
+ *
+ * When to use this:
+ *   If you care about worst case lookup time. Every other hashtable here has
+ *   lookups that get slower as chains (or probe sequences) get longer, a
+ *   lookup here looks at exactly two buckets, and each bucket is one cache
+ *   line (if CUCKOO_SLOTS elements fit in one). It also packs elements
+ *   tighter than our other open addressing tables, it runs at up to 15/16
+ *   full.
+ *   Inserts pay for this, they may have to move other elements around, and
+ *   are slower than robinhoodhashtable.h or swisstable.h.
+ *   Pointers to elements are invalidated by any insert or remove (we move
+ *   things around), if you need stable pointers use ochashtable.h.
+ *
+ * Algorithm:
+ *   Buckets have CUCKOO_SLOTS slots, each with a one byte tag (0 is empty).
+ *   An element can live in one of two buckets, b1 = hash & mask, and
+ *   b2 = b1 ^ f(tag) ("partial key cuckoo hashing"), so we can find an
+ *   element's other bucket from it's current bucket and tag, without hashing
+ *   it again. Tags are the top byte of the hash, so a lookup only compares
+ *   keys for slots with a matching tag.
+ *   Insert: if either bucket has a free slot, use it. Otherwise breadth first
+ *   search (up to CUCKOO_BFS buckets) for a chain of moves, each element
+ *   moving to it's other bucket, that ends at a free slot. BFS finds the
+ *   shortest chain, so we move as few elements as possible. If there is no
+ *   such chain we put the element in the stash, a bucket checked by every
+ *   lookup (when it's not empty). If the stash is full we grow the table,
+ *   that's the last resort.
+ *   Remove moves stashed elements back in to the table when there's room.
+ *
+ * Worst case:
+ *   get() and remove() look at 2 buckets plus the stash, which is empty
+ *   unless we're very unlucky.
+ *   insert() moves at most log(CUCKOO_BFS) elements, unless it resizes.
+ *   Resizes are still linear.
+ *
+ * resizes up when over 15/16 full, or the stash is full
+ * resizes down when under 1/8 full
+ *
+ * HP is the hashing policy, see hash.h. We only use its mixer, the tag comes
+ * from the high bits, so don't use ModHash.
+ *
+ * Concurrent mode (CONCURRENT=true):
+ *   Data_T must be trivially copyable.
+ *   Writers (insert() and remove()) take a lock, so they run one at a time.
+ *   Readers use get(key, &result), which takes no locks. Buckets map to
+ *   CUCKOO_STRIPES seqlocks. A writer makes a bucket's sequence number odd
+ *   while it changes it. A reader reads both of it's buckets, then retries if
+ *   either sequence number changed.
+ *   A move copies the element to it's new bucket before clearing the old one,
+ *   so a reader never sees it missing from both.
+ *   A reader may still be looking at an old table after a resize, so old
+ *   tables are kept until the hashtable is destroyed, and we never shrink.
+ *   As in ts_hashtable.h, reading Data_T while a writer changes it is the
+ *   usual seqlock data race, we throw those copies away.
+ *   get(key) (the pointer version), the Iterator, check() and print() are not
+ *   safe while there are writers.
+ *
+ * Threadsafety:
+ *   thread compatible, or see Concurrent mode above.
+ */
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "panic.h"
+#include "hash.h"
+
+#ifndef CUCKOOHASHTABLE_H
+#define CUCKOOHASHTABLE_H
+
+// Slots per bucket, also the stash size
+#define CUCKOO_SLOTS 4
+// Most buckets an insert will search for a free slot
+#define CUCKOO_BFS 256
+// Seqlocks for concurrent mode, a power of 2
+#define CUCKOO_STRIPES 1024
+
+template <typename Data_T, typename Val_T, typename HC, typename HP=DefaultHash, bool CONCURRENT=false>
+class CuckooHashTable {
+  static_assert(!CONCURRENT || std::is_trivially_copyable<Data_T>::value,
+      "Concurrent CuckooHashTable needs a trivially copyable Data_T");
+  private:
+    static const size_t MIN_BUCKETS = 2;
+    struct alignas(64) Bucket {
+      std::atomic<uint8_t> tags[CUCKOO_SLOTS];
+      typename std::aligned_storage<sizeof(Data_T), alignof(Data_T)>::type raw[CUCKOO_SLOTS];
+      Data_T& slot(size_t i) {
+        return *reinterpret_cast<Data_T*>(&raw[i]);
+      }
+      uint8_t tag(size_t i) const {
+        return tags[i].load(std::memory_order_relaxed);
+      }
+      void set_tag(size_t i, uint8_t t) {
+        tags[i].store(t, std::memory_order_relaxed);
+      }
+    };
+    struct Table {
+      // a power of 2
+      size_t nbuckets;
+      Bucket *buckets;
+      // bucket number nbuckets
+      Bucket stash;
+      size_t stashed;
+      Bucket& bucket(size_t b) {
+        return b == nbuckets ? stash : buckets[b];
+      }
+    };
+    // BFS state, a bucket, and how we got there
+    struct Step {
+      size_t bucket;
+      // index of the Step we came from, -1 for b1 and b2
+      int parent;
+      // the slot in parent's bucket that moves here
+      int slot;
+    };
+
+    std::atomic<Table*> table;
+    size_t count;
+    // See hash.h
+    uint64_t seed;
+    // Only used in concurrent mode
+    std::mutex m;
+    std::atomic<uint64_t> *seqs;
+    std::vector<Table*> retired;
+
+    uint64_t mix(Val_T key) const {
+      return HP::mix(HC::hash(key), seed);
+    }
+    static uint8_t tag_of(uint64_t h) {
+      uint8_t t = h >> 56;
+      return t ? t : 1;
+    }
+    static size_t alt(const Table *t, size_t b, uint8_t tag) {
+      return (b ^ (tag * 0x5bd1e995lu)) & (t->nbuckets - 1);
+    }
+    std::atomic<uint64_t>& seq_for(const Table *t, size_t b) const {
+      return seqs[b == t->nbuckets ? CUCKOO_STRIPES : b & (CUCKOO_STRIPES-1)];
+    }
+    void write_begin(const Table *t, size_t b) {
+      if (CONCURRENT) {
+        std::atomic<uint64_t> &s = seq_for(t, b);
+        s.store(s.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+      }
+    }
+    void write_end(const Table *t, size_t b) {
+      if (CONCURRENT) {
+        std::atomic<uint64_t> &s = seq_for(t, b);
+        s.store(s.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+      }
+    }
+    static Table* alloc_table(size_t nbuckets);
+    // Destroys whatever is left in t
+    static void free_table(Table *t);
+    // Sets *bucket and *slot, returns false if key isn't here
+    bool find(Table *t, Val_T key, size_t *bucket, size_t *slot) const;
+    // Puts data in slot s of bucket b, which must be empty
+    void put(Table *t, size_t b, size_t s, uint8_t tag, Data_T &&data);
+    // Moves slot s of bucket from to slot d of bucket to
+    void move(Table *t, size_t from, size_t s, size_t to, size_t d);
+    void clear(Table *t, size_t b, size_t s);
+    // places data, which must not be in t, returns false if t and it's stash
+    // are full (in which case t is unchanged)
+    bool place(Table *t, Data_T &&data);
+    // Empty slot in bucket b, or CUCKOO_SLOTS
+    static size_t free_slot(Table *t, size_t b);
+    // Rebuilds in to a table with nbuckets buckets, growing if we have to
+    void rebuild(size_t nbuckets);
+    void unstash(Table *t);
+    void check_sizeup(void);
+    void check_sizedown(void);
+  public:
+    class Iterator {
+      private:
+        Table *t;
+        size_t i;
+        void skip() {
+          while (i < (t->nbuckets+1) * CUCKOO_SLOTS &&
+              !t->bucket(i / CUCKOO_SLOTS).tag(i % CUCKOO_SLOTS)) {
+            i++;
+          }
+        }
+      public:
+        Iterator(Table *_t, size_t _i) {
+          t = _t;
+          i = _i;
+          // Look for a valid element (if we don't have one)
+          skip();
+        }
+        Iterator(const Iterator& other) {
+          t = other.t;
+          i = other.i;
+        }
+        Iterator& operator=(const Iterator& other) {
+          t = other.t;
+          i = other.i;
+          return *this;
+        }
+        bool operator==(const Iterator& other) {
+          return i == other.i;
+        }
+        bool operator!=(const Iterator& other) {
+          return !((*this) == other);
+        }
+        Iterator operator++() {
+          // If we're at the end, we're done
+          if (i >= (t->nbuckets+1) * CUCKOO_SLOTS) {
+            return *this;
+          }
+          i++;
+          skip();
+          return *this;
+        }
+        Iterator operator++(int) {
+          Iterator tmp(*this);
+          ++(*this);
+          return tmp;
+        }
+        Data_T& operator*() {
+          return t->bucket(i / CUCKOO_SLOTS).slot(i % CUCKOO_SLOTS);
+        }
+        Data_T* operator->() {
+          return &t->bucket(i / CUCKOO_SLOTS).slot(i % CUCKOO_SLOTS);
+        }
+    };
+    Iterator begin() {
+      return Iterator(table.load(std::memory_order_relaxed), 0);
+    }
+    Iterator end() {
+      Table *t = table.load(std::memory_order_relaxed);
+      return Iterator(t, (t->nbuckets+1) * CUCKOO_SLOTS);
+    }
+
+    CuckooHashTable();
+    CuckooHashTable(size_t s);
+    ~CuckooHashTable();
+    bool insert(const Data_T& data);
+    Data_T* get(Val_T key);
+    // Copies the element out, lock free in concurrent mode
+    bool get(Val_T key, Data_T* result);
+    bool remove(Val_T key, Data_T* data);
+    bool isempty(void) const;
+    size_t size(void) const;
+    void resize(size_t s);
+    // Elements currently in the stash
+    size_t stashed(void) const;
+    void check(void);
+    void print(void);
+};
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::CuckooHashTable(): CuckooHashTable(0) {
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::CuckooHashTable(size_t s) {
+  seed = HP::new_seed();
+  count = 0;
+  seqs = nullptr;
+  if (CONCURRENT) {
+    seqs = new std::atomic<uint64_t>[CUCKOO_STRIPES + 1];
+    for (size_t i=0; i<=CUCKOO_STRIPES; ++i) {
+      seqs[i].store(0, std::memory_order_relaxed);
+    }
+  }
+  size_t nb = MIN_BUCKETS;
+  while (nb * CUCKOO_SLOTS < s) {
+    nb *= 2;
+  }
+  table.store(alloc_table(nb), std::memory_order_relaxed);
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::~CuckooHashTable() {
+  free_table(table.load(std::memory_order_relaxed));
+  for (size_t i=0; i<retired.size(); ++i) {
+    // Everything in these was copied to a newer table, don't destroy it twice
+    // (concurrent mode means trivially copyable, so there's nothing to do)
+    free(retired[i]->buckets);
+    free(retired[i]);
+  }
+  delete[] seqs;
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+typename CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::Table*
+CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::alloc_table(size_t nbuckets) {
+  void *tp;
+  void *bp;
+  // Buckets are cacheline aligned, which plain new doesn't promise in C++11
+  if (posix_memalign(&tp, alignof(Table), sizeof(Table)) ||
+      posix_memalign(&bp, alignof(Bucket), nbuckets * sizeof(Bucket))) {
+    PANIC("CuckooHashTable allocation failed");
+  }
+  Table *t = new (tp) Table;
+  t->nbuckets = nbuckets;
+  t->buckets = (Bucket*) bp;
+  t->stashed = 0;
+  for (size_t i=0; i<=nbuckets; ++i) {
+    Bucket &b = t->bucket(i);
+    if (i < nbuckets) {
+      new (&b) Bucket;
+    }
+    for (size_t s=0; s<CUCKOO_SLOTS; ++s) {
+      b.set_tag(s, 0);
+    }
+  }
+  return t;
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+void CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::free_table(Table *t) {
+  for (size_t i=0; i<=t->nbuckets; ++i) {
+    Bucket &b = t->bucket(i);
+    for (size_t s=0; s<CUCKOO_SLOTS; ++s) {
+      if (b.tag(s)) {
+        b.slot(s).~Data_T();
+      }
+    }
+  }
+  free(t->buckets);
+  free(t);
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+bool CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::find(Table *t, Val_T key, size_t *bucket, size_t *slot) const {
+  uint64_t h = mix(key);
+  uint8_t tag = tag_of(h);
+  size_t b = h & (t->nbuckets - 1);
+  for (int tries=0; tries<2; ++tries) {
+    Bucket &bk = t->buckets[b];
+    for (size_t s=0; s<CUCKOO_SLOTS; ++s) {
+      if (bk.tag(s) == tag && HC::val(bk.slot(s)) == key) {
+        *bucket = b;
+        *slot = s;
+        return true;
+      }
+    }
+    b = alt(t, b, tag);
+  }
+  if (t->stashed) {
+    for (size_t s=0; s<CUCKOO_SLOTS; ++s) {
+      if (t->stash.tag(s) == tag && HC::val(t->stash.slot(s)) == key) {
+        *bucket = t->nbuckets;
+        *slot = s;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+size_t CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::free_slot(Table *t, size_t b) {
+  Bucket &bk = t->bucket(b);
+  size_t s = 0;
+  while (s < CUCKOO_SLOTS && bk.tag(s)) {
+    s++;
+  }
+  return s;
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+void CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::put(Table *t, size_t b, size_t s, uint8_t tag, Data_T &&data) {
+  Bucket &bk = t->bucket(b);
+  write_begin(t, b);
+  new (&bk.slot(s)) Data_T(std::move(data));
+  bk.set_tag(s, tag);
+  write_end(t, b);
+  if (b == t->nbuckets) {
+    t->stashed++;
+  }
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+void CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::clear(Table *t, size_t b, size_t s) {
+  Bucket &bk = t->bucket(b);
+  write_begin(t, b);
+  bk.set_tag(s, 0);
+  bk.slot(s).~Data_T();
+  write_end(t, b);
+  if (b == t->nbuckets) {
+    t->stashed--;
+  }
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+void CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::move(Table *t, size_t from, size_t s, size_t to, size_t d) {
+  Bucket &src = t->bucket(from);
+  // Copy first, so a concurrent reader always finds it in one or the other
+  put(t, to, d, src.tag(s), std::move(src.slot(s)));
+  clear(t, from, s);
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+bool CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::place(Table *t, Data_T &&data) {
+  uint64_t h = mix(HC::val(data));
+  uint8_t tag = tag_of(h);
+  size_t b1 = h & (t->nbuckets - 1);
+  size_t b2 = alt(t, b1, tag);
+  size_t s;
+  if ((s = free_slot(t, b1)) < CUCKOO_SLOTS) {
+    put(t, b1, s, tag, std::move(data));
+    return true;
+  }
+  if ((s = free_slot(t, b2)) < CUCKOO_SLOTS) {
+    put(t, b2, s, tag, std::move(data));
+    return true;
+  }
+  // BFS for a chain of moves ending at a free slot
+  Step steps[CUCKOO_BFS];
+  int n = 0;
+  steps[n++] = {b1, -1, -1};
+  if (b2 != b1) {
+    steps[n++] = {b2, -1, -1};
+  }
+  for (int i=0; i<n; ++i) {
+    size_t b = steps[i].bucket;
+    size_t free_s = free_slot(t, b);
+    if (free_s < CUCKOO_SLOTS) {
+      // Found one, do the moves from the end of the chain back
+      int cur = i;
+      while (steps[cur].parent != -1) {
+        int p = steps[cur].parent;
+        move(t, steps[p].bucket, steps[cur].slot, steps[cur].bucket, free_s);
+        free_s = steps[cur].slot;
+        cur = p;
+      }
+      put(t, steps[cur].bucket, free_s, tag, std::move(data));
+      return true;
+    }
+    Bucket &bk = t->buckets[b];
+    for (size_t j=0; j<CUCKOO_SLOTS && n<CUCKOO_BFS; ++j) {
+      size_t next = alt(t, b, bk.tag(j));
+      // A chain can't visit a bucket twice, or the moves would trip over
+      // each other
+      bool loop = false;
+      for (int a=i; a!=-1; a=steps[a].parent) {
+        if (steps[a].bucket == next) {
+          loop = true;
+          break;
+        }
+      }
+      if (!loop) {
+        steps[n++] = {next, i, (int) j};
+      }
+    }
+  }
+  // Last try before giving up, the stash
+  if ((s = free_slot(t, t->nbuckets)) < CUCKOO_SLOTS) {
+    put(t, t->nbuckets, s, tag, std::move(data));
+    return true;
+  }
+  return false;
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+void CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::rebuild(size_t nbuckets) {
+  Table *old = table.load(std::memory_order_relaxed);
+  while (true) {
+    Table *t = alloc_table(nbuckets);
+    size_t i;
+    // Rehash, no need to check for duplicates
+    // We copy, so if this fails (or a reader is still using it in concurrent
+    // mode) the old table is intact
+    for (i=0; i<(old->nbuckets+1)*CUCKOO_SLOTS; ++i) {
+      Bucket &bk = old->bucket(i / CUCKOO_SLOTS);
+      size_t s = i % CUCKOO_SLOTS;
+      if (!bk.tag(s)) {
+        continue;
+      }
+      Data_T d(bk.slot(s));
+      if (!place(t, std::move(d))) {
+        break;
+      }
+    }
+    if (i == (old->nbuckets+1)*CUCKOO_SLOTS) {
+      table.store(t, std::memory_order_release);
+      break;
+    }
+    // Very unlucky, didn't fit at this size. Throw it away and try again
+    // bigger.
+    free_table(t);
+    nbuckets *= 2;
+  }
+  if (CONCURRENT) {
+    retired.push_back(old);
+  } else {
+    free_table(old);
+  }
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+void CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::unstash(Table *t) {
+  for (size_t s=0; s<CUCKOO_SLOTS && t->stashed; ++s) {
+    if (!t->stash.tag(s)) {
+      continue;
+    }
+    uint64_t h = mix(HC::val(t->stash.slot(s)));
+    size_t b = h & (t->nbuckets - 1);
+    size_t d = free_slot(t, b);
+    if (d == CUCKOO_SLOTS) {
+      b = alt(t, b, tag_of(h));
+      d = free_slot(t, b);
+    }
+    if (d < CUCKOO_SLOTS) {
+      move(t, t->nbuckets, s, b, d);
+    }
+  }
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+bool CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::insert(const Data_T& data) {
+  std::unique_lock<std::mutex> l(m, std::defer_lock);
+  if (CONCURRENT) {
+    l.lock();
+  }
+  size_t b, s;
+  // reject duplicates
+  if (find(table.load(std::memory_order_relaxed), HC::val(data), &b, &s)) {
+    return false;
+  }
+  check_sizeup();
+  while (true) {
+    Data_T d(data);
+    Table *t = table.load(std::memory_order_relaxed);
+    if (place(t, std::move(d))) {
+      break;
+    }
+    // Nowhere to put it, grow
+    if (count*4 < t->nbuckets*CUCKOO_SLOTS) {
+      PANIC("CuckooHashTable has too many colliding hashes");
+    }
+    rebuild(t->nbuckets*2);
+  }
+  count++;
+  return true;
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+Data_T* CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::get(Val_T key) {
+  Table *t = table.load(std::memory_order_relaxed);
+  size_t b, s;
+  if (!find(t, key, &b, &s)) {
+    return nullptr;
+  }
+  return &t->bucket(b).slot(s);
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+bool CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::get(Val_T key, Data_T* result) {
+  if (!CONCURRENT) {
+    Data_T *d = get(key);
+    if (d) {
+      *result = *d;
+    }
+    return d != nullptr;
+  }
+  uint64_t h = mix(key);
+  uint8_t tag = tag_of(h);
+  while (true) {
+    Table *t = table.load(std::memory_order_acquire);
+    size_t b[2];
+    b[0] = h & (t->nbuckets - 1);
+    b[1] = alt(t, b[0], tag);
+    uint64_t s0 = seq_for(t, b[0]).load(std::memory_order_acquire);
+    uint64_t s1 = seq_for(t, b[1]).load(std::memory_order_acquire);
+    uint64_t ss = seq_for(t, t->nbuckets).load(std::memory_order_acquire);
+    if ((s0 | s1 | ss) & 1) {
+      // A writer is in the middle of something
+      std::this_thread::yield();
+      continue;
+    }
+    bool found = false;
+    Data_T tmp{};
+    for (int i=0; i<2 && !found; ++i) {
+      Bucket &bk = t->buckets[b[i]];
+      for (size_t s=0; s<CUCKOO_SLOTS; ++s) {
+        if (bk.tag(s) == tag) {
+          tmp = bk.slot(s);
+          if (HC::val(tmp) == key) {
+            found = true;
+            break;
+          }
+        }
+      }
+    }
+    for (size_t s=0; s<CUCKOO_SLOTS && !found; ++s) {
+      if (t->stash.tag(s) == tag) {
+        tmp = t->stash.slot(s);
+        if (HC::val(tmp) == key) {
+          found = true;
+        }
+      }
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (seq_for(t, b[0]).load(std::memory_order_relaxed) == s0 &&
+        seq_for(t, b[1]).load(std::memory_order_relaxed) == s1 &&
+        seq_for(t, t->nbuckets).load(std::memory_order_relaxed) == ss &&
+        table.load(std::memory_order_relaxed) == t) {
+      if (found) {
+        *result = tmp;
+      }
+      return found;
+    }
+  }
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+bool CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::remove(Val_T key, Data_T *data) {
+  std::unique_lock<std::mutex> l(m, std::defer_lock);
+  if (CONCURRENT) {
+    l.lock();
+  }
+  Table *t = table.load(std::memory_order_relaxed);
+  size_t b, s;
+  if (!find(t, key, &b, &s)) {
+    return false;
+  }
+  *data = std::move(t->bucket(b).slot(s));
+  clear(t, b, s);
+  count--;
+  if (t->stashed) {
+    unstash(t);
+  }
+  check_sizedown();
+  return true;
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+bool CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::isempty(void) const {
+  return count == 0;
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+size_t CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::size(void) const {
+  return count;
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+size_t CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::stashed(void) const {
+  return table.load(std::memory_order_relaxed)->stashed;
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+void CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::resize(size_t s) {
+  std::unique_lock<std::mutex> l(m, std::defer_lock);
+  if (CONCURRENT) {
+    l.lock();
+  }
+  size_t nb = MIN_BUCKETS;
+  while (nb * CUCKOO_SLOTS < s) {
+    nb *= 2;
+  }
+  if (nb * CUCKOO_SLOTS < count) {
+    PANIC("CuckooHashTable resized too small for it's contents");
+  }
+  rebuild(nb);
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+void CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::check_sizeup(void) {
+  // If it's over 15/16ths full resize up
+  Table *t = table.load(std::memory_order_relaxed);
+  if ((count+1)*16 > t->nbuckets*CUCKOO_SLOTS*15) {
+    rebuild(t->nbuckets*2);
+  }
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+void CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::check_sizedown(void) {
+  // If it's under an eighth full resize down
+  // Concurrent mode keeps old tables around, so never shrinks
+  Table *t = table.load(std::memory_order_relaxed);
+  if (!CONCURRENT && t->nbuckets > MIN_BUCKETS && count*8 < t->nbuckets*CUCKOO_SLOTS) {
+    rebuild(t->nbuckets/2);
+  }
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+void CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::check(void) {
+  Table *t = table.load(std::memory_order_relaxed);
+  size_t full = 0;
+  size_t stashed = 0;
+  for (size_t b=0; b<=t->nbuckets; ++b) {
+    Bucket &bk = t->bucket(b);
+    for (size_t s=0; s<CUCKOO_SLOTS; ++s) {
+      if (!bk.tag(s)) {
+        continue;
+      }
+      full++;
+      Val_T key = HC::val(bk.slot(s));
+      uint64_t h = mix(key);
+      if (bk.tag(s) != tag_of(h)) {
+        PANIC("CuckooHashTable tag is wrong");
+      }
+      size_t b1 = h & (t->nbuckets - 1);
+      if (b == t->nbuckets) {
+        stashed++;
+      } else if (b != b1 && b != alt(t, b1, tag_of(h))) {
+        PANIC("CuckooHashTable element is in the wrong bucket");
+      }
+      size_t fb, fs;
+      if (!find(t, key, &fb, &fs) || fb != b || fs != s) {
+        PANIC("CuckooHashTable element can't be found");
+      }
+    }
+  }
+  if (full != count) {
+    PANIC("CuckooHashTable count is wrong");
+  }
+  if (stashed != t->stashed) {
+    PANIC("CuckooHashTable stash count is wrong");
+  }
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool CONCURRENT>
+void CuckooHashTable<Data_T, Val_T, HC, HP, CONCURRENT>::print(void) {
+  Table *t = table.load(std::memory_order_relaxed);
+  printf("[");
+  for (size_t b=0; b<=t->nbuckets; ++b) {
+    Bucket &bk = t->bucket(b);
+    if (b == t->nbuckets) {
+      printf("stash:");
+    }
+    printf("(");
+    for (size_t s=0; s<CUCKOO_SLOTS; ++s) {
+      if (!bk.tag(s)) {
+        printf("_,");
+      } else {
+        HC::printT(bk.slot(s));
+        printf(",");
+      }
+    }
+    printf("),");
+  }
+  printf("]\n");
+}
+
+#endif
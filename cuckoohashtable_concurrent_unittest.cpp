@@ -0,0 +1,170 @@
+#include <atomic>
+#include <thread>
+#include <stdio.h>
+#include <stdint.h>
+#include "cuckoohashtable.h"
+
+#define TEST_SIZE 20000
+#define THREADS 4
+// keys readers expect to always find
+#define STABLE 500
+
+// Two halves that have to match, so we notice a torn read
+struct Pair {
+  uint64_t key;
+  uint64_t check;
+};
+
+uint64_t check_of(uint64_t key) {
+  return ~key * 0x9E3779B97F4A7C15lu;
+}
+
+class PairComp {
+  public:
+    static const uint64_t val(const Pair p) {
+      return p.key;
+    }
+    static const int compare(const uint64_t v1, const uint64_t v2) {
+      if (v1 > v2) return 1;
+      if (v1 < v2) return -1;
+      return 0;
+    }
+    static size_t hash(uint64_t v) {
+      return v;
+    }
+    static void printT(const Pair p) {
+      printf("%lu", p.key);
+    }
+    static void printV(const uint64_t v) {
+      printf("%lu", v);
+    }
+};
+
+// COLLIDE keys with the same hash, more than fit in their two buckets, so
+// some have to go in the stash
+#define COLLIDE 10
+class CollideComp: public PairComp {
+  public:
+    static size_t hash(uint64_t v) {
+      return v < COLLIDE ? 0 : v;
+    }
+};
+
+typedef CuckooHashTable<Pair, uint64_t, PairComp, DefaultHash, true> HT;
+
+HT *ht;
+std::atomic<bool> done;
+
+Pair make(uint64_t key) {
+  Pair p;
+  p.key = key;
+  p.check = check_of(key);
+  return p;
+}
+
+// each writer owns keys == id mod THREADS above STABLE, and churns them
+void writer(int id) {
+  Pair p;
+  for (int round=0; round<5; ++round) {
+    for (uint64_t k=STABLE+id; k<STABLE+TEST_SIZE; k+=THREADS) {
+      if (!ht->insert(make(k))) {
+        PANIC("insert of a key we own failed");
+      }
+    }
+    for (uint64_t k=STABLE+id; k<STABLE+TEST_SIZE; k+=THREADS) {
+      if (!ht->get(k, &p) || p.key != k || p.check != check_of(k)) {
+        PANIC("writer lost a key it owns");
+      }
+    }
+    for (uint64_t k=STABLE+id; k<STABLE+TEST_SIZE; k+=THREADS) {
+      if (!ht->remove(k, &p) || p.check != check_of(k)) {
+        PANIC("remove of a key we own failed");
+      }
+    }
+  }
+}
+
+// the stable keys never change, so must always be there, and never torn
+// (they get moved around by other inserts, and by resizes)
+void reader() {
+  Pair p;
+  uint64_t k = 0;
+  while (!done.load()) {
+    if (!ht->get(k, &p)) {
+      PANIC("reader missed a stable key");
+    }
+    if (p.key != k || p.check != check_of(k)) {
+      PANIC("reader saw a torn element");
+    }
+    k = (k + 1) % STABLE;
+    // whatever the writers are doing, a get() must be self consistent
+    uint64_t w = STABLE + (k * 7919) % TEST_SIZE;
+    if (ht->get(w, &p) && (p.key != w || p.check != check_of(w))) {
+      PANIC("reader saw a torn element");
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  printf("Begin CuckooHashTable.h concurrent unittest\n");
+  Pair p;
+  uint64_t k;
+
+  // Colliding hashes, one thread, so we exercise the BFS and stash
+  CuckooHashTable<Pair, uint64_t, CollideComp> collide;
+  for (k=0; k<TEST_SIZE; ++k) {
+    if (!collide.insert(make(k))) {
+      PANIC("insert failed");
+    }
+  }
+  collide.check();
+  if (collide.stashed() == 0) {
+    PANIC("colliding keys didn't use the stash");
+  }
+  for (k=0; k<TEST_SIZE; ++k) {
+    if (!collide.get(k, &p) || p.check != check_of(k)) {
+      PANIC("get failed");
+    }
+  }
+  for (k=0; k<COLLIDE; k+=2) {
+    if (!collide.remove(k, &p) || p.key != k) {
+      PANIC("remove failed");
+    }
+    collide.check();
+  }
+  if (collide.stashed() != 0) {
+    PANIC("stash wasn't emptied back in to the table");
+  }
+  for (k=COLLIDE; k<TEST_SIZE; ++k) {
+    collide.remove(k, &p);
+  }
+  collide.check();
+
+  // Many threads, readers and writers at once
+  ht = new HT();
+  for (k=0; k<STABLE; ++k) {
+    ht->insert(make(k));
+  }
+  done = false;
+  std::thread writers[THREADS];
+  std::thread readers[THREADS];
+  for (int i=0; i<THREADS; ++i) {
+    writers[i] = std::thread(writer, i);
+    readers[i] = std::thread(reader);
+  }
+  for (int i=0; i<THREADS; ++i) {
+    writers[i].join();
+  }
+  done = true;
+  for (int i=0; i<THREADS; ++i) {
+    readers[i].join();
+  }
+  ht->check();
+  if (ht->size() != STABLE) {
+    PANIC("wrong size after threads finished");
+  }
+  delete ht;
+
+  printf("PASS\n");
+  return 0;
+}
@@ -17,9 +17,18 @@
  *
  * Threadsafety:
  *  Thread compatible
+ *
+ * Define BTREE_IMAGE before including this for Image, save() and load(), see
+ * btree_image.h. It's opt-in since it pulls in mmap and the other POSIX file
+ * headers.
  */ 
 
+#include <tuple>
+#include <utility>
 #include "btree.h"
+#ifdef BTREE_IMAGE
+#include "btree_image.h"
+#endif
 
 #ifndef DICT_H
 #define DICT_H
@@ -41,10 +50,21 @@ class Dict {
           return v1-v2;
         }
     };
-    BTree<std::pair<KT,VT>, KT, DictComp, DICT_ARITY> tree;
+    typedef BTree<std::pair<KT,VT>, KT, DictComp, DICT_ARITY> Tree;
+    Tree tree;
+    Dict(Tree &&t):tree(std::move(t)) {}
   public:
+    #ifdef BTREE_IMAGE
+    // A read-only, mmap'able copy of a Dict, see btree_image.h
+    typedef BTreeImage<std::pair<KT,VT>, KT, DictComp> Image;
+    #endif
     Dict():tree() {}
+    Dict(Dict &&d):tree(std::move(d.tree)) {}
     ~Dict() {}
+    Dict& operator=(Dict &&d) {
+      tree = std::move(d.tree);
+      return *this;
+    }
     VT* get(KT val) {
       auto ptr = tree.get(val);
       if (ptr) {
@@ -55,19 +75,36 @@ class Dict {
     void set(KT key, VT value) {
       auto *el = tree.get(key);
       if (el) {
-        el->second = value;
+        el->second = std::move(value);
       } else {
-        insert(key, value);
+        insert(key, std::move(value));
       }
     }
     bool insert(KT key, VT value) {
-      return tree.insert(std::pair<KT,VT>(key,value));
+      return tree.insert(std::pair<KT,VT>(key, std::move(value)));
+    }
+    // Builds the value from args, from then on it's only ever moved
+    template<typename... Args>
+    bool emplace(KT key, Args&&... args) {
+      return tree.insert(std::pair<KT,VT>(std::piecewise_construct,
+            std::forward_as_tuple(key),
+            std::forward_as_tuple(std::forward<Args>(args)...)));
     }
+    // Same, but doesn't build the value at all if key is already here
+    // (which costs an extra descent)
+    template<typename... Args>
+    bool try_emplace(KT key, Args&&... args) {
+      if (tree.get(key)) {
+        return false;
+      }
+      return emplace(key, std::forward<Args>(args)...);
+    }
+    // result may be nullptr, if you don't want the value back
     bool remove(KT key, VT *result) {
       std::pair<KT,VT> pair;
       bool found = tree.remove(key, &pair);
-      if (found) {
-        *result = pair.second;
+      if (found && result) {
+        *result = std::move(pair.second);
       }
       return found;
     }
@@ -86,6 +123,50 @@ class Dict {
     typename BTree<std::pair<KT,VT>, KT, DictComp, DICT_ARITY>::Iterator end() {
       return tree.end(); 
     }
+    // First element with key >= key
+    typename BTree<std::pair<KT,VT>, KT, DictComp, DICT_ARITY>::Iterator lower_bound(KT key) {
+      return tree.lower_bound(key);
+    }
+    // First element with key > key
+    typename BTree<std::pair<KT,VT>, KT, DictComp, DICT_ARITY>::Iterator upper_bound(KT key) {
+      return tree.upper_bound(key);
+    }
+    // Elements with keys in [lo, hi), e.g. for (auto &kv : d.range(lo, hi))
+    typename BTree<std::pair<KT,VT>, KT, DictComp, DICT_ARITY>::Range range(KT lo, KT hi) {
+      return tree.range(lo, hi);
+    }
+    // Merges by key, each is linear in both sizes and builds the result
+    // directly rather than inserting into it. VT must be copyable, and where
+    // both have a key the result gets a's value. With threads > 1 that many
+    // key ranges are merged at once.
+    static Dict set_union(const Dict &a, const Dict &b, size_t threads=1) {
+      return Dict(Tree::set_union(a.tree, b.tree, threads));
+    }
+    static Dict set_intersection(const Dict &a, const Dict &b, size_t threads=1) {
+      return Dict(Tree::set_intersection(a.tree, b.tree, threads));
+    }
+    // Keys in a that aren't in b
+    static Dict set_difference(const Dict &a, const Dict &b, size_t threads=1) {
+      return Dict(Tree::set_difference(a.tree, b.tree, threads));
+    }
+    // Adds our keys that dest doesn't have to dest, like insert() it doesn't
+    // change values dest already has. If this is much smaller than dest, a
+    // loop of dest.insert() is cheaper than rebuilding dest
+    void merge_into(Dict &dest, size_t threads=1) const {
+      dest.tree = Tree::set_union(dest.tree, tree, threads);
+    }
+    #ifdef BTREE_IMAGE
+    // Write us out for Image::map(), KT and VT must be trivially copyable
+    bool save(const char *path) const {
+      return Image::save(path, tree.begin(), tree.end());
+    }
+    // Add everything in image, e.g. to get a mutable copy of a mapped Image
+    void load(const Image &image) {
+      for (auto it = image.begin(); it != image.end(); ++it) {
+        tree.insert(*it);
+      }
+    }
+    #endif
 };
 
 #endif
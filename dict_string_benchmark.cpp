@@ -0,0 +1,88 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * Benchmark for a Dict with std::string values, which is where copying T
+ * around in the btree really hurts. We insert TEST_SIZE keys in random order,
+ * look each one up, then remove them all, and count how many times the
+ * values got copied and moved along the way.
+ *
+ * Values are longer than the small string optimization, so every copy is a
+ * malloc and a memcpy, and every move is just a few pointers.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string>
+#include "panic.h"
+#include "timer.h"
+#include "dict.h"
+
+#ifndef TEST_SIZE
+#define TEST_SIZE 1000000
+#endif
+
+uint64_t copies = 0;
+uint64_t moves = 0;
+
+// A std::string that counts copies and moves
+class Value {
+  public:
+    std::string s;
+    Value() {}
+    Value(const std::string &str):s(str) {}
+    Value(const Value &other):s(other.s) {
+      copies++;
+    }
+    Value(Value &&other):s(std::move(other.s)) {
+      moves++;
+    }
+    Value& operator=(const Value &other) {
+      s = other.s;
+      copies++;
+      return *this;
+    }
+    Value& operator=(Value &&other) {
+      s = std::move(other.s);
+      moves++;
+      return *this;
+    }
+};
+
+int keys[TEST_SIZE];
+
+int main(int argc, char* argv[]) {
+  printf("Dict.h string values ");
+  Dict<int, Value> dict;
+  for (int i=0; i<TEST_SIZE; ++i) {
+    keys[i] = i;
+  }
+  // Note, we did not initialize rand, this is purposeful
+  for (int i=TEST_SIZE-1; i>0; --i) {
+    std::swap(keys[i], keys[rand() % (i+1)]);
+  }
+  std::string base(40, 'x');
+
+  timeb t1, t2;
+  ftime(&t1);
+  for (int i=0; i<TEST_SIZE; ++i) {
+    dict.insert(keys[i], Value(base));
+  }
+  size_t total = 0;
+  for (int i=0; i<TEST_SIZE; ++i) {
+    Value *v = dict.get(keys[i]);
+    if (!v) {
+      PANIC("dict lost a value");
+    }
+    total += v->s.size();
+  }
+  Value junk;
+  for (int i=0; i<TEST_SIZE; ++i) {
+    dict.remove(keys[i], &junk);
+  }
+  ftime(&t2);
+  if (total != base.size() * TEST_SIZE || !dict.isempty()) {
+    PANIC("dict contents are wrong");
+  }
+  printf("test_size=%d time=%lf copies_per_element=%.2lf moves_per_element=%.2lf\n", TEST_SIZE, tdiff(t2,t1), (double) copies / TEST_SIZE, (double) moves / TEST_SIZE);
+  return 0;
+}
@@ -1,4 +1,9 @@
+#include <memory>
 #include <stdio.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#define BTREE_IMAGE
 #include "dict.h"
 
 int main(int argc, char *argv[]) {
@@ -93,6 +98,214 @@ int main(int argc, char *argv[]) {
     }
     ++i;
   }
+
+  // Test range queries
+  if (d.lower_bound(50)->first != 50 || d.upper_bound(50)->first != 51) {
+    PANIC("lower_bound/upper_bound broken");
+  }
+  if (d.lower_bound(100) != d.end()) {
+    PANIC("lower_bound past the end isn't end()");
+  }
+  i = 20;
+  for (auto &kv : d.range(20, 30)) {
+    if (kv.first != i || kv.second != i) {
+      PANIC("Dict range broken");
+    }
+    ++i;
+  }
+  if (i != 30) {
+    PANIC("Dict range missed elements");
+  }
+
+  // Test values that are expensive to copy, with enough of them to split
+  // and merge plenty of nodes
+  Dict<int, std::string> sd;
+  for (i=0; i<2000; i++) {
+    if (!sd.insert(i, std::to_string(i) + std::string(40, 'x'))) {
+      PANIC("string insert failed");
+    }
+  }
+  if (sd.try_emplace(5, 40, 'y') || sd.emplace(5, 40, 'y')) {
+    PANIC("emplace over an existing key succeeded");
+  }
+  if (!sd.try_emplace(2000, 40, 'y') || !sd.emplace(2001, 40, 'z')) {
+    PANIC("emplace failed");
+  }
+  if (*sd.get(2000) != std::string(40, 'y') || *sd.get(2001) != std::string(40, 'z')) {
+    PANIC("emplace built the wrong value");
+  }
+  sd.set(2000, "set");
+  for (i=0; i<2002; i++) {
+    std::string s;
+    if (!sd.remove(i, &s)) {
+      PANIC("string remove failed");
+    }
+    if (i < 2000 && s != std::to_string(i) + std::string(40, 'x')) {
+      PANIC("string value was mangled");
+    }
+    if (i == 2000 && s != "set") {
+      PANIC("set didn't replace the string");
+    }
+  }
+  if (!sd.isempty()) {
+    PANIC("Not empty");
+  }
+
+  // Test a move-only value type
+  Dict<int, std::unique_ptr<int>> ud;
+  for (i=0; i<2000; i++) {
+    if (!ud.insert(i, std::unique_ptr<int>(new int(i)))) {
+      PANIC("unique_ptr insert failed");
+    }
+  }
+  if (!ud.emplace(2000, new int(2000)) || ud.try_emplace(0, std::unique_ptr<int>(new int(-1)))) {
+    PANIC("unique_ptr emplace is broken");
+  }
+  for (i=0; i<=2000; i+=2) {
+    if (!ud.remove(i, nullptr)) {
+      PANIC("unique_ptr remove without a result failed");
+    }
+  }
+  for (i=1; i<2000; i+=2) {
+    std::unique_ptr<int> p;
+    if (!ud.remove(i, &p) || !p || *p != i) {
+      PANIC("unique_ptr value was mangled");
+    }
+  }
+  if (!ud.isempty()) {
+    PANIC("Not empty");
+  }
+
+  // Save an image, big enough for a few levels of inner nodes, and map it
+  // back in. Odd keys are misses.
+  const char *path = "/tmp/dict_unittest.img";
+  Dict<int, int> id;
+  for (i=0; i<200000; i+=2) {
+    id.insert(i, -i);
+  }
+  if (!id.save(path)) {
+    PANIC("save failed");
+  }
+  Dict<int, int>::Image image;
+  if (!image.map(path)) {
+    PANIC("map failed");
+  }
+  if (image.size() != 100000) {
+    PANIC("image has the wrong size");
+  }
+  for (i=-1; i<=200000; i++) {
+    auto kv = image.get(i);
+    if (i >= 0 && i < 200000 && i % 2 == 0) {
+      if (!kv || kv->first != i || kv->second != -i) {
+        PANIC("image lost an element");
+      }
+    } else if (kv) {
+      PANIC("image has an element it shouldn't");
+    }
+    auto lb = image.lower_bound(i);
+    int want = i < 0 ? 0 : (i + 1) / 2 * 2;
+    if (want >= 200000 ? lb != image.end() : (lb == image.end() || lb->first != want)) {
+      PANIC("image lower_bound is wrong");
+    }
+  }
+  i = 0;
+  for (auto it = image.begin(); it != image.end(); ++it) {
+    if (it->first != i) {
+      PANIC("image iterator is wrong");
+    }
+    i += 2;
+  }
+  if (i != 200000) {
+    PANIC("image iterator skipped elements");
+  }
+  // A truncated or inconsistent image is rejected up front, rather than read
+  // out of bounds later. The header is 9 uint64_t's: magic, t_size, val_size,
+  // page, count, leaves, pages, root, height.
+  FILE *f = fopen(path, "rb");
+  std::vector<uint64_t> raw(image.size() * sizeof(std::pair<int,int>));
+  size_t len = fread(raw.data(), 1, raw.size() * sizeof(uint64_t), f);
+  fclose(f);
+  Dict<int, int>::Image bad;
+  if (!bad.load(raw.data(), len) || bad.load(raw.data(), len - BTREE_IMAGE_PAGE) ||
+      bad.load(raw.data(), len - 1)) {
+    PANIC("truncated image was accepted");
+  }
+  for (size_t field : {4, 5, 6, 7, 8}) {
+    uint64_t was = raw[field];
+    // pages*BTREE_IMAGE_PAGE wraps around to len, the last leaf has room
+    // for one more, so double count
+    raw[field] = field == 6 ? was + (1lu << 52) : field == 4 ? was * 2 : was + 1;
+    if (bad.load(raw.data(), len)) {
+      PANIC("inconsistent image header was accepted");
+    }
+    raw[field] = was;
+  }
+  if (!bad.load(raw.data(), len) || bad.get(2)->second != -2) {
+    PANIC("image didn't survive the corruption test");
+  }
+  // and back to a mutable Dict
+  Dict<int, int> loaded;
+  loaded.load(image);
+  for (i=0; i<200000; i+=2) {
+    if (!loaded.get(i) || *loaded.get(i) != -i || !id.remove(i, nullptr)) {
+      PANIC("load lost an element");
+    }
+  }
+  // An empty dict makes an empty image
+  if (!id.save(path) || !image.map(path) || !image.isempty() ||
+      image.begin() != image.end() || image.get(0)) {
+    PANIC("empty image isn't empty");
+  }
+  // Garbage isn't an image
+  f = fopen(path, "wb");
+  fprintf(f, "not an image");
+  fclose(f);
+  if (image.map(path) || image.get(0)) {
+    PANIC("mapped garbage");
+  }
+  unlink(path);
+  if (image.map(path)) {
+    PANIC("mapped a missing file");
+  }
+
+  // Bulk merges by key, where both have a key values come from the first
+  Dict<int, std::string> a;
+  Dict<int, std::string> b;
+  for (i=0; i<20000; i++) {
+    a.insert(i*2, "a");
+    b.insert(i*3, "b");
+  }
+  for (size_t threads : {1, 4}) {
+    auto u = Dict<int, std::string>::set_union(a, b, threads);
+    auto in = Dict<int, std::string>::set_intersection(a, b, threads);
+    auto diff = Dict<int, std::string>::set_difference(a, b, threads);
+    for (i=0; i<60000; i++) {
+      bool ina = i % 2 == 0 && i < 40000;
+      bool inb = i % 3 == 0;
+      const char *want = ina ? "a" : "b";
+      if (!!u.get(i) != (ina || inb) || (u.get(i) && *u.get(i) != want)) {
+        PANIC("set_union doesn't work");
+      }
+      if (!!in.get(i) != (ina && inb) || (in.get(i) && *in.get(i) != "a")) {
+        PANIC("set_intersection doesn't work");
+      }
+      if (!!diff.get(i) != (ina && !inb)) {
+        PANIC("set_difference doesn't work");
+      }
+    }
+  }
+  // merge_into keeps dest's values, like insert()
+  b.merge_into(a, 2);
+  for (i=0; i<60000; i++) {
+    bool ina = i % 2 == 0 && i < 40000;
+    bool inb = i % 3 == 0;
+    if (!!a.get(i) != (ina || inb) || (a.get(i) && *a.get(i) != (ina ? "a" : "b"))) {
+      PANIC("merge_into doesn't work");
+    }
+  }
+  if (!a.insert(-1, "c") || !a.remove(0, nullptr) || !b) {
+    PANIC("dict built by a merge doesn't take inserts and removes");
+  }
   printf("PASS\n");
 }
 
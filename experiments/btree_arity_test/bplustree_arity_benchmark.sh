@@ -0,0 +1,13 @@
+#!/bin/bash 
+# btree.h against bplustree.h at each arity, plain and with range scans
+# run from the top of the repo
+for x in $(seq 5 5 200); do
+  echo ARITY: ${x}
+  for b in btree bplustree btree_range bplustree_range; do
+    make -s -B ${b}_benchmark BTREE_ARITY=${x} > /dev/null 2>&1 && ./${b}_benchmark
+  done
+done > experiments/btree_arity_test/bplustree_arity_test.txt 2>&1
+rm -f btree_benchmark bplustree_benchmark btree_range_benchmark bplustree_range_benchmark
+# prep the data for graphing, arity then the 4 times
+cat experiments/btree_arity_test/bplustree_arity_test.txt | awk '/ARITY/{printf "\n%s", $2} /time=/{for (i=1; i<=NF; i++) if ($i ~ /^time=/) printf " %s", substr($i, 6)}' > data
+gnuplot -e 'plot "data" using 1:2 with lines title "btree", "data" using 1:3 with lines title "bplustree", "data" using 1:4 with lines title "btree range", "data" using 1:5 with lines title "bplustree range"; pause -1'
@@ -0,0 +1,88 @@
+/* Memory use per element of ochashtable.h vs compactochashtable.h
+ *
+ * Build from the top of the repo:
+ *  g++ -O3 -std=c++11 -I. experiments/datastructure_size_comparison/bytes_per_element.cpp -o bytes_per_element
+ *
+ * Nodes are allocated one at a time with new, the way most users will,
+ * so "node" includes malloc's own overhead, not just sizeof().
+ * Heap use is measured with mallinfo2(), big arrays are mmap'd so we count
+ * those too.
+ */
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include "ochashtable.h"
+#include "compactochashtable.h"
+
+size_t heap() {
+  struct mallinfo2 m = mallinfo2();
+  return m.uordblks + m.hblkhd;
+}
+
+template <typename Key_T>
+class OCNode: public OCHashTableNode_base<OCNode<Key_T>> {
+  public:
+    Key_T value;
+    OCNode(Key_T v): value(v) {}
+    const Key_T val(void) const {
+      return value;
+    }
+    static size_t hash(Key_T v) {
+      return v;
+    }
+    static int compare(const Key_T v1, const Key_T v2) {
+      return v1 < v2 ? -1 : v1 > v2;
+    }
+};
+
+template <typename Key_T>
+class CompactNode: public CompactOCHashTableNode_base<CompactNode<Key_T>> {
+  public:
+    Key_T value;
+    CompactNode(Key_T v): value(v) {}
+    const Key_T val(void) const {
+      return value;
+    }
+    static size_t hash(Key_T v) {
+      return v;
+    }
+    static int compare(const Key_T v1, const Key_T v2) {
+      return v1 < v2 ? -1 : v1 > v2;
+    }
+};
+
+template <typename Table_T, typename Node_T>
+void measure(const char *name, size_t n) {
+  std::vector<Node_T*> nodes(n);
+  size_t h0 = heap();
+  for (size_t i=0; i<n; ++i) {
+    nodes[i] = new Node_T(i * 2654435761lu);
+  }
+  size_t h1 = heap();
+  Table_T *t = new Table_T();
+  for (size_t i=0; i<n; ++i) {
+    t->insert(nodes[i]);
+  }
+  size_t h2 = heap();
+  double node = (double) (h1 - h0) / n;
+  double buckets = (double) (h2 - h1) / n;
+  printf("%-28s n=%-8lu sizeof(node)=%-3lu node=%5.1lf buckets=%5.1lf total=%5.1lf bytes/element\n",
+      name, n, sizeof(Node_T), node, buckets, node + buckets);
+  for (size_t i=0; i<n; ++i) {
+    t->remove(nodes[i]);
+    delete nodes[i];
+  }
+  delete t;
+}
+
+int main() {
+  size_t sizes[] = {1000000, 1500000};
+  for (size_t n : sizes) {
+    measure<OCHashTable<OCNode<uint64_t>, uint64_t>, OCNode<uint64_t>>("OCHashTable uint64_t", n);
+    measure<CompactOCHashTable<CompactNode<uint64_t>, uint64_t>, CompactNode<uint64_t>>("CompactOCHashTable uint64_t", n);
+    measure<OCHashTable<OCNode<uint32_t>, uint32_t>, OCNode<uint32_t>>("OCHashTable uint32_t", n);
+    measure<CompactOCHashTable<CompactNode<uint32_t>, uint32_t>, CompactNode<uint32_t>>("CompactOCHashTable uint32_t", n);
+  }
+  return 0;
+}
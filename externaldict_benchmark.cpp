@@ -20,6 +20,21 @@
 #ifndef TEST_SIZE
 #define TEST_SIZE 100
 #endif
+// Extra lookups of (almost certainly) missing keys per insert
+#ifndef MISSES
+#define MISSES 0
+#endif
+// Range scans per iteration, once the dict is full (ordered dicts only)
+// each reads RANGE_LENGTH elements from lower_bound() of a random key
+#ifndef RANGE_SCANS
+#define RANGE_SCANS 0
+#endif
+#ifndef RANGE_LENGTH
+#define RANGE_LENGTH 16
+#endif
+// MEASURE_LATENCY times every insert and remove, and reports the max and
+// p999. This slows everything down a bit, so don't compare the times.
+// INCREMENTAL_REHASH uses the incremental resize mode of ochashtable
 
 #ifdef TEST_AVL
 #include "avl.h"
@@ -33,6 +48,10 @@ class Node: public AVLHashTableNode_base<Node, uint64_t> {
 #include "boundedhashtable.h"
 class Node: public BoundedHashTableNode_base<Node, uint64_t> {
 #endif
+#ifdef TEST_FASTBOUNDEDHASHTABLE
+#include "fastboundedhashtable.h"
+class Node: public FastBoundedHashTableNode_base<Node, uint64_t> {
+#endif
 #ifdef TEST_DLIST
 #include "dlist.h"
 class Node: public DListNode_base<Node> {
@@ -41,6 +60,10 @@ class Node: public DListNode_base<Node> {
 #include "ochashtable.h"
 class Node: public OCHashTableNode_base<Node> {
 #endif
+#ifdef TEST_COMPACTOCHASHTABLE
+#include "compactochashtable.h"
+class Node: public CompactOCHashTableNode_base<Node> {
+#endif
 #ifdef TEST_REDBLACK
 #include "redblack.h"
 class Node: public RedBlackNode_base<Node, uint64_t> {
@@ -85,9 +108,18 @@ Node *nodes = new Node[TEST_SIZE];
 
 int main(int argc, char* argv[]) {
   #ifdef TEST_OCHASHTABLE
+  #ifdef INCREMENTAL_REHASH
+  printf("OCHashTable.h (incremental) ");
+  OCHashTable<Node, uint64_t, DefaultHash, true> hash;
+  #else
   printf("OCHashTable.h ");
   OCHashTable<Node, uint64_t> hash;
   #endif
+  #endif
+  #ifdef TEST_COMPACTOCHASHTABLE
+  printf("CompactOCHashTable.h ");
+  CompactOCHashTable<Node, uint64_t> hash;
+  #endif
   #ifdef TEST_AVLHASHTABLE
   printf("AVLHashTable.h ");
   AVLHashTable<Node, uint64_t> hash;
@@ -96,6 +128,10 @@ int main(int argc, char* argv[]) {
   printf("AVL.h ");
   AVL<Node, uint64_t> hash;
   #endif
+  #ifdef TEST_FASTBOUNDEDHASHTABLE
+  printf("FastBoundedHashTable.h ");
+  FastBoundedHashTable<Node, uint64_t> hash;
+  #endif
   #ifdef TEST_BOUNDEDHASHTABLE
   printf("BoundedHashTable.h ");
   BoundedHashTable<Node, uint64_t> hash;
@@ -124,7 +160,15 @@ int main(int argc, char* argv[]) {
   //time_t t1 = time(nullptr);
   size_t j;
   uint64_t get_count=0;
+  uint64_t miss_count=0;
   uint64_t insert_count=0;
+  #if RANGE_SCANS
+  uint64_t scan_count=0;
+  #endif
+  #ifdef MEASURE_LATENCY
+  Latency insert_latency, remove_latency;
+  uint64_t start;
+  #endif
   for (j=0; j<TEST_ITERATIONS; j++) {
     ints_end=0;
     size_t i;
@@ -145,6 +189,10 @@ int main(int argc, char* argv[]) {
         new_v = (!hash.get(r)); 
         get_count++;
       }
+      for (size_t m=0; m<MISSES; m++) {
+        // use the result, so this can't be optimized out
+        miss_count += !hash.get(rand()*rand());
+      }
       insert_count++;
       // put it in thet hash
       #ifdef USE_MALLOC
@@ -153,10 +201,25 @@ int main(int argc, char* argv[]) {
       Node *n = &(nodes[ni++]); 
       #endif
       n->set(r);
+      #ifdef MEASURE_LATENCY
+      start = now_ns();
       hash.insert(n);
+      insert_latency.record(now_ns() - start);
+      #else
+      hash.insert(n);
+      #endif
       // and in the list
       ints[ints_end++] = r;
     }
+    #if RANGE_SCANS
+    for (size_t s=0; s<RANGE_SCANS; s++) {
+      size_t k = 0;
+      for (auto it = hash.lower_bound(rand()*rand()); it != hash.end() && k < RANGE_LENGTH; ++it, ++k) {
+        // use the result, so this can't be optimized out
+        scan_count += it->val() & 1;
+      }
+    }
+    #endif
     for(i=0; i<ints_end; i++) {
       uint64_t v = ints[i];
       #ifdef TEST_RREDBLACK
@@ -168,7 +231,13 @@ int main(int argc, char* argv[]) {
       #else
       // Everything else uses the node we get
       auto n = hash.get(v);
+      #ifdef MEASURE_LATENCY
+      start = now_ns();
       hash.remove(n);
+      remove_latency.record(now_ns() - start);
+      #else
+      hash.remove(n);
+      #endif
       #endif
       #ifdef USE_MALLOC
       delete n;
@@ -178,6 +247,15 @@ int main(int argc, char* argv[]) {
   ftime(&t2);
   double t = tdiff(t2,t1); 
   //time_t t2 = time(nullptr);
-  printf("time=%lf insert=%ld get=%ld\n", t, insert_count, get_count);
+  printf("time=%lf insert=%ld get=%ld misses=%ld", t, insert_count, get_count, miss_count);
+  #if RANGE_SCANS
+  printf(" range_scans=%d range_length=%d odd=%lu", RANGE_SCANS, RANGE_LENGTH, scan_count);
+  #endif
+  #ifdef MEASURE_LATENCY
+  printf(" insert_max_ns=%lu insert_p999_ns<=%lu remove_max_ns=%lu remove_p999_ns<=%lu",
+      insert_latency.max, insert_latency.percentile(0.999),
+      remove_latency.max, remove_latency.percentile(0.999));
+  #endif
+  printf("\n");
   return 0;
 }
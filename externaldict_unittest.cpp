@@ -8,6 +8,7 @@
  * datastructures have the same API (Except where it really isn't a good idea)
  */
 
+#include <algorithm>
 #include <stdio.h>
 #include "panic.h"
 #include "dlist.h"
@@ -21,8 +22,12 @@
 #define DEBUG_AVL
 #include "avl.h"
 #define SORTED_ITERATOR
+#ifdef ORDER_STATISTICS
+class Node: public AVLCountedNode_base<Node, int> {
+#else
 class Node: public AVLNode_base<Node, int> {
 #endif
+#endif
 #ifdef TEST_AVLHASHTABLE
 // This turns on rather expensive internal consistancy checking
 #define DEBUG_AVLHASHTABLE
@@ -36,12 +41,21 @@ class Node: public AVLHashTableNode_base<Node, int> {
 class Node: public BoundedHashTableNode_base<Node, int> {
 #endif
 
+#ifdef TEST_FASTBOUNDEDHASHTABLE
+#include "fastboundedhashtable.h"
+class Node: public FastBoundedHashTableNode_base<Node, int> {
+#endif
+
 #ifdef TEST_OCHASHTABLE
 // This turns on rather expensive internal consistancy checking
 #define DEBUG_OCHASHTABLE
 #include "ochashtable.h"
 class Node: public OCHashTableNode_base<Node> {
 #endif
+#ifdef TEST_COMPACTOCHASHTABLE
+#include "compactochashtable.h"
+class Node: public CompactOCHashTableNode_base<Node> {
+#endif
 #ifdef TEST_REDBLACK
 // This turns on rather expensive internal consistancy checking
 #define DEBUG_REDBLACK
@@ -109,13 +123,30 @@ class TNode: public DListNode_base<TNode> {
 
 template<typename DT>
 void check(DT *dict, DList<TNode,int> *tdict) {
+  #ifdef ORDER_STATISTICS
+  // rank() and select() should agree with each other for every element
+  size_t n = 0;
+  #endif
   auto i = tdict->begin();
   for (; i != tdict->end(); i++) {
     if(!dict->get(i->val())) {
       printf("value = %d\n", i->val());
       PANIC("Element not in dict anymore!");
     }
+    #ifdef ORDER_STATISTICS
+    n++;
+    auto s = dict->select(dict->rank(i->val()));
+    if (!s || s->val() != i->val()) {
+      printf("value = %d\n", i->val());
+      PANIC("select(rank()) doesn't find the element");
+    }
+    #endif
+  }
+  #ifdef ORDER_STATISTICS
+  if (dict->size() != n || dict->select(n)) {
+    PANIC("dict has the wrong size");
   }
+  #endif
   auto j = dict->begin();
   for (; j != dict->end(); j++) {
     if (!tdict->get(j->val())) {
@@ -129,16 +160,32 @@ int main(int argc, char* argv[]) {
   DList<TNode, int> tdict;
   #ifdef TEST_OCHASHTABLE
   printf("Begin OCHashTable.h unittest\n");
+  #ifdef INCREMENTAL_REHASH
+  OCHashTable<Node, int, DefaultHash, true> dict;
+  #else
   OCHashTable<Node, int> dict;
   #endif
+  #endif
+  #ifdef TEST_COMPACTOCHASHTABLE
+  printf("Begin CompactOCHashTable.h unittest\n");
+  CompactOCHashTable<Node, int> dict;
+  #endif
   #ifdef TEST_AVLHASHTABLE
   printf("Begin AVLHashTable.h unittest\n");
   AVLHashTable<Node, int> dict;
   #endif
   #ifdef TEST_AVL
+  #ifdef ORDER_STATISTICS
+  printf("Begin counted AVL.h unittest\n");
+  #else
   printf("Begin AVL.h unittest\n");
+  #endif
   AVL<Node, int> dict;
   #endif
+  #ifdef TEST_FASTBOUNDEDHASHTABLE
+  printf("Begin FastBoundedHashTable.h unittest\n");
+  FastBoundedHashTable<Node, int> dict;
+  #endif
   #ifdef TEST_BOUNDEDHASHTABLE
   printf("Begin BoundedHashTable.h unittest\n");
   BoundedHashTable<Node, int> dict;
@@ -284,5 +331,138 @@ int main(int argc, char* argv[]) {
     a = dict.begin();
   }
   #endif
+  #ifdef TEST_AVL
+  // Range queries, on the even numbers so we probe both hits and misses
+  for (i=0; i<1000; i+=2) {
+    dict.insert(new Node(i));
+  }
+  for (int v=-1; v<=1000; ++v) {
+    int lower = v < 0 ? 0 : (v + 1) / 2 * 2;
+    int upper = v < 0 ? 0 : v / 2 * 2 + 2;
+    auto l = dict.lower_bound(v);
+    if (lower >= 1000 ? l != dict.end() : (l == dict.end() || l->val() != lower)) {
+      PANIC("lower_bound is wrong");
+    }
+    auto u = dict.upper_bound(v);
+    if (upper >= 1000 ? u != dict.end() : (u == dict.end() || u->val() != upper)) {
+      PANIC("upper_bound is wrong");
+    }
+    // The iterator we get has to carry on just like one from begin()
+    int expect = lower;
+    for (; l != dict.end(); ++l) {
+      if (l->val() != expect) {
+        PANIC("iterating from lower_bound is wrong");
+      }
+      expect += 2;
+    }
+    if (expect < 1000) {
+      PANIC("iterating from lower_bound stopped early");
+    }
+    int count = 0;
+    for (auto &r : dict.range(v, v + 10)) {
+      if (r.val() < v || r.val() >= v + 10) {
+        PANIC("range returned something out of range");
+      }
+      count++;
+    }
+    int want = 0;
+    for (int k = std::max(v, 0); k < std::min(v + 10, 1000); ++k) {
+      want += k % 2 == 0;
+    }
+    if (count != want) {
+      PANIC("range missed elements");
+    }
+  }
+  for (auto &r : dict.range(10, 10)) {
+    r.print();
+    PANIC("empty range isn't empty");
+  }
+  #ifdef ORDER_STATISTICS
+  // Order statistics, again probing both hits and misses
+  for (int v=-1; v<=1000; ++v) {
+    size_t want = v < 0 ? 0 : (v + 1) / 2;
+    if (dict.rank(v) != std::min(want, (size_t) 500)) {
+      printf("rank(%d) = %ld\n", v, dict.rank(v));
+      PANIC("rank is wrong");
+    }
+  }
+  for (size_t k=0; k<500; ++k) {
+    n = dict.select(k);
+    if (!n || n->val() != (int) k * 2) {
+      PANIC("select is wrong");
+    }
+  }
+  if (dict.select(500)) {
+    PANIC("select past the end returned something");
+  }
+  #endif
+  for (i=0; i<1000; i+=2) {
+    n = dict.get(i);
+    dict.remove(n);
+    delete n;
+  }
+  // Hinted inserts, ascending keys at end(), then the odd ones just before
+  // the next even one
+  for (i=0; i<1000; i+=2) {
+    if (!dict.insert_hint(dict.end(), new Node(i))) {
+      PANIC("insert_hint at end() failed");
+    }
+  }
+  for (i=1; i<1000; i+=2) {
+    auto hint = dict.lower_bound(i + 1);
+    if (!dict.insert_hint(hint, new Node(i))) {
+      PANIC("insert_hint failed");
+    }
+  }
+  auto hint = dict.lower_bound(500);
+  n = new Node(5000);
+  Node dup(500);
+  if (!dict.insert_hint(hint, n) || dict.insert_hint(hint, &dup)) {
+    PANIC("insert_hint with a bad hint failed");
+  }
+  dict.checkAll();
+  i = 0;
+  for (auto &r : dict) {
+    if (r.val() != (i < 1000 ? i : 5000)) {
+      PANIC("insert_hint put something in the wrong place");
+    }
+    i++;
+  }
+  if (i != 1001) {
+    PANIC("insert_hint lost nodes");
+  }
+  #ifdef ORDER_STATISTICS
+  if (dict.size() != 1001) {
+    PANIC("insert_hint got the counts wrong");
+  }
+  #endif
+  while (!dict.isempty()) {
+    n = &(*dict.begin());
+    dict.remove(n);
+    delete n;
+  }
+  #endif
+  #if defined(TEST_OCHASHTABLE) || defined(TEST_COMPACTOCHASHTABLE)
+  // Batched lookups match get(), hits and misses (odd keys aren't there)
+  int keys[1000];
+  Node *found[1000];
+  for (i=0; i<1000; i++) {
+    keys[i] = i;
+    if (i % 2 == 0) {
+      dict.insert(new Node(i));
+    }
+  }
+  dict.get_batch(keys, 1000, found);
+  for (i=0; i<1000; i++) {
+    if (found[i] != dict.get(i) || (found[i] && found[i]->val() != i)) {
+      PANIC("get_batch doesn't match get");
+    }
+  }
+  for (i=0; i<1000; i+=2) {
+    n = dict.get(i);
+    dict.remove(n);
+    delete n;
+  }
+  #endif
   printf("PASS\n");
 }
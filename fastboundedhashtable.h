@@ -0,0 +1,491 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * A hashtable with the same worst case bounds as boundedhashtable.h, but with
+ * average case speed close to ochashtable.h.
+ *
+ * boundedhashtable.h is slow because every bucket is an AVL tree, every node
+ * is also on a DList (so we can find one to rehash), and the buckets live in a
+ * ZeroArray, which adds two indirections to every access. Instead:
+ * 1) A bucket holds FASTBOUNDED_INLINE node pointers inline, and only spills
+ * in to an AVL tree once those are full. At our load factors the tree is
+ * almost never used, but a bucket full of collisions is still O(log(n)).
+ * 2) Bucket arrays come straight from mmap. Anonymous pages start out zeroed,
+ * and an all zero bucket is an empty bucket, so a new table is "zeroed" in
+ * constant time, the OS zeroes each page the first time we touch it.
+ * 3) Resizes are incremental, like boundedhashtable, but to find nodes to
+ * rehash we walk the old table with a cursor instead of keeping a list. Each
+ * insert or remove does a bounded amount of that work (moving one node or
+ * skipping FASTBOUNDED_SCAN empty buckets, FASTBOUNDED_REHASH_STEP times).
+ *
+ * When to use this:
+ *   If you want a hashtable, but can't afford the occasional linear
+ *   operation of ochashtable.h (e.g. you care about tail latency)
+ *
+ * Assumption: mmap/munmap and page faults are constant time
+ * Given this assumption:
+ * worst case: O(log(n)) insert, remove, get
+ * average case: O(1) insert, remove, get
+ *
+ * The API matches boundedhashtable.h, FastFixedHashTable is a drop in for
+ * FixedHashTable.
+ *
+ * HP is the hashing policy, see hash.h
+ *
+ * resizes up when it has more elements than buckets
+ * resizes down when it has less than 1/4 as many elements as buckets
+ * and never starts a resize while the last one is still going
+ *
+ * Threadsafety:
+ *   thead compatible
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include "panic.h"
+#include "avl.h"
+#include "hash.h"
+
+#ifndef FAST_BOUNDED_HASHTABLE_H
+#define FAST_BOUNDED_HASHTABLE_H
+
+#define FASTBOUNDED_MINSIZE 4
+// Node pointers kept inline in each bucket before we spill to an AVL tree
+// 3 pointers + the tree's root is 32 bytes, 2 buckets per cacheline
+#define FASTBOUNDED_INLINE 3
+// Empty buckets getOne() will skip before giving up
+#define FASTBOUNDED_SCAN 4
+// getOne() calls per insert/remove during a resize
+#define FASTBOUNDED_REHASH_STEP 2
+
+template <typename Node_T, typename Val_T, typename HP=DefaultHash>
+class FastFixedHashTable {
+  private:
+    // All zero is an empty bucket (AVL is just a root pointer)
+    // slots are packed to the front, and overflow is only used when all
+    // slots are full, so a lookup can stop at the first nullptr
+    struct Bucket {
+      Node_T *slots[FASTBOUNDED_INLINE];
+      AVL<Node_T, Val_T> overflow;
+    };
+    // See hash.h
+    uint64_t seed;
+    Bucket *table;
+    size_t length;
+    size_t bytes;
+    size_t count;
+    // Every bucket below this is empty, see getOne()
+    size_t next;
+    void unmap(void);
+  public:
+    class Iterator {
+      private:
+        const FastFixedHashTable<Node_T, Val_T, HP> *t;
+        size_t i;
+        // index in to slots, or FASTBOUNDED_INLINE if we're in the overflow
+        size_t j;
+        typename AVL<Node_T, Val_T>::Iterator it;
+        void skip() {
+          while (i < t->length) {
+            Bucket &b = t->table[i];
+            if (j < FASTBOUNDED_INLINE) {
+              if (b.slots[j]) {
+                return;
+              }
+            } else if (it != b.overflow.end()) {
+              return;
+            }
+            // slots are packed, if we hit a nullptr there's nothing left here
+            i++;
+            j = 0;
+          }
+        }
+      public:
+        Iterator(const FastFixedHashTable<Node_T, Val_T, HP> *_t, size_t _i) {
+          t = _t;
+          i = _i;
+          j = 0;
+          skip();
+        }
+        Iterator(const Iterator& other) {
+          t = other.t;
+          i = other.i;
+          j = other.j;
+          it = other.it;
+        }
+        Iterator& operator=(const Iterator& other) {
+          t = other.t;
+          i = other.i;
+          j = other.j;
+          it = other.it;
+          return *this;
+        }
+        bool operator==(const Iterator& other) {
+          return (i >= t->length && other.i >= other.t->length) ||
+            (i == other.i && j == other.j && it == other.it);
+        }
+        bool operator!=(const Iterator& other) {
+          return !((*this) == other);
+        }
+        Iterator operator++() {
+          // If we're at the end, we're done
+          if (i >= t->length) {
+            return *this;
+          }
+          if (j < FASTBOUNDED_INLINE) {
+            j++;
+            if (j == FASTBOUNDED_INLINE) {
+              it = t->table[i].overflow.begin();
+            }
+          } else {
+            ++it;
+          }
+          skip();
+          return *this;
+        }
+        Iterator operator++(int) {
+          Iterator tmp(*this);
+          ++(*this);
+          return tmp;
+        }
+        Node_T& operator*() {
+					// Get what's inside the iterator
+          if (j < FASTBOUNDED_INLINE) {
+            return *t->table[i].slots[j];
+          }
+          return *it;
+        }
+        Node_T* operator->() {
+					// Get a reference to what's inside the iterator (lol)
+          return &(**this);
+        }
+    };
+    Iterator begin() {
+      return Iterator(this, 0);
+    }
+    Iterator end() {
+      return Iterator(this, length);
+    }
+
+    FastFixedHashTable();
+    ~FastFixedHashTable();
+    void reset(size_t s);
+    bool insert(Node_T *n);
+    Node_T* get(Val_T key);
+    // Returns some node in the table, looking at no more than FASTBOUNDED_SCAN
+    // buckets. May return nullptr even when we aren't empty, keep calling.
+    // The cursor only moves forward, so this assumes nothing is inserted
+    // until the table is empty (true for the table we're rehashing out of)
+    Node_T* getOne(void);
+    Node_T* remove(Node_T *n);
+    bool isempty(void) const;
+    void print(void);
+    size_t size(void);
+};
+
+template <typename Node_T, typename Val_T, typename HP>
+FastFixedHashTable<Node_T,Val_T,HP>::FastFixedHashTable() {
+  seed = HP::new_seed();
+  table = nullptr;
+  length = 0;
+  bytes = 0;
+  count = 0;
+  next = 0;
+}
+
+template <typename Node_T, typename Val_T, typename HP>
+FastFixedHashTable<Node_T,Val_T,HP>::~FastFixedHashTable() {
+  // Like boundedhashtable we never run the AVL destructors, they're
+  // empty (or the user broke the API)
+  unmap();
+}
+
+template <typename Node_T, typename Val_T, typename HP>
+void FastFixedHashTable<Node_T,Val_T,HP>::unmap(void) {
+  if (table) {
+    munmap(table, bytes);
+    table = nullptr;
+  }
+}
+
+template <typename Node_T, typename Val_T, typename HP>
+void FastFixedHashTable<Node_T,Val_T,HP>::reset(size_t s) {
+  if (count) {
+    PANIC("FastFixedHashTable reset while not empty");
+  }
+  unmap();
+  bytes = s * sizeof(Bucket);
+  // Anonymous mappings are zero filled, lazily, by the OS
+  void *m = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (m == MAP_FAILED) {
+    PANIC("FastFixedHashTable mmap failed");
+  }
+  table = (Bucket*) m;
+  length = s;
+  next = 0;
+}
+
+template <typename Node_T, typename Val_T, typename HP>
+bool FastFixedHashTable<Node_T,Val_T,HP>::insert(Node_T *new_node) {
+  Val_T v = new_node->val();
+  Bucket &b = table[HP::index(Node_T::hash(v), seed, length)];
+  for (size_t j=0; j<FASTBOUNDED_INLINE; ++j) {
+    if (!b.slots[j]) {
+      b.slots[j] = new_node;
+      count++;
+      return true;
+    }
+    if (Node_T::compare(b.slots[j]->val(), v) == 0) {
+      return false;
+    }
+  }
+  if (b.overflow.insert(new_node)) {
+    count++;
+    return true;
+  }
+  return false;
+}
+
+template <typename Node_T, typename Val_T, typename HP>
+Node_T* FastFixedHashTable<Node_T,Val_T,HP>::get(Val_T key) {
+  Bucket &b = table[HP::index(Node_T::hash(key), seed, length)];
+  for (size_t j=0; j<FASTBOUNDED_INLINE; ++j) {
+    if (!b.slots[j]) {
+      return nullptr;
+    }
+    if (Node_T::compare(b.slots[j]->val(), key) == 0) {
+      return b.slots[j];
+    }
+  }
+  return b.overflow.get(key);
+}
+
+template <typename Node_T, typename Val_T, typename HP>
+Node_T* FastFixedHashTable<Node_T,Val_T,HP>::getOne(void) {
+  for (size_t k=0; k<FASTBOUNDED_SCAN && next < length; ++k) {
+    if (table[next].slots[0]) {
+      return table[next].slots[0];
+    }
+    next++;
+  }
+  return nullptr;
+}
+
+template <typename Node_T, typename Val_T, typename HP>
+Node_T* FastFixedHashTable<Node_T,Val_T,HP>::remove(Node_T *n) {
+  // Note, if n is not in the table, this will cause
+  // some nasty corruption.
+  Bucket &b = table[HP::index(Node_T::hash(n->val()), seed, length)];
+  count--;
+  for (size_t j=0; j<FASTBOUNDED_INLINE; ++j) {
+    if (b.slots[j] == n) {
+      if (!b.overflow.isempty()) {
+        // All slots are full, refill this one from the tree
+        Node_T *o = &(*b.overflow.begin());
+        b.overflow.remove(o);
+        b.slots[j] = o;
+        return n;
+      }
+      // Keep the slots packed, move the last one in to the hole
+      size_t last = j;
+      while (last+1 < FASTBOUNDED_INLINE && b.slots[last+1]) {
+        last++;
+      }
+      b.slots[j] = b.slots[last];
+      b.slots[last] = nullptr;
+      return n;
+    }
+  }
+  b.overflow.remove(n);
+  return n;
+}
+
+template <typename Node_T, typename Val_T, typename HP>
+bool FastFixedHashTable<Node_T,Val_T,HP>::isempty(void) const {
+  return count == 0;
+}
+
+template <typename Node_T, typename Val_T, typename HP>
+void FastFixedHashTable<Node_T,Val_T,HP>::print(void) {
+  printf("[\n");
+  for (size_t i=0; i<length; ++i) {
+    printf("  [");
+    for (size_t j=0; j<FASTBOUNDED_INLINE && table[i].slots[j]; ++j) {
+      table[i].slots[j]->print();
+      printf(",");
+    }
+    if (!table[i].overflow.isempty()) {
+      table[i].overflow.print();
+    }
+    printf("]\n");
+  }
+  printf("]\n");
+}
+
+template <typename Node_T, typename Val_T, typename HP>
+size_t FastFixedHashTable<Node_T,Val_T,HP>::size(void) {
+  return length;
+}
+
+template <typename Node_T, typename Val_T, typename HP=DefaultHash>
+class FastBoundedHashTable {
+  private:
+    FastFixedHashTable<Node_T, Val_T, HP> at1;
+    FastFixedHashTable<Node_T, Val_T, HP> at2;
+    // t1 is the table we insert in to, t2 the one we're rehashing out of
+    FastFixedHashTable<Node_T, Val_T, HP> *t1;
+    FastFixedHashTable<Node_T, Val_T, HP> *t2;
+
+    size_t count;
+    void resize(size_t s) {
+      if (!t2->isempty()) {
+        PANIC("t2 not empty and we're trying to reset!\n");
+      }
+      t2->reset(s);
+      // Swap the tables
+      auto tmp = t2;
+      t2 = t1;
+      t1 = tmp;
+    }
+    void inc() {
+      for (size_t i=0; i<FASTBOUNDED_REHASH_STEP; ++i) {
+        Node_T *n = t2->getOne();
+        if (n) {
+          t2->remove(n);
+          n->ht = t1;
+          t1->insert(n);
+        }
+      }
+    }
+  public:
+    class Iterator {
+      private:
+        typename FastFixedHashTable<Node_T, Val_T, HP>::Iterator it;
+        typename FastFixedHashTable<Node_T, Val_T, HP>::Iterator jump;
+        typename FastFixedHashTable<Node_T, Val_T, HP>::Iterator jumpto;
+        bool jumped;
+      public:
+        Iterator(typename FastFixedHashTable<Node_T, Val_T, HP>::Iterator _it,
+            typename FastFixedHashTable<Node_T, Val_T, HP>::Iterator _jump,
+            typename FastFixedHashTable<Node_T, Val_T, HP>::Iterator _jumpto,
+            bool _jumped):it(_it), jump(_jump), jumpto(_jumpto) {
+          jumped = _jumped;
+          if (!jumped && it == jump) {
+            jumped = true;
+            it = jumpto;
+          }
+        }
+        Iterator(const Iterator& other):it(other.it), jump(other.jump), jumpto(other.jumpto) {
+          jumped = other.jumped;
+        }
+        Iterator& operator=(const Iterator& other) {
+          it = other.it;
+          jump = other.jump;
+          jumpto = other.jumpto;
+          jumped = other.jumped;
+          return *this;
+        }
+        bool operator==(const Iterator& other) {
+          return jumped == other.jumped && it == other.it;
+        }
+        bool operator!=(const Iterator& other) {
+          return !((*this) == other);
+        }
+        Iterator operator++() {
+          it++;
+          if (!jumped && it == jump) {
+            jumped = true;
+            it = jumpto;
+          }
+          return *this;
+        }
+        Iterator operator++(int) {
+          Iterator tmp(*this);
+          ++(*this);
+          return tmp;
+        }
+        Node_T& operator*() {
+					// Get what's inside the iterator
+          return *it;
+        }
+        Node_T* operator->() {
+					// Get a reference to what's inside the iterator (lol)
+          return &(*it);
+        }
+    };
+    Iterator begin() {
+      return Iterator(t1->begin(), t1->end(), t2->begin(), false);
+    }
+    Iterator end() {
+      return Iterator(t2->end(), t1->end(), t2->begin(), true);
+    }
+
+    FastBoundedHashTable() {
+      count = 0;
+      t1 = &at1;
+      t2 = &at2;
+      t1->reset(FASTBOUNDED_MINSIZE);
+      t2->reset(FASTBOUNDED_MINSIZE);
+    };
+    ~FastBoundedHashTable() {}
+    bool insert(Node_T *n) {
+      inc();
+      // if it's over full resize up, unless we're still rehashing
+      if (t1->size() < count+1 && t2->isempty()) {
+        resize(t1->size()*2);
+      }
+      // Make sure it's not in t2 already
+      if (t2->get(n->val())) {
+        return false;
+      }
+      n->ht = t1;
+      if(t1->insert(n)) {
+        count++;
+        return true;
+      }
+      return false;
+    }
+    Node_T* get(Val_T key) {
+      Node_T *n = t1->get(key);
+      if (!n) {
+        n = t2->get(key);
+      }
+      return n;
+    }
+    Node_T* remove(Node_T *n) {
+      n->ht->remove(n);
+      count--;
+      inc();
+      // if it's under a quarter full resize down
+      if (t1->size() > 4*count && t1->size() > FASTBOUNDED_MINSIZE &&
+          t2->isempty()) {
+        resize(t1->size()/2);
+      }
+      return n;
+    }
+    bool isempty(void) const {
+      return count == 0;
+    }
+    void print() {
+      printf("[");
+      printf("t1=");
+      t1->print();
+      printf("t2=");
+      t2->print();
+      printf("]\n");
+    }
+};
+
+template <typename Node_T, typename Val_T, typename HP=DefaultHash>
+class FastBoundedHashTableNode_base: public AVLNode_base<Node_T, Val_T> {
+  public:
+    FastFixedHashTable<Node_T,Val_T,HP> *ht;
+    // subclass must implement:
+    // Val_T val(void);
+    // void print(void);
+    // static size_t hash(Val_T v);
+    // static int compare(Val_T v1, Val_T v2);
+};
+
+#endif
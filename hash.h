@@ -0,0 +1,136 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * Hashing policies, shared by all of our hashtables.
+ *
+ * Our nodes and comparators supply a hash function, and they're usually
+ * lazy about it (the benchmarks just return the key). That's fine, as long as
+ * the table mixes the bits before using them. A policy decides how a
+ * user's hash becomes a bucket index:
+ *   mix(h, seed)    spreads the bits of h over all 64 bits
+ *   reduce(m, size) maps a mixed hash on to [0, size)
+ *   index(h, seed, size) is just reduce(mix(h, seed), size)
+ *   new_seed()      gives a seed for a new table (0 if the policy is unseeded)
+ * Tables take the policy as their last template argument, and call new_seed()
+ * once on construction.
+ *
+ * The policies:
+ *   ModHash       h % size, no mixing. The old behavior. Costs a hardware
+ *                 divide per operation, and clusters badly on structured keys
+ *                 (e.g. multiples of a power of 2) unless your hash is good.
+ *   MaskHash      mix, then mask with size-1. Fastest, only uniform when size
+ *                 is a power of 2 (our tables always double, so it usually is)
+ *   FastRangeHash mix, then Lemire's fastrange: (m * size) >> 64 using the
+ *                 high half of a 64x64 multiply. Works for any size, and costs
+ *                 about the same as a mask. This is the default.
+ *   SeededHash    like FastRangeHash but every table gets a random seed, so an
+ *                 attacker can't precompute keys that all collide. Use this
+ *                 if your keys come from untrusted input.
+ *
+ * The mixer is the murmur3/splitmix64 finalizer, the seeded mixer is a
+ * wyhash-style 128 bit multiply and fold. Both are a few cycles.
+ * Note that a mixer can't fix a hash that collides *before* mixing, if
+ * hash(a) == hash(b) they still land in the same bucket.
+ *
+ * Threadsafety:
+ *   thread safe (new_seed() uses an atomic counter)
+ */
+
+#include <atomic>
+#include <random>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef HASH_H
+#define HASH_H
+
+// murmur3 / splitmix64 finalizer, a bijection on 64 bits
+inline uint64_t hash_mix64(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdlu;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53lu;
+  h ^= h >> 33;
+  return h;
+}
+
+// wyhash style mixer, 64x64->128 multiply, then xor the halves
+inline uint64_t hash_wymix(uint64_t a, uint64_t b) {
+  unsigned __int128 r = (unsigned __int128) a * b;
+  return (uint64_t) r ^ (uint64_t) (r >> 64);
+}
+
+// Lemire's fastrange, maps m uniformly on to [0, size) using the high bits
+inline size_t hash_fastrange(uint64_t m, size_t size) {
+  return (size_t) (((unsigned __int128) m * size) >> 64);
+}
+
+class ModHash {
+  public:
+    static uint64_t mix(uint64_t h, uint64_t seed) {
+      return h;
+    }
+    static size_t reduce(uint64_t m, size_t size) {
+      return m % size;
+    }
+    static size_t index(uint64_t h, uint64_t seed, size_t size) {
+      return reduce(mix(h, seed), size);
+    }
+    static uint64_t new_seed() {
+      return 0;
+    }
+};
+
+class MaskHash {
+  public:
+    static uint64_t mix(uint64_t h, uint64_t seed) {
+      return hash_mix64(h);
+    }
+    static size_t reduce(uint64_t m, size_t size) {
+      return m & (size-1);
+    }
+    static size_t index(uint64_t h, uint64_t seed, size_t size) {
+      return reduce(mix(h, seed), size);
+    }
+    static uint64_t new_seed() {
+      return 0;
+    }
+};
+
+class FastRangeHash {
+  public:
+    static uint64_t mix(uint64_t h, uint64_t seed) {
+      return hash_mix64(h);
+    }
+    static size_t reduce(uint64_t m, size_t size) {
+      return hash_fastrange(m, size);
+    }
+    static size_t index(uint64_t h, uint64_t seed, size_t size) {
+      return reduce(mix(h, seed), size);
+    }
+    static uint64_t new_seed() {
+      return 0;
+    }
+};
+
+class SeededHash {
+  public:
+    static uint64_t mix(uint64_t h, uint64_t seed) {
+      return hash_wymix(h ^ seed, 0x9E3779B97F4A7C15lu ^ (seed >> 32));
+    }
+    static size_t reduce(uint64_t m, size_t size) {
+      return hash_fastrange(m, size);
+    }
+    static size_t index(uint64_t h, uint64_t seed, size_t size) {
+      return reduce(mix(h, seed), size);
+    }
+    static uint64_t new_seed() {
+      // One trip to the OS per process, after that just count
+      static const uint64_t base = ((uint64_t) std::random_device()() << 32) ^ std::random_device()();
+      static std::atomic<uint64_t> counter(0);
+      return hash_mix64(base + counter++) | 1;
+    }
+};
+
+typedef FastRangeHash DefaultHash;
+
+#endif
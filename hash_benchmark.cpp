@@ -0,0 +1,148 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * Benchmark for the hashing policies in hash.h
+ * We decide WHAT we're testing using the macro system, TEST_OCHASHTABLE or
+ * TEST_HASHTABLE picks the table, HASH_POLICY picks the policy.
+ *
+ * Each run does the same insert/get/remove loop with three key patterns:
+ *   sequential  0, 1, 2, ...
+ *   strided     multiples of STRIDE, the worst case for h % size
+ *   random      rand()*rand()
+ * Benchmark hash functions just return the key, like our other benchmarks,
+ * so this is really measuring what the policy does with a lazy hash.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "panic.h"
+#include "timer.h"
+#include "hash.h"
+
+#ifndef TEST_ITERATIONS
+#define TEST_ITERATIONS 100
+#endif
+#ifndef TEST_SIZE
+#define TEST_SIZE 10000
+#endif
+#ifndef HASH_POLICY
+#define HASH_POLICY DefaultHash
+#endif
+#define STRIDE 4096
+
+#define STR(x) #x
+#define XSTR(x) STR(x)
+
+#ifdef TEST_OCHASHTABLE
+#include "ochashtable.h"
+class Node: public OCHashTableNode_base<Node> {
+  public:
+    uint64_t value;
+  public:
+    const uint64_t val(void) const {
+      return value;
+    }
+    static size_t hash(uint64_t v) {
+      return v;
+    }
+    static int compare(const uint64_t v1, const uint64_t v2) {
+      if (v1 > v2) return 1;
+      if (v1 < v2) return -1;
+      return 0;
+    }
+    void print(void) {
+      printf("%lu", value);
+    }
+};
+Node nodes[TEST_SIZE];
+#endif
+
+#ifdef TEST_HASHTABLE
+#include "hashtable.h"
+class Comp {
+  public:
+    static const uint64_t val(const uint64_t t) {
+      return t;
+    }
+    static const int compare(const uint64_t v1, const uint64_t v2) {
+      if (v1 > v2) return 1;
+      if (v1 < v2) return -1;
+      return 0;
+    }
+    static size_t hash(uint64_t v) {
+      return v;
+    }
+    static void printT(const uint64_t t) {
+      printf("%lu", t);
+    }
+    static void printV(const uint64_t v) {
+      printf("%lu", v);
+    }
+};
+#endif
+
+uint64_t keys[TEST_SIZE];
+
+void run(const char *pattern) {
+  #ifdef TEST_OCHASHTABLE
+  OCHashTable<Node, uint64_t, HASH_POLICY> hash;
+  #endif
+  #ifdef TEST_HASHTABLE
+  HashTable<uint64_t, uint64_t, Comp, HASH_POLICY> hash;
+  #endif
+  timeb t1, t2;
+  ftime(&t1);
+  uint64_t found = 0;
+  for (size_t j=0; j<TEST_ITERATIONS; j++) {
+    for (size_t i=0; i<TEST_SIZE; i++) {
+      #ifdef TEST_OCHASHTABLE
+      nodes[i].value = keys[i];
+      hash.insert(&nodes[i]);
+      #else
+      hash.insert(keys[i]);
+      #endif
+    }
+    for (size_t i=0; i<TEST_SIZE; i++) {
+      found += hash.get(keys[i]) != nullptr;
+    }
+    for (size_t i=0; i<TEST_SIZE; i++) {
+      #ifdef TEST_OCHASHTABLE
+      hash.remove(hash.get(keys[i]));
+      #else
+      uint64_t v;
+      hash.remove(keys[i], &v);
+      #endif
+    }
+  }
+  ftime(&t2);
+  if (found != (uint64_t) TEST_SIZE * TEST_ITERATIONS) {
+    PANIC("Lost a key");
+  }
+  printf("  %s time=%lf\n", pattern, tdiff(t2, t1));
+}
+
+int main(int argc, char* argv[]) {
+  #ifdef TEST_OCHASHTABLE
+  printf("OCHashTable.h ");
+  #endif
+  #ifdef TEST_HASHTABLE
+  printf("HashTable.h ");
+  #endif
+  printf("policy=%s test_size=%d test_iterations=%d\n", XSTR(HASH_POLICY), TEST_SIZE, TEST_ITERATIONS);
+
+  for (size_t i=0; i<TEST_SIZE; i++) {
+    keys[i] = i;
+  }
+  run("sequential");
+  for (size_t i=0; i<TEST_SIZE; i++) {
+    keys[i] = i * STRIDE;
+  }
+  run("strided");
+  // Note, we did not initialize rand, this is purposeful
+  // duplicates are unlikely with 64 bits, but would break the found count
+  for (size_t i=0; i<TEST_SIZE; i++) {
+    keys[i] = ((uint64_t) rand() << 32) ^ rand() ^ i;
+  }
+  run("random");
+  return 0;
+}
@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+#include "panic.h"
+#include "hash.h"
+#include "hashtable.h"
+#include "ochashtable.h"
+
+#define TEST_SIZE 1000
+// Keys are multiples of this, the bad case for h % size
+#define STRIDE 1024
+
+class Comp {
+  public:
+    static const uint64_t val(const uint64_t t) {
+      return t;
+    }
+    static const int compare(const uint64_t v1, const uint64_t v2) {
+      if (v1 > v2) return 1;
+      if (v1 < v2) return -1;
+      return 0;
+    }
+    static size_t hash(uint64_t v) {
+      return v;
+    }
+    static void printT(const uint64_t t) {
+      printf("%lu", t);
+    }
+    static void printV(const uint64_t v) {
+      printf("%lu", v);
+    }
+};
+
+class Node: public OCHashTableNode_base<Node> {
+  public:
+    uint64_t value;
+    Node(uint64_t v) {
+      value = v;
+    }
+    const uint64_t val(void) const {
+      return value;
+    }
+    static size_t hash(uint64_t v) {
+      return v;
+    }
+    static int compare(const uint64_t v1, const uint64_t v2) {
+      if (v1 > v2) return 1;
+      if (v1 < v2) return -1;
+      return 0;
+    }
+    void print(void) {
+      printf("%lu", value);
+    }
+};
+
+template <typename HP>
+void test_policy(const char *name) {
+  printf("  %s\n", name);
+  uint64_t seed = HP::new_seed();
+  // Everything lands in range, for power of 2 sizes and (unless we mask)
+  // for odd sizes too
+  size_t sizes[] = {1, 2, 4, 64, 1024, 7, 1000, 12345};
+  for (size_t s : sizes) {
+    if (std::is_same<HP, MaskHash>::value && (s & (s-1))) {
+      continue;
+    }
+    for (uint64_t k=0; k<TEST_SIZE; ++k) {
+      if (HP::index(k*STRIDE, seed, s) >= s) {
+        PANIC("index out of range");
+      }
+      if (HP::index(~k, seed, s) >= s) {
+        PANIC("index out of range");
+      }
+    }
+  }
+
+  // A table using the policy works, with strided keys
+  HashTable<uint64_t, uint64_t, Comp, HP> ht;
+  OCHashTable<Node, uint64_t, HP> oc;
+  std::vector<Node*> nodes;
+  for (uint64_t k=0; k<TEST_SIZE; ++k) {
+    if (!ht.insert(k*STRIDE)) {
+      PANIC("HashTable insert failed");
+    }
+    Node *n = new Node(k*STRIDE);
+    nodes.push_back(n);
+    if (!oc.insert(n)) {
+      PANIC("OCHashTable insert failed");
+    }
+  }
+  for (uint64_t k=0; k<TEST_SIZE; ++k) {
+    if (!ht.get(k*STRIDE) || *ht.get(k*STRIDE) != k*STRIDE) {
+      PANIC("HashTable get failed");
+    }
+    if (ht.get(k*STRIDE+1)) {
+      PANIC("HashTable got a key we didn't insert");
+    }
+    if (oc.get(k*STRIDE) != nodes[k]) {
+      PANIC("OCHashTable get failed");
+    }
+  }
+  for (uint64_t k=0; k<TEST_SIZE; ++k) {
+    uint64_t v;
+    if (!ht.remove(k*STRIDE, &v) || v != k*STRIDE) {
+      PANIC("HashTable remove failed");
+    }
+    oc.remove(nodes[k]);
+    delete nodes[k];
+  }
+  if (!ht.isempty() || !oc.isempty()) {
+    PANIC("table not empty after removing everything");
+  }
+}
+
+int main(int argc, char **argv) {
+  printf("Begin hash.h unittest\n");
+
+  // The mixer is a bijection, sequential keys must not collide
+  std::vector<uint64_t> mixed;
+  for (uint64_t k=0; k<TEST_SIZE; ++k) {
+    mixed.push_back(hash_mix64(k));
+  }
+  std::sort(mixed.begin(), mixed.end());
+  if (std::unique(mixed.begin(), mixed.end()) != mixed.end()) {
+    PANIC("hash_mix64 collided on sequential keys");
+  }
+
+  // fastrange hits both ends of the range
+  if (hash_fastrange(0, 10) != 0 || hash_fastrange(~0lu, 10) != 9) {
+    PANIC("hash_fastrange out of range");
+  }
+
+  // Strided keys should spread over the buckets once mixed
+  // with ModHash they'd all land in bucket 0
+  size_t buckets[64] = {};
+  for (uint64_t k=0; k<TEST_SIZE; ++k) {
+    buckets[FastRangeHash::index(k*STRIDE, 0, 64)]++;
+  }
+  for (size_t i=0; i<64; ++i) {
+    if (buckets[i] == 0) {
+      PANIC("FastRangeHash left a bucket empty on strided keys");
+    }
+  }
+
+  // Seeded tables shouldn't agree with each other
+  uint64_t s1 = SeededHash::new_seed();
+  uint64_t s2 = SeededHash::new_seed();
+  if (s1 == s2) {
+    PANIC("SeededHash gave the same seed twice");
+  }
+  size_t same = 0;
+  for (uint64_t k=0; k<TEST_SIZE; ++k) {
+    if (SeededHash::index(k, s1, 1024) == SeededHash::index(k, s2, 1024)) {
+      same++;
+    }
+  }
+  // We'd expect about 1 in 1024 to match by chance
+  if (same > TEST_SIZE / 16) {
+    PANIC("SeededHash ignores the seed");
+  }
+
+  test_policy<ModHash>("ModHash");
+  test_policy<MaskHash>("MaskHash");
+  test_policy<FastRangeHash>("FastRangeHash");
+  test_policy<SeededHash>("SeededHash");
+
+  printf("PASS\n");
+  return 0;
+}
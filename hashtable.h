@@ -9,6 +9,17 @@
  * resizes up when size is < x data it contains
  * resizes down when size is > 2x data it contains
  * 
+ * HP is the hashing policy, see hash.h
+ *
+ * INCREMENTAL: like ochashtable.h, keep the old table during a resize and move
+ * HASHTABLE_REHASH_STEP buckets per insert/remove, instead of stalling for
+ * O(n) on the operation that triggers the resize. Like there, the new bucket
+ * array is first constructed HASHTABLE_BUILD_STEP buckets per operation.
+ *
+ * get_batch() looks up many keys at once, prefetching each group of
+ * HASHTABLE_BATCH_GROUP buckets, then their element arrays, before doing the
+ * lookups, so the cache misses overlap. See ochashtable.h.
+ *
  * Worst case for all operations is linear
  *
  * Threadsafety:
@@ -16,18 +27,42 @@
  */ 
 
 #include "panic.h"
+#include "hash.h"
+#include <algorithm>
 #include <vector>
 
 #ifndef HASHTABLE_H
 #define HASHTABLE_H
 
 #define MINSIZE 4
+// Buckets migrated per operation for INCREMENTAL
+#define HASHTABLE_REHASH_STEP 2
+// Buckets of the new table constructed per operation for INCREMENTAL
+#define HASHTABLE_BUILD_STEP 8
+// Keys get_batch() has in flight at once
+#define HASHTABLE_BATCH_GROUP 16
 
-template <typename Data_T, typename Val_T, typename HC>
+template <typename Data_T, typename Val_T, typename HC, typename HP=DefaultHash, bool INCREMENTAL=false>
 class HashTable {
   private:
+    // See hash.h
+    uint64_t seed;
     std::vector<std::vector<Data_T>> *table;
     size_t count = 0;
+    // INCREMENTAL only, the table we're migrating out of (or nullptr)
+    std::vector<std::vector<Data_T>> *old_table = nullptr;
+    // buckets of old_table below this have already been moved
+    size_t migrated = 0;
+    // INCREMENTAL only, the table we're constructing before we migrate in to
+    // it, it will have next_size buckets (or nullptr)
+    std::vector<std::vector<Data_T>> *next_table = nullptr;
+    size_t next_size = 0;
+    void build(size_t steps);
+    void migrate(size_t steps);
+    // One operation's share of an INCREMENTAL resize
+    void resize_step(void);
+    void finish_resize(void);
+    bool remove_from(std::vector<Data_T>& bucket, Val_T v, Data_T* data);
     void check_sizeup(void);
     void check_sizedown(void);
   public:
@@ -91,6 +126,9 @@ class HashTable {
         }
     };
     Iterator begin() {
+      if (INCREMENTAL) {
+        finish_resize();
+      }
       return Iterator(table, 0, 0);
     }
     Iterator end() {
@@ -102,14 +140,17 @@ class HashTable {
     ~HashTable();
     bool insert(const Data_T& data);
     Data_T* get(Val_T key);
+    // out[i] = get(keys[i]) for i in [0, n), but faster for big n
+    void get_batch(const Val_T *keys, size_t n, Data_T **out);
     bool remove(Val_T key, Data_T* data);
     bool isempty(void) const; 
     void resize(size_t s);
     void print(void);
 };
 
-template <typename Data_T, typename Val_T, typename HC>
-HashTable<Data_T, Val_T, HC>::HashTable() {
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool INCREMENTAL>
+HashTable<Data_T, Val_T, HC, HP, INCREMENTAL>::HashTable() {
+  seed = HP::new_seed();
   table = new std::vector<std::vector<Data_T>>(MINSIZE);
   // We have to initialize the lists since
   // array doesn't construct objects it contains
@@ -118,8 +159,9 @@ HashTable<Data_T, Val_T, HC>::HashTable() {
   }
 }
 
-template <typename Data_T, typename Val_T, typename HC>
-HashTable<Data_T, Val_T, HC>::HashTable(size_t s):table(s) {
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool INCREMENTAL>
+HashTable<Data_T, Val_T, HC, HP, INCREMENTAL>::HashTable(size_t s):table(s) {
+  seed = HP::new_seed();
   table = new std::vector<std::vector<Data_T>>(s);
   // We have to initialize the lists since
   // array doesn't construct objects it contains
@@ -128,49 +170,93 @@ HashTable<Data_T, Val_T, HC>::HashTable(size_t s):table(s) {
   }
 }
 
-template <typename Data_T, typename Val_T, typename HC>
-HashTable<Data_T, Val_T, HC>::~HashTable() {
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool INCREMENTAL>
+HashTable<Data_T, Val_T, HC, HP, INCREMENTAL>::~HashTable() {
   delete table;
+  delete old_table;
+  delete next_table;
 }
 
-template <typename Data_T, typename Val_T, typename HC>
-bool HashTable<Data_T, Val_T, HC>::insert(const Data_T& data) {
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool INCREMENTAL>
+bool HashTable<Data_T, Val_T, HC, HP, INCREMENTAL>::insert(const Data_T& data) {
+  if (INCREMENTAL) {
+    resize_step();
+  }
   check_sizeup();
   Val_T v = HC::val(data);
-  size_t i = HC::hash(v) % table->size();
   // reject duplicates
-  for (size_t j = 0; j < (*table)[i].size(); j++) {
-    if (HC::val((*table)[i][j]) == v) {
-      return false;
-    }
+  if (get(v)) {
+    return false;
   }
+  size_t i = HP::index(HC::hash(v), seed, table->size());
   (*table)[i].push_back(data);
   count++;
   return true;
 }
 
-template <typename Data_T, typename Val_T, typename HC>
-Data_T* HashTable<Data_T, Val_T, HC>::get(Val_T key) {
-  size_t i = HC::hash(key) % table->size();
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool INCREMENTAL>
+Data_T* HashTable<Data_T, Val_T, HC, HP, INCREMENTAL>::get(Val_T key) {
+  size_t i = HP::index(HC::hash(key), seed, table->size());
   size_t j;
   for (j=0; j < (*table)[i].size(); j++) {
     if (HC::val((*table)[i][j]) == key) {
       return &((*table)[i][j]);
     }
   }
+  if (INCREMENTAL && old_table) {
+    i = HP::index(HC::hash(key), seed, old_table->size());
+    for (j=0; j < (*old_table)[i].size(); j++) {
+      if (HC::val((*old_table)[i][j]) == key) {
+        return &((*old_table)[i][j]);
+      }
+    }
+  }
   return nullptr;
 }
 
-template <typename Data_T, typename Val_T, typename HC>
-bool HashTable<Data_T, Val_T, HC>::remove(Val_T v, Data_T *data) {
-  size_t i = HC::hash(v) % table->size();
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool INCREMENTAL>
+void HashTable<Data_T, Val_T, HC, HP, INCREMENTAL>::get_batch(const Val_T *keys, size_t n, Data_T **out) {
+  size_t index[HASHTABLE_BATCH_GROUP];
+  for (size_t g=0; g<n; g+=HASHTABLE_BATCH_GROUP) {
+    size_t end = std::min(n, g + HASHTABLE_BATCH_GROUP);
+    // Hash everything, and start loading the buckets
+    for (size_t k=g; k<end; ++k) {
+      index[k-g] = HP::index(HC::hash(keys[k]), seed, table->size());
+      __builtin_prefetch(&(*table)[index[k-g]]);
+    }
+    // Then the elements in each
+    for (size_t k=g; k<end; ++k) {
+      std::vector<Data_T> &bucket = (*table)[index[k-g]];
+      if (!bucket.empty()) {
+        __builtin_prefetch(bucket.data());
+      }
+    }
+    // Now the lookups mostly hit cache
+    for (size_t k=g; k<end; ++k) {
+      std::vector<Data_T> &bucket = (*table)[index[k-g]];
+      out[k] = nullptr;
+      for (size_t j=0; j < bucket.size(); j++) {
+        if (HC::val(bucket[j]) == keys[k]) {
+          out[k] = &bucket[j];
+          break;
+        }
+      }
+      if (!out[k] && INCREMENTAL && old_table) {
+        out[k] = get(keys[k]);
+      }
+    }
+  }
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool INCREMENTAL>
+bool HashTable<Data_T, Val_T, HC, HP, INCREMENTAL>::remove_from(std::vector<Data_T>& bucket, Val_T v, Data_T *data) {
   // Find it
   bool found = false;
   size_t j;
-  for (j = 0; j < (*table)[i].size(); j++) {
-    if (HC::val((*table)[i][j]) == v) {
+  for (j = 0; j < bucket.size(); j++) {
+    if (HC::val(bucket[j]) == v) {
       found = true;
-      *data = (*table)[i][j];
+      *data = bucket[j];
       break;
     }
   }
@@ -178,52 +264,140 @@ bool HashTable<Data_T, Val_T, HC>::remove(Val_T v, Data_T *data) {
     return false;
   }
   // Shift the table
-  for (;j+1 < (*table)[i].size(); j++) {
-    (*table)[i][j] = (*table)[i][j+1];
+  for (;j+1 < bucket.size(); j++) {
+    bucket[j] = bucket[j+1];
   }
   // Now that it's shifted, just drop the last element
-  (*table)[i].pop_back();
+  bucket.pop_back();
+  return true;
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool INCREMENTAL>
+bool HashTable<Data_T, Val_T, HC, HP, INCREMENTAL>::remove(Val_T v, Data_T *data) {
+  size_t i = HP::index(HC::hash(v), seed, table->size());
+  if (!remove_from((*table)[i], v, data)) {
+    if (!INCREMENTAL || !old_table) {
+      return false;
+    }
+    i = HP::index(HC::hash(v), seed, old_table->size());
+    if (!remove_from((*old_table)[i], v, data)) {
+      return false;
+    }
+  }
   // bookkeeping
   count--;
+  if (INCREMENTAL) {
+    resize_step();
+  }
   check_sizedown();
   return true;
- }
+}
 
-template <typename Data_T, typename Val_T, typename HC>
-bool HashTable<Data_T, Val_T, HC>::isempty(void) const {
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool INCREMENTAL>
+bool HashTable<Data_T, Val_T, HC, HP, INCREMENTAL>::isempty(void) const {
   return count == 0;
 }
 
-template <typename Data_T, typename Val_T, typename HC>
-void HashTable<Data_T, Val_T, HC>::resize(size_t s) {
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool INCREMENTAL>
+void HashTable<Data_T, Val_T, HC, HP, INCREMENTAL>::resize(size_t s) {
   // nothing to do
   if (s == table->size()) {
     return;
   }
-  std::vector<std::vector<Data_T>> *old_table = table;
+  if (INCREMENTAL) {
+    // Only one resize at a time
+    finish_resize();
+    if (s != table->size()) {
+      next_size = s;
+      next_table = new std::vector<std::vector<Data_T>>();
+      next_table->reserve(s);
+    }
+    return;
+  }
+  std::vector<std::vector<Data_T>> *prev_table = table;
   table = new std::vector<std::vector<Data_T>>(s);
   // Initialize the new array
   for (size_t i=0; i<table->size(); i++) {
     (*table)[i] = std::vector<Data_T>();
   }
   // Rehash
-  for (size_t i=0; i<old_table->size(); i++) {
+  for (size_t i=0; i<prev_table->size(); i++) {
     Data_T tmp;
-    while ((*old_table)[i].size()) {
-      tmp = (*old_table)[i].back();
-      (*old_table)[i].pop_back();
+    while ((*prev_table)[i].size()) {
+      tmp = (*prev_table)[i].back();
+      (*prev_table)[i].pop_back();
       // We already swapped the tables, so normal insert should work fine
       // This way we don't have to duplicate our hashing logic
       Val_T v = HC::val(tmp);
-      size_t index = HC::hash(v) % table->size();
+      size_t index = HP::index(HC::hash(v), seed, table->size());
       (*table)[index].push_back(tmp);
     }
   }
-  delete old_table;
+  delete prev_table;
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool INCREMENTAL>
+void HashTable<Data_T, Val_T, HC, HP, INCREMENTAL>::build(size_t steps) {
+  if (!next_table) {
+    return;
+  }
+  // reserve()'d, so these never reallocate
+  for (; steps > 0 && next_table->size() < next_size; --steps) {
+    next_table->emplace_back();
+  }
+  if (next_table->size() == next_size) {
+    // Done, now start migrating in to it
+    old_table = table;
+    table = next_table;
+    next_table = nullptr;
+    next_size = 0;
+    migrated = 0;
+  }
 }
 
-template <typename Data_T, typename Val_T, typename HC>
-void HashTable<Data_T, Val_T, HC>::check_sizedown(void) {
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool INCREMENTAL>
+void HashTable<Data_T, Val_T, HC, HP, INCREMENTAL>::resize_step(void) {
+  if (next_table) {
+    build(HASHTABLE_BUILD_STEP);
+  } else {
+    migrate(HASHTABLE_REHASH_STEP);
+  }
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool INCREMENTAL>
+void HashTable<Data_T, Val_T, HC, HP, INCREMENTAL>::finish_resize(void) {
+  build(next_size);
+  if (old_table) {
+    migrate(old_table->size());
+  }
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool INCREMENTAL>
+void HashTable<Data_T, Val_T, HC, HP, INCREMENTAL>::migrate(size_t steps) {
+  if (!old_table) {
+    return;
+  }
+  for (; steps > 0 && migrated < old_table->size(); --steps, ++migrated) {
+    std::vector<Data_T>& bucket = (*old_table)[migrated];
+    for (size_t j=0; j<bucket.size(); ++j) {
+      size_t index = HP::index(HC::hash(HC::val(bucket[j])), seed, table->size());
+      (*table)[index].push_back(bucket[j]);
+    }
+    // Free it now, or deleting old_table frees them all at once
+    std::vector<Data_T>().swap(bucket);
+  }
+  if (migrated == old_table->size()) {
+    delete old_table;
+    old_table = nullptr;
+  }
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool INCREMENTAL>
+void HashTable<Data_T, Val_T, HC, HP, INCREMENTAL>::check_sizedown(void) {
+  // Wait for the last resize to finish
+  if (INCREMENTAL && (next_table || old_table)) {
+    return;
+  }
   // If it's under a quarter full resize down
   if (table->size() > 2*count) {
     size_t s = table->size() / 2;
@@ -234,16 +408,20 @@ void HashTable<Data_T, Val_T, HC>::check_sizedown(void) {
   }
 }
 
-template <typename Data_T, typename Val_T, typename HC>
-void HashTable<Data_T, Val_T, HC>::check_sizeup(void) {
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool INCREMENTAL>
+void HashTable<Data_T, Val_T, HC, HP, INCREMENTAL>::check_sizeup(void) {
+  // Wait for the last resize to finish
+  if (INCREMENTAL && (next_table || old_table)) {
+    return;
+  }
   // If it's over half-full resize up
   if (table->size() < count) {
     resize(table->size()*2); 
   } 
 }
 
-template <typename Data_T, typename Val_T, typename HC>
-void HashTable<Data_T, Val_T, HC>::print(void) {
+template <typename Data_T, typename Val_T, typename HC, typename HP, bool INCREMENTAL>
+void HashTable<Data_T, Val_T, HC, HP, INCREMENTAL>::print(void) {
 	printf("[");
   for (size_t i=0; i<table->size(); ++i) {
 		printf("[");
@@ -8,6 +8,7 @@
  * datastructures have the same API (Except where it really isn't a good idea)
  */
 
+#include <stdint.h>
 #include "heap.h"
 #include "array.h"
 
@@ -16,6 +17,15 @@
 #endif
 #define PASSES 1000000
 
+// With MONOTONE_KEYS defined we run an event simulation style workload
+// (the classic "hold" model) instead of push everything then pop everything.
+// We fill the heap, then repeatedly pop the smallest key and push it back in
+// at a random time in the future. Keys never go below the last key popped,
+// which is what radixheap.h requires.
+#ifndef MONOTONE_RANGE
+#define MONOTONE_RANGE 1024
+#endif
+
 #ifdef TEST_BHEAP
 #ifndef NODE_SIZE
 #define NODE_SIZE 3
@@ -23,20 +33,37 @@
 #include "bheap.h"
 #endif
 
+// Heaps using external allocation, these push and pop nodes
 #ifdef TEST_BOUNDEDHEAP
+#define NODE_HEAP
 #include "boundedheap.h"
+typedef int Key_T;
 class HeapNode: public BoundedHeapNode_base<HeapNode, int>{
+#endif
+#ifdef TEST_PAIRINGHEAP
+#define NODE_HEAP
+#include "pairingheap.h"
+typedef int Key_T;
+class HeapNode: public PairingHeapNode_base<HeapNode, int>{
+#endif
+#ifdef TEST_RADIXHEAP
+#define NODE_HEAP
+#include "radixheap.h"
+typedef uint32_t Key_T;
+class HeapNode: public RadixHeapNode_base<HeapNode>{
+#endif
+#ifdef NODE_HEAP
   public:
-    int value;
+    Key_T value;
     HeapNode() {};
-    HeapNode(int val) { value=val; }
-    int val() {
+    HeapNode(Key_T val) { value=val; }
+    Key_T val() {
       return value;
     }
-		void set(int v) {
+		void set(Key_T v) {
 			value = v;
 		}		
-    static int compare(int v1, int v2) {
+    static int compare(Key_T v1, Key_T v2) {
       return v1 - v2;
     }
 };
@@ -54,6 +81,11 @@ class HeapNode: public BoundedHeapNode_base<HeapNode, int>{
 #include "treearray.h"
 #endif
 
+#ifdef TEST_MINMAXHEAP_DCARRAY
+#include "minmaxheap.h"
+#include "delayed_copy_array.h"
+#endif
+
 class HeapCompare {
   public:
     static int val(int v) {
@@ -72,6 +104,16 @@ int main(int argc, char **argv) {
   #ifdef TEST_BOUNDEDHEAP
   printf("Begin BoundedHeap benchmark\n");
   BoundedHeap<HeapNode, int> heap;
+  #endif
+  #ifdef TEST_PAIRINGHEAP
+  printf("Begin PairingHeap benchmark\n");
+  PairingHeap<HeapNode, int> heap;
+  #endif
+  #ifdef TEST_RADIXHEAP
+  printf("Begin RadixHeap benchmark\n");
+  RadixHeap<HeapNode, uint32_t> heap;
+  #endif
+  #ifdef NODE_HEAP
 	HeapNode heap_nodes[TEST_SIZE];
   #endif
   #ifdef TEST_HEAP_DICTARRAY
@@ -90,30 +132,52 @@ int main(int argc, char **argv) {
   printf("Begin Heap on doubling array benchmark\n");
   Heap<UArray<int>, int, HeapCompare> heap;
   #endif
+  #ifdef TEST_MINMAXHEAP_DCARRAY
+  printf("Begin MinMaxHeap on delayed copy array benchmark\n");
+  MinMaxHeap<DCUArray<int>, int, HeapCompare> heap;
+  #endif
 
   int j;
 
   for (int i=0; i<PASSES; i++) {
-		#ifdef TEST_BOUNDEDHEAP
+		#ifdef NODE_HEAP
 		#ifndef USE_MALLOC
 		int ni=0;
 		#endif
     #endif
     for (j=0;j<TEST_SIZE;j++) {
-			#ifdef TEST_BOUNDEDHEAP
+      #ifdef MONOTONE_KEYS
+      int key = rand() % MONOTONE_RANGE;
+      #else
+      int key = rand();
+      #endif
+			#ifdef NODE_HEAP
 			#ifndef USE_MALLOC
 			auto n = &(heap_nodes[ni++]);
 			#else
 			auto n = new HeapNode();
 			#endif
-			n->set(rand());
+			n->set(key);
 			heap.push(n);
 			#else
-      heap.push(rand());
+      heap.push(key);
 			#endif
     }
+    #ifdef MONOTONE_KEYS
+    for (j=0;j<TEST_SIZE;j++) {
+			#ifdef NODE_HEAP
+      auto n = heap.pop();
+      n->set(n->val() + rand() % MONOTONE_RANGE);
+      heap.push(n);
+			#else
+      int val=-1;
+      heap.pop(&val);
+      heap.push(val + rand() % MONOTONE_RANGE);
+			#endif
+    }
+    #endif
     for (j=0;j<TEST_SIZE;j++) {
-			#ifdef TEST_BOUNDEDHEAP
+			#ifdef NODE_HEAP
 			#ifndef USE_MALLOC
       heap.pop();
 			#else
@@ -29,6 +29,11 @@
 #include "btree.h"
 #endif
 
+#ifdef TEST_BPLUSTREE
+// This is so we can script sets of tests at different arities
+#include "bplustree.h"
+#endif
+
 #ifdef TEST_TS_BTREE
 // This is so we can script sets of tests at different arities
 #include "ts_btree.h"
@@ -42,6 +47,34 @@
 #include "hashtable.h"
 #endif
 
+#ifdef TEST_SWISSTABLE
+#include "swisstable.h"
+#endif
+
+#ifdef TEST_ROBINHOODHASHTABLE
+#include "robinhoodhashtable.h"
+#endif
+
+#ifdef TEST_CUCKOOHASHTABLE
+#include "cuckoohashtable.h"
+#endif
+
+// Extra lookups of (almost certainly) missing keys per insert
+#ifndef MISSES
+#define MISSES 0
+#endif
+// Range scans per iteration, once the dict is full (ordered dicts only)
+// each reads RANGE_LENGTH elements from lower_bound() of a random key
+#ifndef RANGE_SCANS
+#define RANGE_SCANS 0
+#endif
+#ifndef RANGE_LENGTH
+#define RANGE_LENGTH 16
+#endif
+// MEASURE_LATENCY times every insert and remove, and reports the max and
+// p999. This slows everything down a bit, so don't compare the times.
+// INCREMENTAL_REHASH uses the incremental resize mode of hashtable
+
 class Comp {
   // For use with T=int, Val_T=int
   public:
@@ -71,9 +104,18 @@ uint64_t ints_end;
 
 int main(int argc, char* argv[]) {
   #ifdef TEST_BTREE
+  #ifdef ORDER_STATISTICS
+  printf("Counted BTree.h ");
+  BTree<uint64_t, uint64_t, Comp, ARITY, true> dict;
+  #else
   printf("BTree.h ");
   BTree<uint64_t, uint64_t, Comp, ARITY> dict;
   #endif
+  #endif
+  #ifdef TEST_BPLUSTREE
+  printf("BPlusTree.h ");
+  BPlusTree<uint64_t, uint64_t, Comp, ARITY> dict;
+  #endif
   #ifdef TEST_TS_BTREE
   printf("TS_BTree.h ");
   TSBTree<uint64_t, uint64_t, Comp, ARITY> dict;
@@ -83,14 +125,39 @@ int main(int argc, char* argv[]) {
   BTreeHashTable<uint64_t, uint64_t, Comp> dict; 
   #endif
   #ifdef TEST_HASHTABLE
+  #ifdef INCREMENTAL_REHASH
+  printf("HashTable.h (incremental) ");
+  HashTable<uint64_t, uint64_t, Comp, DefaultHash, true> dict; 
+  #else
   printf("HashTable.h ");
   HashTable<uint64_t, uint64_t, Comp> dict; 
   #endif
+  #endif
+  #ifdef TEST_SWISSTABLE
+  printf("SwissTable.h ");
+  SwissTable<uint64_t, uint64_t, Comp> dict; 
+  #endif
+  #ifdef TEST_ROBINHOODHASHTABLE
+  printf("RobinHoodHashTable.h ");
+  RobinHoodHashTable<uint64_t, uint64_t, Comp> dict; 
+  #endif
+  #ifdef TEST_CUCKOOHASHTABLE
+  printf("CuckooHashTable.h ");
+  CuckooHashTable<uint64_t, uint64_t, Comp> dict; 
+  #endif
 
   timeb t1, t2;
   ftime(&t1);
   uint64_t j;
   uint64_t get_count=0;
+  uint64_t miss_count=0;
+  #if RANGE_SCANS
+  uint64_t scan_count=0;
+  #endif
+  #ifdef MEASURE_LATENCY
+  Latency insert_latency, remove_latency;
+  uint64_t start;
+  #endif
   for (j=0; j<TEST_ITERATIONS; j++) {
     uint64_t i;
     ints_end=0;
@@ -110,18 +177,56 @@ int main(int argc, char* argv[]) {
         #endif
         get_count++;
       }
+      for (size_t m=0; m<MISSES; m++) {
+        #ifdef TEST_TS_BTREE
+        uint64_t tmp;
+        miss_count += !dict.get(rand()*rand(), &tmp);
+        #else
+        miss_count += !dict.get(rand()*rand());
+        #endif
+      }
       // put it in the dict
+      #ifdef MEASURE_LATENCY
+      start = now_ns();
       dict.insert(r);
+      insert_latency.record(now_ns() - start);
+      #else
+      dict.insert(r);
+      #endif
       // and in the list
       ints[ints_end++] = r;
     }
+    #if RANGE_SCANS
+    for (size_t s=0; s<RANGE_SCANS; s++) {
+      size_t k = 0;
+      for (auto it = dict.lower_bound(rand()*rand()); it != dict.end() && k < RANGE_LENGTH; ++it, ++k) {
+        // use the result, so this can't be optimized out
+        scan_count += *it & 1;
+      }
+    }
+    #endif
     for(i=0; i<ints_end; i++) {
       uint64_t junk;
+      #ifdef MEASURE_LATENCY
+      start = now_ns();
+      dict.remove(ints[i], &junk);
+      remove_latency.record(now_ns() - start);
+      #else
       dict.remove(ints[i], &junk);
+      #endif
     }
   }
   ftime(&t2);
   printf("test_size=%d test_iterations=%d ", TEST_SIZE, TEST_ITERATIONS);
-  printf("time=%lf arity=%u\n", tdiff(t2,t1), ARITY);
+  printf("time=%lf arity=%u misses=%lu", tdiff(t2,t1), ARITY, miss_count);
+  #if RANGE_SCANS
+  printf(" range_scans=%d range_length=%d odd=%lu", RANGE_SCANS, RANGE_LENGTH, scan_count);
+  #endif
+  #ifdef MEASURE_LATENCY
+  printf(" insert_max_ns=%lu insert_p999_ns<=%lu remove_max_ns=%lu remove_p999_ns<=%lu",
+      insert_latency.max, insert_latency.percentile(0.999),
+      remove_latency.max, remove_latency.percentile(0.999));
+  #endif
+  printf("\n");
 }
 
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <stdio.h>
 #include "panic.h"
 #include "dlist.h"
@@ -13,6 +14,40 @@
 #define ARITY 5
 #endif
 
+#ifdef TEST_BPLUSTREE
+// This turns on rather expensive internal consistancy checking
+#define BPLUSTREE_DEBUG
+#include "bplustree.h"
+#define ARITY 5
+#endif
+
+#ifdef TEST_COW_BTREE
+// This turns on rather expensive internal consistancy checking
+#define COW_BTREE_DEBUG
+#include <thread>
+#include "cow_btree.h"
+#define ARITY 5
+#endif
+
+#ifdef TEST_PAGED_BTREE
+// This turns on rather expensive internal consistancy checking
+#define PAGED_BTREE_DEBUG
+#define BUFFER_POOL_DEBUG
+#include <unistd.h>
+#include "paged_btree.h"
+#define ARITY 5
+#endif
+
+#ifdef TEST_BETREE
+// This turns on rather expensive internal consistancy checking
+#define BETREE_DEBUG
+#include <string>
+#include "betree.h"
+// Small nodes, with only a few messages per buffer, so we flush constantly
+#define ARITY 8
+#define FANOUT 3
+#endif
+
 #ifdef TEST_TS_BTREE
 #define BTREE_DEBUG
 #include "ts_btree.h"
@@ -21,10 +56,29 @@
 
 #ifdef TEST_BTREEHASHTABLE
 #include "btreehashtable.h"
+// Iterates in hash order, not key order
+#define UNORDERED_ITERATOR
 #endif
 
 #ifdef TEST_HASHTABLE
 #include "hashtable.h"
+#define UNORDERED_ITERATOR
+#endif
+
+#ifdef TEST_SWISSTABLE
+#include "swisstable.h"
+// Iterates in hash order, not key order
+#define UNORDERED_ITERATOR
+#endif
+
+#ifdef TEST_ROBINHOODHASHTABLE
+#include "robinhoodhashtable.h"
+#define UNORDERED_ITERATOR
+#endif
+
+#ifdef TEST_CUCKOOHASHTABLE
+#include "cuckoohashtable.h"
+#define UNORDERED_ITERATOR
 #endif
 
 class Comp {
@@ -47,6 +101,22 @@ class Comp {
     }
 };
 
+#ifdef TEST_BETREE
+// A T whose val() changes when it's moved from
+class StringComp {
+  public:
+    static std::string val(const std::string &s) {
+      return s;
+    }
+    static int compare(const std::string &s1, const std::string &s2) {
+      return s1.compare(s2);
+    }
+    static void printT(const std::string &s) {
+      printf("%s", s.c_str());
+    }
+};
+#endif
+
 class TNode: public DListNode_base<TNode> {
   public:
     int value;
@@ -68,9 +138,24 @@ class TNode: public DListNode_base<TNode> {
 
 template<typename DT>
 void check(DT *dict, DList<TNode,int> *tdict) {
+  #if defined(TEST_SWISSTABLE) || defined(TEST_ROBINHOODHASHTABLE) || defined(TEST_CUCKOOHASHTABLE)
+  dict->check();
+  #endif
+  #ifdef ORDER_STATISTICS
+  // rank() and select() should agree with each other for every element
+  size_t n = 0;
+  #endif
   auto i = tdict->begin();
   for (; i != tdict->end(); i++) {
-    #ifdef TEST_TS_BTREE
+    #ifdef ORDER_STATISTICS
+    n++;
+    int *s = dict->select(dict->rank(i->val()));
+    if (!s || *s != i->val()) {
+      printf("%d\n", i->val());
+      PANIC("select(rank()) doesn't find the element");
+    }
+    #endif
+    #if defined(TEST_TS_BTREE) || defined(TEST_PAGED_BTREE)
     int res;
     if(!dict->get(i->val(), &res)) {
     #else
@@ -80,15 +165,47 @@ void check(DT *dict, DList<TNode,int> *tdict) {
       PANIC("Element not in dict anymore!");
     }
   }
+  #ifdef ORDER_STATISTICS
+  if (dict->size() != n || dict->select(n)) {
+    PANIC("dict has the wrong size");
+  }
+  #endif
 }
 
 int main(int argc, char* argv[]) {
   DList<TNode, int> tdict;
 
   #ifdef TEST_BTREE
+  #ifdef ORDER_STATISTICS
+  printf("Begin counted BTree.h unittest\n");
+  BTree<int, int, Comp, ARITY, true> dict;
+  #else
   printf("Begin BTree.h unittest\n");
   BTree<int, int, Comp, ARITY> dict;
   #endif
+  #endif
+  #ifdef TEST_BPLUSTREE
+  printf("Begin BPlusTree.h unittest\n");
+  BPlusTree<int, int, Comp, ARITY> dict;
+  #endif
+  #ifdef TEST_COW_BTREE
+  printf("Begin CowBTree.h unittest\n");
+  CowBTree<int, int, Comp, ARITY> dict;
+  #endif
+  #ifdef TEST_PAGED_BTREE
+  printf("Begin PagedBTree.h unittest\n");
+  // A tiny pool, so we evict (and write back) constantly
+  const char *path = "/tmp/paged_btree_unittest.db";
+  unlink(path);
+  PagedBTree<int, int, Comp, ARITY> dict;
+  if (!dict.open(path, 0)) {
+    PANIC("open failed");
+  }
+  #endif
+  #ifdef TEST_BETREE
+  printf("Begin BETree.h unittest\n");
+  BETree<int, int, Comp, ARITY, FANOUT> dict;
+  #endif
   #ifdef TEST_TS_BTREE
   printf("Begin TS_BTree.h unittest\n");
   TSBTree<int, int, Comp, ARITY> dict;
@@ -99,8 +216,24 @@ int main(int argc, char* argv[]) {
   #endif
   #ifdef TEST_HASHTABLE
   printf("Begin HashTable.h unittest\n");
+  #ifdef INCREMENTAL_REHASH
+  HashTable<int, int, Comp, DefaultHash, true> dict;
+  #else
   HashTable<int, int, Comp> dict;
   #endif
+  #endif
+  #ifdef TEST_SWISSTABLE
+  printf("Begin SwissTable.h unittest\n");
+  SwissTable<int, int, Comp> dict;
+  #endif
+  #ifdef TEST_ROBINHOODHASHTABLE
+  printf("Begin RobinHoodHashTable.h unittest\n");
+  RobinHoodHashTable<int, int, Comp> dict;
+  #endif
+  #ifdef TEST_CUCKOOHASHTABLE
+  printf("Begin CuckooHashTable.h unittest\n");
+  CuckooHashTable<int, int, Comp> dict;
+  #endif
 
   int i;
   // insert in order, then remove
@@ -132,7 +265,7 @@ int main(int argc, char* argv[]) {
       int d;
       bool f;
       //printf("removing %d\n", i->val());
-      #ifdef TEST_TS_BTREE
+      #if defined(TEST_TS_BTREE) || defined(TEST_PAGED_BTREE)
       int res;
       f = !!dict.get(i->val(), &res);
       #else
@@ -142,7 +275,7 @@ int main(int argc, char* argv[]) {
         PANIC("dict lacks element it should have");
       }
       dict.remove(i->val(), &d);
-      #ifdef TEST_TS_BTREE
+      #if defined(TEST_TS_BTREE) || defined(TEST_PAGED_BTREE)
       f = !!dict.get(i->val(), &res);
       #else
       f = !!dict.get(i->val());
@@ -185,19 +318,33 @@ int main(int argc, char* argv[]) {
     dict.print();
     PANIC("Dict thinks it's not empty");
   }
-  #ifndef TEST_TS_BTREE
+  #if !defined(TEST_TS_BTREE) && !defined(TEST_PAGED_BTREE) && !defined(TEST_BETREE)
   // Test iterator
   for (size_t i=0; i<100; i++) {
     dict.insert(i);
   }
   i = 0;
+  #ifdef UNORDERED_ITERATOR
+  bool seen[100] = {};
+  #endif
   for (auto i2 = dict.begin(); i2 != dict.end(); ++i2) {
+    #ifdef UNORDERED_ITERATOR
+    if (*i2 < 0 || *i2 >= 100 || seen[*i2]) {
+      printf("%d unexpected\n", *i2);
+      PANIC("dict iterator broken");
+    }
+    seen[*i2] = true;
+    #else
     if (*i2 != i) {
       printf("%d should be %d\n", *i2, i);
       PANIC("dict iterator broken");
     }
+    #endif
     ++i;
   }
+  if (i != 100) {
+    PANIC("dict iterator skipped elements");
+  }
   int val;
   auto a = dict.begin();
   while (a != dict.end() && dict.remove(*a, &val)) {
@@ -207,5 +354,401 @@ int main(int argc, char* argv[]) {
     PANIC("Iterator returning elements from empty structure");
   }
   #endif
+  #if defined(TEST_BTREE) || defined(TEST_BPLUSTREE)
+  // Range queries, on the even numbers so we probe both hits and misses
+  for (i=0; i<1000; i+=2) {
+    dict.insert(i);
+  }
+  for (int v=-1; v<=1000; ++v) {
+    int lower = v < 0 ? 0 : (v + 1) / 2 * 2;
+    int upper = v < 0 ? 0 : v / 2 * 2 + 2;
+    auto l = dict.lower_bound(v);
+    if (lower >= 1000 ? l != dict.end() : (l == dict.end() || *l != lower)) {
+      PANIC("lower_bound is wrong");
+    }
+    auto u = dict.upper_bound(v);
+    if (upper >= 1000 ? u != dict.end() : (u == dict.end() || *u != upper)) {
+      PANIC("upper_bound is wrong");
+    }
+    // The iterator we get has to carry on just like one from begin()
+    int expect = lower;
+    for (; l != dict.end(); ++l) {
+      if (*l != expect) {
+        PANIC("iterating from lower_bound is wrong");
+      }
+      expect += 2;
+    }
+    if (expect < 1000) {
+      PANIC("iterating from lower_bound stopped early");
+    }
+    int count = 0;
+    for (int r : dict.range(v, v + 10)) {
+      if (r < v || r >= v + 10) {
+        PANIC("range returned something out of range");
+      }
+      count++;
+    }
+    int want = 0;
+    for (int k = std::max(v, 0); k < std::min(v + 10, 1000); ++k) {
+      want += k % 2 == 0;
+    }
+    if (count != want) {
+      PANIC("range missed elements");
+    }
+  }
+  for (int r : dict.range(10, 10)) {
+    printf("%d\n", r);
+    PANIC("empty range isn't empty");
+  }
+  #ifdef ORDER_STATISTICS
+  // Order statistics, again probing both hits and misses
+  for (int v=-1; v<=1000; ++v) {
+    size_t want = v < 0 ? 0 : (v + 1) / 2;
+    if (dict.rank(v) != std::min(want, (size_t) 500)) {
+      printf("rank(%d) = %ld\n", v, dict.rank(v));
+      PANIC("rank is wrong");
+    }
+  }
+  for (size_t k=0; k<500; ++k) {
+    int *s = dict.select(k);
+    if (!s || *s != (int) k * 2) {
+      PANIC("select is wrong");
+    }
+  }
+  if (dict.select(500)) {
+    PANIC("select past the end returned something");
+  }
+  #endif
+  for (i=0; i<1000; i+=2) {
+    dict.remove(i, &val);
+  }
+  #endif
+  #ifdef TEST_BTREE
+  // Ascending keys take the tail path, and split 90/10
+  for (i=0; i<2000; i+=2) {
+    if (!dict.insert(i)) {
+      PANIC("insert at the tail failed");
+    }
+  }
+  if (dict.insert(1998)) {
+    PANIC("insert at the tail took a duplicate");
+  }
+  // Then fill in the odd ones, each just before the next even one
+  auto hint = dict.lower_bound(2);
+  for (i=1; i<2000; i+=2) {
+    if ((hint != dict.end()) != (i < 1999) || (hint != dict.end() && *hint != i + 1)) {
+      PANIC("insert_hint moved hint");
+    }
+    if (!dict.insert_hint(hint, i)) {
+      PANIC("insert_hint failed");
+    }
+    if (dict.insert_hint(hint, i) || dict.insert_hint(hint, i - 1)) {
+      PANIC("insert_hint took a duplicate");
+    }
+    if (hint != dict.end()) {
+      ++hint;
+    }
+  }
+  // A hint in the wrong place still inserts
+  hint = dict.begin();
+  if (!dict.insert_hint(hint, 5000) || *hint != 0) {
+    PANIC("insert_hint with a bad hint failed");
+  }
+  i = 0;
+  for (int v : dict) {
+    if (v != (i < 2000 ? i : 5000)) {
+      PANIC("insert_hint put something in the wrong place");
+    }
+    i++;
+  }
+  if (i != 2001) {
+    PANIC("insert_hint lost elements");
+  }
+  #ifdef ORDER_STATISTICS
+  if (dict.size() != 2001 || dict.rank(1000) != 1000 || *dict.select(1999) != 1999) {
+    PANIC("insert at the tail or insert_hint got the counts wrong");
+  }
+  #endif
+  for (i=0; i<2000; ++i) {
+    dict.remove(i, &val);
+  }
+  dict.remove(5000, &val);
+  if (!dict.isempty()) {
+    PANIC("dict isn't empty");
+  }
+  // Bulk loading, every size up to a few levels deep
+  typedef decltype(dict) Tree;
+  for (int n=0; n<300; n+=(n < 40 ? 1 : 37)) {
+    Tree::Builder builder;
+    for (i=0; i<n; i++) {
+      builder.append(i*2);
+    }
+    Tree built = builder.finish();
+    i = 0;
+    for (int v : built) {
+      if (v != i*2) {
+        PANIC("Builder put something in the wrong place");
+      }
+      i++;
+    }
+    if (i != n) {
+      PANIC("Builder lost elements");
+    }
+    #ifdef ORDER_STATISTICS
+    if (built.size() != (size_t) n || (n && *built.select(n/2) != n/2*2)) {
+      PANIC("Builder got the counts wrong");
+    }
+    #endif
+    // and it's an ordinary tree after
+    for (i=0; i<n; i++) {
+      if (!built.insert(i*2+1) || !built.remove(i*2, &val)) {
+        PANIC("tree from Builder doesn't take inserts and removes");
+      }
+    }
+  }
+  // Merges of the evens below 2000 and multiples of 3 below 3000
+  Tree evens;
+  Tree threes;
+  for (i=0; i<1000; i++) {
+    evens.insert(i*2);
+    threes.insert(i*3);
+  }
+  for (size_t threads : {1, 3}) {
+    Tree u = Tree::set_union(evens, threes, threads);
+    Tree in = Tree::set_intersection(evens, threes, threads);
+    Tree diff = Tree::set_difference(evens, threes, threads);
+    for (i=-1; i<3001; i++) {
+      bool ina = i >= 0 && i % 2 == 0 && i < 2000;
+      bool inb = i >= 0 && i % 3 == 0 && i < 3000;
+      if (!!u.get(i) != (ina || inb) || !!in.get(i) != (ina && inb) ||
+          !!diff.get(i) != (ina && !inb)) {
+        PANIC("merge got the wrong elements");
+      }
+    }
+    #ifdef ORDER_STATISTICS
+    if (u.size() != 1666 || in.size() != 334 || diff.size() != 666) {
+      PANIC("merge got the counts wrong");
+    }
+    #endif
+  }
+  #endif
+  #ifdef TEST_COW_BTREE
+  // Snapshots keep seeing what was there when they were taken, however the
+  // tree changes after
+  for (i=0; i<1000; i+=2) {
+    dict.insert(i);
+  }
+  auto snap = dict.snapshot();
+  for (i=0; i<1000; i+=4) {
+    dict.remove(i, &val);
+  }
+  for (i=1; i<1000; i+=2) {
+    dict.insert(i);
+  }
+  auto snap2 = dict;
+  snap2.insert(-1);
+  if (dict.get(-1)) {
+    PANIC("write to a snapshot showed up in the tree");
+  }
+  if (dict.copies() == 0) {
+    PANIC("writes after a snapshot didn't copy anything");
+  }
+  snap.check();
+  snap2.check();
+  i = 0;
+  for (auto s = snap.begin(); s != snap.end(); ++s) {
+    if (*s != i) {
+      printf("%d should be %d\n", *s, i);
+      PANIC("snapshot changed");
+    }
+    i += 2;
+  }
+  if (i != 1000) {
+    PANIC("snapshot lost elements");
+  }
+  for (i=0; i<1000; ++i) {
+    if (!dict.get(i) != (i % 4 == 0)) {
+      PANIC("tree is wrong after writing over a snapshot");
+    }
+  }
+  // Dropping the tree leaves the snapshot intact, and vice versa
+  snap2 = dict;
+  dict = CowBTree<int, int, Comp, ARITY>();
+  for (i=0; i<1000; i+=2) {
+    if (!snap.get(i)) {
+      PANIC("snapshot lost an element when the tree went away");
+    }
+  }
+  snap = snap2;
+  snap2 = CowBTree<int, int, Comp, ARITY>();
+  for (i=0; i<1000; ++i) {
+    if (!snap.get(i) != (i % 4 == 0)) {
+      PANIC("snapshot is wrong after the tree went away");
+    }
+  }
+  // Readers on other threads see a consistent snapshot while we write
+  for (i=0; i<1000; ++i) {
+    dict.insert(i);
+  }
+  std::thread readers[2];
+  for (auto &t : readers) {
+    auto mine = dict.snapshot();
+    t = std::thread([mine]() {
+      for (int round=0; round<50; ++round) {
+        int expect = 0;
+        for (auto s = mine.begin(); s != mine.end(); ++s) {
+          if (*s != expect) {
+            PANIC("snapshot changed under a reader");
+          }
+          expect++;
+        }
+        if (expect != 1000) {
+          PANIC("snapshot lost elements under a reader");
+        }
+      }
+    });
+  }
+  for (int round=0; round<20; ++round) {
+    auto keep = dict.snapshot();
+    for (i=0; i<1000; ++i) {
+      dict.remove(i, &val);
+    }
+    for (i=0; i<1000; ++i) {
+      dict.insert(i);
+    }
+  }
+  for (auto &t : readers) {
+    t.join();
+  }
+  for (i=0; i<1000; ++i) {
+    dict.remove(i, nullptr);
+  }
+  if (!dict.isempty()) {
+    PANIC("tree isn't empty");
+  }
+  #endif
+  #ifdef TEST_PAGED_BTREE
+  // Everything is still there after closing and reopening the file
+  int res;
+  for (i=0; i<2000; i+=2) {
+    dict.insert(i);
+  }
+  size_t pages = dict.pages();
+  for (i=0; i<2000; i+=4) {
+    dict.remove(i, &res);
+  }
+  dict.close();
+  if (!dict.open(path, 0) || dict.size() != 500) {
+    PANIC("reopened tree is the wrong size");
+  }
+  dict.check();
+  for (i=0; i<2000; ++i) {
+    bool want = i % 4 == 2;
+    if (dict.get(i, &res) != want || (want && res != i)) {
+      PANIC("reopened tree has the wrong contents");
+    }
+  }
+  // Pages freed by merges get reused before the file grows
+  for (i=0; i<2000; i+=4) {
+    dict.insert(i);
+  }
+  if (dict.pages() > pages) {
+    PANIC("file grew instead of reusing free pages");
+  }
+  for (i=0; i<2000; i+=2) {
+    if (!dict.remove(i, nullptr)) {
+      PANIC("remove failed");
+    }
+  }
+  if (!dict.isempty()) {
+    PANIC("tree isn't empty");
+  }
+  dict.close();
+  // A file written with a different SIZE isn't ours
+  PagedBTree<int, int, Comp, ARITY+2> other;
+  if (other.open(path, 0)) {
+    PANIC("opened a tree with a different SIZE");
+  }
+  unlink(path);
+  #endif
+  #ifdef TEST_BETREE
+  // Blind writes, the newest message for a key wins wherever it's buffered
+  for (i=0; i<1000; ++i) {
+    dict.upsert(i);
+  }
+  for (i=0; i<1000; i+=2) {
+    dict.erase(i);
+  }
+  for (i=0; i<1000; i+=4) {
+    dict.upsert(i);
+  }
+  // Erasing what isn't there is fine too
+  for (i=1000; i<1100; ++i) {
+    dict.erase(i);
+  }
+  for (int pass=0; pass<2; ++pass) {
+    if (pass == 1) {
+      dict.flush_all();
+      dict.check();
+    }
+    for (i=0; i<1100; ++i) {
+      bool want = i < 1000 && (i % 2 == 1 || i % 4 == 0);
+      if (!!dict.get(i) != want) {
+        printf("%d\n", i);
+        PANIC("blind writes gave the wrong contents");
+      }
+    }
+  }
+  for (i=0; i<1000; ++i) {
+    dict.erase(i);
+  }
+  if (!dict.isempty()) {
+    dict.print();
+    PANIC("tree isn't empty");
+  }
+  // remove() hands back a copy, what's left in the tree until the tombstone
+  // gets there must keep it's key. Long enough that moving empties them.
+  BETree<std::string, std::string, StringComp, ARITY, FANOUT> strings;
+  std::string pad(32, 'x');
+  for (char c='a'; c<='f'; ++c) {
+    strings.upsert(std::string(1, c) + pad);
+  }
+  strings.flush_all();
+  std::string removed;
+  if (!strings.remove("b" + pad, &removed) || removed != "b" + pad) {
+    PANIC("remove of a string failed");
+  }
+  strings.check();
+  for (char c='g'; c<='z'; ++c) {
+    strings.upsert(std::string(1, c) + pad);
+  }
+  strings.flush_all();
+  strings.check();
+  for (char c='a'; c<='z'; ++c) {
+    if (!!strings.get(std::string(1, c) + pad) != (c != 'b')) {
+      PANIC("strings have the wrong contents after a remove");
+    }
+  }
+  #endif
+  #ifdef TEST_HASHTABLE
+  // Batched lookups match get(), hits and misses (odd keys aren't there)
+  int keys[1000];
+  int *found[1000];
+  for (i=0; i<1000; i++) {
+    keys[i] = i;
+    if (i % 2 == 0) {
+      dict.insert(i);
+    }
+  }
+  dict.get_batch(keys, 1000, found);
+  for (i=0; i<1000; i++) {
+    if (found[i] != dict.get(i) || (found[i] && *found[i] != i)) {
+      PANIC("get_batch doesn't match get");
+    }
+  }
+  for (i=0; i<1000; i+=2) {
+    dict.remove(i, &val);
+  }
+  #endif
   printf("PASS\n");
 }
@@ -0,0 +1,78 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * Benchmark for iterating over a Dict (so a BTree), or with TEST_BPLUSTREE
+ * a BPlusTree holding the same pairs with the same arity.
+ * We fill it with TEST_SIZE keys, then iterate over the whole thing
+ * TEST_ITERATIONS times, starting a new iterator each time.
+ *
+ * With small dicts this is mostly the cost of making iterators, with big
+ * ones it's mostly the cost of ++.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "panic.h"
+#include "timer.h"
+#include "dict.h"
+#ifdef TEST_BPLUSTREE
+#include "bplustree.h"
+
+class PairComp {
+  public:
+    static int val(const std::pair<int,int> &el) {
+      return el.first;
+    }
+    static int compare(int v1, int v2) {
+      return v1-v2;
+    }
+};
+#endif
+
+#ifndef TEST_ITERATIONS
+#define TEST_ITERATIONS 1000000
+#endif
+#ifndef TEST_SIZE
+#define TEST_SIZE 16
+#endif
+
+int main(int argc, char* argv[]) {
+  #ifdef TEST_BPLUSTREE
+  printf("BPlusTree.h iterate ");
+  BPlusTree<std::pair<int,int>, int, PairComp, DICT_ARITY> dict;
+  for (int i=0; i<TEST_SIZE; ++i) {
+    dict.insert(std::make_pair(i, i));
+  }
+  #else
+  printf("Dict.h iterate ");
+  Dict<int, int> dict;
+  for (int i=0; i<TEST_SIZE; ++i) {
+    dict.insert(i, i);
+  }
+  #endif
+
+  timeb t1, t2;
+  ftime(&t1);
+  uint64_t sum = 0;
+  for (size_t j=0; j<TEST_ITERATIONS; ++j) {
+    for (auto it = dict.begin(); it != dict.end(); ++it) {
+      sum += it->second;
+    }
+  }
+  ftime(&t2);
+  double t = tdiff(t2,t1);
+  uint64_t expect = (uint64_t) TEST_SIZE * (TEST_SIZE - 1) / 2 * TEST_ITERATIONS;
+  if (sum != expect) {
+    PANIC("iteration missed elements");
+  }
+  printf("test_size=%d test_iterations=%d time=%lf elements_per_sec=%.0lf\n", TEST_SIZE, TEST_ITERATIONS, t, (double) TEST_SIZE * TEST_ITERATIONS / t);
+
+  #ifdef TEST_BPLUSTREE
+  std::pair<int,int> junk;
+  #else
+  int junk;
+  #endif
+  for (int i=0; i<TEST_SIZE; ++i) {
+    dict.remove(i, &junk);
+  }
+  return 0;
+}
@@ -0,0 +1,547 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * A log structured merge (LSM) dictionary, a Dict for write heavy workloads.
+ *
+ * When to use this:
+ *   Lots of writes (set(), erase()) to a big dictionary, e.g. ingesting
+ *   key/value state, where even a BTree insert's cache misses add up. Writes
+ *   go to a small BTree (the memtable) that stays in cache. When it fills it
+ *   is frozen in to an immutable sorted array (a run), and a background thread
+ *   merges runs together in big sequential passes.
+ *   Reads pay for it: a miss in the memtable checks each run, newest first.
+ *   Each run has a Bloom filter, so that's mostly one cache miss per run.
+ *   If you read about as much as you write, use dict.h.
+ *
+ * How to use this:
+ *   Like Dict, with these differences:
+ *    - get() copies the value out, runs can be freed by compaction at any
+ *      time, so we can't hand out pointers in to them (like ts_btree.h)
+ *    - set() and erase() are "blind", they just write to the memtable, so
+ *      they're the fast way to write. insert(), emplace() and remove() have
+ *      Dict's meaning, so they do a get() first.
+ *    - Iterators are read only, and like Dict's are invalidated by writes
+ *    - No operator[], lower_bound() or range()
+ *
+ * Design Decisions:
+ *   Compaction is size-tiered:
+ * A run's tier is log_ratio(size / memtable size). Whenever ratio runs in a
+ * row share a tier we merge them, so there are at most about
+ * ratio * log_ratio(n / memtable size) runs, and each entry gets rewritten
+ * about log_ratio(n / memtable size) times. Leveled compaction (one run per
+ * level, merging in to it every time) gives cheaper reads, but rewrites each
+ * entry about ratio times per level, and this is for writes.
+ * Merging the oldest runs can drop tombstones, since there's nothing older
+ * for them to hide.
+ *   If compaction falls behind and there are LSM_MAX_RUNS runs, writers wait
+ * for it, rather than letting reads get slower and slower.
+ *
+ *   Runs are just sorted std::vectors:
+ * The memtable is already sorted, so freezing it is a copy (no fast_sort
+ * needed), and merging runs is a k-way merge. Runs are shared_ptrs, so an
+ * Iterator or a merge in progress keeps the runs it's using alive even if
+ * compaction replaces them.
+ *
+ *   Locking:
+ * The runs list is protected by a mutex, which get() holds while searching
+ * runs. The compactor only holds it to pick work and to swap in its result.
+ * We only ever append new runs, and only the compactor removes them, so the
+ * group it's merging stays where it was while it works.
+ *
+ * Threadsafety:
+ *   thread compatible (each LSMDict runs its own compaction thread, but you
+ *   can only use it from one thread at a time)
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "bloom.h"
+#include "btree.h"
+
+#ifndef LSM_H
+#define LSM_H
+
+// Entries in the memtable before we freeze it in to a run
+#ifndef LSM_MEMTABLE_SIZE
+#define LSM_MEMTABLE_SIZE 65536
+#endif
+// Runs in a tier before we merge them
+#ifndef LSM_RATIO
+#define LSM_RATIO 4
+#endif
+// Writers wait for compaction once there are this many runs
+#ifndef LSM_MAX_RUNS
+#define LSM_MAX_RUNS 32
+#endif
+// Bloom filter bits per entry, 10 is about a 1% false positive rate
+#ifndef LSM_BLOOM_BITS
+#define LSM_BLOOM_BITS 10
+#endif
+// Same as DICT_ARITY
+#ifndef LSM_ARITY
+#define LSM_ARITY 30
+#endif
+
+template<typename KT, typename VT>
+class LSMDict {
+  private:
+    // The newest version of a key, or a tombstone saying it was removed
+    struct Entry: public std::pair<KT,VT> {
+      bool tombstone;
+      Entry():tombstone(false) {}
+      Entry(KT key, VT value, bool dead):std::pair<KT,VT>(key, std::move(value)), tombstone(dead) {}
+    };
+    class EntryComp {
+      public:
+        static KT val(const Entry &e) {
+          return e.first;
+        }
+        static int compare(KT v1, KT v2) {
+          return v1 < v2 ? -1 : v1 > v2;
+        }
+    };
+    typedef BTree<Entry, KT, EntryComp, LSM_ARITY> Memtable;
+    struct Run {
+      // sorted, one entry per key
+      std::vector<Entry> entries;
+      BloomFilter bloom;
+      const Entry* find(KT key) const {
+        auto e = std::lower_bound(entries.begin(), entries.end(), key,
+            [](const Entry &a, const KT &k) { return EntryComp::compare(a.first, k) < 0; });
+        if (e != entries.end() && EntryComp::compare(e->first, key) == 0) {
+          return &(*e);
+        }
+        return nullptr;
+      }
+    };
+    typedef std::shared_ptr<const Run> RunPtr;
+
+    Memtable *mem;
+    size_t mem_count;
+    size_t memtable_size;
+    size_t ratio;
+    // Oldest first
+    std::vector<RunPtr> runs;
+    mutable std::mutex m;
+    // The compactor waits on work, writers (and wait_for_compaction()) on room
+    std::condition_variable work;
+    mutable std::condition_variable room;
+    bool stopping;
+    bool merging;
+    // Entries written by compaction, over all time
+    uint64_t merged;
+    std::thread compactor;
+
+    static uint64_t hash(KT key) {
+      return std::hash<KT>()(key);
+    }
+    static RunPtr build(std::vector<Entry> &&entries);
+    void put(KT key, VT &&value, bool tombstone);
+    void freeze(void);
+    size_t tier(const RunPtr &run) const;
+    bool pick(size_t *first, size_t *count) const;
+    RunPtr merge(const std::vector<RunPtr> &inputs, bool bottom) const;
+    void compact(void);
+  public:
+    class Iterator;
+    LSMDict(size_t memtable_entries=LSM_MEMTABLE_SIZE, size_t tier_ratio=LSM_RATIO);
+    ~LSMDict();
+    LSMDict(const LSMDict&) = delete;
+    LSMDict& operator=(const LSMDict&) = delete;
+    // Copies the value in to result, if it's not nullptr
+    bool get(KT key, VT *result) const;
+    // Insert or replace, doesn't look
+    void set(KT key, VT value);
+    // Remove key if it's there, doesn't look
+    void erase(KT key);
+    // Same as Dict: false (and no change) if key is already here
+    bool insert(KT key, VT value);
+    // Same, but builds the value from args, only if key isn't here
+    template<typename... Args>
+    bool emplace(KT key, Args&&... args) {
+      if (get(key, nullptr)) {
+        return false;
+      }
+      put(key, VT(std::forward<Args>(args)...), false);
+      return true;
+    }
+    template<typename... Args>
+    bool try_emplace(KT key, Args&&... args) {
+      return emplace(key, std::forward<Args>(args)...);
+    }
+    // result may be nullptr, if you don't want the value back
+    bool remove(KT key, VT *result);
+    // Has to skip past tombstones, so O(n) if you've removed everything
+    bool isempty(void) const;
+    operator bool() const {
+      return !isempty();
+    }
+    Iterator begin(void) const;
+    Iterator end(void) const;
+    // Blocks until the compactor has nothing left to do
+    void wait_for_compaction(void) const;
+    size_t get_runs(void) const;
+    uint64_t get_merged(void) const;
+};
+
+// Merges the memtable and a snapshot of the runs, in key order
+template<typename KT, typename VT>
+class LSMDict<KT,VT>::Iterator {
+  private:
+    std::vector<RunPtr> runs;
+    std::vector<size_t> pos;
+    typename Memtable::Iterator mit;
+    typename Memtable::Iterator mend;
+    const Entry *cur;
+
+    // Step every source past key
+    void skip(KT key) {
+      for (size_t i=0; i<runs.size(); ++i) {
+        if (pos[i] < runs[i]->entries.size() &&
+            EntryComp::compare(runs[i]->entries[pos[i]].first, key) == 0) {
+          pos[i]++;
+        }
+      }
+      if (mit != mend && EntryComp::compare(mit->first, key) == 0) {
+        ++mit;
+      }
+    }
+    // Point cur at the newest version of the smallest key left, skipping
+    // removed keys
+    void settle() {
+      while (true) {
+        const Entry *best = nullptr;
+        // Newer runs win ties, and the memtable is newest of all
+        for (size_t i=0; i<runs.size(); ++i) {
+          if (pos[i] == runs[i]->entries.size()) {
+            continue;
+          }
+          const Entry &e = runs[i]->entries[pos[i]];
+          if (!best || EntryComp::compare(e.first, best->first) <= 0) {
+            best = &e;
+          }
+        }
+        if (mit != mend && (!best || EntryComp::compare(mit->first, best->first) <= 0)) {
+          best = &(*mit);
+        }
+        cur = best;
+        if (!cur || !cur->tombstone) {
+          return;
+        }
+        skip(cur->first);
+      }
+    }
+  public:
+    Iterator():cur(nullptr) {}
+    Iterator(const Memtable *mem, std::vector<RunPtr> &&snapshot):runs(std::move(snapshot)), pos(runs.size(), 0), mit(mem->begin()), mend(mem->end()) {
+      settle();
+    }
+    bool operator==(const Iterator &other) const {
+      return cur == other.cur;
+    }
+    bool operator!=(const Iterator &other) const {
+      return cur != other.cur;
+    }
+    Iterator& operator++(void) {
+      skip(cur->first);
+      settle();
+      return *this;
+    }
+    const std::pair<KT,VT>& operator*() const {
+      return *cur;
+    }
+    const std::pair<KT,VT>* operator->() const {
+      return cur;
+    }
+};
+
+template<typename KT, typename VT>
+LSMDict<KT,VT>::LSMDict(size_t memtable_entries, size_t tier_ratio) {
+  mem = new Memtable();
+  mem_count = 0;
+  memtable_size = memtable_entries ? memtable_entries : 1;
+  ratio = tier_ratio < 2 ? 2 : tier_ratio;
+  if (ratio >= LSM_MAX_RUNS) {
+    ratio = LSM_MAX_RUNS - 1;
+  }
+  stopping = false;
+  merging = false;
+  merged = 0;
+  compactor = std::thread([this]() { compact(); });
+}
+
+template<typename KT, typename VT>
+LSMDict<KT,VT>::~LSMDict() {
+  {
+    std::lock_guard<std::mutex> l(m);
+    stopping = true;
+  }
+  work.notify_all();
+  compactor.join();
+  delete mem;
+}
+
+template<typename KT, typename VT>
+bool LSMDict<KT,VT>::get(KT key, VT *result) const {
+  const Entry *e = mem->get(key);
+  if (e) {
+    if (e->tombstone) {
+      return false;
+    }
+    if (result) {
+      *result = e->second;
+    }
+    return true;
+  }
+  uint64_t h = hash(key);
+  std::lock_guard<std::mutex> l(m);
+  for (size_t i=runs.size(); i-- > 0;) {
+    if (!runs[i]->bloom.maybe_contains(h)) {
+      continue;
+    }
+    e = runs[i]->find(key);
+    if (e) {
+      if (e->tombstone) {
+        return false;
+      }
+      if (result) {
+        *result = e->second;
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+template<typename KT, typename VT>
+void LSMDict<KT,VT>::set(KT key, VT value) {
+  put(key, std::move(value), false);
+}
+
+template<typename KT, typename VT>
+void LSMDict<KT,VT>::erase(KT key) {
+  put(key, VT(), true);
+}
+
+template<typename KT, typename VT>
+bool LSMDict<KT,VT>::insert(KT key, VT value) {
+  if (get(key, nullptr)) {
+    return false;
+  }
+  put(key, std::move(value), false);
+  return true;
+}
+
+template<typename KT, typename VT>
+bool LSMDict<KT,VT>::remove(KT key, VT *result) {
+  if (!get(key, result)) {
+    return false;
+  }
+  put(key, VT(), true);
+  return true;
+}
+
+template<typename KT, typename VT>
+bool LSMDict<KT,VT>::isempty(void) const {
+  return begin() == end();
+}
+
+template<typename KT, typename VT>
+typename LSMDict<KT,VT>::Iterator LSMDict<KT,VT>::begin(void) const {
+  std::vector<RunPtr> snapshot;
+  {
+    std::lock_guard<std::mutex> l(m);
+    snapshot = runs;
+  }
+  return Iterator(mem, std::move(snapshot));
+}
+
+template<typename KT, typename VT>
+typename LSMDict<KT,VT>::Iterator LSMDict<KT,VT>::end(void) const {
+  return Iterator();
+}
+
+template<typename KT, typename VT>
+void LSMDict<KT,VT>::wait_for_compaction(void) const {
+  size_t first, count;
+  std::unique_lock<std::mutex> l(m);
+  while (merging || pick(&first, &count)) {
+    room.wait(l);
+  }
+}
+
+template<typename KT, typename VT>
+size_t LSMDict<KT,VT>::get_runs(void) const {
+  std::lock_guard<std::mutex> l(m);
+  return runs.size();
+}
+
+template<typename KT, typename VT>
+uint64_t LSMDict<KT,VT>::get_merged(void) const {
+  std::lock_guard<std::mutex> l(m);
+  return merged;
+}
+
+// Writes an entry (or tombstone) to the memtable, freezing it if it's full
+template<typename KT, typename VT>
+void LSMDict<KT,VT>::put(KT key, VT &&value, bool tombstone) {
+  Entry *e = mem->get(key);
+  if (e) {
+    e->second = std::move(value);
+    e->tombstone = tombstone;
+    return;
+  }
+  mem->insert(Entry(key, std::move(value), tombstone));
+  if (++mem_count >= memtable_size) {
+    freeze();
+  }
+}
+
+template<typename KT, typename VT>
+typename LSMDict<KT,VT>::RunPtr LSMDict<KT,VT>::build(std::vector<Entry> &&entries) {
+  std::shared_ptr<Run> run = std::make_shared<Run>();
+  run->entries = std::move(entries);
+  run->bloom.init(run->entries.size(), LSM_BLOOM_BITS);
+  for (const Entry &e : run->entries) {
+    run->bloom.add(hash(e.first));
+  }
+  return run;
+}
+
+// Turns the memtable in to the newest run
+template<typename KT, typename VT>
+void LSMDict<KT,VT>::freeze(void) {
+  std::vector<Entry> entries;
+  entries.reserve(mem_count);
+  for (auto it = mem->begin(); it != mem->end(); ++it) {
+    entries.push_back(std::move(*it));
+  }
+  RunPtr run = build(std::move(entries));
+  {
+    std::unique_lock<std::mutex> l(m);
+    while (runs.size() >= LSM_MAX_RUNS) {
+      room.wait(l);
+    }
+    runs.push_back(run);
+  }
+  work.notify_one();
+  delete mem;
+  mem = new Memtable();
+  mem_count = 0;
+}
+
+template<typename KT, typename VT>
+size_t LSMDict<KT,VT>::tier(const RunPtr &run) const {
+  size_t t = 0;
+  for (size_t s=memtable_size*ratio; s <= run->entries.size(); s*=ratio) {
+    t++;
+  }
+  return t;
+}
+
+// Finds the oldest group of ratio or more adjacent runs in the same tier.
+// Overwrites and removes shrink runs as they're merged, so a run can end up
+// in a lower tier than a newer one. We count each run as being in no higher
+// a tier than the runs older than it, so tiers only go down as runs get
+// newer, and every tier stays under ratio runs. Call with m held.
+template<typename KT, typename VT>
+bool LSMDict<KT,VT>::pick(size_t *first, size_t *count) const {
+  size_t start = 0;
+  size_t start_tier = 0;
+  size_t t = 0;
+  for (size_t i=0; i<=runs.size(); ++i) {
+    if (i < runs.size()) {
+      t = i ? std::min(t, tier(runs[i])) : tier(runs[i]);
+      if (i && t == start_tier) {
+        continue;
+      }
+    }
+    if (i - start >= ratio) {
+      *first = start;
+      *count = i - start;
+      return true;
+    }
+    start = i;
+    start_tier = t;
+  }
+  // Only possible with a tiny ratio and a huge dict, but writers are waiting
+  // if we're full, so merge the newest.
+  if (runs.size() >= LSM_MAX_RUNS) {
+    *first = runs.size() - ratio;
+    *count = ratio;
+    return true;
+  }
+  return false;
+}
+
+// k-way merge of inputs (oldest first), the newest version of a key wins.
+// bottom means nothing is older than inputs, so tombstones can go.
+template<typename KT, typename VT>
+typename LSMDict<KT,VT>::RunPtr LSMDict<KT,VT>::merge(const std::vector<RunPtr> &inputs, bool bottom) const {
+  size_t total = 0;
+  for (const RunPtr &r : inputs) {
+    total += r->entries.size();
+  }
+  std::vector<Entry> out;
+  out.reserve(total);
+  std::vector<size_t> pos(inputs.size(), 0);
+  while (true) {
+    const Entry *best = nullptr;
+    for (size_t i=0; i<inputs.size(); ++i) {
+      if (pos[i] == inputs[i]->entries.size()) {
+        continue;
+      }
+      const Entry &e = inputs[i]->entries[pos[i]];
+      if (!best || EntryComp::compare(e.first, best->first) <= 0) {
+        best = &e;
+      }
+    }
+    if (!best) {
+      break;
+    }
+    if (!(bottom && best->tombstone)) {
+      out.push_back(*best);
+    }
+    KT key = best->first;
+    for (size_t i=0; i<inputs.size(); ++i) {
+      if (pos[i] < inputs[i]->entries.size() &&
+          EntryComp::compare(inputs[i]->entries[pos[i]].first, key) == 0) {
+        pos[i]++;
+      }
+    }
+  }
+  return build(std::move(out));
+}
+
+// The compaction thread
+template<typename KT, typename VT>
+void LSMDict<KT,VT>::compact(void) {
+  std::unique_lock<std::mutex> l(m);
+  while (!stopping) {
+    size_t first, count;
+    if (!pick(&first, &count)) {
+      merging = false;
+      room.notify_all();
+      work.wait(l);
+      continue;
+    }
+    merging = true;
+    std::vector<RunPtr> inputs(runs.begin() + first, runs.begin() + first + count);
+    l.unlock();
+    RunPtr out = merge(inputs, first == 0);
+    l.lock();
+    merged += out->entries.size();
+    runs.erase(runs.begin() + first, runs.begin() + first + count);
+    if (!out->entries.empty()) {
+      runs.insert(runs.begin() + first, out);
+    }
+    room.notify_all();
+  }
+}
+
+#endif
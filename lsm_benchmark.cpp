@@ -0,0 +1,115 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * Benchmark for LSMDict against Dict on mixed read/write workloads.
+ * First we load TEST_SIZE random keys with set(), then run TEST_ITERATIONS
+ * operations at each mix of writes (set() of a random key) and reads (get()
+ * of a random key, about half of which are there). All keys are drawn from
+ * [0, 2*TEST_SIZE).
+ * LSMDict's compaction runs on its own thread, so on a machine with a spare
+ * core some of its cost doesn't show up in these times. We also print how
+ * many entries compaction wrote per write (write amplification), and the
+ * number of runs reads had to check.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "panic.h"
+#include "timer.h"
+#include "dict.h"
+#include "lsm.h"
+
+#ifndef TEST_SIZE
+#define TEST_SIZE 4000000
+#endif
+#ifndef TEST_ITERATIONS
+#define TEST_ITERATIONS 4000000
+#endif
+
+int *keys;
+bool *is_write;
+
+// Percent of operations that are writes
+int mixes[] = {100, 90, 50, 10};
+
+template<typename D>
+void load(D *d) {
+  for (int i=0; i<TEST_SIZE; ++i) {
+    d->set(keys[i], i);
+  }
+}
+
+void make_ops(int writes) {
+  for (int i=0; i<TEST_ITERATIONS; ++i) {
+    keys[i] = rand() % (2 * TEST_SIZE);
+    is_write[i] = rand() % 100 < writes;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  printf("test_size=%d test_iterations=%d\n", TEST_SIZE, TEST_ITERATIONS);
+  size_t n = TEST_SIZE > TEST_ITERATIONS ? TEST_SIZE : TEST_ITERATIONS;
+  keys = new int[n];
+  is_write = new bool[n];
+  Dict<int, int> *dict = new Dict<int, int>();
+  LSMDict<int, int> *lsm = new LSMDict<int, int>();
+  timeb t1, t2;
+
+  // Note, we did not initialize rand, this is purposeful
+  for (int i=0; i<TEST_SIZE; ++i) {
+    keys[i] = rand() % (2 * TEST_SIZE);
+  }
+  ftime(&t1);
+  load(dict);
+  ftime(&t2);
+  printf("load Dict time=%lf ops_per_sec=%.0lf\n", tdiff(t2, t1), TEST_SIZE / tdiff(t2, t1));
+  ftime(&t1);
+  load(lsm);
+  ftime(&t2);
+  printf("load LSMDict time=%lf ops_per_sec=%.0lf\n", tdiff(t2, t1), TEST_SIZE / tdiff(t2, t1));
+  ftime(&t1);
+  lsm->wait_for_compaction();
+  ftime(&t2);
+  printf("load LSMDict compaction_catchup=%lf write_amplification=%.2lf runs=%ld\n", tdiff(t2, t1), (double) lsm->get_merged() / TEST_SIZE, lsm->get_runs());
+
+  for (int writes : mixes) {
+    make_ops(writes);
+    uint64_t sum = 0;
+    ftime(&t1);
+    for (int i=0; i<TEST_ITERATIONS; ++i) {
+      if (is_write[i]) {
+        dict->set(keys[i], i);
+      } else {
+        int *v = dict->get(keys[i]);
+        sum += v ? *v : 0;
+      }
+    }
+    ftime(&t2);
+    printf("writes=%d%% Dict time=%lf ops_per_sec=%.0lf\n", writes, tdiff(t2, t1), TEST_ITERATIONS / tdiff(t2, t1));
+    uint64_t lsum = 0;
+    uint64_t merged = lsm->get_merged();
+    ftime(&t1);
+    for (int i=0; i<TEST_ITERATIONS; ++i) {
+      if (is_write[i]) {
+        lsm->set(keys[i], i);
+      } else {
+        int v;
+        lsum += lsm->get(keys[i], &v) ? v : 0;
+      }
+    }
+    ftime(&t2);
+    printf("writes=%d%% LSMDict time=%lf ops_per_sec=%.0lf runs=%ld\n", writes, tdiff(t2, t1), TEST_ITERATIONS / tdiff(t2, t1), lsm->get_runs());
+    ftime(&t1);
+    lsm->wait_for_compaction();
+    ftime(&t2);
+    printf("writes=%d%% LSMDict compaction_catchup=%lf write_amplification=%.2lf\n", writes, tdiff(t2, t1), (double) (lsm->get_merged() - merged) / TEST_ITERATIONS / writes * 100);
+    if (sum != lsum) {
+      PANIC("Dict and LSMDict disagree");
+    }
+  }
+  delete dict;
+  delete lsm;
+  delete[] keys;
+  delete[] is_write;
+  return 0;
+}
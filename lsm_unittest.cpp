@@ -0,0 +1,138 @@
+#include <map>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "panic.h"
+#include "lsm.h"
+
+#define TEST_SIZE 200000
+#define KEY_RANGE 5000
+
+// Everything in d matches ref, through get() and iteration
+void check(const LSMDict<int, int> &d, const std::map<int, int> &ref) {
+  for (int k=-1; k<=KEY_RANGE; ++k) {
+    int v = -1;
+    auto r = ref.find(k);
+    if (d.get(k, &v) != (r != ref.end())) {
+      printf("%d\n", k);
+      PANIC("get disagrees about whether key is here");
+    }
+    if (r != ref.end() && v != r->second) {
+      printf("%d: %d should be %d\n", k, v, r->second);
+      PANIC("get returned an old value");
+    }
+  }
+  auto r = ref.begin();
+  for (auto &kv : d) {
+    if (r == ref.end() || kv.first != r->first || kv.second != r->second) {
+      PANIC("iterator disagrees");
+    }
+    ++r;
+  }
+  if (r != ref.end()) {
+    PANIC("iterator stopped early");
+  }
+  if (d.isempty() != ref.empty()) {
+    PANIC("isempty is wrong");
+  }
+}
+
+int main(int argc, char* argv[]) {
+  printf("Begin LSM.h unittest\n");
+
+  // Bloom filters never give false negatives, and about the false positive
+  // rate they promise
+  BloomFilter bloom;
+  bloom.init(10000, 10);
+  for (uint64_t i=0; i<10000; ++i) {
+    bloom.add(i * 3);
+  }
+  size_t fp = 0;
+  for (uint64_t i=0; i<30000; ++i) {
+    bool in = bloom.maybe_contains(i);
+    if (i % 3 == 0 && !in) {
+      PANIC("bloom filter lost a key");
+    }
+    fp += i % 3 != 0 && in;
+  }
+  if (fp > 20000 * 3 / 100) {
+    printf("%ld false positives\n", fp);
+    PANIC("bloom filter false positive rate is too high");
+  }
+
+  // A tiny memtable, so we freeze and compact constantly
+  LSMDict<int, int> d(64, 3);
+  std::map<int, int> ref;
+  check(d, ref);
+  // Note, we did not initialize rand, this is purposeful
+  for (int i=0; i<TEST_SIZE; ++i) {
+    int k = rand() % KEY_RANGE;
+    int v = rand();
+    int got;
+    switch (rand() % 6) {
+      case 0:
+      case 1:
+        d.set(k, v);
+        ref[k] = v;
+        break;
+      case 2:
+        d.erase(k);
+        ref.erase(k);
+        break;
+      case 3:
+        if (d.insert(k, v) != !ref.count(k)) {
+          PANIC("insert disagrees about whether key is here");
+        }
+        ref.insert(std::make_pair(k, v));
+        break;
+      case 4:
+        if (d.remove(k, &got) != !!ref.count(k)) {
+          PANIC("remove disagrees about whether key is here");
+        }
+        if (ref.count(k) && got != ref[k]) {
+          PANIC("remove returned the wrong value");
+        }
+        ref.erase(k);
+        break;
+      case 5:
+        if (d.emplace(k, v) != !ref.count(k)) {
+          PANIC("emplace disagrees about whether key is here");
+        }
+        ref.insert(std::make_pair(k, v));
+        break;
+    }
+    if (i % 20000 == 0) {
+      check(d, ref);
+    }
+  }
+  check(d, ref);
+  if (d.get_merged() == 0) {
+    PANIC("nothing was ever compacted");
+  }
+
+  // Once compaction catches up, tiers keep the number of runs down. 5000 keys
+  // is at most 79 runs of 64, we should have just a few.
+  d.wait_for_compaction();
+  if (d.get_runs() > 12) {
+    printf("%ld runs\n", d.get_runs());
+    PANIC("compaction didn't keep up");
+  }
+  check(d, ref);
+
+  // Remove everything, tombstones hide keys in any run
+  for (int k=0; k<KEY_RANGE; ++k) {
+    d.erase(k);
+  }
+  ref.clear();
+  check(d, ref);
+  for (int k=KEY_RANGE; k<2*KEY_RANGE; ++k) {
+    d.set(k, k);
+    d.erase(k);
+  }
+  d.wait_for_compaction();
+  check(d, ref);
+  if (d) {
+    PANIC("dict thinks it isn't empty");
+  }
+  printf("PASS\n");
+}
@@ -0,0 +1,266 @@
+/*
+ * Copyright: Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * This is a min-max heap, a double ended priority queue.
+ *
+ * When to use this:
+ * Any time you need both the smallest and the largest element, e.g. a bounded
+ * "best K" set where you read the best element and evict the worst one.
+ * min() and max() are O(1), push, pop_min and pop_max are O(log(n)).
+ * If you only need one end heap.h is a little faster.
+ *
+ * How to use this:
+ * The template arguments are the same as heap.h. UArrayT is the backing store,
+ * we suggest DCUArray from delayed_copy_array.h.
+ * "Better" means smaller, as in heap.h, so pop() is the same as pop_min().
+ *
+ * Keep best K:
+ * offer(data, k) keeps the k smallest elements seen. Until the heap has k
+ * elements it just pushes, after that it replaces max() if data is smaller.
+ * If you use a StaticUArray<T, K> from array.h as the backing store, with
+ * k=K, then streaming top-K does no allocation at all.
+ * (If you want the k *largest* elements, flip your compare function)
+ *
+ * Algorithm:
+ * Levels alternate between min levels and max levels, starting with a min
+ * level at the root. Every node on a min level is <= all of it's
+ * descendants, every node on a max level is >= all of it's descendants.
+ * So the min is the root, and the max is one of it's two children.
+ * Bubbling up compares against grandparents (same kind of level), trickling
+ * down looks at children and grandchildren. See Atkinson et al. 1986.
+ *
+ * Threadsafety:
+ *   Thread compatible
+ */
+
+#include <stdio.h>
+#include "panic.h"
+
+#ifndef MINMAXHEAP_H
+#define MINMAXHEAP_H
+
+// Define this to implement some expensive consistancy checking, this is great
+// for debugging code that uses the heap as well.
+// This checks all of the heap invariants before and after ever oparation.
+#ifdef MINMAXHEAP_DEBUG
+#define MINMAXHEAP_CHECK() check()
+#else
+#define MINMAXHEAP_CHECK()
+#endif
+
+template<typename UArrayT, typename T, typename C>
+class MinMaxHeap {
+  private:
+    UArrayT ar;
+    static bool is_min_level(size_t i) {
+      return !((63 - __builtin_clzll(i+1)) & 1);
+    }
+    // true if ar[i] should be above ar[j] on a min level
+    bool less(size_t i, size_t j) {
+      return C::compare(&ar[i], &ar[j]) < 0;
+    }
+    // index of max(), heap must not be empty
+    size_t max_index() {
+      if (ar.size() == 1) {
+        return 0;
+      }
+      if (ar.size() == 2 || less(2, 1)) {
+        return 1;
+      }
+      return 2;
+    }
+    // MIN is true when i is on a min level
+    template<bool MIN>
+    bool before(size_t i, size_t j) {
+      return MIN ? less(i, j) : less(j, i);
+    }
+    template<bool MIN>
+    void bubble_up_same(size_t i) {
+      // grandparents are on the same kind of level
+      while (i > 2) {
+        size_t gp = ((i-1)/2 - 1)/2;
+        if (!before<MIN>(i, gp)) {
+          return;
+        }
+        ar.swap(i, gp);
+        i = gp;
+      }
+    }
+    void bubble_up(size_t i) {
+      if (i == 0) {
+        return;
+      }
+      size_t parent = (i-1)/2;
+      if (is_min_level(i)) {
+        if (less(parent, i)) {
+          ar.swap(i, parent);
+          bubble_up_same<false>(parent);
+        } else {
+          bubble_up_same<true>(i);
+        }
+      } else {
+        if (less(i, parent)) {
+          ar.swap(i, parent);
+          bubble_up_same<true>(parent);
+        } else {
+          bubble_up_same<false>(i);
+        }
+      }
+    }
+    template<bool MIN>
+    void trickle_down_same(size_t i) {
+      size_t n = ar.size();
+      while (2*i+1 < n) {
+        // find the best of our children and grandchildren
+        size_t m = 2*i+1;
+        if (m+1 < n && before<MIN>(m+1, m)) {
+          m = m+1;
+        }
+        size_t first_gc = 4*i+3;
+        for (size_t gc = first_gc; gc < first_gc+4 && gc < n; ++gc) {
+          if (before<MIN>(gc, m)) {
+            m = gc;
+          }
+        }
+        if (!before<MIN>(m, i)) {
+          return;
+        }
+        ar.swap(i, m);
+        if (m < first_gc) {
+          // it was a child, it has no children of it's own that we could
+          // be out of order with (otherwise a grandchild would have won)
+          return;
+        }
+        // grandchild, we may now be out of order with it's parent
+        size_t parent = (m-1)/2;
+        if (before<MIN>(parent, m)) {
+          ar.swap(m, parent);
+        }
+        i = m;
+      }
+    }
+    void trickle_down(size_t i) {
+      if (is_min_level(i)) {
+        trickle_down_same<true>(i);
+      } else {
+        trickle_down_same<false>(i);
+      }
+    }
+    // removes ar[i] by moving the last element in to it's place
+    void remove_at(size_t i, T *val) {
+      *val = ar[i];
+      // See heap.h, we can't pop straight in to ar[i]
+      T tmp;
+      if (!ar.pop(&tmp)) {
+        PANIC("This should never happen");
+      }
+      if (i < ar.size()) {
+        ar[i] = tmp;
+        trickle_down(i);
+      }
+    }
+  public:
+    MinMaxHeap():ar() {
+    }
+    ~MinMaxHeap() {
+    }
+    void push(T data) {
+      MINMAXHEAP_CHECK();
+      ar.push(data);
+      bubble_up(ar.size()-1);
+      MINMAXHEAP_CHECK();
+    }
+    bool pop_min(T *val) {
+      MINMAXHEAP_CHECK();
+      if (!ar.size()) {
+        return false;
+      }
+      remove_at(0, val);
+      MINMAXHEAP_CHECK();
+      return true;
+    }
+    bool pop_max(T *val) {
+      MINMAXHEAP_CHECK();
+      if (!ar.size()) {
+        return false;
+      }
+      remove_at(max_index(), val);
+      MINMAXHEAP_CHECK();
+      return true;
+    }
+    bool pop(T *val) {
+      return pop_min(val);
+    }
+    // heap must not be empty
+    const T& min() {
+      return ar[0];
+    }
+    // heap must not be empty
+    const T& max() {
+      return ar[max_index()];
+    }
+    // Replaces min() with data, same as a pop_min() then push() but faster
+    // heap must not be empty
+    void replace_min(T data) {
+      MINMAXHEAP_CHECK();
+      ar[0] = data;
+      trickle_down_same<true>(0);
+      MINMAXHEAP_CHECK();
+    }
+    // Replaces max() with data, same as a pop_max() then push() but faster
+    // heap must not be empty
+    void replace_max(T data) {
+      MINMAXHEAP_CHECK();
+      size_t m = max_index();
+      ar[m] = data;
+      if (m != 0) {
+        // our new value might belong at the root
+        if (less(m, 0)) {
+          ar.swap(0, m);
+        }
+        trickle_down_same<false>(m);
+      }
+      MINMAXHEAP_CHECK();
+    }
+    // Keeps the k smallest elements offered
+    // returns false if data was rejected
+    bool offer(T data, size_t k) {
+      if (ar.size() < k) {
+        push(data);
+        return true;
+      }
+      if (!k || C::compare(&data, &ar[max_index()]) >= 0) {
+        return false;
+      }
+      replace_max(data);
+      return true;
+    }
+    bool isempty() const {
+      return !ar;
+    }
+    operator bool() const {
+      return ar;
+    }
+    size_t size() const {
+      return ar.size();
+    }
+    // Raw access to the backing store, in heap order
+    const T& get(size_t i) {
+      return ar[i];
+    }
+    void check() {
+      for (size_t i=1; i<ar.size(); ++i) {
+        // check against every ancestor
+        size_t a = i;
+        while (a != 0) {
+          a = (a-1)/2;
+          if (is_min_level(a) ? less(i, a) : less(a, i)) {
+            printf("i=%lu ancestor=%lu\n", i, a);
+            PANIC("minmaxheap is not in order\n");
+          }
+        }
+      }
+    }
+};
+
+#endif
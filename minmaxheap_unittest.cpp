@@ -0,0 +1,135 @@
+#define MINMAXHEAP_DEBUG
+#define ARRAY_DEBUG
+#define DELAYED_COPY_ARRAY_DEBUG
+#include <algorithm>
+#include "minmaxheap.h"
+#include "array.h"
+#include "delayed_copy_array.h"
+
+#define TEST_SIZE 200
+#define K 10
+
+class HeapCompare {
+  public:
+    static int compare(int *v1, int *v2) {
+      return (*v1) - (*v2);
+    }
+};
+
+int main(int argc, char **argv) {
+  printf("Begin MinMaxHeap.h unittest\n");
+  MinMaxHeap<DCUArray<int>, int, HeapCompare> heap;
+  int ref[TEST_SIZE];
+  int i,j;
+  int val=-1;
+
+  // Fill with random values then alternate pop_min and pop_max
+  for (j=0; j<TEST_SIZE; j++) {
+    for (i=0; i<j; i++) {
+      ref[i] = rand() % TEST_SIZE;
+      heap.push(ref[i]);
+    }
+    std::sort(ref, ref+j);
+    int lo = 0;
+    int hi = j-1;
+    for (i=0; i<j; i++) {
+      if (heap.min() != ref[lo] || heap.max() != ref[hi]) {
+        PANIC("min() or max() is wrong");
+      }
+      if (i%2) {
+        heap.pop_max(&val);
+        if (val != ref[hi--]) {
+          PANIC("pop_max returned the wrong value");
+        }
+      } else {
+        heap.pop_min(&val);
+        if (val != ref[lo++]) {
+          PANIC("pop_min returned the wrong value");
+        }
+      }
+    }
+    if (heap.pop(&val) || heap.pop_max(&val) || !heap.isempty()) {
+      PANIC("MinMaxHeap didn't drain");
+    }
+  }
+
+  // Ascending and descending
+  for (i=0; i<TEST_SIZE; i++) {
+    heap.push(i);
+  }
+  for (i=TEST_SIZE-1; i>=0; i--) {
+    heap.pop_max(&val);
+    if (val != i) {
+      PANIC("pop_max out of order");
+    }
+  }
+  for (i=TEST_SIZE-1; i>=0; i--) {
+    heap.push(i);
+  }
+  for (i=0; i<TEST_SIZE; i++) {
+    heap.pop(&val);
+    if (val != i) {
+      PANIC("pop out of order");
+    }
+  }
+
+  // replace_min and replace_max
+  for (i=0; i<TEST_SIZE; i++) {
+    ref[i] = rand() % TEST_SIZE;
+    heap.push(ref[i]);
+  }
+  for (j=0; j<TEST_SIZE; j++) {
+    std::sort(ref, ref+TEST_SIZE);
+    int v = rand() % TEST_SIZE;
+    if (j%2) {
+      heap.replace_max(v);
+      ref[TEST_SIZE-1] = v;
+    } else {
+      heap.replace_min(v);
+      ref[0] = v;
+    }
+  }
+  std::sort(ref, ref+TEST_SIZE);
+  for (i=0; i<TEST_SIZE; i++) {
+    heap.pop(&val);
+    if (val != ref[i]) {
+      PANIC("replace broke the heap");
+    }
+  }
+
+  // Duplicates
+  for (i=0; i<10; i++) {
+    heap.push(1);
+  }
+  for (i=0; i<10; i++) {
+    if (!heap.pop_max(&val) || val != 1) {
+      PANIC("duplicate handling broken");
+    }
+  }
+  if (heap.pop(&val)) {
+    PANIC("MinMaxHeap didn't drain");
+  }
+
+  // Keep best K on a static array, so no allocation
+  MinMaxHeap<StaticUArray<int, K>, int, HeapCompare> best;
+  for (i=0; i<TEST_SIZE; i++) {
+    ref[i] = rand();
+    best.offer(ref[i], K);
+    if (best.size() > K) {
+      PANIC("offer kept too many elements");
+    }
+  }
+  std::sort(ref, ref+TEST_SIZE);
+  if (best.offer(ref[TEST_SIZE-1], K)) {
+    PANIC("offer accepted an element worse than everything kept");
+  }
+  for (i=0; i<K; i++) {
+    best.pop_min(&val);
+    if (val != ref[i]) {
+      PANIC("offer didn't keep the best K");
+    }
+  }
+
+  printf("PASS\n");
+  return 0;
+}
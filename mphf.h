@@ -0,0 +1,544 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * A minimal perfect hash function (MPHF) for a static set of keys, PTHash
+ * style.
+ *
+ * When to use this:
+ *   You have a big set of keys that never changes (e.g. loaded at startup),
+ *   and want to map each one to a unique index in [0, n), to index an array
+ *   of values. It takes a few bits per key (we never store the keys), and a
+ *   lookup touches up to three arrays, see "Lookup cost" below.
+ *   Keys *not* in the set map to some arbitrary index in [0, n). If you need
+ *   to know whether a key is in the set, store the key (or a fingerprint) in
+ *   your value array and compare.
+ *
+ * How to use this:
+ *   HC provides static size_t hash(Key_T), as for our hashtables. Keys with the
+ *   same hash look like duplicates, so use a decent 64 bit hash.
+ *   build() the function from an array of keys. After that lookup() it, or
+ *   save() it to a file. A saved function can be map()ed back in, which just
+ *   mmaps the file and uses it as is, or load()ed from any buffer you already
+ *   have, which doesn't copy it either.
+ *
+ * Algorithm (PTHash, Pibiri and Trani 2021):
+ *   Each key gets a 64 bit hash pair (a, b). "a" picks a partition and then a
+ *   bucket in it, with about 7 buckets per log2(n) keys. Buckets are skewed,
+ *   60% of keys go to 30% of buckets, so we get a few big buckets to place
+ *   first while the table is empty.
+ *   Each bucket has a "pilot", a small integer. A key's position is
+ *     fastrange(b ^ mix(pilot), m)
+ *   where m = n/0.99 is the partition's table size. We place buckets biggest
+ *   first, trying pilots 0,1,2... until every key in the bucket lands on a free
+ *   position. Pilots are stored bit packed, so a lookup is one read from the
+ *   pilot array.
+ *   Since m is a bit bigger than n, some keys land at positions >= n, for
+ *   those we keep a small array mapping them to the unused positions < n.
+ *   That's the (rare) second read.
+ *   The partitions are built independently, so we build them in parallel.
+ *
+ * Lookup cost:
+ *   A lookup reads the key's Partition entry, then one pilot, then for the
+ *   few keys landing at positions >= n one remap entry. That's three arrays,
+ *   not two, on purpose: the partition table is small (a few bytes per
+ *   million keys) and stays in cache, so in practice it's one cache miss for
+ *   the pilot and occasionally a second for the remap. Folding the partition
+ *   offsets in to the pilot words would save that cached read, at the cost
+ *   of bigger pilots and of building partitions independently.
+ *
+ * Serialized form:
+ *   Header, Partition table, pilot words, remap entries. Everything is
+ *   a fixed size integer, the file is used in place, no parsing.
+ *   It's in native byte order, don't move it between machines of different
+ *   endianness.
+ *
+ * Threadsafety:
+ *   thread compatible, lookup() is const and can run concurrently.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "panic.h"
+#include "hash.h"
+
+#ifndef MPHF_H
+#define MPHF_H
+
+// Average keys per partition
+#define MPHF_PARTITION_KEYS (1<<20)
+// Buckets = MPHF_C * keys / log2(keys), bigger is faster to build, more space
+#define MPHF_C 7
+// Table size is keys / MPHF_ALPHA
+#define MPHF_ALPHA 0.99
+// Give up on a bucket (and try a new seed) after this many pilots
+#define MPHF_MAX_PILOT (1<<24)
+// Seeds to try before deciding the keys must have duplicates
+#define MPHF_ATTEMPTS 4
+#define MPHF_MAGIC 0x3146485048504d4dlu
+
+template <typename Key_T, typename HC>
+class MPHF {
+  private:
+    struct Header {
+      uint64_t magic;
+      uint64_t n;
+      uint64_t seed;
+      uint64_t partitions;
+      uint64_t pilot_bits;
+      uint64_t pilot_words;
+      uint64_t remap_count;
+    };
+    struct Partition {
+      // index of this partition's first key
+      uint64_t key_offset;
+      uint64_t bucket_offset;
+      uint64_t remap_offset;
+      uint32_t n;
+      uint32_t m;
+      uint32_t buckets;
+      uint32_t pad;
+    };
+
+    // Either we own this (malloc), or it's someone else's (mmap or load())
+    uint8_t *buf;
+    size_t len;
+    bool owned;
+    bool mapped;
+    // Pointers in to buf
+    const Header *header;
+    const Partition *parts;
+    const uint8_t *pilots;
+    const uint32_t *remap;
+
+    static uint64_t hash_a(uint64_t h, uint64_t seed) {
+      return hash_mix64(h + seed);
+    }
+    static uint64_t hash_b(uint64_t a) {
+      return hash_mix64(a ^ 0x9E3779B97F4A7C15lu);
+    }
+    // r is the fastrange remainder of a, uniform in 64 bits
+    static uint32_t bucket_of(uint64_t r, uint32_t buckets) {
+      // 60% of keys to the first 30% of buckets
+      uint32_t p2 = (uint32_t) (0.3 * buckets);
+      uint32_t lo = (uint32_t) r;
+      uint32_t hi = (uint32_t) (r >> 32);
+      if (lo < (uint32_t) (0.6 * 4294967296.0) || p2 == buckets) {
+        return ((uint64_t) hi * p2) >> 32;
+      }
+      return p2 + (((uint64_t) hi * (buckets - p2)) >> 32);
+    }
+    static uint64_t position(uint64_t b, uint64_t pilot, uint32_t m) {
+      return hash_fastrange(b ^ hash_mix64(pilot), m);
+    }
+    uint64_t get_pilot(uint64_t i) const {
+      uint64_t bit = i * header->pilot_bits;
+      uint64_t w;
+      memcpy(&w, pilots + bit/8, sizeof(w));
+      return (w >> (bit % 8)) & ((((uint64_t) 1) << header->pilot_bits) - 1);
+    }
+    static uint32_t partition_buckets(uint32_t n);
+    static bool build_partition(const uint64_t *r, const uint64_t *b, uint32_t n,
+        uint32_t m, uint32_t buckets, uint64_t *pilots_out,
+        std::vector<uint32_t> *remap_out);
+    bool try_build(const Key_T *keys, size_t n, size_t threads, uint64_t seed);
+    bool attach(uint8_t *data, size_t l);
+    void clear();
+  public:
+    MPHF();
+    ~MPHF();
+    // Build for keys[0..n), returns false if the keys have duplicates
+    bool build(const Key_T *keys, size_t n, size_t threads=1);
+    // In [0, size()), unique for each key in the set, garbage for others
+    uint64_t lookup(Key_T key) const;
+    size_t size() const;
+    // Size of the serialized form
+    size_t bytes() const;
+    const void* data() const;
+    bool save(const char *path) const;
+    // Use data (e.g. mmap'd) in place, it must outlive us
+    bool load(const void *data, size_t l);
+    bool map(const char *path);
+};
+
+template <typename Key_T, typename HC>
+MPHF<Key_T, HC>::MPHF() {
+  buf = nullptr;
+  len = 0;
+  owned = false;
+  mapped = false;
+  header = nullptr;
+}
+
+template <typename Key_T, typename HC>
+MPHF<Key_T, HC>::~MPHF() {
+  clear();
+}
+
+template <typename Key_T, typename HC>
+void MPHF<Key_T, HC>::clear() {
+  if (owned) {
+    free(buf);
+  }
+  if (mapped) {
+    munmap(buf, len);
+  }
+  buf = nullptr;
+  len = 0;
+  owned = false;
+  mapped = false;
+  header = nullptr;
+}
+
+template <typename Key_T, typename HC>
+uint32_t MPHF<Key_T, HC>::partition_buckets(uint32_t n) {
+  double lg = n > 2 ? log2((double) n) : 1;
+  uint32_t b = (uint32_t) (MPHF_C * n / lg) + 1;
+  return b;
+}
+
+// r and b are the hashes of this partition's keys.
+// Fills in pilots_out[0..buckets), and the remap of positions [n, m).
+// Returns false if some bucket couldn't be placed (almost certainly duplicates)
+template <typename Key_T, typename HC>
+bool MPHF<Key_T, HC>::build_partition(const uint64_t *r, const uint64_t *b,
+    uint32_t n, uint32_t m, uint32_t buckets, uint64_t *pilots_out,
+    std::vector<uint32_t> *remap_out) {
+  // Group keys by bucket (counting sort)
+  std::vector<uint32_t> start(buckets + 1, 0);
+  for (uint32_t i=0; i<n; ++i) {
+    start[bucket_of(r[i], buckets) + 1]++;
+  }
+  for (uint32_t i=0; i<buckets; ++i) {
+    start[i+1] += start[i];
+  }
+  std::vector<uint64_t> keys(n);
+  std::vector<uint32_t> fill(start.begin(), start.end() - 1);
+  for (uint32_t i=0; i<n; ++i) {
+    keys[fill[bucket_of(r[i], buckets)]++] = b[i];
+  }
+  // Biggest buckets first
+  std::vector<uint32_t> order(buckets);
+  for (uint32_t i=0; i<buckets; ++i) {
+    order[i] = i;
+    pilots_out[i] = 0;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t x, uint32_t y) {
+      return start[x+1] - start[x] > start[y+1] - start[y];
+  });
+  std::vector<bool> taken(m, false);
+  std::vector<uint64_t> pos;
+  for (uint32_t oi=0; oi<buckets; ++oi) {
+    uint32_t bk = order[oi];
+    uint32_t s = start[bk];
+    uint32_t e = start[bk+1];
+    if (s == e) {
+      break;
+    }
+    // Same b twice in a bucket, no pilot can ever separate them
+    std::sort(&keys[s], &keys[0] + e);
+    for (uint32_t i=s+1; i<e; ++i) {
+      if (keys[i] == keys[i-1]) {
+        return false;
+      }
+    }
+    uint64_t pilot = 0;
+    for (; pilot < MPHF_MAX_PILOT; ++pilot) {
+      pos.clear();
+      uint64_t mp = hash_mix64(pilot);
+      bool ok = true;
+      for (uint32_t i=s; i<e && ok; ++i) {
+        uint64_t p = hash_fastrange(keys[i] ^ mp, m);
+        if (taken[p]) {
+          ok = false;
+          break;
+        }
+        // mark as we go, so we catch collisions inside the bucket
+        taken[p] = true;
+        pos.push_back(p);
+      }
+      if (ok) {
+        break;
+      }
+      for (size_t i=0; i<pos.size(); ++i) {
+        taken[pos[i]] = false;
+      }
+    }
+    if (pilot == MPHF_MAX_PILOT) {
+      return false;
+    }
+    pilots_out[bk] = pilot;
+  }
+  // Send keys that landed past n to the holes below n
+  uint32_t hole = 0;
+  for (uint32_t p=n; p<m; ++p) {
+    if (!taken[p]) {
+      remap_out->push_back(0);
+      continue;
+    }
+    while (taken[hole]) {
+      hole++;
+    }
+    remap_out->push_back(hole++);
+  }
+  return true;
+}
+
+template <typename Key_T, typename HC>
+bool MPHF<Key_T, HC>::try_build(const Key_T *keys, size_t n, size_t threads, uint64_t seed) {
+  uint64_t nparts = (n + MPHF_PARTITION_KEYS - 1) / MPHF_PARTITION_KEYS;
+  if (nparts == 0) {
+    nparts = 1;
+  }
+  if (threads == 0) {
+    threads = 1;
+  }
+  // Hash everything, and group by partition
+  // each thread counts its chunk, then scatters in to its own slots
+  std::vector<std::vector<uint64_t>> counts(threads, std::vector<uint64_t>(nparts + 1, 0));
+  size_t chunk = (n + threads - 1) / threads;
+  std::vector<std::thread> workers;
+  for (size_t t=0; t<threads; ++t) {
+    workers.push_back(std::thread([&, t]() {
+      for (size_t i=t*chunk; i<n && i<(t+1)*chunk; ++i) {
+        uint64_t a = hash_a(HC::hash(keys[i]), seed);
+        counts[t][hash_fastrange(a, nparts)]++;
+      }
+    }));
+  }
+  for (size_t t=0; t<threads; ++t) {
+    workers[t].join();
+  }
+  workers.clear();
+  std::vector<uint64_t> part_start(nparts + 1, 0);
+  std::vector<std::vector<uint64_t>> offsets(threads, std::vector<uint64_t>(nparts, 0));
+  uint64_t off = 0;
+  for (uint64_t p=0; p<nparts; ++p) {
+    part_start[p] = off;
+    for (size_t t=0; t<threads; ++t) {
+      offsets[t][p] = off;
+      off += counts[t][p];
+    }
+  }
+  part_start[nparts] = off;
+  for (uint64_t p=0; p<nparts; ++p) {
+    if (part_start[p+1] - part_start[p] >= ((uint64_t) 1 << 31)) {
+      PANIC("MPHF partition too big");
+    }
+  }
+  std::vector<uint64_t> rs(n);
+  std::vector<uint64_t> bs(n);
+  for (size_t t=0; t<threads; ++t) {
+    workers.push_back(std::thread([&, t]() {
+      for (size_t i=t*chunk; i<n && i<(t+1)*chunk; ++i) {
+        uint64_t a = hash_a(HC::hash(keys[i]), seed);
+        uint64_t p = hash_fastrange(a, nparts);
+        uint64_t o = offsets[t][p]++;
+        // the low half of a*nparts is uniform, and independent of p
+        rs[o] = a * nparts;
+        bs[o] = hash_b(a);
+      }
+    }));
+  }
+  for (size_t t=0; t<threads; ++t) {
+    workers[t].join();
+  }
+  workers.clear();
+
+  // Lay out the partitions
+  std::vector<Partition> ps(nparts);
+  uint64_t nbuckets = 0;
+  uint64_t nremap = 0;
+  for (uint64_t p=0; p<nparts; ++p) {
+    uint32_t pn = part_start[p+1] - part_start[p];
+    ps[p].key_offset = part_start[p];
+    ps[p].n = pn;
+    ps[p].m = pn ? (uint32_t) (pn / MPHF_ALPHA) + 1 : 1;
+    ps[p].buckets = partition_buckets(pn);
+    ps[p].bucket_offset = nbuckets;
+    ps[p].remap_offset = nremap;
+    ps[p].pad = 0;
+    nbuckets += ps[p].buckets;
+    nremap += ps[p].m - pn;
+  }
+
+  // Build the partitions in parallel
+  std::vector<uint64_t> raw_pilots(nbuckets);
+  std::vector<std::vector<uint32_t>> remaps(nparts);
+  std::atomic<uint64_t> next(0);
+  std::atomic<bool> failed(false);
+  for (size_t t=0; t<threads; ++t) {
+    workers.push_back(std::thread([&]() {
+      uint64_t p;
+      while (!failed.load() && (p = next++) < nparts) {
+        uint64_t s = part_start[p];
+        if (!build_partition(&rs[s], &bs[s], ps[p].n, ps[p].m, ps[p].buckets,
+              &raw_pilots[ps[p].bucket_offset], &remaps[p])) {
+          failed = true;
+        }
+      }
+    }));
+  }
+  for (size_t t=0; t<threads; ++t) {
+    workers[t].join();
+  }
+  if (failed) {
+    return false;
+  }
+
+  // Pack it all up
+  uint64_t max_pilot = 0;
+  for (uint64_t i=0; i<nbuckets; ++i) {
+    max_pilot = std::max(max_pilot, raw_pilots[i]);
+  }
+  uint64_t bits = 1;
+  while ((max_pilot >> bits) != 0) {
+    bits++;
+  }
+  // +1 word so get_pilot() can always read 8 bytes
+  uint64_t words = (nbuckets * bits + 63) / 64 + 1;
+  size_t l = sizeof(Header) + nparts * sizeof(Partition) +
+    words * sizeof(uint64_t) + nremap * sizeof(uint32_t);
+  uint8_t *d = (uint8_t*) calloc(l, 1);
+  if (!d) {
+    PANIC("MPHF allocation failed");
+  }
+  Header *h = (Header*) d;
+  h->magic = MPHF_MAGIC;
+  h->n = n;
+  h->seed = seed;
+  h->partitions = nparts;
+  h->pilot_bits = bits;
+  h->pilot_words = words;
+  h->remap_count = nremap;
+  memcpy(d + sizeof(Header), &ps[0], nparts * sizeof(Partition));
+  uint8_t *pw = d + sizeof(Header) + nparts * sizeof(Partition);
+  for (uint64_t i=0; i<nbuckets; ++i) {
+    uint64_t bit = i * bits;
+    uint64_t w;
+    memcpy(&w, pw + bit/8, sizeof(w));
+    w |= raw_pilots[i] << (bit % 8);
+    memcpy(pw + bit/8, &w, sizeof(w));
+  }
+  uint32_t *rm = (uint32_t*) (pw + words * sizeof(uint64_t));
+  for (uint64_t p=0; p<nparts; ++p) {
+    memcpy(rm + ps[p].remap_offset, remaps[p].data(), remaps[p].size() * sizeof(uint32_t));
+  }
+  clear();
+  attach(d, l);
+  owned = true;
+  return true;
+}
+
+template <typename Key_T, typename HC>
+bool MPHF<Key_T, HC>::build(const Key_T *keys, size_t n, size_t threads) {
+  uint64_t seed = 0x5EED;
+  for (size_t i=0; i<MPHF_ATTEMPTS; ++i) {
+    if (try_build(keys, n, threads, seed)) {
+      return true;
+    }
+    seed = hash_mix64(seed);
+  }
+  return false;
+}
+
+// Sets up our pointers, and sanity checks the layout
+template <typename Key_T, typename HC>
+bool MPHF<Key_T, HC>::attach(uint8_t *data, size_t l) {
+  if (l < sizeof(Header)) {
+    return false;
+  }
+  const Header *h = (const Header*) data;
+  if (h->magic != MPHF_MAGIC ||
+      l != sizeof(Header) + h->partitions * sizeof(Partition) +
+      h->pilot_words * sizeof(uint64_t) + h->remap_count * sizeof(uint32_t)) {
+    return false;
+  }
+  buf = data;
+  len = l;
+  header = h;
+  parts = (const Partition*) (data + sizeof(Header));
+  pilots = data + sizeof(Header) + h->partitions * sizeof(Partition);
+  remap = (const uint32_t*) (pilots + h->pilot_words * sizeof(uint64_t));
+  return true;
+}
+
+template <typename Key_T, typename HC>
+uint64_t MPHF<Key_T, HC>::lookup(Key_T key) const {
+  uint64_t a = hash_a(HC::hash(key), header->seed);
+  uint64_t p = hash_fastrange(a, header->partitions);
+  const Partition &part = parts[p];
+  uint64_t bucket = bucket_of(a * header->partitions, part.buckets);
+  uint64_t pos = position(hash_b(a), get_pilot(part.bucket_offset + bucket), part.m);
+  if (pos < part.n) {
+    return part.key_offset + pos;
+  }
+  return part.key_offset + remap[part.remap_offset + pos - part.n];
+}
+
+template <typename Key_T, typename HC>
+size_t MPHF<Key_T, HC>::size() const {
+  return header ? header->n : 0;
+}
+
+template <typename Key_T, typename HC>
+size_t MPHF<Key_T, HC>::bytes() const {
+  return len;
+}
+
+template <typename Key_T, typename HC>
+const void* MPHF<Key_T, HC>::data() const {
+  return buf;
+}
+
+template <typename Key_T, typename HC>
+bool MPHF<Key_T, HC>::save(const char *path) const {
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    return false;
+  }
+  bool ok = fwrite(buf, 1, len, f) == len;
+  return (fclose(f) == 0) && ok;
+}
+
+template <typename Key_T, typename HC>
+bool MPHF<Key_T, HC>::load(const void *data, size_t l) {
+  clear();
+  return attach((uint8_t*) data, l);
+}
+
+template <typename Key_T, typename HC>
+bool MPHF<Key_T, HC>::map(const char *path) {
+  clear();
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  void *m = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (m == MAP_FAILED) {
+    return false;
+  }
+  if (!attach((uint8_t*) m, st.st_size)) {
+    munmap(m, st.st_size);
+    return false;
+  }
+  mapped = true;
+  return true;
+}
+
+#endif
@@ -0,0 +1,130 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * Benchmark for mphf.h, against an OCHashTable doing the same job
+ * We decide WHAT we're testing using the macro system, TEST_MPHF or
+ * TEST_OCHASHTABLE.
+ *
+ * Both map each of KEYS random keys to a unique index in [0, KEYS). We report
+ * build time, space in bits per key, and how fast we can look up every key (in
+ * a shuffled order, so it's cache misses, not prefetching).
+ * For OCHashTable space is the nodes plus one bucket per key, the table may
+ * be up to twice that, so it's a lower bound.
+ */
+
+#include <algorithm>
+#include <random>
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include "panic.h"
+#include "timer.h"
+
+#ifndef KEYS
+#define KEYS 10000000
+#endif
+#ifndef THREADS
+#define THREADS 4
+#endif
+// Times we look up every key
+#define LOOKUP_PASSES 3
+
+#ifdef TEST_MPHF
+#include "mphf.h"
+class Comp {
+  public:
+    static size_t hash(uint64_t v) {
+      return v;
+    }
+};
+MPHF<uint64_t, Comp> func;
+#endif
+
+#ifdef TEST_OCHASHTABLE
+#include "ochashtable.h"
+class Node: public OCHashTableNode_base<Node> {
+  public:
+    uint64_t value;
+    uint64_t index;
+  public:
+    const uint64_t val(void) const {
+      return value;
+    }
+    static size_t hash(uint64_t v) {
+      return v;
+    }
+    static int compare(const uint64_t v1, const uint64_t v2) {
+      if (v1 > v2) return 1;
+      if (v1 < v2) return -1;
+      return 0;
+    }
+};
+OCHashTable<Node, uint64_t> table;
+std::vector<Node> nodes;
+#endif
+
+int main(int argc, char* argv[]) {
+  #ifdef TEST_MPHF
+  printf("MPHF.h threads=%d ", THREADS);
+  #endif
+  #ifdef TEST_OCHASHTABLE
+  printf("OCHashTable.h ");
+  #endif
+  printf("keys=%d ", KEYS);
+
+  std::mt19937_64 rng(1);
+  std::vector<uint64_t> keys(KEYS);
+  for (size_t i=0; i<KEYS; ++i) {
+    keys[i] = rng();
+  }
+
+  timeb t1, t2;
+  double bits;
+  ftime(&t1);
+  #ifdef TEST_MPHF
+  if (!func.build(keys.data(), KEYS, THREADS)) {
+    PANIC("Build failed");
+  }
+  bits = func.bytes() * 8.0 / KEYS;
+  #endif
+  #ifdef TEST_OCHASHTABLE
+  nodes.resize(KEYS);
+  for (size_t i=0; i<KEYS; ++i) {
+    nodes[i].value = keys[i];
+    nodes[i].index = i;
+    if (!table.insert(&nodes[i])) {
+      PANIC("Duplicate key");
+    }
+  }
+  bits = (sizeof(Node) + sizeof(DList<Node, uint64_t>)) * 8.0;
+  #endif
+  ftime(&t2);
+  printf("build_time=%lf bits_per_key=%.2lf ", tdiff(t2,t1), bits);
+
+  std::shuffle(keys.begin(), keys.end(), rng);
+  uint64_t sum = 0;
+  ftime(&t1);
+  for (size_t p=0; p<LOOKUP_PASSES; ++p) {
+    for (size_t i=0; i<KEYS; ++i) {
+      #ifdef TEST_MPHF
+      sum += func.lookup(keys[i]);
+      #endif
+      #ifdef TEST_OCHASHTABLE
+      sum += table.get(keys[i])->index;
+      #endif
+    }
+  }
+  ftime(&t2);
+  double t = tdiff(t2,t1);
+  // every index once per pass
+  if (sum != LOOKUP_PASSES * ((uint64_t) KEYS * (KEYS - 1) / 2)) {
+    PANIC("Lookups aren't a bijection");
+  }
+  printf("lookup_time=%lf lookups_per_sec=%.0lf\n", t, LOOKUP_PASSES * (double) KEYS / t);
+
+  #ifdef TEST_OCHASHTABLE
+  for (size_t i=0; i<KEYS; ++i) {
+    table.remove(&nodes[i]);
+  }
+  #endif
+  return 0;
+}
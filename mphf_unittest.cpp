@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+#include "panic.h"
+#include "mphf.h"
+
+#define TEST_SIZE 100000
+#define THREADS 4
+
+class Comp {
+  public:
+    static size_t hash(uint64_t v) {
+      return v;
+    }
+};
+
+typedef MPHF<uint64_t, Comp> Func;
+
+// Every key gets its own index in [0, n)
+void check_bijection(const Func &f, const std::vector<uint64_t> &keys) {
+  if (f.size() != keys.size()) {
+    PANIC("size is wrong");
+  }
+  std::vector<bool> seen(keys.size(), false);
+  for (size_t i=0; i<keys.size(); ++i) {
+    uint64_t idx = f.lookup(keys[i]);
+    if (idx >= keys.size()) {
+      PANIC("index out of range");
+    }
+    if (seen[idx]) {
+      PANIC("two keys share an index");
+    }
+    seen[idx] = true;
+  }
+}
+
+std::vector<uint64_t> make_keys(size_t n, uint64_t stride) {
+  std::vector<uint64_t> keys;
+  for (size_t i=0; i<n; ++i) {
+    keys.push_back(i * stride);
+  }
+  return keys;
+}
+
+int main(int argc, char **argv) {
+  printf("Begin MPHF.h unittest\n");
+
+  // Small and awkward sizes
+  size_t sizes[] = {0, 1, 2, 3, 17, 1000};
+  for (size_t s : sizes) {
+    std::vector<uint64_t> keys = make_keys(s, 1);
+    Func f;
+    if (!f.build(keys.data(), keys.size())) {
+      PANIC("build failed");
+    }
+    check_bijection(f, keys);
+  }
+
+  // Sequential, strided, and random keys
+  std::vector<uint64_t> keys = make_keys(TEST_SIZE, 4096);
+  Func strided;
+  if (!strided.build(keys.data(), keys.size())) {
+    PANIC("build failed");
+  }
+  check_bijection(strided, keys);
+  keys.clear();
+  srand(1);
+  for (size_t i=0; i<TEST_SIZE; ++i) {
+    keys.push_back(((uint64_t) rand() << 32) ^ rand() ^ i);
+  }
+  Func random;
+  if (!random.build(keys.data(), keys.size())) {
+    PANIC("build failed");
+  }
+  check_bijection(random, keys);
+
+  // Several partitions, built in parallel
+  keys = make_keys(3 * MPHF_PARTITION_KEYS + 12345, 1);
+  Func big;
+  if (!big.build(keys.data(), keys.size(), THREADS)) {
+    PANIC("parallel build failed");
+  }
+  check_bijection(big, keys);
+  // a few bits per key
+  if (big.bytes() * 8.0 / keys.size() > 8) {
+    PANIC("too many bits per key");
+  }
+
+  // Duplicates can't be built
+  keys = make_keys(1000, 1);
+  keys.push_back(500);
+  Func dup;
+  if (dup.build(keys.data(), keys.size())) {
+    PANIC("built with a duplicate key");
+  }
+
+  // Save, then use in place from a buffer and from an mmap'd file
+  keys = make_keys(TEST_SIZE, 1);
+  Func orig;
+  if (!orig.build(keys.data(), keys.size(), THREADS)) {
+    PANIC("build failed");
+  }
+  const char *path = "/tmp/mphf_unittest.bin";
+  if (!orig.save(path)) {
+    PANIC("save failed");
+  }
+  Func view;
+  if (!view.load(orig.data(), orig.bytes())) {
+    PANIC("load failed");
+  }
+  Func mapped;
+  if (!mapped.map(path)) {
+    PANIC("map failed");
+  }
+  for (size_t i=0; i<keys.size(); ++i) {
+    if (view.lookup(keys[i]) != orig.lookup(keys[i]) ||
+        mapped.lookup(keys[i]) != orig.lookup(keys[i])) {
+      PANIC("saved function differs");
+    }
+  }
+  unlink(path);
+  // garbage isn't accepted
+  if (view.load(keys.data(), 100)) {
+    PANIC("loaded garbage");
+  }
+
+  printf("PASS\n");
+  return 0;
+}
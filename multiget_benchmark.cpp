@@ -0,0 +1,143 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * Benchmark for batched lookups, get_batch() against a loop of get()
+ * We decide WHAT we're testing using the macro system, TEST_OCHASHTABLE or
+ * TEST_HASHTABLE picks the table, BATCH > 0 uses get_batch() on BATCH keys at
+ * a time, BATCH=0 calls get() for each key.
+ *
+ * The table holds KEYS keys, the default is far bigger than cache (that's
+ * the case batching is for, in cache it's no faster). We then look up
+ * LOOKUPS random keys, about half of which are there.
+ */
+
+#include <algorithm>
+#include <random>
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include "panic.h"
+#include "timer.h"
+
+#ifndef KEYS
+#define KEYS (1<<23)
+#endif
+#ifndef LOOKUPS
+#define LOOKUPS (1<<24)
+#endif
+#ifndef BATCH
+#define BATCH 128
+#endif
+
+#ifdef TEST_OCHASHTABLE
+#include "ochashtable.h"
+class Node: public OCHashTableNode_base<Node> {
+  public:
+    uint64_t value;
+  public:
+    const uint64_t val(void) const {
+      return value;
+    }
+    static size_t hash(uint64_t v) {
+      return v;
+    }
+    static int compare(const uint64_t v1, const uint64_t v2) {
+      if (v1 > v2) return 1;
+      if (v1 < v2) return -1;
+      return 0;
+    }
+};
+typedef Node Result;
+OCHashTable<Node, uint64_t> dict;
+std::vector<Node> nodes;
+#endif
+
+#ifdef TEST_HASHTABLE
+#include "hashtable.h"
+class Comp {
+  public:
+    static const uint64_t val(const uint64_t t) {
+      return t;
+    }
+    static const int compare(const uint64_t v1, const uint64_t v2) {
+      if (v1 > v2) return 1;
+      if (v1 < v2) return -1;
+      return 0;
+    }
+    static size_t hash(uint64_t v) {
+      return v;
+    }
+    static void printT(const uint64_t t) {
+      printf("%lu", t);
+    }
+    static void printV(const uint64_t v) {
+      printf("%lu", v);
+    }
+};
+typedef uint64_t Result;
+HashTable<uint64_t, uint64_t, Comp> dict;
+#endif
+
+int main(int argc, char* argv[]) {
+  #ifdef TEST_OCHASHTABLE
+  printf("OCHashTable.h ");
+  #endif
+  #ifdef TEST_HASHTABLE
+  printf("HashTable.h ");
+  #endif
+  printf("keys=%d lookups=%d batch=%d ", KEYS, LOOKUPS, BATCH);
+
+  // Keys are even, so odd lookups miss
+  std::mt19937_64 rng(1);
+  #ifdef TEST_OCHASHTABLE
+  nodes.resize(KEYS);
+  #endif
+  for (size_t i=0; i<KEYS; ++i) {
+    uint64_t k = rng() & ~1lu;
+    #ifdef TEST_OCHASHTABLE
+    nodes[i].value = k;
+    dict.insert(&nodes[i]);
+    #endif
+    #ifdef TEST_HASHTABLE
+    dict.insert(k);
+    #endif
+  }
+  // Lookups are half keys we inserted, half odd keys that can't be there
+  std::vector<uint64_t> lookups(LOOKUPS);
+  std::mt19937_64 replay(1);
+  for (size_t i=0; i<LOOKUPS; ++i) {
+    if (i % 2) {
+      lookups[i] = rng() | 1;
+    } else {
+      lookups[i] = replay() & ~1lu;
+    }
+  }
+  std::shuffle(lookups.begin(), lookups.end(), rng);
+
+  timeb t1, t2;
+  uint64_t found = 0;
+  ftime(&t1);
+  #if BATCH > 0
+  Result *out[BATCH];
+  for (size_t i=0; i<LOOKUPS; i+=BATCH) {
+    size_t n = LOOKUPS - i < BATCH ? LOOKUPS - i : BATCH;
+    dict.get_batch(&lookups[i], n, out);
+    for (size_t j=0; j<n; ++j) {
+      found += out[j] != nullptr;
+    }
+  }
+  #else
+  for (size_t i=0; i<LOOKUPS; ++i) {
+    found += dict.get(lookups[i]) != nullptr;
+  }
+  #endif
+  ftime(&t2);
+  double t = tdiff(t2,t1);
+  printf("found=%lu time=%lf lookups_per_sec=%.0lf\n", found, t, LOOKUPS / t);
+
+  #ifdef TEST_OCHASHTABLE
+  for (size_t i=0; i<KEYS; ++i) {
+    dict.remove(&nodes[i]);
+  }
+  #endif
+  return 0;
+}
@@ -16,6 +16,30 @@
  *
  * Faster average case than btree by ~2x
  *
+ * HP is the hashing policy, see hash.h
+ *
+ * INCREMENTAL: normally resize rehashes everything at once, so the insert or
+ * remove that triggers it takes O(n). With INCREMENTAL=true resize instead
+ * keeps the old table around, and every insert/remove moves
+ * OC_REHASH_STEP buckets from the old table to the new one. Lookups check
+ * both tables until it's done. We don't start another resize until the
+ * current one is finished, the table is just a bit overfull in the meantime.
+ * begin() finishes any migration in progress (iterating is linear anyway).
+ * Constructing the new bucket array would still be O(n) in one operation, so
+ * before migrating we build it: reserve() only allocates, then each
+ * insert/remove constructs OC_BUILD_STEP buckets, and only once it's complete
+ * do we start moving nodes in to it. Until then everything stays in the old
+ * table, which gets a bit fuller. This costs a little on every operation
+ * (see latency_benchmark in the Makefile).
+ *
+ * get_batch() looks up many keys at once. A get() is a chain of dependent
+ * cache misses (bucket, then node), so one at a time we wait for each miss.
+ * get_batch() works through the keys in groups of OC_BATCH_GROUP, hashing
+ * and prefetching every bucket in the group, then every first node, then
+ * doing the lookups. That way the misses in a group overlap
+ * ("group prefetching"). It only helps once the table is bigger than
+ * cache, see multiget_benchmark in the Makefile.
+ *
  * Worst case operation is linear per op due to
  * 1) linear rehash
  * 2) possability of every item hash colliding
@@ -27,29 +51,54 @@
 #include "panic.h"
 #include "array.h"
 #include "dlist.h"
+#include "hash.h"
+#include <algorithm>
 #include <vector>
 
 #ifndef OC_HASHTABLE_H
 #define OC_HASHTABLE_H
 
 #define MINSIZE 4
+// Buckets migrated per operation for INCREMENTAL
+#define OC_REHASH_STEP 2
+// Buckets of the new table constructed per operation for INCREMENTAL, before
+// migrating starts. Tables double, so this needs to outpace OC_REHASH_STEP
+#define OC_BUILD_STEP 8
+// Keys get_batch() has in flight at once
+#define OC_BATCH_GROUP 32
 
 template <typename Node_T>
 class OCHashTableNode_base: public DListNode_base<Node_T> {
   public:
     // The size when this was hashed, used like a generation counter
     // So we can track what was rehashed during a resize
+    // (or for INCREMENTAL which of the two tables we're in)
     size_t hs;
     // subclass must implement:
     // Val_T val(void);
     // static size_t hash(Val_T v);
 };
 
-template <typename Node_T, typename Val_T>
+template <typename Node_T, typename Val_T, typename HP=DefaultHash, bool INCREMENTAL=false>
 class OCHashTable {
   private:
+    // See hash.h
+    uint64_t seed;
     std::vector<DList<Node_T, Val_T>> table;
     size_t count = 0;
+    // INCREMENTAL only, the table we're migrating out of (empty if we aren't)
+    std::vector<DList<Node_T, Val_T>> old_table;
+    // buckets of old_table below this have already been moved
+    size_t migrated = 0;
+    // INCREMENTAL only, the table we're constructing before we migrate in to
+    // it, it will have next_size buckets (0 if we aren't)
+    std::vector<DList<Node_T, Val_T>> next_table;
+    size_t next_size = 0;
+    void build(size_t steps);
+    void migrate(size_t steps);
+    // One operation's share of an INCREMENTAL resize
+    void resize_step(void);
+    void finish_resize(void);
     void check_sizeup(void);
     void check_sizedown(void);
   public:
@@ -116,6 +165,9 @@ class OCHashTable {
         }
     };
     Iterator begin() {
+      if (INCREMENTAL) {
+        finish_resize();
+      }
       return Iterator(&table, 0);
     }
     Iterator end() {
@@ -126,14 +178,17 @@ class OCHashTable {
     ~OCHashTable();
     bool insert(Node_T *n);
     Node_T* get(Val_T key);
+    // out[i] = get(keys[i]) for i in [0, n), but faster for big n
+    void get_batch(const Val_T *keys, size_t n, Node_T **out);
     void remove(Node_T *n);
     bool isempty(void) const; 
     void resize(size_t s);
     void print();
 };
 
-template <typename Node_T, typename Val_T>
-OCHashTable<Node_T,Val_T>::OCHashTable():table(MINSIZE) {
+template <typename Node_T, typename Val_T, typename HP, bool INCREMENTAL>
+OCHashTable<Node_T,Val_T,HP,INCREMENTAL>::OCHashTable():table(MINSIZE) {
+  seed = HP::new_seed();
   // We have to initialize the lists since
   // array doesn't construct objects it contains
   for (size_t i=0; i<MINSIZE; ++i) {
@@ -141,8 +196,9 @@ OCHashTable<Node_T,Val_T>::OCHashTable():table(MINSIZE) {
   }
 }
 
-template <typename Node_T, typename Val_T>
-OCHashTable<Node_T,Val_T>::OCHashTable(size_t s):table(s) {
+template <typename Node_T, typename Val_T, typename HP, bool INCREMENTAL>
+OCHashTable<Node_T,Val_T,HP,INCREMENTAL>::OCHashTable(size_t s):table(s) {
+  seed = HP::new_seed();
   // We have to initialize the lists since
   // array doesn't construct objects it contains
   for (size_t i=0; i<s; ++i) {
@@ -150,8 +206,8 @@ OCHashTable<Node_T,Val_T>::OCHashTable(size_t s):table(s) {
   }
 }
 
-template <typename Node_T, typename Val_T>
-OCHashTable<Node_T,Val_T>::~OCHashTable() {
+template <typename Node_T, typename Val_T, typename HP, bool INCREMENTAL>
+OCHashTable<Node_T,Val_T,HP,INCREMENTAL>::~OCHashTable() {
   for (size_t i=0; i<table.size(); ++i) {
     if (!table[i].isempty()) {
       PANIC("Hashtable not empty before destruction");
@@ -161,52 +217,111 @@ OCHashTable<Node_T,Val_T>::~OCHashTable() {
   }
 };
 
-template <typename Node_T, typename Val_T>
-bool OCHashTable<Node_T,Val_T>::insert(Node_T *new_node) {
+template <typename Node_T, typename Val_T, typename HP, bool INCREMENTAL>
+bool OCHashTable<Node_T,Val_T,HP,INCREMENTAL>::insert(Node_T *new_node) {
+  if (INCREMENTAL) {
+    resize_step();
+  }
   check_sizeup();
   Val_T v = new_node->val();
   new_node->hs = table.size();
-  size_t i = Node_T::hash(v) % table.size();
+  size_t i = HP::index(Node_T::hash(v), seed, table.size());
   if (table[i].get(v)) {
     return false;
   }
+  if (INCREMENTAL && !old_table.empty() &&
+      old_table[HP::index(Node_T::hash(v), seed, old_table.size())].get(v)) {
+    return false;
+  }
   table[i].enqueue(new_node);
   count++;
   return true;
 }
 
-template <typename Node_T, typename Val_T>
-Node_T* OCHashTable<Node_T,Val_T>::get(Val_T key) {
-  size_t i = Node_T::hash(key) % table.size();
+template <typename Node_T, typename Val_T, typename HP, bool INCREMENTAL>
+Node_T* OCHashTable<Node_T,Val_T,HP,INCREMENTAL>::get(Val_T key) {
+  size_t i = HP::index(Node_T::hash(key), seed, table.size());
   auto n = table[i].get(key);
   if (n) {
     return &(*n);
   }
+  if (INCREMENTAL && !old_table.empty()) {
+    i = HP::index(Node_T::hash(key), seed, old_table.size());
+    n = old_table[i].get(key);
+    if (n) {
+      return &(*n);
+    }
+  }
   return nullptr;
 }
 
-template <typename Node_T, typename Val_T>
-void OCHashTable<Node_T,Val_T>::remove(Node_T *n) {
+template <typename Node_T, typename Val_T, typename HP, bool INCREMENTAL>
+void OCHashTable<Node_T,Val_T,HP,INCREMENTAL>::get_batch(const Val_T *keys, size_t n, Node_T **out) {
+  size_t index[OC_BATCH_GROUP];
+  for (size_t g=0; g<n; g+=OC_BATCH_GROUP) {
+    size_t end = std::min(n, g + OC_BATCH_GROUP);
+    // Hash everything, and start loading the buckets
+    for (size_t k=g; k<end; ++k) {
+      index[k-g] = HP::index(Node_T::hash(keys[k]), seed, table.size());
+      __builtin_prefetch(&table[index[k-g]]);
+    }
+    // Then the first node in each
+    for (size_t k=g; k<end; ++k) {
+      Node_T *head = table[index[k-g]].peak();
+      if (head) {
+        __builtin_prefetch(head);
+      }
+    }
+    // Now the lookups mostly hit cache
+    for (size_t k=g; k<end; ++k) {
+      out[k] = table[index[k-g]].get(keys[k]);
+      if (!out[k] && INCREMENTAL && !old_table.empty()) {
+        out[k] = get(keys[k]);
+      }
+    }
+  }
+}
+
+template <typename Node_T, typename Val_T, typename HP, bool INCREMENTAL>
+void OCHashTable<Node_T,Val_T,HP,INCREMENTAL>::remove(Node_T *n) {
   // Note, if n is not in the hashtable, this will cause
   // some nasty corruption.
   Val_T v = n->val();
-  size_t i = Node_T::hash(v) % table.size();
-  table[i].remove(&(*n)); 
+  if (INCREMENTAL && n->hs != table.size()) {
+    // Hasn't been migrated yet
+    size_t i = HP::index(Node_T::hash(v), seed, old_table.size());
+    old_table[i].remove(&(*n));
+  } else {
+    size_t i = HP::index(Node_T::hash(v), seed, table.size());
+    table[i].remove(&(*n)); 
+  }
   count--;
+  if (INCREMENTAL) {
+    resize_step();
+  }
   check_sizedown();
 }
 
-template <typename Node_T, typename Val_T>
-bool OCHashTable<Node_T,Val_T>::isempty(void) const {
+template <typename Node_T, typename Val_T, typename HP, bool INCREMENTAL>
+bool OCHashTable<Node_T,Val_T,HP,INCREMENTAL>::isempty(void) const {
   return count == 0;
 }
 
-template <typename Node_T, typename Val_T>
-void OCHashTable<Node_T,Val_T>::resize(size_t s) {
+template <typename Node_T, typename Val_T, typename HP, bool INCREMENTAL>
+void OCHashTable<Node_T,Val_T,HP,INCREMENTAL>::resize(size_t s) {
   // nothing to do
   if (s == table.size()) {
     return;
   }
+  if (INCREMENTAL) {
+    // Only one resize at a time
+    finish_resize();
+    if (s != table.size()) {
+      next_size = s;
+      next_table.reserve(s);
+    }
+    return;
+  }
   // If increasing size, we resize before we rehash
   if (s > table.size()) {
     table.resize(s);
@@ -218,7 +333,7 @@ void OCHashTable<Node_T,Val_T>::resize(size_t s) {
     // so we can just peak 'til we hit one!
     while (table[i].peak() && table[i].peak()->hs != s) {
       auto node = table[i].dequeue();
-      size_t new_index = Node_T::hash(node->val()) % s;
+      size_t new_index = HP::index(Node_T::hash(node->val()), seed, s);
       node->hs = s;
       // We remove and enqueue even if it didn't move
       // this saves us a linear search
@@ -231,8 +346,64 @@ void OCHashTable<Node_T,Val_T>::resize(size_t s) {
   }
 }
 
-template <typename Node_T, typename Val_T>
-void OCHashTable<Node_T,Val_T>::check_sizedown(void) {
+template <typename Node_T, typename Val_T, typename HP, bool INCREMENTAL>
+void OCHashTable<Node_T,Val_T,HP,INCREMENTAL>::build(size_t steps) {
+  if (!next_size) {
+    return;
+  }
+  // reserve()'d, so these never reallocate
+  for (; steps > 0 && next_table.size() < next_size; --steps) {
+    next_table.emplace_back();
+  }
+  if (next_table.size() == next_size) {
+    // Done, now start migrating in to it
+    old_table = std::move(table);
+    table = std::move(next_table);
+    next_table = std::vector<DList<Node_T, Val_T>>();
+    next_size = 0;
+    migrated = 0;
+  }
+}
+
+template <typename Node_T, typename Val_T, typename HP, bool INCREMENTAL>
+void OCHashTable<Node_T,Val_T,HP,INCREMENTAL>::resize_step(void) {
+  if (next_size) {
+    build(OC_BUILD_STEP);
+  } else {
+    migrate(OC_REHASH_STEP);
+  }
+}
+
+template <typename Node_T, typename Val_T, typename HP, bool INCREMENTAL>
+void OCHashTable<Node_T,Val_T,HP,INCREMENTAL>::finish_resize(void) {
+  build(next_size);
+  migrate(old_table.size());
+}
+
+template <typename Node_T, typename Val_T, typename HP, bool INCREMENTAL>
+void OCHashTable<Node_T,Val_T,HP,INCREMENTAL>::migrate(size_t steps) {
+  if (old_table.empty()) {
+    return;
+  }
+  for (; steps > 0 && migrated < old_table.size(); --steps, ++migrated) {
+    while (old_table[migrated].peak()) {
+      Node_T *node = old_table[migrated].dequeue();
+      node->hs = table.size();
+      table[HP::index(Node_T::hash(node->val()), seed, table.size())].enqueue(node);
+    }
+  }
+  if (migrated == old_table.size()) {
+    // actually free it, clear() wouldn't
+    std::vector<DList<Node_T, Val_T>>().swap(old_table);
+  }
+}
+
+template <typename Node_T, typename Val_T, typename HP, bool INCREMENTAL>
+void OCHashTable<Node_T,Val_T,HP,INCREMENTAL>::check_sizedown(void) {
+  // Wait for the last resize to finish
+  if (INCREMENTAL && (next_size || !old_table.empty())) {
+    return;
+  }
   // If it's under half full resize down
   if (table.size() > 2*count) {
     size_t s = table.size() / 2;
@@ -243,21 +414,29 @@ void OCHashTable<Node_T,Val_T>::check_sizedown(void) {
   }
 }
 
-template <typename Node_T, typename Val_T>
-void OCHashTable<Node_T,Val_T>::check_sizeup(void) {
+template <typename Node_T, typename Val_T, typename HP, bool INCREMENTAL>
+void OCHashTable<Node_T,Val_T,HP,INCREMENTAL>::check_sizeup(void) {
+  // Wait for the last resize to finish
+  if (INCREMENTAL && (next_size || !old_table.empty())) {
+    return;
+  }
   // If it's over full resize up
   if (table.size() < count) {
     resize(table.size()*2); 
   } 
 }
 
-template <typename Node_T, typename Val_T>
-void OCHashTable<Node_T,Val_T>::print(void) {
+template <typename Node_T, typename Val_T, typename HP, bool INCREMENTAL>
+void OCHashTable<Node_T,Val_T,HP,INCREMENTAL>::print(void) {
   printf("[\n");
   for (size_t i=0; i<table.size(); ++i) {
     printf("  ");
     table[i].print();
   }
+  for (size_t i=migrated; i<old_table.size(); ++i) {
+    printf("  old ");
+    old_table[i].print();
+  }
   printf("]\n");
 }
 
@@ -0,0 +1,591 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * A B-tree whose nodes are fixed size pages in a file, cached by a buffer
+ * pool (see buffer_pool.h).
+ *
+ * When to use this:
+ *   Your dictionary is bigger than the memory you want to give it. Only
+ *   about pool_bytes of it is ever in memory, the rest stays in the file, and
+ *   the file is the tree, so it's there again after a restart (open() the same
+ *   path). If it fits in memory use btree.h, or to ship a read-only copy
+ *   around see btree_image.h.
+ *
+ * How to use this:
+ *   T, Val_T and C are the same as for btree.h. T is written to disk as
+ *   bytes, so it must be trivially copyable (no pointers, std::string etc.).
+ *   SIZE defaults to as many elements as fit in a PAGED_BTREE_PAGE page.
+ *   open() a file (it's created if it doesn't exist), then use it much like a
+ *   BTree. get() copies the element out, since it's only in memory while the
+ *   page holding it is pinned.
+ *   Changes reach the file when their pages are evicted, or on flush() (which
+ *   close() and the destructor call). There's no journal, if you crash between
+ *   flushes the file may be inconsistent.
+ *
+ * Design Decisions:
+ *   Nodes are BTreeNode's, with page numbers for children instead of
+ *   pointers, so searching, splitting, merging and rotating within a node is
+ *   the same code btree.h runs. insert() and remove() are btree.h's, with the
+ *   same lazy split/merge on the way down, pinning each node while we work
+ *   on it. Page 0 is our header, so page number 0 works as "no child".
+ *   Pages of merged away nodes go on a free list (linked through the pages
+ *   themselves) and get reused before the file grows.
+ *
+ * Threadsafety:
+ *   thread compatible
+ */
+
+#include <fcntl.h>
+#include <new>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+#include <utility>
+#include "panic.h"
+#include "btree.h"
+#include "buffer_pool.h"
+
+#ifndef PAGED_BTREE_H
+#define PAGED_BTREE_H
+
+#ifndef PAGED_BTREE_PAGE
+#define PAGED_BTREE_PAGE 4096
+#endif
+#define PAGED_BTREE_MAGIC 0x31454552544450lu
+
+// Define this to implement some expensive consistancy checking
+// This checks all of the invariants before and after every operation
+#ifdef PAGED_BTREE_DEBUG
+#define PAGED_BTREE_CHECK() check()
+#else
+#define PAGED_BTREE_CHECK()
+#endif
+
+template<typename T, typename Val_T, typename C, int SIZE=(PAGED_BTREE_PAGE - 2*sizeof(uint64_t)) / (sizeof(T) + sizeof(uint64_t))>
+class PagedBTree {
+  static_assert(std::is_trivially_copy_constructible<T>::value && std::is_trivially_destructible<T>::value, "T must be trivially copyable to be paged");
+  static_assert(SIZE >= 5, "SIZE must be at least 5, see btree.h");
+  private:
+    typedef BTreeNode<T,Val_T,C,SIZE,false,uint64_t> Node;
+    static_assert(sizeof(Node) <= PAGED_BTREE_PAGE, "SIZE is too big for a page");
+    struct Header {
+      uint64_t magic;
+      // So we notice if the file was written with a different T or SIZE
+      uint64_t page;
+      uint64_t t_size;
+      uint64_t size;
+      uint64_t root;
+      // pages in the file, including this one
+      uint64_t pages;
+      // head of the free list, 0 for empty
+      uint64_t free;
+      uint64_t count;
+    };
+    int fd;
+    BufferPool *pool;
+    Header header;
+
+    Node* pin(uint64_t page) {
+      return (Node*) pool->pin(page);
+    }
+    void unpin(Node *n, bool dirty) {
+      pool->unpin(n, dirty);
+    }
+    // A new empty node, pinned
+    uint64_t alloc(Node **n);
+    // Puts n's page on the free list, and unpins it
+    void free_page(uint64_t page, Node *n);
+    int maybe_merge(Node *parent, size_t i);
+    std::pair<Val_T,Val_T> _check(uint64_t page, size_t depth, size_t *leaf_depth, size_t *count) const;
+    void _print(uint64_t page) const;
+  public:
+    PagedBTree();
+    ~PagedBTree();
+    // Opens (or creates) the tree in path, caching about pool_bytes of it.
+    // Fails if path isn't one of ours, or is for a different T or SIZE.
+    bool open(const char *path, size_t pool_bytes);
+    // flush()es and closes the file
+    void close();
+    // Writes every change back to the file
+    void flush();
+    // result may be nullptr, if you only want to know if it's there
+    bool get(Val_T val, T *result) const;
+    bool insert(T datum);
+    // result may be nullptr, if you don't want the element back
+    bool remove(Val_T val, T *result);
+    bool isempty(void) const;
+    size_t size(void) const;
+    // Pages in the file, including the header and free ones
+    size_t pages(void) const;
+    const BufferPool* get_pool(void) const;
+    void check(void) const;
+    void print(void) const;
+};
+
+template<typename T, typename Val_T, typename C, int SIZE>
+PagedBTree<T,Val_T,C,SIZE>::PagedBTree() {
+  fd = -1;
+  pool = nullptr;
+  memset(&header, 0, sizeof(header));
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+PagedBTree<T,Val_T,C,SIZE>::~PagedBTree() {
+  close();
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+bool PagedBTree<T,Val_T,C,SIZE>::open(const char *path, size_t pool_bytes) {
+  close();
+  int f = ::open(path, O_RDWR | O_CREAT, 0644);
+  if (f < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(f, &st) != 0) {
+    ::close(f);
+    return false;
+  }
+  if (st.st_size == 0) {
+    // A new tree
+    memset(&header, 0, sizeof(header));
+    header.magic = PAGED_BTREE_MAGIC;
+    header.page = PAGED_BTREE_PAGE;
+    header.t_size = sizeof(T);
+    header.size = SIZE;
+    header.pages = 1;
+  } else if (pread(f, &header, sizeof(header), 0) != sizeof(header) ||
+      header.magic != PAGED_BTREE_MAGIC || header.page != PAGED_BTREE_PAGE ||
+      header.t_size != sizeof(T) || header.size != SIZE) {
+    ::close(f);
+    memset(&header, 0, sizeof(header));
+    return false;
+  }
+  fd = f;
+  pool = new BufferPool(fd, PAGED_BTREE_PAGE, pool_bytes);
+  flush();
+  return true;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+void PagedBTree<T,Val_T,C,SIZE>::flush() {
+  if (!pool) {
+    return;
+  }
+  pool->flush();
+  if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+    PANIC("PagedBTree header write failed");
+  }
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+void PagedBTree<T,Val_T,C,SIZE>::close() {
+  if (!pool) {
+    return;
+  }
+  flush();
+  delete pool;
+  pool = nullptr;
+  ::close(fd);
+  fd = -1;
+  memset(&header, 0, sizeof(header));
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+uint64_t PagedBTree<T,Val_T,C,SIZE>::alloc(Node **n) {
+  uint64_t page;
+  void *data;
+  if (header.free) {
+    page = header.free;
+    data = pool->pin(page);
+    header.free = *((uint64_t*) data);
+    memset(data, 0, PAGED_BTREE_PAGE);
+  } else {
+    page = header.pages++;
+    data = pool->pin_new(page);
+  }
+  *n = new (data) Node();
+  return page;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+void PagedBTree<T,Val_T,C,SIZE>::free_page(uint64_t page, Node *n) {
+  *((uint64_t*) n) = header.free;
+  header.free = page;
+  unpin(n, true);
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+bool PagedBTree<T,Val_T,C,SIZE>::get(Val_T val, T *result) const {
+  uint64_t page = header.root;
+  bool found;
+  while (page) {
+    Node *n = (Node*) pool->pin(page);
+    size_t i = n->find(val, &found);
+    if (found) {
+      if (result) {
+        *result = n->get_data(i);
+      }
+      pool->unpin(n, false);
+      return true;
+    }
+    page = n->get_node(i);
+    pool->unpin(n, false);
+  }
+  return false;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+bool PagedBTree<T,Val_T,C,SIZE>::isempty(void) const {
+  return header.count == 0;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+size_t PagedBTree<T,Val_T,C,SIZE>::size(void) const {
+  return header.count;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+size_t PagedBTree<T,Val_T,C,SIZE>::pages(void) const {
+  return header.pages;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+const BufferPool* PagedBTree<T,Val_T,C,SIZE>::get_pool(void) const {
+  return pool;
+}
+
+// Same as BTree::insert(), see there
+template<typename T, typename Val_T, typename C, int SIZE>
+bool PagedBTree<T,Val_T,C,SIZE>::insert(T datum) {
+  PAGED_BTREE_CHECK();
+  Val_T v = C::val(datum);
+  Node *n;
+  // empty-tree case
+  if (!header.root) {
+    header.root = alloc(&n);
+    n->insert_right(0, std::move(datum), 0);
+    unpin(n, true);
+    header.count++;
+    PAGED_BTREE_CHECK();
+    return true;
+  }
+  n = pin(header.root);
+  bool dirty = false;
+  // Root splits look a little different, so seperate them out
+  if (n->get_used() == SIZE) {
+    Node *right_n;
+    uint64_t right_page = alloc(&right_n);
+    T pivot = n->split(right_n);
+    Node *r;
+    uint64_t root_page = alloc(&r);
+    r->set_node(0, header.root);
+    r->insert_right(0, std::move(pivot), right_page);
+    header.root = root_page;
+    int c = C::compare(v, C::val(r->get_data(0)));
+    unpin(r, true);
+    if (c == 0) {
+      // The pivot we just pulled up is the one we're inserting
+      unpin(n, true);
+      unpin(right_n, true);
+      return false;
+    }
+    if (c > 0) {
+      unpin(n, true);
+      n = right_n;
+    } else {
+      unpin(right_n, true);
+    }
+    dirty = true;
+  }
+  size_t i;
+  bool found;
+  while (true) {
+    i = n->find(v, &found);
+    if (found) {
+      unpin(n, dirty);
+      PAGED_BTREE_CHECK();
+      return false;
+    }
+    uint64_t child_page = n->get_node(i);
+    if (!child_page) {
+      break;
+    }
+    Node *child = pin(child_page);
+    bool child_dirty = false;
+    if (child->get_used() == SIZE) {
+      Node *right_n;
+      uint64_t right_page = alloc(&right_n);
+      T pivot = child->split(right_n);
+      n->insert_right(i, std::move(pivot), right_page);
+      dirty = true;
+      child_dirty = true;
+      // Note that when we split, we always add the new node to our right
+      int c = C::compare(v, C::val(n->get_data(i)));
+      if (c == 0) {
+        unpin(right_n, true);
+        unpin(child, true);
+        unpin(n, true);
+        PAGED_BTREE_CHECK();
+        return false;
+      }
+      if (c > 0) {
+        unpin(child, true);
+        child = right_n;
+      } else {
+        unpin(right_n, true);
+      }
+    }
+    unpin(n, dirty);
+    n = child;
+    dirty = child_dirty;
+  }
+  // insert only occurs at leafs
+  n->insert_right(i, std::move(datum), 0);
+  unpin(n, true);
+  header.count++;
+  PAGED_BTREE_CHECK();
+  return true;
+}
+
+// Same as BTree::remove(), see there
+template<typename T, typename Val_T, typename C, int SIZE>
+bool PagedBTree<T,Val_T,C,SIZE>::remove(Val_T v, T *result) {
+  PAGED_BTREE_CHECK();
+  if (!header.root) {
+    return false;
+  }
+  Node *n = pin(header.root);
+  // if the root node is empty (except one child), free it
+  if (!n->get_used()) {
+    uint64_t child = n->get_node(0);
+    free_page(header.root, n);
+    header.root = child;
+    if (!child) {
+      return false;
+    }
+    n = pin(child);
+  }
+  bool dirty = false;
+  bool found;
+  size_t i;
+  while (true) {
+    i = n->find(v, &found);
+    if (found) {
+      // the element could move down in to the child we'd take a replacement
+      // from, so merge first and look again
+      if (n->get_node(i) && maybe_merge(n, i)) {
+        dirty = true;
+        continue;
+      }
+      break;
+    }
+    if (!n->get_node(i)) {
+      unpin(n, dirty);
+      PAGED_BTREE_CHECK();
+      return false;
+    }
+    int merged = maybe_merge(n, i);
+    if (merged) {
+      dirty = true;
+    }
+    if (merged == 2) {
+      // we merged in to our left sibling
+      i--;
+    }
+    uint64_t next = n->get_node(i);
+    unpin(n, dirty);
+    n = pin(next);
+    dirty = false;
+  }
+  if (result) {
+    *result = n->get_data(i);
+  }
+  uint64_t junk;
+  if (!n->get_node(i)) {
+    // If we're a leaf, we can just remove the datum
+    n->remove_right(i, &junk);
+    unpin(n, true);
+    header.count--;
+    PAGED_BTREE_CHECK();
+    return true;
+  }
+  // If we're an inner node, we have to find a replacement datum, walk down
+  // the right side of n's left child
+  Node *r = pin(n->get_node(i));
+  bool r_dirty = false;
+  while (r->get_node(r->get_used())) {
+    if (maybe_merge(r, r->get_used())) {
+      r_dirty = true;
+    }
+    uint64_t next = r->get_node(r->get_used());
+    unpin(r, r_dirty);
+    r = pin(next);
+    r_dirty = false;
+  }
+  T replacement = r->remove_right(r->get_used()-1, &junk);
+  unpin(r, true);
+  n->set_data(i, std::move(replacement));
+  unpin(n, true);
+  header.count--;
+  PAGED_BTREE_CHECK();
+  return true;
+}
+
+// Same as BTree::maybe_merge(), parent must be pinned, and is dirty if this
+// returns nonzero
+template<typename T, typename Val_T, typename C, int SIZE>
+int PagedBTree<T,Val_T,C,SIZE>::maybe_merge(Node *parent, size_t i) {
+  uint64_t page = parent->get_node(i);
+  if (!page) {
+    return 0;
+  }
+  Node *n = pin(page);
+  if (n->get_used() > (SIZE-1)/2-1) {
+    unpin(n, false);
+    return 0;
+  }
+  uint64_t sibling_child;
+  // check if there's a node to our left
+  if (i > 0) {
+    Node *sibling = pin(parent->get_node(i-1));
+    if (sibling->get_used() + n->get_used() >= SIZE) {
+      // sibling is too large to join with, so rotate right instead
+      T sibling_datum = sibling->remove_right(sibling->get_used()-1, &sibling_child);
+      T old_pivot = parent->get_data(i-1);
+      parent->set_data(i-1, std::move(sibling_datum));
+      n->insert_left(0, std::move(old_pivot), sibling_child);
+      unpin(sibling, true);
+      unpin(n, true);
+      return 1;
+    }
+    T pivot = parent->remove_right(i-1, &sibling_child);
+    sibling->merge(pivot, n);
+    unpin(sibling, true);
+    free_page(page, n);
+    return 2;
+  }
+  // if there's nothing to the left, there must be something to the right
+  uint64_t sibling_page = parent->get_node(i+1);
+  Node *sibling = pin(sibling_page);
+  if (sibling->get_used() + n->get_used() >= SIZE) {
+    // rotate left
+    T sibling_datum = sibling->remove_left(0, &sibling_child);
+    T old_pivot = parent->get_data(i);
+    parent->set_data(i, std::move(sibling_datum));
+    n->insert_right(n->get_used(), std::move(old_pivot), sibling_child);
+    unpin(sibling, true);
+    unpin(n, true);
+    return 1;
+  }
+  T pivot = parent->remove_right(i, &sibling_child);
+  n->merge(pivot, sibling);
+  unpin(n, true);
+  free_page(sibling_page, sibling);
+  return 1;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+void PagedBTree<T,Val_T,C,SIZE>::check(void) const {
+  if (!header.root) {
+    if (header.count) {
+      PANIC("Empty tree has a count");
+    }
+    return;
+  }
+  size_t leaf_depth = 0;
+  size_t count = 0;
+  _check(header.root, 1, &leaf_depth, &count);
+  if (count != header.count) {
+    printf("count = %ld, header says %ld\n", count, header.count);
+    PANIC("Tree has the wrong count");
+  }
+}
+
+// Checks fill, order and leaf depth under page, counting elements, and
+// returns it's smallest and largest (or garbage if it's empty)
+template<typename T, typename Val_T, typename C, int SIZE>
+std::pair<Val_T,Val_T> PagedBTree<T,Val_T,C,SIZE>::_check(uint64_t page, size_t depth, size_t *leaf_depth, size_t *count) const {
+  if (page >= header.pages) {
+    PANIC("Child is past the end of the file");
+  }
+  // Copy it out, so we don't hold pins all the way down
+  Node n;
+  Node *p = (Node*) pool->pin(page);
+  memcpy((void*) &n, p, sizeof(Node));
+  pool->unpin(p, false);
+  if (page != header.root && n.get_used() < (SIZE-1)/2-1) {
+    PANIC("Node is insufficiently full, and is not root");
+  }
+  *count += n.get_used();
+  std::pair<Val_T,Val_T> range;
+  if (n.get_used()) {
+    range = std::make_pair(C::val(n.get_data(0)), C::val(n.get_data(n.get_used()-1)));
+  }
+  for (size_t i=1; i<n.get_used(); ++i) {
+    if (C::compare(C::val(n.get_data(i-1)), C::val(n.get_data(i))) >= 0) {
+      PANIC("Node is out of order");
+    }
+  }
+  if (!n.get_node(0)) {
+    for (size_t i=0; i<=n.get_used(); ++i) {
+      if (n.get_node(i)) {
+        PANIC("Leaf has a child");
+      }
+    }
+    if (*leaf_depth && *leaf_depth != depth) {
+      PANIC("Leaves are at different depths");
+    }
+    *leaf_depth = depth;
+    return range;
+  }
+  for (size_t i=0; i<=n.get_used(); ++i) {
+    if (!n.get_node(i)) {
+      PANIC("Inner node is missing a child");
+    }
+    std::pair<Val_T,Val_T> r = _check(n.get_node(i), depth+1, leaf_depth, count);
+    if ((i > 0 && C::compare(r.first, C::val(n.get_data(i-1))) <= 0) ||
+        (i < n.get_used() && C::compare(r.second, C::val(n.get_data(i))) >= 0)) {
+      PANIC("Child is out of order with it's parent");
+    }
+    if (i == 0 && !n.get_used()) {
+      range = r;
+    } else if (i == 0) {
+      range.first = r.first;
+    } else if (i == n.get_used()) {
+      range.second = r.second;
+    }
+  }
+  return range;
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+void PagedBTree<T,Val_T,C,SIZE>::print(void) const {
+  _print(header.root);
+  printf("\n");
+}
+
+template<typename T, typename Val_T, typename C, int SIZE>
+void PagedBTree<T,Val_T,C,SIZE>::_print(uint64_t page) const {
+  if (!page) {
+    printf("n");
+    return;
+  }
+  Node n;
+  Node *p = (Node*) pool->pin(page);
+  memcpy((void*) &n, p, sizeof(Node));
+  pool->unpin(p, false);
+  printf("[");
+  for (size_t i=0; i<n.get_used(); ++i) {
+    _print(n.get_node(i));
+    printf(",");
+    C::printT(n.get_data(i));
+    printf(",");
+  }
+  _print(n.get_node(n.get_used()));
+  printf("]");
+}
+
+#endif
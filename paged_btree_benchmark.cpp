@@ -0,0 +1,116 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * Benchmark for PagedBTree on a file much bigger than it's buffer pool.
+ * We insert TEST_SIZE keys in random order with a POOL_BYTES pool, then do
+ * TEST_ITERATIONS random gets, first with the same pool, then reopened with a
+ * pool big enough to hold the whole file, to show what the misses cost.
+ *
+ * Note that the OS page cache sits under our pool, so unless the file is also
+ * bigger than RAM a "miss" is a pread() from the page cache, not the disk.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "panic.h"
+#include "timer.h"
+#include "paged_btree.h"
+
+#ifndef TEST_SIZE
+#define TEST_SIZE 1000000
+#endif
+#ifndef TEST_ITERATIONS
+#define TEST_ITERATIONS 1000000
+#endif
+#ifndef POOL_BYTES
+#define POOL_BYTES (4 << 20)
+#endif
+
+struct KV {
+  uint64_t key;
+  uint64_t value;
+};
+
+class KVComp {
+  public:
+    static uint64_t val(const KV &kv) {
+      return kv.key;
+    }
+    static int compare(uint64_t v1, uint64_t v2) {
+      return v1 < v2 ? -1 : v1 > v2;
+    }
+    static void printT(const KV &kv) {
+      printf("%lu", kv.key);
+    }
+};
+
+typedef PagedBTree<KV, uint64_t, KVComp> Tree;
+
+uint64_t keys[TEST_SIZE];
+
+void report(const char *name, double t, size_t ops, const BufferPool *pool, uint64_t hits, uint64_t misses, uint64_t writes) {
+  hits = pool->get_hits() - hits;
+  misses = pool->get_misses() - misses;
+  writes = pool->get_writes() - writes;
+  printf("%s time=%lf ops_per_sec=%.0lf hit_rate=%.4lf page_reads_per_op=%.2lf page_writes_per_op=%.2lf\n", name, t, ops / t, (double) hits / (hits + misses), (double) misses / ops, (double) writes / ops);
+}
+
+int main(int argc, char* argv[]) {
+  const char *path = "/tmp/paged_btree_benchmark.db";
+  unlink(path);
+  for (int i=0; i<TEST_SIZE; ++i) {
+    keys[i] = i;
+  }
+  // Note, we did not initialize rand, this is purposeful
+  for (int i=TEST_SIZE-1; i>0; --i) {
+    std::swap(keys[i], keys[rand() % (i+1)]);
+  }
+
+  Tree tree;
+  if (!tree.open(path, POOL_BYTES)) {
+    PANIC("open failed");
+  }
+  timeb t1, t2;
+  const BufferPool *pool = tree.get_pool();
+  ftime(&t1);
+  for (int i=0; i<TEST_SIZE; ++i) {
+    KV kv = {keys[i], keys[i] * 2};
+    tree.insert(kv);
+  }
+  tree.flush();
+  ftime(&t2);
+  printf("PagedBTree.h test_size=%d pool_bytes=%d file_bytes=%lu\n", TEST_SIZE, POOL_BYTES, tree.pages() * (uint64_t) PAGED_BTREE_PAGE);
+  report("insert", tdiff(t2, t1), TEST_SIZE, pool, 0, 0, 0);
+
+  for (int pass=0; pass<2; ++pass) {
+    if (pass == 1) {
+      size_t bytes = tree.pages() * PAGED_BTREE_PAGE;
+      tree.close();
+      if (!tree.open(path, bytes + (1 << 20))) {
+        PANIC("open failed");
+      }
+      pool = tree.get_pool();
+      // warm it up
+      for (int i=0; i<TEST_SIZE; ++i) {
+        tree.get(keys[i], nullptr);
+      }
+    }
+    uint64_t hits = pool->get_hits();
+    uint64_t misses = pool->get_misses();
+    uint64_t writes = pool->get_writes();
+    ftime(&t1);
+    KV kv;
+    for (int i=0; i<TEST_ITERATIONS; ++i) {
+      uint64_t k = keys[i % TEST_SIZE];
+      if (!tree.get(k, &kv) || kv.value != k * 2) {
+        PANIC("tree lost an element");
+      }
+    }
+    ftime(&t2);
+    report(pass == 0 ? "get_small_pool" : "get_whole_file_pool", tdiff(t2, t1), TEST_ITERATIONS, pool, hits, misses, writes);
+  }
+  tree.close();
+  unlink(path);
+  return 0;
+}
@@ -0,0 +1,301 @@
+/* Copyright: Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * This is a Minheap, implemented as a pairing heap.
+ *
+ * When to use this:
+ * If you need to meld heaps together, or decrease keys of elements already
+ * in the heap. Meld is O(1), push is O(1), decrease is o(log(N)) amortized
+ * and pop is O(log(N)) amortized.
+ * If you just want push and pop heap.h with a delayed copy array is faster
+ * and has worst-case rather than amortized bounds.
+ *
+ * Like boundedheap.h this uses external allocation. You allocate the nodes
+ * and we link them together, so nodes never move in memory. This is what makes
+ * decrease() and remove() possible, you hand us back the node.
+ *
+ * Worst case:
+ * A single pop can take O(N) (e.g. after N pushes with no pops, the root has
+ * N children to pair up). The amortized bound is O(log(N)).
+ *
+ * Algorithm:
+ * Every node keeps a pointer to it's leftmost child, and it's siblings are a
+ * doubly linked list. The "prev" pointer of a leftmost child points to the
+ * parent instead of a sibling, this is how we find our way back up to cut
+ * a node out in decrease().
+ * Pop uses the standard two-pass pairing, left to right pairs, then melding
+ * the pairs right to left.
+ *
+ * Threadsafety:
+ *   Thread compatible
+ */
+
+#include <stdio.h>
+#include <utility>
+#include "panic.h"
+
+#ifndef PAIRINGHEAP_H
+#define PAIRINGHEAP_H
+
+// Define this to implement some expensive consistancy checking, this is great
+// for debugging code that uses the heap as well.
+// This checks all of the heap invariants before and after ever oparation.
+#ifdef PAIRINGHEAP_DEBUG
+#define PAIRINGHEAP_CHECK() check()
+#else
+#define PAIRINGHEAP_CHECK()
+#endif
+
+template <typename Node_T, typename Val_T>
+class PairingHeapNode_base {
+  public:
+    // leftmost child
+    Node_T *child;
+    // next sibling to our right
+    Node_T *next;
+    // sibling to our left, or our parent if we are the leftmost child
+    Node_T *prev;
+    // subclass must implement:
+    // Val_T val(void);
+    // static int compare(Val_T v1, Val_T v2);
+    void print(void) {
+      printf("?");
+    }
+};
+
+template <typename Node_T, typename Val_T>
+class PairingHeap {
+  private:
+    Node_T *root;
+    Node_T *meld_nodes(Node_T *a, Node_T *b);
+    Node_T *combine_siblings(Node_T *first);
+    void cut(Node_T *n);
+    void _check(Node_T *n, Node_T *prev) const;
+    void _print(Node_T *n) const;
+  public:
+    PairingHeap();
+    ~PairingHeap();
+    void push(Node_T *n);
+    Node_T *pop(void);
+    Node_T *peek(void) const;
+    // Call this *after* lowering the value of a node already in the heap
+    void decrease(Node_T *n);
+    // Removes an arbitrary node from the heap
+    void remove(Node_T *n);
+    // Moves everything in other in to this heap, other is left empty
+    void meld(PairingHeap<Node_T, Val_T> *other);
+    bool isempty(void) const;
+    void check(void) const;
+    void print(void) const;
+};
+
+template<typename Node_T, typename Val_T>
+PairingHeap<Node_T,Val_T>::PairingHeap() {
+  root = nullptr;
+}
+
+template<typename Node_T, typename Val_T>
+PairingHeap<Node_T,Val_T>::~PairingHeap() {
+  if (root) {
+    PANIC("PairingHeap destroyed while not empty");
+  }
+}
+
+// a and b must both be roots (no siblings, no parent)
+template<typename Node_T, typename Val_T>
+Node_T *PairingHeap<Node_T,Val_T>::meld_nodes(Node_T *a, Node_T *b) {
+  if (!a) {
+    return b;
+  }
+  if (!b) {
+    return a;
+  }
+  if (Node_T::compare(b->val(), a->val()) < 0) {
+    std::swap(a, b);
+  }
+  // b becomes a's leftmost child
+  b->PairingHeapNode_base<Node_T,Val_T>::prev = a;
+  b->PairingHeapNode_base<Node_T,Val_T>::next = a->PairingHeapNode_base<Node_T,Val_T>::child;
+  if (a->PairingHeapNode_base<Node_T,Val_T>::child) {
+    a->PairingHeapNode_base<Node_T,Val_T>::child->PairingHeapNode_base<Node_T,Val_T>::prev = b;
+  }
+  a->PairingHeapNode_base<Node_T,Val_T>::child = b;
+  return a;
+}
+
+// Standard two pass pairing
+// We thread the intermediate results through "next" so we don't need any
+// extra memory (or recursion)
+template<typename Node_T, typename Val_T>
+Node_T *PairingHeap<Node_T,Val_T>::combine_siblings(Node_T *first) {
+  if (!first) {
+    return nullptr;
+  }
+  // First pass, meld pairs left to right, and push the results on a stack
+  Node_T *stack = nullptr;
+  while (first) {
+    Node_T *a = first;
+    Node_T *b = a->PairingHeapNode_base<Node_T,Val_T>::next;
+    a->PairingHeapNode_base<Node_T,Val_T>::prev = nullptr;
+    a->PairingHeapNode_base<Node_T,Val_T>::next = nullptr;
+    if (!b) {
+      first = nullptr;
+    } else {
+      first = b->PairingHeapNode_base<Node_T,Val_T>::next;
+      b->PairingHeapNode_base<Node_T,Val_T>::prev = nullptr;
+      b->PairingHeapNode_base<Node_T,Val_T>::next = nullptr;
+      a = meld_nodes(a, b);
+    }
+    a->PairingHeapNode_base<Node_T,Val_T>::next = stack;
+    stack = a;
+  }
+  // Second pass, meld the pairs right to left (the stack is reversed already)
+  Node_T *result = stack;
+  stack = stack->PairingHeapNode_base<Node_T,Val_T>::next;
+  result->PairingHeapNode_base<Node_T,Val_T>::next = nullptr;
+  while (stack) {
+    Node_T *n = stack;
+    stack = stack->PairingHeapNode_base<Node_T,Val_T>::next;
+    n->PairingHeapNode_base<Node_T,Val_T>::next = nullptr;
+    result = meld_nodes(result, n);
+  }
+  return result;
+}
+
+// Unlinks n (and it's subtree) from it's parent, n must not be root
+template<typename Node_T, typename Val_T>
+void PairingHeap<Node_T,Val_T>::cut(Node_T *n) {
+  Node_T *prev = n->PairingHeapNode_base<Node_T,Val_T>::prev;
+  Node_T *next = n->PairingHeapNode_base<Node_T,Val_T>::next;
+  if (prev->PairingHeapNode_base<Node_T,Val_T>::child == n) {
+    // prev is our parent
+    prev->PairingHeapNode_base<Node_T,Val_T>::child = next;
+  } else {
+    prev->PairingHeapNode_base<Node_T,Val_T>::next = next;
+  }
+  if (next) {
+    next->PairingHeapNode_base<Node_T,Val_T>::prev = prev;
+  }
+  n->PairingHeapNode_base<Node_T,Val_T>::prev = nullptr;
+  n->PairingHeapNode_base<Node_T,Val_T>::next = nullptr;
+}
+
+template<typename Node_T, typename Val_T>
+void PairingHeap<Node_T,Val_T>::push(Node_T *n) {
+  PAIRINGHEAP_CHECK();
+  n->PairingHeapNode_base<Node_T,Val_T>::child = nullptr;
+  n->PairingHeapNode_base<Node_T,Val_T>::next = nullptr;
+  n->PairingHeapNode_base<Node_T,Val_T>::prev = nullptr;
+  root = meld_nodes(root, n);
+  PAIRINGHEAP_CHECK();
+}
+
+template<typename Node_T, typename Val_T>
+Node_T *PairingHeap<Node_T,Val_T>::pop(void) {
+  PAIRINGHEAP_CHECK();
+  Node_T *n = root;
+  if (!n) {
+    return nullptr;
+  }
+  root = combine_siblings(n->PairingHeapNode_base<Node_T,Val_T>::child);
+  n->PairingHeapNode_base<Node_T,Val_T>::child = nullptr;
+  PAIRINGHEAP_CHECK();
+  return n;
+}
+
+template<typename Node_T, typename Val_T>
+Node_T *PairingHeap<Node_T,Val_T>::peek(void) const {
+  return root;
+}
+
+template<typename Node_T, typename Val_T>
+void PairingHeap<Node_T,Val_T>::decrease(Node_T *n) {
+  // Note we can't check the whole heap first, the user has already changed
+  // the value out from under us, so the heap is (legally) out of order
+  if (n == root) {
+    return;
+  }
+  cut(n);
+  root = meld_nodes(root, n);
+  PAIRINGHEAP_CHECK();
+}
+
+template<typename Node_T, typename Val_T>
+void PairingHeap<Node_T,Val_T>::remove(Node_T *n) {
+  PAIRINGHEAP_CHECK();
+  if (n == root) {
+    pop();
+    return;
+  }
+  cut(n);
+  Node_T *sub = combine_siblings(n->PairingHeapNode_base<Node_T,Val_T>::child);
+  n->PairingHeapNode_base<Node_T,Val_T>::child = nullptr;
+  root = meld_nodes(root, sub);
+  PAIRINGHEAP_CHECK();
+}
+
+template<typename Node_T, typename Val_T>
+void PairingHeap<Node_T,Val_T>::meld(PairingHeap<Node_T, Val_T> *other) {
+  PAIRINGHEAP_CHECK();
+  root = meld_nodes(root, other->root);
+  other->root = nullptr;
+  PAIRINGHEAP_CHECK();
+}
+
+template<typename Node_T, typename Val_T>
+bool PairingHeap<Node_T,Val_T>::isempty(void) const {
+  return !root;
+}
+
+template<typename Node_T, typename Val_T>
+void PairingHeap<Node_T,Val_T>::check(void) const {
+  if (!root) {
+    return;
+  }
+  if (root->PairingHeapNode_base<Node_T,Val_T>::next ||
+      root->PairingHeapNode_base<Node_T,Val_T>::prev) {
+    PANIC("root has siblings");
+  }
+  _check(root, nullptr);
+}
+
+// Walks one sibling list, prev is what the first node's prev should be
+template<typename Node_T, typename Val_T>
+void PairingHeap<Node_T,Val_T>::_check(Node_T *n, Node_T *prev) const {
+  Node_T *parent = prev;
+  for (; n; n = n->PairingHeapNode_base<Node_T,Val_T>::next) {
+    if (n->PairingHeapNode_base<Node_T,Val_T>::prev != prev) {
+      PANIC("prev pointer is corrupt");
+    }
+    if (parent && Node_T::compare(n->val(), parent->val()) < 0) {
+      PANIC("Node is smaller than it's parent");
+    }
+    Node_T *child = n->PairingHeapNode_base<Node_T,Val_T>::child;
+    if (child) {
+      _check(child, n);
+    }
+    prev = n;
+  }
+}
+
+template<typename Node_T, typename Val_T>
+void PairingHeap<Node_T,Val_T>::print(void) const {
+  _print(root);
+  printf("\n");
+}
+
+template<typename Node_T, typename Val_T>
+void PairingHeap<Node_T,Val_T>::_print(Node_T *n) const {
+  if (!n) {
+    printf("n");
+    return;
+  }
+  for (; n; n = n->PairingHeapNode_base<Node_T,Val_T>::next) {
+    printf("[");
+    n->print();
+    printf(":");
+    _print(n->PairingHeapNode_base<Node_T,Val_T>::child);
+    printf("]");
+  }
+}
+
+#endif
@@ -0,0 +1,107 @@
+#define PAIRINGHEAP_DEBUG
+#include "pairingheap.h"
+
+#define TEST_SIZE 200
+
+class HeapNode: public PairingHeapNode_base<HeapNode, int>{
+  public:
+    int value; 
+    HeapNode() {};
+    HeapNode(int val) { value=val; }
+    int val() {
+      return value;
+    }
+    static int compare(int v1, int v2) {
+      return v1 - v2;
+    }
+    void print() {
+      printf("%d", value);
+    }
+};
+
+// Pops everything, checking that it comes out in order
+void drain(PairingHeap<HeapNode, int> *heap, size_t expected) {
+  size_t count = 0;
+  int last = -1;
+  HeapNode *n;
+  while ((n = heap->pop())) {
+    if (n->val() < last) {
+      PANIC("Heap popped out of order");
+    }
+    last = n->val();
+    delete n;
+    count++;
+  }
+  if (count != expected) {
+    PANIC("Heap lost or gained elements");
+  }
+}
+
+int main(int argc, char **argv) {
+  PairingHeap<HeapNode, int> heap;
+  int i,j;
+  printf("Begin PairingHeap.h unittest\n");
+  for (j=0;j<TEST_SIZE;j++) {
+    for (i=0;i<j;i++) {
+      heap.push(new HeapNode(i));
+    }
+    drain(&heap, j);
+    for (i=j;i>0;i--) {
+      heap.push(new HeapNode(i));
+    }
+    drain(&heap, j);
+  }
+  for (j=0;j<TEST_SIZE;j++) {
+    for (i=0;i<j;i++) {
+      heap.push(new HeapNode(rand() % 1000));
+    }
+    drain(&heap, j);
+  }
+
+  // Testing duplicate
+  for (i=0; i<10; i++) {
+    heap.push(new HeapNode(1));
+  }
+  drain(&heap, 10);
+  if (heap.pop()) {
+    PANIC("PairingHeap didn't drain");
+  } 
+
+  // Test decrease, remove
+  HeapNode *nodes[TEST_SIZE];
+  for (i=0; i<TEST_SIZE; i++) {
+    nodes[i] = new HeapNode(1000 + rand() % 1000);
+    heap.push(nodes[i]);
+  }
+  // pop one so the heap has real structure to cut out of
+  HeapNode *popped = heap.pop();
+  size_t remaining = TEST_SIZE-1;
+  for (i=0; i<TEST_SIZE; i++) {
+    if (nodes[i] == popped) {
+      continue;
+    }
+    if (i % 3 == 0) {
+      nodes[i]->value = rand() % 1000;
+      heap.decrease(nodes[i]);
+    } else if (i % 3 == 1) {
+      heap.remove(nodes[i]);
+      delete nodes[i];
+      remaining--;
+    }
+  }
+  delete popped;
+  drain(&heap, remaining);
+
+  // Test meld
+  PairingHeap<HeapNode, int> other;
+  for (i=0; i<TEST_SIZE; i++) {
+    heap.push(new HeapNode(rand() % 1000));
+    other.push(new HeapNode(rand() % 1000));
+  }
+  heap.meld(&other);
+  if (!other.isempty()) {
+    PANIC("meld didn't empty the other heap");
+  }
+  drain(&heap, 2*TEST_SIZE);
+  printf("PASS\n");
+}
@@ -0,0 +1,231 @@
+/* Copyright: Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * This is a Minheap for monotone integer keys, implemented as a radix heap.
+ *
+ * When to use this:
+ * If your keys are unsigned integers, and you never push a key smaller than
+ * the last key you popped. This is the case for event simulations (time only
+ * moves forward) and for Dijkstra's algorithm.
+ * Push is O(1), pop is O(log(C)) amortized where C is the number of bits in
+ * the key. In practice pop rarely does any work beyond unlinking a node.
+ *
+ * Like boundedheap.h this uses external allocation, you allocate the nodes.
+ *
+ * Worst case:
+ * A single pop can redistribute every node in the heap, so it's O(N).
+ * Each node can only move down (towards bucket 0) though, at most once per
+ * bit, thus the amortized bound.
+ *
+ * Algorithm:
+ * We remember "last", the last key we popped. Bucket 0 holds keys equal to
+ * last, bucket i holds keys whose highest bit differing from last is bit i-1.
+ * When bucket 0 is empty we find the first non-empty bucket, make it's
+ * smallest key the new "last", and redistribute it. Every node in that bucket
+ * now differs from last in a strictly lower bit, so it moves to a lower
+ * bucket.
+ * Since all keys present are >= last, an empty heap can forget "last", so
+ * a drained heap can be reused starting from any key.
+ *
+ * Threadsafety:
+ *   Thread compatible
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <type_traits>
+#include "panic.h"
+
+#ifndef RADIXHEAP_H
+#define RADIXHEAP_H
+
+// Define this to implement some expensive consistancy checking, this is great
+// for debugging code that uses the heap as well.
+// This checks all of the heap invariants before and after ever oparation.
+#ifdef RADIXHEAP_DEBUG
+#define RADIXHEAP_CHECK() check()
+#else
+#define RADIXHEAP_CHECK()
+#endif
+
+template <typename Node_T>
+class RadixHeapNode_base {
+  public:
+    Node_T *next;
+    // subclass must implement:
+    // Val_T val(void);
+    void print(void) {
+      printf("?");
+    }
+};
+
+template <typename Node_T, typename Val_T>
+class RadixHeap {
+  static_assert(std::is_integral<Val_T>::value && std::is_unsigned<Val_T>::value, "RadixHeap keys must be unsigned integers");
+  private:
+    static const size_t BITS = 8*sizeof(Val_T);
+    // Bucket 0 is keys equal to last, then one bucket per bit
+    Node_T *buckets[BITS+1];
+    // bit i-1 set if buckets[i] is non-empty (bucket 0 is checked directly)
+    uint64_t nonempty;
+    Val_T last;
+    size_t count;
+    size_t bucket(Val_T v) const {
+      if (v == last) {
+        return 0;
+      }
+      return 64 - __builtin_clzll((uint64_t) (v ^ last));
+    }
+    void link(Node_T *n) {
+      size_t b = bucket(n->val());
+      n->RadixHeapNode_base<Node_T>::next = buckets[b];
+      buckets[b] = n;
+      if (b) {
+        nonempty |= 1lu << (b-1);
+      }
+    }
+    void refill(void);
+  public:
+    RadixHeap();
+    ~RadixHeap();
+    void push(Node_T *n);
+    Node_T *pop(void);
+    // Not const, peek may have to redistribute a bucket to find the minimum
+    Node_T *peek(void);
+    bool isempty(void) const;
+    size_t size(void) const;
+    void check(void) const;
+    void print(void) const;
+};
+
+template<typename Node_T, typename Val_T>
+RadixHeap<Node_T,Val_T>::RadixHeap() {
+  for (size_t i=0; i<BITS+1; ++i) {
+    buckets[i] = nullptr;
+  }
+  nonempty = 0;
+  last = 0;
+  count = 0;
+}
+
+template<typename Node_T, typename Val_T>
+RadixHeap<Node_T,Val_T>::~RadixHeap() {
+  if (count) {
+    PANIC("RadixHeap destroyed while not empty");
+  }
+}
+
+// Moves the smallest bucket down so bucket 0 is non-empty
+// must not be called on an empty heap
+template<typename Node_T, typename Val_T>
+void RadixHeap<Node_T,Val_T>::refill(void) {
+  size_t b = __builtin_ctzll(nonempty) + 1;
+  Node_T *n = buckets[b];
+  buckets[b] = nullptr;
+  nonempty &= ~(1lu << (b-1));
+  // find the new last
+  Val_T min = n->val();
+  for (Node_T *m = n->RadixHeapNode_base<Node_T>::next; m; m = m->RadixHeapNode_base<Node_T>::next) {
+    if (m->val() < min) {
+      min = m->val();
+    }
+  }
+  last = min;
+  // and redistribute, everything goes to a lower bucket
+  while (n) {
+    Node_T *next = n->RadixHeapNode_base<Node_T>::next;
+    link(n);
+    n = next;
+  }
+}
+
+template<typename Node_T, typename Val_T>
+void RadixHeap<Node_T,Val_T>::push(Node_T *n) {
+  RADIXHEAP_CHECK();
+  if (n->val() < last) {
+    PANIC("RadixHeap push of a key smaller than the last key popped");
+  }
+  link(n);
+  count++;
+  RADIXHEAP_CHECK();
+}
+
+template<typename Node_T, typename Val_T>
+Node_T *RadixHeap<Node_T,Val_T>::pop(void) {
+  RADIXHEAP_CHECK();
+  if (!count) {
+    return nullptr;
+  }
+  if (!buckets[0]) {
+    refill();
+  }
+  Node_T *n = buckets[0];
+  buckets[0] = n->RadixHeapNode_base<Node_T>::next;
+  count--;
+  if (!count) {
+    last = 0;
+  }
+  RADIXHEAP_CHECK();
+  return n;
+}
+
+template<typename Node_T, typename Val_T>
+Node_T *RadixHeap<Node_T,Val_T>::peek(void) {
+  if (!count) {
+    return nullptr;
+  }
+  if (!buckets[0]) {
+    refill();
+  }
+  return buckets[0];
+}
+
+template<typename Node_T, typename Val_T>
+bool RadixHeap<Node_T,Val_T>::isempty(void) const {
+  return !count;
+}
+
+template<typename Node_T, typename Val_T>
+size_t RadixHeap<Node_T,Val_T>::size(void) const {
+  return count;
+}
+
+template<typename Node_T, typename Val_T>
+void RadixHeap<Node_T,Val_T>::check(void) const {
+  size_t total = 0;
+  for (size_t b=0; b<BITS+1; ++b) {
+    if (b && !!buckets[b] != !!(nonempty & (1lu << (b-1)))) {
+      PANIC("nonempty mask is out of sync with the buckets");
+    }
+    for (Node_T *n = buckets[b]; n; n = n->RadixHeapNode_base<Node_T>::next) {
+      if (n->val() < last) {
+        PANIC("Node is smaller than last");
+      }
+      if (bucket(n->val()) != b) {
+        PANIC("Node is in the wrong bucket");
+      }
+      total++;
+    }
+  }
+  if (total != count) {
+    PANIC("count is wrong");
+  }
+}
+
+template<typename Node_T, typename Val_T>
+void RadixHeap<Node_T,Val_T>::print(void) const {
+  printf("[");
+  for (size_t b=0; b<BITS+1; ++b) {
+    if (!buckets[b]) {
+      continue;
+    }
+    printf("%lu:(", b);
+    for (Node_T *n = buckets[b]; n; n = n->RadixHeapNode_base<Node_T>::next) {
+      n->print();
+      printf(",");
+    }
+    printf(")");
+  }
+  printf("]\n");
+}
+
+#endif
@@ -0,0 +1,91 @@
+#define RADIXHEAP_DEBUG
+#include <stdint.h>
+#include "radixheap.h"
+
+#define TEST_SIZE 200
+
+class HeapNode: public RadixHeapNode_base<HeapNode>{
+  public:
+    uint64_t value; 
+    HeapNode() {};
+    HeapNode(uint64_t val) { value=val; }
+    uint64_t val() {
+      return value;
+    }
+    void print() {
+      printf("%lu", value);
+    }
+};
+
+// Pops everything, checking that it comes out in order
+void drain(RadixHeap<HeapNode, uint64_t> *heap, size_t expected) {
+  size_t count = 0;
+  uint64_t last = 0;
+  HeapNode *n;
+  while ((n = heap->pop())) {
+    if (n->val() < last) {
+      PANIC("Heap popped out of order");
+    }
+    last = n->val();
+    delete n;
+    count++;
+  }
+  if (count != expected) {
+    PANIC("Heap lost or gained elements");
+  }
+}
+
+int main(int argc, char **argv) {
+  RadixHeap<HeapNode, uint64_t> heap;
+  int i,j;
+  printf("Begin RadixHeap.h unittest\n");
+  for (j=0;j<TEST_SIZE;j++) {
+    for (i=0;i<j;i++) {
+      heap.push(new HeapNode(i));
+    }
+    drain(&heap, j);
+    for (i=j;i>0;i--) {
+      heap.push(new HeapNode(i));
+    }
+    drain(&heap, j);
+  }
+  for (j=0;j<TEST_SIZE;j++) {
+    for (i=0;i<j;i++) {
+      heap.push(new HeapNode(((uint64_t) rand()) * rand()));
+    }
+    drain(&heap, j);
+  }
+
+  // Testing duplicate
+  for (i=0; i<10; i++) {
+    heap.push(new HeapNode(1));
+  }
+  drain(&heap, 10);
+  if (heap.pop()) {
+    PANIC("RadixHeap didn't drain");
+  } 
+
+  // Test monotone usage, like an event simulation
+  // we keep popping the smallest, and pushing it back in the future 
+  for (i=0; i<TEST_SIZE; i++) {
+    heap.push(new HeapNode(rand() % 1000));
+  }
+  uint64_t now = 0;
+  for (i=0; i<100*TEST_SIZE; i++) {
+    HeapNode *n = heap.peek();
+    if (heap.pop() != n) {
+      PANIC("peek and pop disagree");
+    }
+    if (n->val() < now) {
+      PANIC("time went backwards");
+    }
+    now = n->val();
+    n->value = now + rand() % 1000;
+    heap.push(n);
+  }
+  if (heap.size() != TEST_SIZE) {
+    PANIC("Heap lost or gained elements");
+  }
+  drain(&heap, TEST_SIZE);
+  printf("PASS\n");
+}
@@ -0,0 +1,448 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * A Robin Hood open addressing hashtable, with backward shift deletion.
+ * This uses internal allocation, like hashtable.h.
+ *
+ * When to use this:
+ *   If you want a hashtable with short, predictable probe sequences, and
+ *   especially if you look up a lot of keys that *aren't* there. Chained
+ *   tables have to walk a whole chain to prove a miss, we usually stop after
+ *   a slot or two.
+ *   Pointers to elements are invalidated by any insert or remove (we move
+ *   things around), if you need stable pointers use ochashtable.h.
+ *
+ * Algorithm:
+ *   Linear probing, but every slot remembers how far it is from it's home
+ *   slot (it's "distance"). On insert, if we find a slot closer to home than
+ *   the element we're carrying we swap them and keep going with the richer
+ *   element ("take from the rich, give to the poor"). This keeps the variance
+ *   of probe distances very low.
+ *   It also means a lookup can stop as soon as it finds a slot closer to home
+ *   than we'd be, if our key were there it would have displaced that slot.
+ *   Remove shifts the following elements back by one until it hits an empty
+ *   slot or an element already at home, so there are no tombstones, and the
+ *   table never degrades after lots of deletes.
+ *
+ * Worst case:
+ *   Distances are stored in a byte, if an insert would probe past that we
+ *   grow the table instead. So no probe sequence is ever longer than
+ *   MAX_DISTANCE. If that happens in a mostly empty table the hash function is
+ *   broken (lots of identical hashes), and we PANIC rather than grow forever.
+ *   Resizes are still linear.
+ *   max_probe() and mean_probe() report how well we're doing.
+ *
+ * resizes up when over 7/8 full
+ * resizes down when under 1/8 full
+ *
+ * HP is the hashing policy, see hash.h. We only use its mixer, the table
+ * does its own power of 2 reduction so probing stays cheap
+ *
+ * Threadsafety:
+ *   thread compatible
+ */
+
+#include <new>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <utility>
+#include "panic.h"
+#include "hash.h"
+
+#ifndef ROBINHOODHASHTABLE_H
+#define ROBINHOODHASHTABLE_H
+
+template <typename Data_T, typename Val_T, typename HC, typename HP=DefaultHash>
+class RobinHoodHashTable {
+  private:
+    static const size_t MIN_CAPACITY = 8;
+    // distance is stored +1, so 0 means empty
+    static const uint8_t MAX_DISTANCE = 255;
+    uint8_t *dist;
+    Data_T *slots;
+    // always a power of 2
+    size_t capacity;
+    size_t count;
+
+    // See hash.h
+    uint64_t seed;
+    size_t mix(size_t h) const {
+      return HP::mix(h, seed);
+    }
+    size_t home(Val_T key) const {
+      return mix(HC::hash(key)) & (capacity-1);
+    }
+    // returns capacity if key isn't here
+    size_t find(Val_T key) const;
+    // places data, which must not be in the table, returns false if it
+    // would exceed MAX_DISTANCE (in which case the table is unchanged)
+    bool place(Data_T data);
+    void alloc(size_t cap);
+    void check_sizeup(void);
+    void check_sizedown(void);
+  public:
+    class Iterator {
+      private:
+        const RobinHoodHashTable<Data_T, Val_T, HC, HP> *t;
+        size_t i;
+        void skip() {
+          while (i < t->capacity && !t->dist[i]) {
+            i++;
+          }
+        }
+      public:
+        Iterator(const RobinHoodHashTable<Data_T, Val_T, HC, HP> *_t, size_t _i) {
+          t = _t;
+          i = _i;
+          // Look for a valid element (if we don't have one)
+          skip();
+        }
+        Iterator(const Iterator& other) {
+          t = other.t;
+          i = other.i;
+        }
+        Iterator& operator=(const Iterator& other) {
+          t = other.t;
+          i = other.i;
+          return *this;
+        }
+        bool operator==(const Iterator& other) {
+          return i == other.i;
+        }
+        bool operator!=(const Iterator& other) {
+          return !((*this) == other);
+        }
+        Iterator operator++() {
+          // If we're at the end, we're done
+          if (i >= t->capacity) {
+            return *this;
+          }
+          i++;
+          skip();
+          return *this;
+        }
+        Iterator operator++(int) {
+          Iterator tmp(*this);
+          ++(*this);
+          return tmp;
+        }
+        Data_T& operator*() {
+					// Get what's inside the iterator
+          return t->slots[i];
+        }
+        Data_T* operator->() {
+					// Get a reference to what's inside the iterator (lol)
+          return &t->slots[i];
+        }
+    };
+    Iterator begin() {
+      return Iterator(this, 0);
+    }
+    Iterator end() {
+      return Iterator(this, capacity);
+    }
+
+    RobinHoodHashTable();
+    RobinHoodHashTable(size_t s);
+    ~RobinHoodHashTable();
+    bool insert(const Data_T& data);
+    Data_T* get(Val_T key);
+    bool remove(Val_T key, Data_T* data);
+    bool isempty(void) const;
+    size_t size(void) const;
+    void resize(size_t s);
+    // Longest probe sequence currently in the table (1 is "at home")
+    size_t max_probe(void) const;
+    // Average probe length of a successful lookup
+    double mean_probe(void) const;
+    void check(void) const;
+    void print(void);
+};
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+RobinHoodHashTable<Data_T, Val_T, HC, HP>::RobinHoodHashTable() {
+  seed = HP::new_seed();
+  count = 0;
+  alloc(MIN_CAPACITY);
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+RobinHoodHashTable<Data_T, Val_T, HC, HP>::RobinHoodHashTable(size_t s) {
+  seed = HP::new_seed();
+  count = 0;
+  size_t cap = MIN_CAPACITY;
+  while (cap < s) {
+    cap *= 2;
+  }
+  alloc(cap);
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+RobinHoodHashTable<Data_T, Val_T, HC, HP>::~RobinHoodHashTable() {
+  for (size_t i=0; i<capacity; ++i) {
+    if (dist[i]) {
+      slots[i].~Data_T();
+    }
+  }
+  free(dist);
+  free(slots);
+}
+
+// Sets up an empty table, doesn't touch count or free the old one
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+void RobinHoodHashTable<Data_T, Val_T, HC, HP>::alloc(size_t cap) {
+  capacity = cap;
+  dist = (uint8_t*) calloc(cap, 1);
+  slots = (Data_T*) malloc(cap * sizeof(Data_T));
+  if (!dist || !slots) {
+    PANIC("RobinHoodHashTable allocation failed");
+  }
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+size_t RobinHoodHashTable<Data_T, Val_T, HC, HP>::find(Val_T key) const {
+  size_t i = home(key);
+  for (size_t d=1; ; ++d) {
+    // Anything closer to home than we'd be means we aren't here
+    // (this also catches empty slots)
+    if (dist[i] < d) {
+      return capacity;
+    }
+    if (dist[i] == d && HC::val(slots[i]) == key) {
+      return i;
+    }
+    i = (i+1) & (capacity-1);
+  }
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+bool RobinHoodHashTable<Data_T, Val_T, HC, HP>::place(Data_T data) {
+  // First make sure we'll fit, so we don't have to undo anything
+  // This walks the same path as below, but only tracks the distance of
+  // whatever element we'd be carrying at each step
+  size_t i = home(HC::val(data));
+  size_t d = 1;
+  while (dist[i]) {
+    if (dist[i] < d) {
+      d = dist[i];
+    }
+    if (d == MAX_DISTANCE) {
+      return false;
+    }
+    i = (i+1) & (capacity-1);
+    d++;
+  }
+  // Now really do it
+  i = home(HC::val(data));
+  d = 1;
+  while (true) {
+    if (!dist[i]) {
+      dist[i] = d;
+      new (&slots[i]) Data_T(std::move(data));
+      return true;
+    }
+    if (dist[i] < d) {
+      // Robin Hood, take the slot and carry on with the richer element
+      std::swap(data, slots[i]);
+      uint8_t tmp = dist[i];
+      dist[i] = d;
+      d = tmp;
+    }
+    if (d == MAX_DISTANCE) {
+      // This can't happen given the check above
+      PANIC("RobinHoodHashTable probe distance overflow");
+    }
+    i = (i+1) & (capacity-1);
+    d++;
+  }
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+bool RobinHoodHashTable<Data_T, Val_T, HC, HP>::insert(const Data_T& data) {
+  // reject duplicates
+  if (find(HC::val(data)) != capacity) {
+    return false;
+  }
+  check_sizeup();
+  while (!place(data)) {
+    // Our probe would be too long, grow
+    if (count*4 < capacity) {
+      PANIC("RobinHoodHashTable has too many colliding hashes");
+    }
+    resize(capacity*2);
+  }
+  count++;
+  return true;
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+Data_T* RobinHoodHashTable<Data_T, Val_T, HC, HP>::get(Val_T key) {
+  size_t i = find(key);
+  if (i == capacity) {
+    return nullptr;
+  }
+  return &slots[i];
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+bool RobinHoodHashTable<Data_T, Val_T, HC, HP>::remove(Val_T v, Data_T *data) {
+  size_t i = find(v);
+  if (i == capacity) {
+    return false;
+  }
+  *data = std::move(slots[i]);
+  // Backward shift, pull everything after us one slot closer to home
+  // until we hit an empty slot or something that's already at home
+  size_t next = (i+1) & (capacity-1);
+  while (dist[next] > 1) {
+    slots[i] = std::move(slots[next]);
+    dist[i] = dist[next] - 1;
+    i = next;
+    next = (next+1) & (capacity-1);
+  }
+  slots[i].~Data_T();
+  dist[i] = 0;
+  count--;
+  check_sizedown();
+  return true;
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+bool RobinHoodHashTable<Data_T, Val_T, HC, HP>::isempty(void) const {
+  return count == 0;
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+size_t RobinHoodHashTable<Data_T, Val_T, HC, HP>::size(void) const {
+  return count;
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+void RobinHoodHashTable<Data_T, Val_T, HC, HP>::resize(size_t s) {
+  size_t cap = MIN_CAPACITY;
+  while (cap < s) {
+    cap *= 2;
+  }
+  if (cap < count) {
+    PANIC("RobinHoodHashTable resized too small for it's contents");
+  }
+  uint8_t *old_dist = dist;
+  Data_T *old_slots = slots;
+  size_t old_capacity = capacity;
+  while (true) {
+    alloc(cap);
+    // Rehash, no need to check for duplicates
+    size_t i;
+    for (i=0; i<old_capacity; ++i) {
+      if (!old_dist[i]) {
+        continue;
+      }
+      if (!place(old_slots[i])) {
+        break;
+      }
+    }
+    if (i == old_capacity) {
+      break;
+    }
+    // Very unlucky, a probe was too long at this size. Throw it away and
+    // try again bigger, the old table is still intact.
+    for (size_t j=0; j<capacity; ++j) {
+      if (dist[j]) {
+        slots[j].~Data_T();
+      }
+    }
+    free(dist);
+    free(slots);
+    cap *= 2;
+  }
+  for (size_t i=0; i<old_capacity; ++i) {
+    if (old_dist[i]) {
+      old_slots[i].~Data_T();
+    }
+  }
+  free(old_dist);
+  free(old_slots);
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+void RobinHoodHashTable<Data_T, Val_T, HC, HP>::check_sizeup(void) {
+  // If it's over 7/8ths full resize up
+  if ((count+1)*8 > capacity*7) {
+    resize(capacity*2);
+  }
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+void RobinHoodHashTable<Data_T, Val_T, HC, HP>::check_sizedown(void) {
+  // If it's under an eighth full resize down
+  if (capacity > MIN_CAPACITY && count*8 < capacity) {
+    resize(capacity/2);
+  }
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+size_t RobinHoodHashTable<Data_T, Val_T, HC, HP>::max_probe(void) const {
+  size_t m = 0;
+  for (size_t i=0; i<capacity; ++i) {
+    if (dist[i] > m) {
+      m = dist[i];
+    }
+  }
+  return m;
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+double RobinHoodHashTable<Data_T, Val_T, HC, HP>::mean_probe(void) const {
+  if (!count) {
+    return 0;
+  }
+  size_t total = 0;
+  for (size_t i=0; i<capacity; ++i) {
+    total += dist[i];
+  }
+  return ((double) total) / count;
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+void RobinHoodHashTable<Data_T, Val_T, HC, HP>::check(void) const {
+  size_t full = 0;
+  for (size_t i=0; i<capacity; ++i) {
+    if (!dist[i]) {
+      continue;
+    }
+    full++;
+    // distance must match where the element hashes to
+    size_t h = home(HC::val(slots[i]));
+    if (((i - h) & (capacity-1)) + 1 != dist[i]) {
+      PANIC("RobinHoodHashTable distance is wrong");
+    }
+    // and we can only be more than 1 further than the previous slot if
+    // we're at home (otherwise the previous slot should have been ours)
+    size_t prev = (i-1) & (capacity-1);
+    if (dist[i] > 1 && dist[prev] + 1 < dist[i]) {
+      PANIC("RobinHoodHashTable is not in Robin Hood order");
+    }
+    if (find(HC::val(slots[i])) != i) {
+      PANIC("RobinHoodHashTable element can't be found");
+    }
+  }
+  if (full != count) {
+    PANIC("RobinHoodHashTable count is wrong");
+  }
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+void RobinHoodHashTable<Data_T, Val_T, HC, HP>::print(void) {
+	printf("[");
+  for (size_t i=0; i<capacity; ++i) {
+    if (!dist[i]) {
+      printf("_,");
+    } else {
+      HC::printT(slots[i]);
+      printf("(%d),", dist[i]);
+    }
+  }
+	printf("]\n");
+}
+
+#endif
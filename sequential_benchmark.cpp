@@ -0,0 +1,168 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * Benchmark for inserting keys that arrive in order, or in clustered runs,
+ * into BTree and AVL. We time TEST_SIZE inserts of:
+ *   ascending keys, which insert() sends straight to the rightmost leaf (for
+ *   AVL we compare insert() with insert_hint(end()))
+ *   random keys, for comparison, and to see what the tail check costs them
+ *   clustered keys, runs of RUN_LENGTH ascending keys starting at random
+ *   places, with insert() and with insert_hint() just before the key after
+ *   the run
+ * then TEST_SIZE gets of random keys we inserted, since how full the nodes
+ * are shows up there.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "panic.h"
+#include "timer.h"
+#include "btree.h"
+#include "avl.h"
+
+#ifndef TEST_SIZE
+#define TEST_SIZE 4000000
+#endif
+#ifndef BTREE_ARITY
+#define BTREE_ARITY 64
+#endif
+#ifndef RUN_LENGTH
+#define RUN_LENGTH 64
+#endif
+
+class Comp {
+  public:
+    static uint64_t val(uint64_t v) {
+      return v;
+    }
+    static int compare(uint64_t v1, uint64_t v2) {
+      return v1 < v2 ? -1 : v1 > v2;
+    }
+    static void printT(uint64_t v) {
+      printf("%lu", v);
+    }
+};
+
+class Node : public AVLNode_base<Node, uint64_t> {
+  public:
+    uint64_t value;
+    Node() {}
+    uint64_t val() const {
+      return value;
+    }
+    static int compare(uint64_t v1, uint64_t v2) {
+      return v1 < v2 ? -1 : v1 > v2;
+    }
+};
+
+typedef BTree<uint64_t, uint64_t, Comp, BTREE_ARITY> Tree;
+
+uint64_t *keys;
+Node *nodes;
+
+enum Workload { ASCENDING, RANDOM, CLUSTERED };
+const char *names[] = {"ascending", "random", "clustered"};
+
+void make_keys(Workload w) {
+  for (size_t i=0; i<TEST_SIZE; ++i) {
+    if (w == ASCENDING) {
+      keys[i] = i;
+    } else if (w == RANDOM) {
+      keys[i] = ((uint64_t) rand() << 31) ^ rand();
+    } else if (i % RUN_LENGTH == 0) {
+      // Room for the whole run before the next one could start
+      keys[i] = (((uint64_t) rand() << 31) ^ rand()) * RUN_LENGTH;
+    } else {
+      keys[i] = keys[i-1] + 1;
+    }
+  }
+}
+
+template<typename Get>
+void gets(const char *name, Get get) {
+  timeb t1, t2;
+  ftime(&t1);
+  for (size_t i=0; i<TEST_SIZE; ++i) {
+    if (!get(keys[(i * 7919) % TEST_SIZE])) {
+      PANIC("tree lost a key");
+    }
+  }
+  ftime(&t2);
+  printf("%s get time=%lf ops_per_sec=%.0lf\n", name, tdiff(t2, t1), TEST_SIZE / tdiff(t2, t1));
+}
+
+void btree(Workload w, bool hint) {
+  Tree *tree = new Tree();
+  timeb t1, t2;
+  ftime(&t1);
+  if (hint) {
+    Tree::Iterator h;
+    for (size_t i=0; i<TEST_SIZE; ++i) {
+      if (i % RUN_LENGTH == 0) {
+        tree->insert(keys[i]);
+        h = tree->upper_bound(keys[i]);
+      } else {
+        tree->insert_hint(h, keys[i]);
+      }
+    }
+  } else {
+    for (size_t i=0; i<TEST_SIZE; ++i) {
+      tree->insert(keys[i]);
+    }
+  }
+  ftime(&t2);
+  printf("BTree.h SIZE=%d %s%s insert time=%lf ops_per_sec=%.0lf\n", BTREE_ARITY, names[w], hint ? " insert_hint" : "", tdiff(t2, t1), TEST_SIZE / tdiff(t2, t1));
+  gets("BTree.h", [&](uint64_t k) { return tree->get(k) != nullptr; });
+  delete tree;
+}
+
+void avl(Workload w, bool hint) {
+  AVL<Node, uint64_t> tree;
+  for (size_t i=0; i<TEST_SIZE; ++i) {
+    nodes[i].value = keys[i];
+  }
+  timeb t1, t2;
+  ftime(&t1);
+  if (hint) {
+    AVL<Node, uint64_t>::Iterator h;
+    for (size_t i=0; i<TEST_SIZE; ++i) {
+      if (i % RUN_LENGTH == 0) {
+        tree.insert(&nodes[i]);
+        // For AVL only the node the hint is on matters, so this is still good
+        // after the inserts in front of it
+        h = tree.upper_bound(keys[i]);
+      } else {
+        tree.insert_hint(h, &nodes[i]);
+      }
+    }
+  } else {
+    for (size_t i=0; i<TEST_SIZE; ++i) {
+      tree.insert(&nodes[i]);
+    }
+  }
+  ftime(&t2);
+  printf("AVL.h %s%s insert time=%lf ops_per_sec=%.0lf\n", names[w], hint ? " insert_hint" : "", tdiff(t2, t1), TEST_SIZE / tdiff(t2, t1));
+  gets("AVL.h", [&](uint64_t k) { return tree.get(k) != nullptr; });
+}
+
+int main(int argc, char* argv[]) {
+  printf("test_size=%d run_length=%d\n", TEST_SIZE, RUN_LENGTH);
+  keys = new uint64_t[TEST_SIZE];
+  nodes = new Node[TEST_SIZE];
+  // Note, we did not initialize rand, this is purposeful
+  for (Workload w : {ASCENDING, RANDOM, CLUSTERED}) {
+    make_keys(w);
+    btree(w, false);
+    // For ascending keys every hint is end()
+    if (w != RANDOM) {
+      btree(w, true);
+    }
+    avl(w, false);
+    if (w != RANDOM) {
+      avl(w, true);
+    }
+  }
+  delete[] keys;
+  delete[] nodes;
+  return 0;
+}
@@ -17,10 +17,16 @@
  *
  * Threadsafety:
  *  Thread compatible
+ *
+ * Define BTREE_IMAGE before including this for Image, save() and load(), see
+ * btree_image.h.
  */
 
 
 #include "btree.h"
+#ifdef BTREE_IMAGE
+#include "btree_image.h"
+#endif
 
 #ifndef SET_H
 #define SET_H
@@ -40,12 +46,19 @@ class Set {
           return v1-v2;
         }
     };
-    BTree<T, T, SetComp, SET_ARITY> tree;
+    typedef BTree<T, T, SetComp, SET_ARITY> Tree;
+    Tree tree;
+    Set(Tree &&t):tree(std::move(t)) {}
   public:
+    #ifdef BTREE_IMAGE
+    // A read-only, mmap'able copy of a Set, see btree_image.h
+    typedef BTreeImage<T, T, SetComp> Image;
+    #endif
     Set():tree() {}
     Set(const Set<T> &s):tree() {
 			*this = s;			
 		}
+    Set(Set<T> &&s):tree(std::move(s.tree)) {}
     ~Set() {
 			auto a = tree.begin();
 			while (a != end() && remove(*a)) {
@@ -56,26 +69,29 @@ class Set {
       return !!tree.get(val);
     }
     bool insert(T val) {
-      return tree.insert(val);
+      return tree.insert(std::move(val));
     }
     bool remove(T val) {
-      T ret;
-      // TODO(mbrewer): consider a version of remove in btree that doesn't copy
-      // the value
-      return tree.remove(val, &ret);
+      return tree.remove(val, nullptr);
     }
     bool isempty(void) const {
       return tree.isempty();
     }
 
     Set& operator=(const Set &s) {
-			// dump it
-			auto a = tree.begin();
-			while (a != end() && remove(*a)) {
-				a = begin();
-			}
-      // and add in the new data
-			return (*this += s);
+      if (this != &s) {
+        // s is already in order, so build the copy rather than insert it
+        typename Tree::Builder b;
+        for (auto i = s.begin(); i != s.end(); ++i) {
+          b.append(*i);
+        }
+        tree = b.finish();
+      }
+      return *this;
+    }
+    Set& operator=(Set &&s) {
+      tree = std::move(s.tree);
+      return *this;
     }
 
     // For use like an array
@@ -88,9 +104,33 @@ class Set {
     typename BTree<T, T, SetComp, SET_ARITY>::Iterator end() const { 
       return tree.end();
     }
+    // First element >= val
+    typename BTree<T, T, SetComp, SET_ARITY>::Iterator lower_bound(T val) const {
+      return tree.lower_bound(val);
+    }
+    // First element > val
+    typename BTree<T, T, SetComp, SET_ARITY>::Iterator upper_bound(T val) const {
+      return tree.upper_bound(val);
+    }
+    // Elements in [lo, hi), e.g. for (auto v : s.range(lo, hi))
+    typename BTree<T, T, SetComp, SET_ARITY>::Range range(T lo, T hi) const {
+      return tree.range(lo, hi);
+    }
     operator bool() const {
       return !tree.isempty();
     }
+    #ifdef BTREE_IMAGE
+    // Write us out for Image::map(), T must be trivially copyable
+    bool save(const char *path) const {
+      return Image::save(path, tree.begin(), tree.end());
+    }
+    // Add everything in image, e.g. to get a mutable copy of a mapped Image
+    void load(const Image &image) {
+      for (auto it = image.begin(); it != image.end(); ++it) {
+        tree.insert(*it);
+      }
+    }
+    #endif
 
     // ** comparisons
     bool operator==(const Set &s) const {
@@ -109,7 +149,29 @@ class Set {
       return !(*this==s);
     }
 
+    // ** bulk set operations
+    // Each of these is one linear merge of a and b, and builds the result
+    // directly rather than inserting into it. With threads > 1 that many key
+    // ranges are merged at once, for big sets on a machine with cores to spare.
+    static Set set_union(const Set &a, const Set &b, size_t threads=1) {
+      return Set(Tree::set_union(a.tree, b.tree, threads));
+    }
+    static Set set_intersection(const Set &a, const Set &b, size_t threads=1) {
+      return Set(Tree::set_intersection(a.tree, b.tree, threads));
+    }
+    // Everything in a that isn't in b
+    static Set set_difference(const Set &a, const Set &b, size_t threads=1) {
+      return Set(Tree::set_difference(a.tree, b.tree, threads));
+    }
+    // Adds everything in this to dest, by rebuilding dest as a merge. This is
+    // linear in both sizes, if this is much smaller than dest use dest += this
+    void merge_into(Set &dest, size_t threads=1) const {
+      dest.tree = Tree::set_union(dest.tree, tree, threads);
+    }
+
 		// ** set operations
+    // The assigning operators other than &= insert or remove one element at a
+    // time, which is best when s is small. The others are merges.
     // sutraction
     Set& operator-=(const Set &s) {
       for (auto i = s.begin(); i != s.end(); ++i) {
@@ -126,11 +188,9 @@ class Set {
     }
     // intersection
     Set& operator&=(const Set &s) {
-      // TODO(mbrewer): This uses more memory and copies than it should
       // we can't modify "this" while iterating over it, so the obvious
-      // removal based algorithm doesn't work
-      Set<T> n((*this) & s);
-      *this = n;
+      // removal based algorithm doesn't work, build the result instead
+      tree = Tree::set_intersection(tree, s.tree);
       return *this;
     }
     // also union
@@ -149,28 +209,16 @@ class Set {
       return *this;
     }
 		Set operator+(const Set &s) const {
-			Set<T> n(*this);
-			n += s;
-			return n;
+			return set_union(*this, s);
 		}
 		Set operator-(const Set &s) const {
-			Set<T> n(*this);
-			n -= s;
-			return n;
+			return set_difference(*this, s);
 		}
 		Set operator&(const Set &s) const {
-			Set<T> n;
-      for (auto i = begin(); i != end(); ++i) {
-        if (s[*i]) {
-          n.insert(*i);
-        }
-      }
-      return n;
+			return set_intersection(*this, s);
 		}
 		Set operator|(const Set &s) const {
-			Set<T> n(*this);
-			n |= s;
-			return n;
+			return set_union(*this, s);
 		}
 		Set operator^(const Set &s) const {
 			Set<T> n(*this);
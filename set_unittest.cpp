@@ -1,4 +1,6 @@
 #include <stdio.h>
+#include <unistd.h>
+#define BTREE_IMAGE
 #include "set.h"
 
 int main(int argc, char *argv[]) {
@@ -48,6 +50,21 @@ int main(int argc, char *argv[]) {
     ++i;
   }
 
+  // Test range queries
+  if (*s.lower_bound(50) != 50 || *s.upper_bound(50) != 51) {
+    PANIC("lower_bound/upper_bound broken");
+  }
+  i = 20;
+  for (auto v : s.range(20, 30)) {
+    if (v != i) {
+      PANIC("Set range broken");
+    }
+    ++i;
+  }
+  if (i != 30) {
+    PANIC("Set range missed elements");
+  }
+
   // Test set operations
   Set<int> s1;
   for (int i=0; i<10; i++) {
@@ -86,6 +103,69 @@ int main(int argc, char *argv[]) {
     PANIC("co-intersection doesn't work");
   }
 
+  // Bulk set operations, against the same thing one element at a time.
+  // Big enough that threads get several key ranges each
+  Set<int> a;
+  Set<int> b;
+  for (int i=0; i<20000; i++) {
+    a.insert(i*3);
+    b.insert(i*5);
+  }
+  for (size_t threads : {1, 4}) {
+    Set<int> u = Set<int>::set_union(a, b, threads);
+    Set<int> in = Set<int>::set_intersection(a, b, threads);
+    Set<int> d = Set<int>::set_difference(a, b, threads);
+    for (int i=-1; i<100001; i++) {
+      bool ina = i >= 0 && i % 3 == 0 && i < 60000;
+      bool inb = i >= 0 && i % 5 == 0 && i < 100000;
+      if (u.contains(i) != (ina || inb)) {
+        PANIC("set_union doesn't work");
+      }
+      if (in.contains(i) != (ina && inb)) {
+        PANIC("set_intersection doesn't work");
+      }
+      if (d.contains(i) != (ina && !inb)) {
+        PANIC("set_difference doesn't work");
+      }
+    }
+    // The results are ordinary sets
+    if (!u.insert(1) || !u.remove(3) || !in.insert(7) || d.insert(3)) {
+      PANIC("set built by a merge doesn't take inserts and removes");
+    }
+  }
+  Set<int> dest(s3);
+  if (dest != s3) {
+    PANIC("Copy doesn't work");
+  }
+  s2.merge_into(dest);
+  if (dest != s2+s3) {
+    PANIC("merge_into doesn't work");
+  }
+  Set<int> s6(s1);
+  s6 &= s2;
+  if (s6 != s5) {
+    PANIC("Intersection assignment doesn't work");
+  }
+  if (Set<int>::set_union(Set<int>(), Set<int>()) || Set<int>::set_intersection(a, Set<int>())) {
+    PANIC("Merges of empty sets aren't empty");
+  }
+
+  // Save an image and map it back in
+  const char *path = "/tmp/set_unittest.img";
+  if (!s1.save(path)) {
+    PANIC("save failed");
+  }
+  Set<int>::Image image;
+  if (!image.map(path)) {
+    PANIC("map failed");
+  }
+  Set<int> loaded;
+  loaded.load(image);
+  if (loaded != s1 || !image.get(5) || image.get(100)) {
+    PANIC("image doesn't match the set");
+  }
+  unlink(path);
+
   printf("PASS\n");
 }
 
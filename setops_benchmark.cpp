@@ -0,0 +1,92 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * Benchmark for Set's bulk set operations against the naive loops, on two
+ * sets of TEST_SIZE random keys drawn from [0, 4*TEST_SIZE), so they overlap
+ * some. The naive versions insert into (or remove from) a set one element at
+ * a time, checking the other set with [] where they need to:
+ *   union: insert everything in a then everything in b
+ *   intersection: insert everything in a that b has
+ *   difference: insert everything in a, then remove everything in b
+ * The merges walk both sets once and build the result, we run them with 1
+ * thread and with THREADS threads. Threads only help with cores to spare.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "panic.h"
+#include "timer.h"
+#include "set.h"
+
+#ifndef TEST_SIZE
+#define TEST_SIZE 2000000
+#endif
+#ifndef THREADS
+#define THREADS 4
+#endif
+
+enum Op { UNION, INTERSECTION, DIFFERENCE };
+const char *names[] = {"union", "intersection", "difference"};
+
+Set<int> naive(Op op, const Set<int> &a, const Set<int> &b) {
+  Set<int> n;
+  for (int v : a) {
+    if (op != INTERSECTION || b[v]) {
+      n.insert(v);
+    }
+  }
+  for (int v : b) {
+    if (op == UNION) {
+      n.insert(v);
+    } else if (op == DIFFERENCE) {
+      n.remove(v);
+    }
+  }
+  return n;
+}
+
+Set<int> merge(Op op, const Set<int> &a, const Set<int> &b, size_t threads) {
+  if (op == UNION) {
+    return Set<int>::set_union(a, b, threads);
+  } else if (op == INTERSECTION) {
+    return Set<int>::set_intersection(a, b, threads);
+  }
+  return Set<int>::set_difference(a, b, threads);
+}
+
+size_t count(const Set<int> &s) {
+  size_t n = 0;
+  for (auto i = s.begin(); i != s.end(); ++i) {
+    n++;
+  }
+  return n;
+}
+
+int main(int argc, char* argv[]) {
+  printf("test_size=%d threads=%d\n", TEST_SIZE, THREADS);
+  Set<int> a;
+  Set<int> b;
+  // Note, we did not initialize rand, this is purposeful
+  for (int i=0; i<TEST_SIZE; ++i) {
+    a.insert(rand() % (4 * TEST_SIZE));
+    b.insert(rand() % (4 * TEST_SIZE));
+  }
+  timeb t1, t2;
+  for (Op op : {UNION, INTERSECTION, DIFFERENCE}) {
+    ftime(&t1);
+    Set<int> n = naive(op, a, b);
+    ftime(&t2);
+    printf("%s naive time=%lf\n", names[op], tdiff(t2, t1));
+    for (size_t threads : {(size_t) 1, (size_t) THREADS}) {
+      ftime(&t1);
+      Set<int> m = merge(op, a, b, threads);
+      ftime(&t2);
+      printf("%s merge threads=%ld time=%lf\n", names[op], threads, tdiff(t2, t1));
+      if (m != n) {
+        PANIC("merge and naive disagree");
+      }
+    }
+    printf("%s elements=%ld\n", names[op], count(n));
+  }
+  return 0;
+}
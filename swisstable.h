@@ -0,0 +1,426 @@
+/* Copyright:  Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * A flat open addressing hashtable, in the style of Google's "Swiss table".
+ * This uses internal allocation, like hashtable.h.
+ *
+ * When to use this:
+ *   If you want a hashtable of small, copyable things and care about speed.
+ *   There's no per-element (or per-bucket) allocation, and a lookup is usually
+ *   one 16 byte load of control bytes, and one load of the slot we want.
+ *   Pointers to elements are invalidated by any insert or remove (we move
+ *   things on resize), if you need stable pointers use ochashtable.h.
+ *
+ * Algorithm:
+ *   Next to the slot array we keep one control byte per slot. The high bit
+ *   set means the slot is EMPTY or DELETED, otherwise the low 7 bits are "h2",
+ *   7 bits of the element's hash. The rest of the hash ("h1") picks a group of
+ *   16 slots to start in.
+ *   A lookup compares all 16 control bytes of a group with h2 at once (SSE2),
+ *   and only looks at slots whose bytes match. If the group has an EMPTY slot
+ *   we stop, otherwise we move to the next group (triangular probing over
+ *   groups, so we visit every group).
+ *
+ *   Deletion: groups are aligned, and every probe looks at a whole group. So
+ *   if the group we delete from still has an EMPTY slot, no probe could have
+ *   passed through this group, and we can just mark the slot EMPTY. Only
+ *   when the group is completely full do we need a DELETED tombstone.
+ *
+ *   We resize up when EMPTY slots drop below 1/8th (tombstones count as used)
+ *   if that's mostly tombstones we rehash at the same size instead.
+ *   We resize down when less than 1/8th full.
+ *
+ * Worst case for all operations is linear, due to
+ * 1) linear rehash
+ * 2) possability of every item hash colliding
+ *
+ * HP is the hashing policy, see hash.h. We only use its mixer, the table
+ * does its own power of 2 reduction so probing stays cheap
+ *
+ * Threadsafety:
+ *   thread compatible
+ */
+
+#include <new>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <utility>
+#include "panic.h"
+#include "hash.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifndef SWISSTABLE_H
+#define SWISSTABLE_H
+
+template <typename Data_T, typename Val_T, typename HC, typename HP=DefaultHash>
+class SwissTable {
+  private:
+    static const size_t GROUP_SIZE = 16;
+    static const int8_t EMPTY = -128;   // 0x80
+    static const int8_t DELETED = -2;   // 0xFE
+    int8_t *ctrl;
+    Data_T *slots;
+    // number of slots, always a power of 2 and a multiple of GROUP_SIZE
+    size_t capacity;
+    size_t count;
+    size_t deleted;
+
+    // See hash.h
+    uint64_t seed;
+    size_t mix(size_t h) const {
+      return HP::mix(h, seed);
+    }
+    static int8_t h2(size_t h) {
+      return h & 0x7F;
+    }
+    size_t first_group(size_t h) const {
+      return (h >> 7) & (capacity/GROUP_SIZE - 1);
+    }
+    size_t next_group(size_t g, size_t step) const {
+      return (g + step) & (capacity/GROUP_SIZE - 1);
+    }
+
+    // bit i set if g[i] == b
+    static uint32_t match_byte(const int8_t *g, int8_t b) {
+      #ifdef __SSE2__
+      __m128i group = _mm_loadu_si128((const __m128i*) g);
+      return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(b)));
+      #else
+      uint32_t mask = 0;
+      for (size_t i=0; i<GROUP_SIZE; ++i) {
+        mask |= ((uint32_t) (g[i] == b)) << i;
+      }
+      return mask;
+      #endif
+    }
+    static uint32_t match_empty(const int8_t *g) {
+      return match_byte(g, EMPTY);
+    }
+    // EMPTY or DELETED, both have the high bit set
+    static uint32_t match_free(const int8_t *g) {
+      #ifdef __SSE2__
+      return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) g));
+      #else
+      uint32_t mask = 0;
+      for (size_t i=0; i<GROUP_SIZE; ++i) {
+        mask |= ((uint32_t) (g[i] < 0)) << i;
+      }
+      return mask;
+      #endif
+    }
+
+    // returns capacity if key isn't here
+    size_t find(Val_T key, size_t h) const;
+    // returns the first EMPTY or DELETED slot on h's probe sequence
+    size_t find_free(size_t h) const;
+    void alloc(size_t cap);
+    void check_sizeup(void);
+    void check_sizedown(void);
+  public:
+    class Iterator {
+      private:
+        const SwissTable<Data_T, Val_T, HC, HP> *t;
+        size_t i;
+        void skip() {
+          while (i < t->capacity && t->ctrl[i] < 0) {
+            i++;
+          }
+        }
+      public:
+        Iterator(const SwissTable<Data_T, Val_T, HC, HP> *_t, size_t _i) {
+          t = _t;
+          i = _i;
+          // Look for a valid element (if we don't have one)
+          skip();
+        }
+        Iterator(const Iterator& other) {
+          t = other.t;
+          i = other.i;
+        }
+        Iterator& operator=(const Iterator& other) {
+          t = other.t;
+          i = other.i;
+          return *this;
+        }
+        bool operator==(const Iterator& other) {
+          return i == other.i;
+        }
+        bool operator!=(const Iterator& other) {
+          return !((*this) == other);
+        }
+        Iterator operator++() {
+          // If we're at the end, we're done
+          if (i >= t->capacity) {
+            return *this;
+          }
+          i++;
+          skip();
+          return *this;
+        }
+        Iterator operator++(int) {
+          Iterator tmp(*this);
+          ++(*this);
+          return tmp;
+        }
+        Data_T& operator*() {
+					// Get what's inside the iterator
+          return t->slots[i];
+        }
+        Data_T* operator->() {
+					// Get a reference to what's inside the iterator (lol)
+          return &t->slots[i];
+        }
+    };
+    Iterator begin() {
+      return Iterator(this, 0);
+    }
+    Iterator end() {
+      return Iterator(this, capacity);
+    }
+
+    SwissTable();
+    SwissTable(size_t s);
+    ~SwissTable();
+    bool insert(const Data_T& data);
+    Data_T* get(Val_T key);
+    bool remove(Val_T key, Data_T* data);
+    bool isempty(void) const;
+    size_t size(void) const;
+    void resize(size_t s);
+    void check(void) const;
+    void print(void);
+};
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+SwissTable<Data_T, Val_T, HC, HP>::SwissTable() {
+  seed = HP::new_seed();
+  count = 0;
+  alloc(GROUP_SIZE);
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+SwissTable<Data_T, Val_T, HC, HP>::SwissTable(size_t s) {
+  seed = HP::new_seed();
+  count = 0;
+  size_t cap = GROUP_SIZE;
+  while (cap < s) {
+    cap *= 2;
+  }
+  alloc(cap);
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+SwissTable<Data_T, Val_T, HC, HP>::~SwissTable() {
+  for (size_t i=0; i<capacity; ++i) {
+    if (ctrl[i] >= 0) {
+      slots[i].~Data_T();
+    }
+  }
+  free(ctrl);
+  free(slots);
+}
+
+// Sets up an empty table, doesn't touch count or free the old one
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+void SwissTable<Data_T, Val_T, HC, HP>::alloc(size_t cap) {
+  capacity = cap;
+  deleted = 0;
+  ctrl = (int8_t*) malloc(cap);
+  slots = (Data_T*) malloc(cap * sizeof(Data_T));
+  if (!ctrl || !slots) {
+    PANIC("SwissTable allocation failed");
+  }
+  for (size_t i=0; i<cap; ++i) {
+    ctrl[i] = EMPTY;
+  }
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+size_t SwissTable<Data_T, Val_T, HC, HP>::find(Val_T key, size_t h) const {
+  size_t g = first_group(h);
+  int8_t tag = h2(h);
+  for (size_t step=1; ; ++step) {
+    const int8_t *group = &ctrl[g*GROUP_SIZE];
+    uint32_t mask = match_byte(group, tag);
+    while (mask) {
+      size_t i = g*GROUP_SIZE + __builtin_ctz(mask);
+      if (HC::val(slots[i]) == key) {
+        return i;
+      }
+      mask &= mask - 1;
+    }
+    if (match_empty(group)) {
+      return capacity;
+    }
+    g = next_group(g, step);
+  }
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+size_t SwissTable<Data_T, Val_T, HC, HP>::find_free(size_t h) const {
+  size_t g = first_group(h);
+  for (size_t step=1; ; ++step) {
+    uint32_t mask = match_free(&ctrl[g*GROUP_SIZE]);
+    if (mask) {
+      return g*GROUP_SIZE + __builtin_ctz(mask);
+    }
+    g = next_group(g, step);
+  }
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+bool SwissTable<Data_T, Val_T, HC, HP>::insert(const Data_T& data) {
+  Val_T v = HC::val(data);
+  size_t h = mix(HC::hash(v));
+  // reject duplicates
+  if (find(v, h) != capacity) {
+    return false;
+  }
+  check_sizeup();
+  size_t i = find_free(h);
+  if (ctrl[i] == DELETED) {
+    deleted--;
+  }
+  ctrl[i] = h2(h);
+  new (&slots[i]) Data_T(data);
+  count++;
+  return true;
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+Data_T* SwissTable<Data_T, Val_T, HC, HP>::get(Val_T key) {
+  size_t i = find(key, mix(HC::hash(key)));
+  if (i == capacity) {
+    return nullptr;
+  }
+  return &slots[i];
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+bool SwissTable<Data_T, Val_T, HC, HP>::remove(Val_T v, Data_T *data) {
+  size_t i = find(v, mix(HC::hash(v)));
+  if (i == capacity) {
+    return false;
+  }
+  *data = std::move(slots[i]);
+  slots[i].~Data_T();
+  // See the top of the file, we only need a tombstone if the group is full
+  if (match_empty(&ctrl[i - i%GROUP_SIZE])) {
+    ctrl[i] = EMPTY;
+  } else {
+    ctrl[i] = DELETED;
+    deleted++;
+  }
+  count--;
+  check_sizedown();
+  return true;
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+bool SwissTable<Data_T, Val_T, HC, HP>::isempty(void) const {
+  return count == 0;
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+size_t SwissTable<Data_T, Val_T, HC, HP>::size(void) const {
+  return count;
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+void SwissTable<Data_T, Val_T, HC, HP>::resize(size_t s) {
+  size_t cap = GROUP_SIZE;
+  while (cap < s) {
+    cap *= 2;
+  }
+  // We can't go below our max load factor
+  if (count*8 >= cap*7) {
+    PANIC("SwissTable resized too small for it's contents");
+  }
+  int8_t *old_ctrl = ctrl;
+  Data_T *old_slots = slots;
+  size_t old_capacity = capacity;
+  alloc(cap);
+  // Rehash, no need to check for duplicates
+  for (size_t i=0; i<old_capacity; ++i) {
+    if (old_ctrl[i] < 0) {
+      continue;
+    }
+    size_t h = mix(HC::hash(HC::val(old_slots[i])));
+    size_t j = find_free(h);
+    ctrl[j] = h2(h);
+    new (&slots[j]) Data_T(std::move(old_slots[i]));
+    old_slots[i].~Data_T();
+  }
+  free(old_ctrl);
+  free(old_slots);
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+void SwissTable<Data_T, Val_T, HC, HP>::check_sizeup(void) {
+  // Keep at least 1/8th of the slots EMPTY, so probes terminate quickly
+  if ((count + deleted + 1)*8 > capacity*7) {
+    if ((count + 1)*16 > capacity*7) {
+      resize(capacity*2);
+    } else {
+      // mostly tombstones, just clean them up
+      resize(capacity);
+    }
+  }
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+void SwissTable<Data_T, Val_T, HC, HP>::check_sizedown(void) {
+  // If it's under an eighth full resize down
+  if (capacity > GROUP_SIZE && count*8 < capacity) {
+    resize(capacity/2);
+  }
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+void SwissTable<Data_T, Val_T, HC, HP>::check(void) const {
+  size_t full = 0;
+  size_t tombstones = 0;
+  for (size_t i=0; i<capacity; ++i) {
+    if (ctrl[i] == DELETED) {
+      tombstones++;
+      continue;
+    }
+    if (ctrl[i] == EMPTY) {
+      continue;
+    }
+    if (ctrl[i] < 0) {
+      PANIC("SwissTable control byte is corrupt");
+    }
+    full++;
+    size_t h = mix(HC::hash(HC::val(slots[i])));
+    if (ctrl[i] != h2(h)) {
+      PANIC("SwissTable control byte doesn't match the hash");
+    }
+    if (find(HC::val(slots[i]), h) != i) {
+      PANIC("SwissTable element can't be found");
+    }
+  }
+  if (full != count || tombstones != deleted) {
+    PANIC("SwissTable counts are wrong");
+  }
+}
+
+template <typename Data_T, typename Val_T, typename HC, typename HP>
+void SwissTable<Data_T, Val_T, HC, HP>::print(void) {
+	printf("[");
+  for (size_t i=0; i<capacity; ++i) {
+    if (ctrl[i] == EMPTY) {
+      printf("_,");
+    } else if (ctrl[i] == DELETED) {
+      printf("x,");
+    } else {
+      HC::printT(slots[i]);
+      printf(",");
+    }
+  }
+	printf("]\n");
+}
+
+#endif
@@ -1,6 +1,41 @@
 #include <sys/timeb.h>
+#include <chrono>
+#include <stdint.h>
 
 double tdiff(timeb& t1, timeb& t2) {
   return ((double)(t1.time - t2.time)) + (((double)(t1.millitm - t2.millitm))/1000);
   //return (t1.millitm - t2.millitm);
 }
+
+uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Per operation latencies, for the MEASURE_LATENCY benchmarks
+// We keep the max, and a power of 2 histogram for percentiles
+class Latency {
+  private:
+    uint64_t hist[65] = {};
+    uint64_t n = 0;
+  public:
+    uint64_t max = 0;
+    void record(uint64_t ns) {
+      if (ns > max) {
+        max = ns;
+      }
+      hist[64 - __builtin_clzll(ns | 1)]++;
+      n++;
+    }
+    // Upper bound (a power of 2) on the p'th percentile, p in [0,1]
+    uint64_t percentile(double p) const {
+      uint64_t seen = 0;
+      for (size_t i=0; i<65; ++i) {
+        seen += hist[i];
+        if (seen >= p * n && i < 64) {
+          return ((uint64_t) 1) << i;
+        }
+      }
+      return max;
+    }
+};
@@ -0,0 +1,210 @@
+/* Copywrite Matthew Brewer
+ *
+ * This is a benchmark for our threadsafe dictionaries
+ * We decide WHAT we're testing using the macro system
+ * Our Makefile takes advantage of this.
+ *
+ * We prefill the dictionary with half of KEY_RANGE, then each of THREADS
+ * threads does TEST_ITERATIONS operations on random keys. READ_PERCENT of
+ * them are get()s, the rest are split evenly between insert() and remove(),
+ * so the size stays about the same.
+ */
+
+#include <mutex>
+#include <stdio.h>
+#include <stdint.h>
+#include <thread>
+#include "panic.h"
+#include "timer.h"
+
+#ifndef TEST_ITERATIONS
+#define TEST_ITERATIONS 1000000
+#endif
+#ifndef THREADS
+#define THREADS 4
+#endif
+#ifndef READ_PERCENT
+#define READ_PERCENT 90
+#endif
+#ifndef ARITY
+#define ARITY 64
+#endif
+// keys are in [0, KEY_RANGE)
+// The dict settles at about KEY_RANGE/2 elements. Don't make that a power of
+// 2, OCHashTable resizes back and forth every few operations right there.
+#define KEY_RANGE 1000000
+
+class Comp {
+  public:
+    static const uint64_t val(const uint64_t T) {
+      return T;
+    }
+    static const int compare(const uint64_t v1, const uint64_t v2) {
+      if (v1 > v2) return 1;
+      if (v1 < v2) return -1;
+      return 0;
+    }
+    static size_t hash(uint64_t v) {
+      return v;
+    }
+    static void printT(const uint64_t t) {
+      printf("%ld", t);
+    }
+    static void printV(const uint64_t v) {
+      printf("%ld", v);
+    }
+};
+
+#ifdef TEST_TS_HASHTABLE
+#include "ts_hashtable.h"
+#endif
+
+#ifdef TEST_TS_BTREE
+#include "ts_btree.h"
+#endif
+
+#ifdef TEST_TS_CUCKOOHASHTABLE
+#include "cuckoohashtable.h"
+#endif
+
+#ifdef TEST_TS_LOCKEDOCHASHTABLE
+#include "ochashtable.h"
+class Node: public OCHashTableNode_base<Node> {
+  public:
+    uint64_t value;
+  public:
+    Node(uint64_t v) {
+      value = v;
+    }
+    const uint64_t val(void) const {
+      return value;
+    }
+    static size_t hash(uint64_t v) {
+      return v;
+    }
+    static int compare(const uint64_t v1, const uint64_t v2) {
+      return Comp::compare(v1, v2);
+    }
+};
+
+// The baseline, an OCHashTable with one big lock around it, and the same
+// API as the threadsafe dicts
+class LockedOCHashTable {
+  private:
+    std::mutex m;
+    OCHashTable<Node, uint64_t> hash;
+  public:
+    bool get(uint64_t key, uint64_t *result) {
+      std::lock_guard<std::mutex> l(m);
+      Node *n = hash.get(key);
+      if (n) {
+        *result = n->val();
+      }
+      return n != nullptr;
+    }
+    bool insert(uint64_t data) {
+      Node *n = new Node(data);
+      std::lock_guard<std::mutex> l(m);
+      if (!hash.insert(n)) {
+        delete n;
+        return false;
+      }
+      return true;
+    }
+    bool remove(uint64_t key, uint64_t *result) {
+      Node *n;
+      {
+        std::lock_guard<std::mutex> l(m);
+        n = hash.get(key);
+        if (!n) {
+          return false;
+        }
+        hash.remove(n);
+      }
+      *result = n->val();
+      delete n;
+      return true;
+    }
+    ~LockedOCHashTable() {
+      for (uint64_t k=0; k<KEY_RANGE; ++k) {
+        uint64_t junk;
+        remove(k, &junk);
+      }
+    }
+};
+#endif
+
+#ifdef TEST_TS_HASHTABLE
+TSHashTable<uint64_t, uint64_t, Comp> dict;
+#endif
+#ifdef TEST_TS_BTREE
+TSBTree<uint64_t, uint64_t, Comp, ARITY> dict;
+#endif
+#ifdef TEST_TS_LOCKEDOCHASHTABLE
+LockedOCHashTable dict;
+#endif
+#ifdef TEST_TS_CUCKOOHASHTABLE
+CuckooHashTable<uint64_t, uint64_t, Comp, DefaultHash, true> dict;
+#endif
+
+uint64_t found[THREADS];
+
+void worker(int id) {
+  // xorshift64, cheaper than rand() and threadsafe
+  uint64_t state = (id + 1) * 0x9E3779B97F4A7C15lu;
+  uint64_t f = 0;
+  uint64_t junk;
+  for (size_t i=0; i<TEST_ITERATIONS; ++i) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    uint64_t key = (state >> 8) % KEY_RANGE;
+    uint64_t op = state % 200;
+    if (op < READ_PERCENT * 2) {
+      f += dict.get(key, &junk);
+    } else if (op % 2) {
+      dict.insert(key);
+    } else {
+      dict.remove(key, &junk);
+    }
+  }
+  found[id] = f;
+}
+
+int main(int argc, char* argv[]) {
+  #ifdef TEST_TS_HASHTABLE
+  printf("TSHashTable.h ");
+  #endif
+  #ifdef TEST_TS_BTREE
+  printf("TSBTree.h ");
+  #endif
+  #ifdef TEST_TS_LOCKEDOCHASHTABLE
+  printf("Locked OCHashTable.h ");
+  #endif
+  #ifdef TEST_TS_CUCKOOHASHTABLE
+  printf("Concurrent CuckooHashTable.h ");
+  #endif
+  printf("threads=%d read_percent=%d test_iterations=%d ", THREADS, READ_PERCENT, TEST_ITERATIONS);
+
+  for (uint64_t k=0; k<KEY_RANGE; k+=2) {
+    dict.insert(k);
+  }
+
+  timeb t1, t2;
+  ftime(&t1);
+  std::thread threads[THREADS];
+  for (int i=0; i<THREADS; ++i) {
+    threads[i] = std::thread(worker, i);
+  }
+  for (int i=0; i<THREADS; ++i) {
+    threads[i].join();
+  }
+  ftime(&t2);
+  double t = tdiff(t2,t1);
+  uint64_t f = 0;
+  for (int i=0; i<THREADS; ++i) {
+    f += found[i];
+  }
+  printf("time=%lf ops_per_sec=%.0lf found=%lu\n", t, THREADS * (double) TEST_ITERATIONS / t, f);
+  return 0;
+}
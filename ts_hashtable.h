@@ -0,0 +1,440 @@
+/*
+ * Copyright: Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * A concurrent hashtable, with lock free reads.
+ *
+ * When to use this:
+ * You have a dictionary shared between threads, you don't care about
+ * ordering, and most operations are lookups (e.g. a cache). If you need
+ * ordering use ts_btree.h.
+ *
+ * How to use this:
+ * Same API as ts_btree.h: get() and remove() copy the element out to you,
+ * since another thread could remove it the moment we return.
+ * T must be trivially copyable (ints, pointers, small structs of them).
+ * Readers copy T out of the table while a writer might be changing it, and
+ * throw the copy away if so. So HC::val() may be called on a torn copy of a
+ * T, it must not follow pointers inside T.
+ * HP is the hashing policy, see hash.h, the shard comes from the high bits of
+ * the mixed hash, so don't use ModHash.
+ *
+ * Algorithm:
+ * The table is split into shards (lock striping), each shard is a small
+ * linear probing table with tombstones, picked by the high bits of the hash.
+ *  Writers: lock the shard's mutex. Writers to different shards never touch
+ *    the same lock or cacheline.
+ *  Readers: take no locks, each shard has a seqlock. A writer makes the
+ *    sequence number odd, changes things, and makes it even again. A reader
+ *    reads the sequence number, searches, and retries if the sequence number
+ *    changed (or was odd) in the meantime. Elements never move except in a
+ *    rehash, so a reader only retries if a write hit the same shard.
+ *  Resize: each shard rehashes by itself, under its own lock, when it gets 3/4
+ *    full (counting tombstones). The other shards don't notice, and readers of
+ *    this shard keep reading the old table while we build the new one. There's
+ *    no global stop-the-world rehash, and the cost of any one is O(n/shards).
+ *    If the shard is mostly tombstones it doesn't grow, we rehash in place
+ *    inside one write, so readers of that shard wait for it like any write.
+ *  Memory: a reader may still be looking at a shard's old table after we swap
+ *    in a new one, so we keep old tables until the whole TSHashTable is
+ *    destroyed. Only growing retires a table, and shards never shrink, so the
+ *    old tables add up to less than the current one, and this at most doubles
+ *    our memory use.
+ *
+ * Technically reading T while another thread writes it is a data race in
+ * C++11, it's the standard seqlock tradeoff. The sequence number and control
+ * bytes are atomics, so the race is only ever on bytes we then throw away.
+ *
+ * Threadsafety:
+ *   this is threadsafe, get() is lock free, insert() and remove() lock one
+ *   shard. size() and isempty() are approximate if other threads are active.
+ *   check() and print() lock each shard in turn, they're only consistent if
+ *   nobody else is using the table.
+ */
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "panic.h"
+#include "hash.h"
+
+#ifndef TSHASHTABLE_H
+#define TSHASHTABLE_H
+
+// Slots per shard to start with, a power of 2
+#define TSHASHTABLE_MINSIZE 16
+// Default number of shards, rounded up to a power of 2
+#define TSHASHTABLE_SHARDS 64
+
+template <typename T, typename Val_T, typename HC, typename HP=DefaultHash>
+class TSHashTable {
+  static_assert(std::is_trivially_copyable<T>::value, "TSHashTable needs a trivially copyable T");
+  private:
+    static const int8_t EMPTY = 0;
+    static const int8_t FULL = 1;
+    static const int8_t DELETED = 2;
+    struct Table {
+      // a power of 2
+      size_t capacity;
+      std::atomic<int8_t> *ctrl;
+      T *slots;
+    };
+    class Shard {
+      public:
+        // held by writers
+        std::mutex m;
+        // odd while a writer is changing the table
+        std::atomic<uint64_t> seq;
+        std::atomic<Table*> table;
+        // Only written with m held, read without it as a hint
+        std::atomic<size_t> count;
+        // FULL + DELETED slots, only touched with m held
+        size_t used;
+        // tables we've rehashed out of, see "Memory" above
+        std::vector<Table*> retired;
+        // keep neighboring shards out of each other's cache lines
+        char padding[64];
+        Shard(): seq(0), table(nullptr), count(0), used(0) {}
+    };
+    // See hash.h
+    uint64_t seed;
+    Shard *shards;
+    size_t nshards;
+    int shard_bits;
+
+    Shard& shard_for(uint64_t m) {
+      return shards[shard_bits ? m >> (64 - shard_bits) : 0];
+    }
+    static Table* alloc_table(size_t cap);
+    static void free_table(Table *t);
+    // Must hold the shard's lock, returns t->capacity if key isn't there
+    size_t find_locked(Table *t, Val_T key, uint64_t m);
+    void rehash_locked(Shard &s, size_t cap);
+    static void write_begin(Shard &s) {
+      s.seq.store(s.seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+    }
+    static void write_end(Shard &s) {
+      s.seq.store(s.seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+  public:
+    TSHashTable(size_t shards=TSHASHTABLE_SHARDS);
+    ~TSHashTable();
+    bool get(Val_T key, T* result);
+    bool insert(T data);
+    bool remove(Val_T key, T* result);
+    size_t size(void) const;
+    bool isempty(void) const;
+    size_t shard_count(void) const;
+    // Bytes in tables, including old ones kept for readers, locks each shard
+    size_t bytes(void);
+    void check(void);
+    void print(void);
+};
+
+template <typename T, typename Val_T, typename HC, typename HP>
+TSHashTable<T, Val_T, HC, HP>::TSHashTable(size_t s) {
+  seed = HP::new_seed();
+  nshards = 1;
+  shard_bits = 0;
+  while (nshards < s) {
+    nshards *= 2;
+    shard_bits++;
+  }
+  shards = new Shard[nshards];
+  for (size_t i=0; i<nshards; ++i) {
+    shards[i].table.store(alloc_table(TSHASHTABLE_MINSIZE), std::memory_order_relaxed);
+  }
+}
+
+template <typename T, typename Val_T, typename HC, typename HP>
+TSHashTable<T, Val_T, HC, HP>::~TSHashTable() {
+  for (size_t i=0; i<nshards; ++i) {
+    free_table(shards[i].table.load(std::memory_order_relaxed));
+    for (size_t j=0; j<shards[i].retired.size(); ++j) {
+      free_table(shards[i].retired[j]);
+    }
+  }
+  delete[] shards;
+}
+
+template <typename T, typename Val_T, typename HC, typename HP>
+typename TSHashTable<T, Val_T, HC, HP>::Table* TSHashTable<T, Val_T, HC, HP>::alloc_table(size_t cap) {
+  Table *t = new Table;
+  t->capacity = cap;
+  t->ctrl = new std::atomic<int8_t>[cap];
+  t->slots = (T*) malloc(cap * sizeof(T));
+  if (!t->slots) {
+    PANIC("TSHashTable allocation failed");
+  }
+  for (size_t i=0; i<cap; ++i) {
+    t->ctrl[i].store(EMPTY, std::memory_order_relaxed);
+  }
+  return t;
+}
+
+template <typename T, typename Val_T, typename HC, typename HP>
+void TSHashTable<T, Val_T, HC, HP>::free_table(Table *t) {
+  delete[] t->ctrl;
+  free(t->slots);
+  delete t;
+}
+
+template <typename T, typename Val_T, typename HC, typename HP>
+size_t TSHashTable<T, Val_T, HC, HP>::find_locked(Table *t, Val_T key, uint64_t m) {
+  size_t mask = t->capacity - 1;
+  size_t i = m & mask;
+  for (size_t probes=0; probes < t->capacity; ++probes, i = (i+1) & mask) {
+    int8_t c = t->ctrl[i].load(std::memory_order_relaxed);
+    if (c == EMPTY) {
+      break;
+    }
+    if (c == FULL && HC::val(t->slots[i]) == key) {
+      return i;
+    }
+  }
+  return t->capacity;
+}
+
+template <typename T, typename Val_T, typename HC, typename HP>
+bool TSHashTable<T, Val_T, HC, HP>::get(Val_T key, T* result) {
+  uint64_t m = HP::mix(HC::hash(key), seed);
+  Shard &s = shard_for(m);
+  while (true) {
+    uint64_t s1 = s.seq.load(std::memory_order_acquire);
+    if (s1 & 1) {
+      // A writer is in the middle of something
+      std::this_thread::yield();
+      continue;
+    }
+    Table *t = s.table.load(std::memory_order_acquire);
+    size_t mask = t->capacity - 1;
+    size_t i = m & mask;
+    bool found = false;
+    T tmp;
+    for (size_t probes=0; probes < t->capacity; ++probes, i = (i+1) & mask) {
+      int8_t c = t->ctrl[i].load(std::memory_order_relaxed);
+      if (c == EMPTY) {
+        break;
+      }
+      if (c == FULL) {
+        tmp = t->slots[i];
+        if (HC::val(tmp) == key) {
+          found = true;
+          break;
+        }
+      }
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (s.seq.load(std::memory_order_relaxed) == s1) {
+      if (found) {
+        *result = tmp;
+      }
+      return found;
+    }
+  }
+}
+
+template <typename T, typename Val_T, typename HC, typename HP>
+bool TSHashTable<T, Val_T, HC, HP>::insert(T data) {
+  Val_T v = HC::val(data);
+  uint64_t m = HP::mix(HC::hash(v), seed);
+  Shard &s = shard_for(m);
+  std::lock_guard<std::mutex> l(s.m);
+  Table *t = s.table.load(std::memory_order_relaxed);
+  if (find_locked(t, v, m) != t->capacity) {
+    return false;
+  }
+  // Keep it under 3/4 full, counting tombstones
+  if ((s.used + 1) * 4 > t->capacity * 3) {
+    size_t cap = t->capacity;
+    // If it's mostly tombstones just clean them out
+    if ((s.count.load(std::memory_order_relaxed) + 1) * 2 > cap) {
+      cap *= 2;
+    }
+    rehash_locked(s, cap);
+    t = s.table.load(std::memory_order_relaxed);
+  }
+  size_t mask = t->capacity - 1;
+  size_t i = m & mask;
+  while (t->ctrl[i].load(std::memory_order_relaxed) == FULL) {
+    i = (i+1) & mask;
+  }
+  if (t->ctrl[i].load(std::memory_order_relaxed) == EMPTY) {
+    s.used++;
+  }
+  write_begin(s);
+  t->slots[i] = data;
+  t->ctrl[i].store(FULL, std::memory_order_relaxed);
+  write_end(s);
+  s.count.store(s.count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  return true;
+}
+
+template <typename T, typename Val_T, typename HC, typename HP>
+bool TSHashTable<T, Val_T, HC, HP>::remove(Val_T key, T* result) {
+  uint64_t m = HP::mix(HC::hash(key), seed);
+  Shard &s = shard_for(m);
+  std::lock_guard<std::mutex> l(s.m);
+  Table *t = s.table.load(std::memory_order_relaxed);
+  size_t i = find_locked(t, key, m);
+  if (i == t->capacity) {
+    return false;
+  }
+  *result = t->slots[i];
+  write_begin(s);
+  t->ctrl[i].store(DELETED, std::memory_order_relaxed);
+  write_end(s);
+  s.count.store(s.count.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+  return true;
+}
+
+// Readers keep using the old table until we swap the pointer, we don't
+// change it, so they don't need to retry for the copy.
+// At the same capacity we'd just be retiring a table the size of the new one
+// every few writes, so we copy out and rehash in place as one write instead.
+template <typename T, typename Val_T, typename HC, typename HP>
+void TSHashTable<T, Val_T, HC, HP>::rehash_locked(Shard &s, size_t cap) {
+  Table *old = s.table.load(std::memory_order_relaxed);
+  if (cap == old->capacity) {
+    std::vector<T> live;
+    live.reserve(s.count.load(std::memory_order_relaxed));
+    for (size_t i=0; i<cap; ++i) {
+      if (old->ctrl[i].load(std::memory_order_relaxed) == FULL) {
+        live.push_back(old->slots[i]);
+      }
+    }
+    size_t mask = cap - 1;
+    write_begin(s);
+    for (size_t i=0; i<cap; ++i) {
+      old->ctrl[i].store(EMPTY, std::memory_order_relaxed);
+    }
+    for (size_t i=0; i<live.size(); ++i) {
+      size_t j = HP::mix(HC::hash(HC::val(live[i])), seed) & mask;
+      while (old->ctrl[j].load(std::memory_order_relaxed) != EMPTY) {
+        j = (j+1) & mask;
+      }
+      old->slots[j] = live[i];
+      old->ctrl[j].store(FULL, std::memory_order_relaxed);
+    }
+    write_end(s);
+    s.used = s.count.load(std::memory_order_relaxed);
+    return;
+  }
+  Table *t = alloc_table(cap);
+  size_t mask = cap - 1;
+  for (size_t i=0; i<old->capacity; ++i) {
+    if (old->ctrl[i].load(std::memory_order_relaxed) != FULL) {
+      continue;
+    }
+    size_t j = HP::mix(HC::hash(HC::val(old->slots[i])), seed) & mask;
+    while (t->ctrl[j].load(std::memory_order_relaxed) != EMPTY) {
+      j = (j+1) & mask;
+    }
+    t->slots[j] = old->slots[i];
+    t->ctrl[j].store(FULL, std::memory_order_relaxed);
+  }
+  write_begin(s);
+  s.table.store(t, std::memory_order_release);
+  write_end(s);
+  s.used = s.count.load(std::memory_order_relaxed);
+  s.retired.push_back(old);
+}
+
+template <typename T, typename Val_T, typename HC, typename HP>
+size_t TSHashTable<T, Val_T, HC, HP>::size(void) const {
+  size_t c = 0;
+  for (size_t i=0; i<nshards; ++i) {
+    c += shards[i].count.load(std::memory_order_relaxed);
+  }
+  return c;
+}
+
+template <typename T, typename Val_T, typename HC, typename HP>
+bool TSHashTable<T, Val_T, HC, HP>::isempty(void) const {
+  return size() == 0;
+}
+
+template <typename T, typename Val_T, typename HC, typename HP>
+size_t TSHashTable<T, Val_T, HC, HP>::shard_count(void) const {
+  return nshards;
+}
+
+template <typename T, typename Val_T, typename HC, typename HP>
+size_t TSHashTable<T, Val_T, HC, HP>::bytes(void) {
+  size_t b = 0;
+  for (size_t i=0; i<nshards; ++i) {
+    Shard &s = shards[i];
+    std::lock_guard<std::mutex> l(s.m);
+    b += s.table.load(std::memory_order_relaxed)->capacity * (sizeof(T) + 1);
+    for (size_t j=0; j<s.retired.size(); ++j) {
+      b += s.retired[j]->capacity * (sizeof(T) + 1);
+    }
+  }
+  return b;
+}
+
+template <typename T, typename Val_T, typename HC, typename HP>
+void TSHashTable<T, Val_T, HC, HP>::check(void) {
+  for (size_t i=0; i<nshards; ++i) {
+    Shard &s = shards[i];
+    std::lock_guard<std::mutex> l(s.m);
+    if (s.seq.load(std::memory_order_relaxed) & 1) {
+      PANIC("TSHashTable shard left mid-write");
+    }
+    Table *t = s.table.load(std::memory_order_relaxed);
+    size_t full = 0;
+    size_t used = 0;
+    for (size_t j=0; j<t->capacity; ++j) {
+      int8_t c = t->ctrl[j].load(std::memory_order_relaxed);
+      if (c == EMPTY) {
+        continue;
+      }
+      used++;
+      if (c != FULL) {
+        continue;
+      }
+      full++;
+      // It's in the right shard, and we can find it from where it hashes to
+      Val_T v = HC::val(t->slots[j]);
+      uint64_t m = HP::mix(HC::hash(v), seed);
+      if (&shard_for(m) != &s) {
+        PANIC("TSHashTable element in the wrong shard");
+      }
+      if (find_locked(t, v, m) != j) {
+        PANIC("TSHashTable element unreachable");
+      }
+    }
+    if (full != s.count.load(std::memory_order_relaxed) || used != s.used) {
+      PANIC("TSHashTable shard count is wrong");
+    }
+    if (used * 4 > t->capacity * 3) {
+      PANIC("TSHashTable shard over full");
+    }
+  }
+}
+
+template <typename T, typename Val_T, typename HC, typename HP>
+void TSHashTable<T, Val_T, HC, HP>::print(void) {
+  printf("[");
+  for (size_t i=0; i<nshards; ++i) {
+    Shard &s = shards[i];
+    std::lock_guard<std::mutex> l(s.m);
+    Table *t = s.table.load(std::memory_order_relaxed);
+    printf("[");
+    for (size_t j=0; j<t->capacity; ++j) {
+      if (t->ctrl[j].load(std::memory_order_relaxed) == FULL) {
+        HC::printT(t->slots[j]);
+        printf(",");
+      }
+    }
+    printf("]");
+  }
+  printf("]\n");
+}
+
+#endif
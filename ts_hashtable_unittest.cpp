@@ -0,0 +1,198 @@
+#include <atomic>
+#include <thread>
+#include <stdio.h>
+#include <stdint.h>
+#include "ts_hashtable.h"
+
+#define TEST_SIZE 2000
+#define THREADS 4
+// keys readers expect to always find
+#define STABLE 500
+
+// Two halves that have to match, so we notice a torn read
+struct Pair {
+  uint64_t key;
+  uint64_t check;
+};
+
+uint64_t check_of(uint64_t key) {
+  return ~key * 0x9E3779B97F4A7C15lu;
+}
+
+class PairComp {
+  public:
+    static const uint64_t val(const Pair p) {
+      return p.key;
+    }
+    static const int compare(const uint64_t v1, const uint64_t v2) {
+      if (v1 > v2) return 1;
+      if (v1 < v2) return -1;
+      return 0;
+    }
+    static size_t hash(uint64_t v) {
+      return v;
+    }
+    static void printT(const Pair p) {
+      printf("%lu", p.key);
+    }
+    static void printV(const uint64_t v) {
+      printf("%lu", v);
+    }
+};
+
+typedef TSHashTable<Pair, uint64_t, PairComp> HT;
+
+HT *ht;
+std::atomic<bool> done;
+
+Pair make(uint64_t key) {
+  Pair p;
+  p.key = key;
+  p.check = check_of(key);
+  return p;
+}
+
+// each writer owns keys == id mod THREADS above STABLE, and churns them
+void writer(int id) {
+  Pair p;
+  for (int round=0; round<10; ++round) {
+    for (uint64_t k=STABLE+id; k<STABLE+TEST_SIZE; k+=THREADS) {
+      if (!ht->insert(make(k))) {
+        PANIC("insert of a key we own failed");
+      }
+    }
+    for (uint64_t k=STABLE+id; k<STABLE+TEST_SIZE; k+=THREADS) {
+      if (!ht->get(k, &p) || p.key != k || p.check != check_of(k)) {
+        PANIC("writer lost a key it owns");
+      }
+    }
+    for (uint64_t k=STABLE+id; k<STABLE+TEST_SIZE; k+=THREADS) {
+      if (!ht->remove(k, &p) || p.check != check_of(k)) {
+        PANIC("remove of a key we own failed");
+      }
+    }
+  }
+}
+
+// the stable keys never change, so must always be there, and never torn
+void reader() {
+  Pair p;
+  uint64_t k = 0;
+  while (!done.load()) {
+    if (!ht->get(k, &p)) {
+      PANIC("reader missed a stable key");
+    }
+    if (p.key != k || p.check != check_of(k)) {
+      PANIC("reader saw a torn element");
+    }
+    k = (k + 1) % STABLE;
+    // whatever the writers are doing, a get() must be self consistent
+    uint64_t w = STABLE + (k * 7919) % TEST_SIZE;
+    if (ht->get(w, &p) && (p.key != w || p.check != check_of(w))) {
+      PANIC("reader saw a torn element");
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  printf("Begin TSHashTable.h unittest\n");
+  Pair p;
+  uint64_t k;
+
+  // One thread, one shard, lots of rehashing and tombstones
+  HT single(1);
+  if (single.shard_count() != 1) {
+    PANIC("wrong number of shards");
+  }
+  for (int round=0; round<3; ++round) {
+    for (k=0; k<TEST_SIZE; ++k) {
+      if (!single.insert(make(k))) {
+        PANIC("insert failed");
+      }
+      if (single.insert(make(k))) {
+        PANIC("duplicate insert succeeded");
+      }
+    }
+    single.check();
+    if (single.size() != TEST_SIZE) {
+      PANIC("size is wrong");
+    }
+    // remove the evens
+    for (k=0; k<TEST_SIZE; k+=2) {
+      if (!single.remove(k, &p) || p.key != k) {
+        PANIC("remove failed");
+      }
+      if (single.remove(k, &p)) {
+        PANIC("removed something twice");
+      }
+    }
+    single.check();
+    for (k=0; k<TEST_SIZE; ++k) {
+      bool found = single.get(k, &p);
+      if (found != (k % 2 == 1)) {
+        PANIC("get is wrong after removes");
+      }
+      if (found && p.check != check_of(k)) {
+        PANIC("get returned the wrong element");
+      }
+    }
+    for (k=1; k<TEST_SIZE; k+=2) {
+      single.remove(k, &p);
+    }
+    if (!single.isempty()) {
+      PANIC("table didn't drain");
+    }
+  }
+
+  // Inserts and removes with no net growth only clear tombstones, which
+  // mustn't pile up old tables
+  HT churn(1);
+  for (k=0; k<200000; ++k) {
+    churn.insert(make(k));
+    if (k >= 8 && !churn.remove(k - 8, &p)) {
+      PANIC("remove failed");
+    }
+  }
+  churn.check();
+  if (churn.size() != 8) {
+    PANIC("size is wrong after churn");
+  }
+  if (churn.bytes() > 4 * 64 * (sizeof(Pair) + 1)) {
+    printf("%ld bytes\n", churn.bytes());
+    PANIC("memory grew without the table growing");
+  }
+
+  // Shard count rounds up to a power of 2
+  HT odd(5);
+  if (odd.shard_count() != 8) {
+    PANIC("shard count not rounded up");
+  }
+
+  // Many threads, readers and writers at once
+  ht = new HT(THREADS);
+  for (k=0; k<STABLE; ++k) {
+    ht->insert(make(k));
+  }
+  done = false;
+  std::thread writers[THREADS];
+  std::thread readers[THREADS];
+  for (int i=0; i<THREADS; ++i) {
+    writers[i] = std::thread(writer, i);
+    readers[i] = std::thread(reader);
+  }
+  for (int i=0; i<THREADS; ++i) {
+    writers[i].join();
+  }
+  done = true;
+  for (int i=0; i<THREADS; ++i) {
+    readers[i].join();
+  }
+  ht->check();
+  if (ht->size() != STABLE) {
+    PANIC("wrong size after threads finished");
+  }
+  delete ht;
+
+  printf("PASS\n");
+  return 0;
+}
@@ -0,0 +1,175 @@
+/* Copywrite Matthew Brewer
+ *
+ * This is a benchmark for our threadsafe priority queues
+ * We decide WHAT we're testing using the macro system
+ * Our Makefile takes advantage of this.
+ *
+ * We prefill the queue with TEST_SIZE elements, then each of THREADS threads
+ * does TEST_ITERATIONS pop/push pairs, pushing back a fresh random key.
+ *
+ * With MEASURE_RANK_ERROR defined we also measure quality: for every pop we
+ * count how many elements in the queue were smaller than the one we got.
+ * This is done with a Fenwick tree behind a global lock, so it serializes
+ * everything, don't look at the time from those runs.
+ * We count an element as "in the queue" slightly before it's pushed and
+ * slightly after it's popped, so the measured rank error is a bit pessimistic.
+ */
+
+#include <mutex>
+#include <stdio.h>
+#include <stdint.h>
+#include <thread>
+#include "panic.h"
+#include "timer.h"
+#include "heap.h"
+#include "delayed_copy_array.h"
+
+#ifndef TEST_ITERATIONS
+#define TEST_ITERATIONS 1000000
+#endif
+#ifndef TEST_SIZE
+#define TEST_SIZE 100
+#endif
+#ifndef THREADS
+#define THREADS 4
+#endif
+// keys are in [0, KEY_RANGE)
+#define KEY_RANGE (1<<20)
+
+#ifdef TEST_TS_MULTIQUEUE
+#include "ts_multiqueue.h"
+#endif
+
+class HeapCompare {
+  public:
+    static int compare(int *v1, int *v2) {
+      return *v1 - *v2;
+    }
+};
+
+#ifdef TEST_TS_LOCKEDHEAP
+// The baseline, a Heap with one big lock around it
+class LockedHeap {
+  private:
+    std::mutex m;
+    Heap<DCUArray<int>, int, HeapCompare> heap;
+  public:
+    void push(int data) {
+      std::lock_guard<std::mutex> l(m);
+      heap.push(data);
+    }
+    bool pop(int *val) {
+      std::lock_guard<std::mutex> l(m);
+      return heap.pop(val);
+    }
+};
+#endif
+
+#ifdef MEASURE_RANK_ERROR
+std::mutex rank_lock;
+int fenwick[KEY_RANGE+1];
+uint64_t rank_total = 0;
+uint64_t rank_max = 0;
+uint64_t rank_count = 0;
+
+void fenwick_add(int key, int delta) {
+  for (int i=key+1; i<=KEY_RANGE; i+=i&(-i)) {
+    fenwick[i] += delta;
+  }
+}
+
+// number of keys strictly smaller than key
+uint64_t fenwick_smaller(int key) {
+  uint64_t sum = 0;
+  for (int i=key; i>0; i-=i&(-i)) {
+    sum += fenwick[i];
+  }
+  return sum;
+}
+
+void note_push(int key) {
+  std::lock_guard<std::mutex> l(rank_lock);
+  fenwick_add(key, 1);
+}
+
+void note_pop(int key) {
+  std::lock_guard<std::mutex> l(rank_lock);
+  uint64_t rank = fenwick_smaller(key);
+  fenwick_add(key, -1);
+  rank_total += rank;
+  rank_count++;
+  if (rank > rank_max) {
+    rank_max = rank;
+  }
+}
+#else
+#define note_push(key)
+#define note_pop(key)
+#endif
+
+#ifdef TEST_TS_MULTIQUEUE
+TSMultiQueue<DCUArray<int>, int, HeapCompare> queue(THREADS);
+#endif
+#ifdef TEST_TS_LOCKEDHEAP
+LockedHeap queue;
+#endif
+
+// rand() takes a lock in glibc, so each thread gets it's own generator
+int next_key(uint64_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state % KEY_RANGE;
+}
+
+void worker(int id) {
+  uint64_t state = 0x9E3779B97F4A7C15lu * (id+1);
+  for (size_t i=0; i<TEST_ITERATIONS; ++i) {
+    int val;
+    if (queue.pop(&val)) {
+      note_pop(val);
+    }
+    int key = next_key(&state);
+    note_push(key);
+    queue.push(key);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  #ifdef TEST_TS_MULTIQUEUE
+  printf("TSMultiQueue.h ");
+  #endif
+  #ifdef TEST_TS_LOCKEDHEAP
+  printf("Locked Heap.h ");
+  #endif
+
+  uint64_t state = 0x2545F4914F6CDD1Dlu;
+  for (size_t i=0; i<TEST_SIZE; ++i) {
+    int key = next_key(&state);
+    note_push(key);
+    queue.push(key);
+  }
+
+  timeb t1, t2;
+  ftime(&t1);
+  std::thread threads[THREADS];
+  for (int i=0; i<THREADS; ++i) {
+    threads[i] = std::thread(worker, i);
+  }
+  for (int i=0; i<THREADS; ++i) {
+    threads[i].join();
+  }
+  ftime(&t2);
+
+  int val;
+  while (queue.pop(&val)) {
+  }
+
+  double t = tdiff(t2,t1);
+  printf("test_size=%d test_iterations=%d threads=%d ", TEST_SIZE, TEST_ITERATIONS, THREADS);
+  printf("time=%lf ops_per_sec=%lf", t, 2.0*THREADS*TEST_ITERATIONS/t);
+  #ifdef MEASURE_RANK_ERROR
+  printf(" mean_rank_error=%lf max_rank_error=%lu", ((double) rank_total)/rank_count, rank_max);
+  #endif
+  printf("\n");
+}
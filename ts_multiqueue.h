@@ -0,0 +1,242 @@
+/*
+ * Copyright: Matthew Brewer (mbrewer@smalladventures.net)
+ *
+ * This is a relaxed concurrent priority queue, a "MultiQueue".
+ *
+ * When to use this:
+ * You have many threads pushing and popping prioritized work (e.g. a parallel
+ * scheduler) and a single locked Heap has become the bottleneck. In exchange
+ * for scaling, pop() does *not* always return the minimum, just something
+ * close to it (see "Rank error" below).
+ * If you need exact ordering wrap a Heap from heap.h in a mutex instead.
+ *
+ * How to use this:
+ * The template arguments are the same as heap.h, UArrayT is the backing store
+ * for each internal Heap (we suggest DCUArray from delayed_copy_array.h).
+ * Construct with the number of threads that will use the queue, and
+ * optionally the number of internal heaps per thread ("c", default 2).
+ *
+ * Algorithm:
+ * We keep c*threads independent Heaps, each with it's own mutex.
+ * push() try_locks a random heap, and pushes into it.
+ * pop() picks two random heaps, try_locks both, and pops from whichever has
+ * the smaller top. If a try_lock fails we just pick again, nobody ever blocks
+ * while holding a lock, so there are no deadlocks.
+ * Each heap keeps an approximate size we can read without it's lock, so we
+ * don't waste locks on empty heaps. When the samples keep coming up empty we
+ * fall back to scanning every heap, so pop() only returns false if each heap
+ * looked empty when the scan got to it. That doesn't mean the queue was ever
+ * empty all at once, an element pushed to a heap the scan already passed is
+ * missed. If you need to know all the work is done, count it yourself.
+ *
+ * Rank error:
+ * The rank of a popped element is the number of elements in the queue smaller
+ * than it. A locked Heap always has rank 0. Taking the better of two random
+ * choices keeps the heaps "balanced", so with Q=c*threads heaps the expected
+ * rank is O(Q), and ranks much larger than Q are exponentially unlikely.
+ * In practice the mean rank comes out at a small multiple of Q. It does not
+ * grow with the number of elements in the queue.
+ * ts_heap_benchmark.cpp measures it, see the _quality benchmarks.
+ * Note that the guarantee is probabilistic. Nothing stops a small element from
+ * sitting in an unlucky heap for a while, it just gets less likely the longer
+ * it sits there.
+ *
+ * Threadsafety:
+ *   this is threadsafe, based on locking semantics
+ *   push() and pop() may be called from any number of threads.
+ *   size() and isempty() are approximate if other threads are active.
+ *   check() locks each heap in turn, it's only consistent if nobody else is
+ *   using the queue.
+ */
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include "heap.h"
+#include "panic.h"
+
+#ifndef TSMULTIQUEUE_H
+#define TSMULTIQUEUE_H
+
+// How many samples of two empty heaps we take before scanning everything
+#define TSMULTIQUEUE_EMPTY_SAMPLES 4
+
+template<typename UArrayT, typename T, typename C>
+class TSMultiQueue {
+  private:
+    class Queue {
+      public:
+        std::mutex m;
+        // Only written with m held, read without it as a hint
+        std::atomic<size_t> size;
+        Heap<UArrayT, T, C> heap;
+        // keep neighboring queues out of each other's cache lines
+        char padding[64];
+        Queue(): size(0), heap() {}
+    };
+    Queue *queues;
+    size_t nqueues;
+
+    // xorshift64, one state per thread
+    static uint64_t next_rand() {
+      static thread_local uint64_t state = 0;
+      if (!state) {
+        state = ((uint64_t) (uintptr_t) &state) * 0x9E3779B97F4A7C15lu | 1;
+      }
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      return state;
+    }
+    Queue *pick() {
+      // multiply-shift rather than %, nqueues need not be a power of 2
+      return &queues[((next_rand() >> 32) * nqueues) >> 32];
+    }
+    // must hold q->m
+    void pop_locked(Queue *q, T *val) {
+      q->heap.pop(val);
+      q->size.store(q->heap.size(), std::memory_order_relaxed);
+    }
+    bool pop_scan(T *val);
+  public:
+    TSMultiQueue(size_t threads, size_t queues_per_thread=2);
+    ~TSMultiQueue();
+    void push(T data);
+    bool pop(T *val);
+    size_t size() const;
+    bool isempty() const;
+    size_t queue_count() const;
+    void check();
+};
+
+template<typename UArrayT, typename T, typename C>
+TSMultiQueue<UArrayT, T, C>::TSMultiQueue(size_t threads, size_t queues_per_thread) {
+  nqueues = threads * queues_per_thread;
+  if (nqueues == 0) {
+    PANIC("TSMultiQueue needs at least one queue");
+  }
+  queues = new Queue[nqueues];
+}
+
+template<typename UArrayT, typename T, typename C>
+TSMultiQueue<UArrayT, T, C>::~TSMultiQueue() {
+  delete[] queues;
+}
+
+template<typename UArrayT, typename T, typename C>
+void TSMultiQueue<UArrayT, T, C>::push(T data) {
+  while (true) {
+    Queue *q = pick();
+    if (q->m.try_lock()) {
+      q->heap.push(data);
+      q->size.store(q->heap.size(), std::memory_order_relaxed);
+      q->m.unlock();
+      return;
+    }
+  }
+}
+
+template<typename UArrayT, typename T, typename C>
+bool TSMultiQueue<UArrayT, T, C>::pop(T *val) {
+  size_t empties = 0;
+  while (empties < TSMULTIQUEUE_EMPTY_SAMPLES) {
+    Queue *a = pick();
+    Queue *b = pick();
+    bool a_full = a->size.load(std::memory_order_relaxed) != 0;
+    bool b_full = b->size.load(std::memory_order_relaxed) != 0;
+    if (!a_full && !b_full) {
+      empties++;
+      continue;
+    }
+    // Only bother with the heaps that look non-empty
+    if (!a_full) {
+      a = b;
+    } else if (!b_full) {
+      b = a;
+    }
+    if (!a->m.try_lock()) {
+      continue;
+    }
+    if (b != a && !b->m.try_lock()) {
+      b = a;
+    }
+    Queue *best = a;
+    if (b != a && b->heap.size()) {
+      if (!a->heap.size()) {
+        best = b;
+      } else {
+        T ta = a->heap.get(0);
+        T tb = b->heap.get(0);
+        if (C::compare(&tb, &ta) < 0) {
+          best = b;
+        }
+      }
+    }
+    bool found = best->heap.size() != 0;
+    if (found) {
+      pop_locked(best, val);
+    }
+    if (b != a) {
+      b->m.unlock();
+    }
+    a->m.unlock();
+    if (found) {
+      return true;
+    }
+    // someone beat us to it, the hints were stale
+    empties++;
+  }
+  return pop_scan(val);
+}
+
+// The slow path, look at every queue so we don't give up while the hints say
+// there's something left. Each heap is checked at a different moment, so
+// false doesn't prove the whole queue was empty.
+template<typename UArrayT, typename T, typename C>
+bool TSMultiQueue<UArrayT, T, C>::pop_scan(T *val) {
+  for (size_t i=0; i<nqueues; ++i) {
+    Queue *q = &queues[i];
+    if (!q->size.load(std::memory_order_relaxed)) {
+      continue;
+    }
+    std::lock_guard<std::mutex> l(q->m);
+    if (q->heap.size()) {
+      pop_locked(q, val);
+      return true;
+    }
+  }
+  return false;
+}
+
+template<typename UArrayT, typename T, typename C>
+size_t TSMultiQueue<UArrayT, T, C>::size() const {
+  size_t total = 0;
+  for (size_t i=0; i<nqueues; ++i) {
+    total += queues[i].size.load(std::memory_order_relaxed);
+  }
+  return total;
+}
+
+template<typename UArrayT, typename T, typename C>
+bool TSMultiQueue<UArrayT, T, C>::isempty() const {
+  return size() == 0;
+}
+
+template<typename UArrayT, typename T, typename C>
+size_t TSMultiQueue<UArrayT, T, C>::queue_count() const {
+  return nqueues;
+}
+
+template<typename UArrayT, typename T, typename C>
+void TSMultiQueue<UArrayT, T, C>::check() {
+  for (size_t i=0; i<nqueues; ++i) {
+    std::lock_guard<std::mutex> l(queues[i].m);
+    queues[i].heap.check();
+    if (queues[i].size.load(std::memory_order_relaxed) != queues[i].heap.size()) {
+      PANIC("size hint is out of sync with the heap");
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,114 @@
+#define HEAP_DEBUG
+#include <atomic>
+#include <thread>
+#include <stdio.h>
+#include "ts_multiqueue.h"
+#include "delayed_copy_array.h"
+
+#define TEST_SIZE 1000
+#define THREADS 4
+
+class HeapCompare {
+  public:
+    static int compare(int *v1, int *v2) {
+      return (*v1) - (*v2);
+    }
+};
+
+typedef TSMultiQueue<DCUArray<int>, int, HeapCompare> MQ;
+
+MQ *mq;
+std::atomic<int> seen[THREADS*TEST_SIZE];
+
+// push our own range, popping as we go
+void worker(int id) {
+  int val;
+  for (int i=0; i<TEST_SIZE; ++i) {
+    mq->push(id*TEST_SIZE + i);
+    if (i % 2 && mq->pop(&val)) {
+      seen[val]++;
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  printf("Begin TSMultiQueue.h unittest\n");
+  int i;
+  int val=-1;
+
+  // With a single queue this is just a heap, so order is exact
+  MQ single(1, 1);
+  for (i=0; i<TEST_SIZE; ++i) {
+    single.push(rand() % TEST_SIZE);
+  }
+  single.check();
+  int last = -1;
+  for (i=0; i<TEST_SIZE; ++i) {
+    if (!single.pop(&val)) {
+      PANIC("queue is empty when it shouldn't be");
+    }
+    if (val < last) {
+      PANIC("single queue popped out of order");
+    }
+    last = val;
+  }
+  if (single.pop(&val)) {
+    PANIC("queue didn't drain");
+  }
+
+  // Many queues, one thread, everything comes back exactly once
+  MQ multi(THREADS);
+  if (multi.queue_count() != 2*THREADS) {
+    PANIC("wrong number of queues");
+  }
+  for (i=0; i<TEST_SIZE; ++i) {
+    multi.push(i);
+  }
+  multi.check();
+  if (multi.size() != TEST_SIZE) {
+    PANIC("size is wrong");
+  }
+  for (i=0; i<TEST_SIZE; ++i) {
+    seen[i] = 0;
+  }
+  for (i=0; i<TEST_SIZE; ++i) {
+    if (!multi.pop(&val)) {
+      PANIC("queue is empty when it shouldn't be");
+    }
+    seen[val]++;
+  }
+  for (i=0; i<TEST_SIZE; ++i) {
+    if (seen[i] != 1) {
+      PANIC("element lost or duplicated");
+    }
+  }
+  if (!multi.isempty() || multi.pop(&val)) {
+    PANIC("queue didn't drain");
+  }
+
+  // Many threads at once
+  mq = new MQ(THREADS);
+  for (i=0; i<THREADS*TEST_SIZE; ++i) {
+    seen[i] = 0;
+  }
+  std::thread threads[THREADS];
+  for (i=0; i<THREADS; ++i) {
+    threads[i] = std::thread(worker, i);
+  }
+  for (i=0; i<THREADS; ++i) {
+    threads[i].join();
+  }
+  mq->check();
+  while (mq->pop(&val)) {
+    seen[val]++;
+  }
+  for (i=0; i<THREADS*TEST_SIZE; ++i) {
+    if (seen[i] != 1) {
+      PANIC("element lost or duplicated");
+    }
+  }
+  delete mq;
+
+  printf("PASS\n");
+  return 0;
+}